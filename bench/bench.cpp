@@ -0,0 +1,581 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+#include "corpus.h"
+#include "lexer/lexer.h"
+#include "parser/parser.h"
+#include "parser/dump.h"
+#include "parser/incremental.h"
+#include "analysis/constfold.h"
+#include "analysis/nodecount.h"
+#include "analysis/typeinfer.h"
+#include "runtime/pool.h"
+#include "util/diagnostics.h"
+#include "util/stats.h"
+#include "util/threadpool.h"
+
+// lang_bench: lexer, parser, dump, analysis and teardown throughput on
+// generated corpora, parser scaling on malformed input, incremental edit
+// latency, plus the whole pipeline and the VM's call paths. Every
+// measurement is the median of --repeat runs; --json saves the results and
+// --baseline compares against a saved run and fails when something got
+// slower than --threshold.
+
+struct Result {
+	std::string name;
+	double ms = 0;
+	double mbPerSec = 0;
+	double itemsPerSec = 0;
+	std::string unit;
+	uint64_t bytes = 0;
+};
+
+struct Options {
+	size_t size = 1 << 20;
+	std::vector<CorpusKind> kinds;
+	bool vm = false;
+	int repeat = 5;
+	std::string json, baseline;
+	double threshold = 10;
+
+	// Write the corpora as <dir>/<kind>.rs instead of measuring.
+	std::string emit;
+};
+
+using Clock = std::chrono::steady_clock;
+
+static double elapsedMs(Clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static double median(std::vector<double> values) {
+	std::sort(values.begin(), values.end());
+	return values[values.size() / 2];
+}
+
+static bool parseSize(const std::string& text, size_t& size) {
+	char* end;
+	double value = std::strtod(text.c_str(), &end);
+	switch (*end) {
+		case 'k': case 'K': value *= 1 << 10; end++; break;
+		case 'm': case 'M': value *= 1 << 20; end++; break;
+		case 'g': case 'G': value *= 1 << 30; end++; break;
+		default: break;
+	}
+	if (*end != 0 || value <= 0) return false;
+	size = size_t(value);
+	return true;
+}
+
+// One phase of one kind, timed over all repeats.
+class Measure {
+public:
+	Measure(const std::string& name, size_t sourceBytes) : m_name(name), m_sourceBytes(sourceBytes) {}
+
+	void start() {
+		m_bytes = Stats::threadAllocatedBytes();
+		m_start = Clock::now();
+	}
+
+	void stop(uint64_t items, const char* unit) {
+		m_times.push_back(elapsedMs(m_start));
+		m_allocated = Stats::threadAllocatedBytes() - m_bytes;
+		m_items = items;
+		m_unit = unit;
+	}
+
+	Result result() const {
+		Result res;
+		res.name = m_name;
+		res.ms = median(m_times);
+		res.mbPerSec = m_sourceBytes / (1 << 20) / (res.ms / 1000.0);
+		res.itemsPerSec = m_items / (res.ms / 1000.0);
+		res.unit = m_unit;
+		res.bytes = m_allocated;
+		return res;
+	}
+
+private:
+	std::string m_name;
+	double m_sourceBytes;
+	std::vector<double> m_times;
+	Clock::time_point m_start;
+	uint64_t m_bytes = 0, m_allocated = 0, m_items = 0;
+	const char* m_unit = "";
+};
+
+// Parses a quarter, a half and all of the corpus. Time per token must not
+// grow with the input, however broken it is.
+static void benchScaling(CorpusKind kind, const Options& options, std::vector<Result>& results) {
+	std::string prefix = corpusKindName(kind);
+	for (int parts : { 4, 2, 1 }) {
+		std::string source = generateCorpus(kind, options.size / parts);
+		LangLexer lexer(source);
+		lexer.tokenize();
+
+		Measure parse(prefix + "/parse-1/" + std::to_string(parts), source.size());
+		for (int i = 0; i < options.repeat; i++) {
+			LangParser parser(lexer.tokens());
+			parser.setLazyBodies(false);
+			parse.start();
+			parser.parse();
+			parse.stop(lexer.tokens().size(), "tokens");
+		}
+		results.push_back(parse.result());
+	}
+}
+
+// An editor's keystrokes: one character typed and deleted again at spread
+// out offsets, each re-parsed incrementally. Compare with <kind>/parse.
+// A space typed into a word is a syntax error; those are not printed.
+static void benchIncremental(CorpusKind kind, const Options& options, std::vector<Result>& results) {
+	const int edits = 200;
+	DiagnosticCapture quiet;
+	std::string source = generateCorpus(kind, options.size);
+	IncrementalParser parser;
+	parser.parse(source);
+
+	Measure edit(std::string(corpusKindName(kind)) + "/edit", source.size());
+	uint64_t seed = 1;
+	for (int i = 0; i < options.repeat; i++) {
+		edit.start();
+		for (int j = 0; j < edits; j++) {
+			seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+			int offset = int((seed >> 33) % source.size());
+			parser.edit({ offset, 0, " " });
+			parser.edit({ offset, 1, "" });
+		}
+		edit.stop(edits * 2, "edits");
+	}
+	results.push_back(edit.result());
+}
+
+static void benchKind(CorpusKind kind, const Options& options, std::vector<Result>& results) {
+	std::string prefix = corpusKindName(kind);
+
+	// Finding the malformed corpus' errors is measured, printing them is not.
+	std::unique_ptr<DiagnosticCapture> quiet;
+	if (kind == CorpusKind::Malformed) quiet.reset(new DiagnosticCapture());
+
+	std::string source = generateCorpus(kind, options.size);
+	size_t bytes = source.size();
+
+	Measure lex(prefix + "/lex", bytes), parse(prefix + "/parse", bytes), parallelParse(prefix + "/parse-parallel", bytes),
+		analyze(prefix + "/analyze", bytes), teardown(prefix + "/teardown", bytes),
+		pipeline(prefix + "/pipeline", bytes);
+
+	// Dumps go into one collecting buffer that is cleared, not freed,
+	// between runs, the way a tool writing to a pipe would reuse it.
+	Measure dumps[] = {
+		Measure(prefix + "/dump-text", bytes),
+		Measure(prefix + "/dump-json", bytes),
+		Measure(prefix + "/dump-binary", bytes)
+	};
+	const DumpFormat formats[] = { DumpFormat::Text, DumpFormat::Json, DumpFormat::Binary };
+	OutputBuffer sink;
+	ThreadPool pool;
+
+	for (int i = 0; i < options.repeat; i++) {
+		LangLexer lexer(source);
+		lex.start();
+		lexer.tokenize();
+		lex.stop(lexer.tokens().size(), "tokens");
+
+		LangParser parser(lexer.tokens());
+		parser.setLazyBodies(false);
+		parse.start();
+		parser.parse();
+		NodeCounter counter;
+		counter.run(parser.program());
+		parse.stop(counter.total(), "nodes");
+
+		// The same tokens split at statement boundaries, one pool thread
+		// per hardware thread.
+		LangParser parallel(lexer.tokens());
+		parallel.setLazyBodies(false);
+		parallelParse.start();
+		parallel.parseParallel(pool);
+		parallelParse.stop(counter.total(), "nodes");
+
+		for (int f = 0; f < 3; f++) {
+			sink.data().clear();
+			dumps[f].start();
+			dumpProgram(parser.program(), formats[f], sink);
+			dumps[f].stop(counter.total(), "nodes");
+		}
+
+		analyze.start();
+		ConstantFolder folder;
+		folder.run(parser.program());
+		TypeInference types;
+		types.run(parser.program());
+		analyze.stop(counter.total(), "nodes");
+
+		std::unique_ptr<Program> program = parser.takeProgram();
+		teardown.start();
+		program.reset();
+		teardown.stop(counter.total(), "nodes");
+	}
+
+	// The whole front end as a user sees it: lazy bodies, nothing reused.
+	for (int i = 0; i < options.repeat; i++) {
+		pipeline.start();
+		LangLexer lexer(source);
+		lexer.tokenize();
+		LangParser parser(lexer.tokens());
+		parser.parse();
+		ConstantFolder folder;
+		folder.run(parser.program());
+		TypeInference types;
+		types.run(parser.program());
+		parser.takeProgram().reset();
+		pipeline.stop(bytes, "bytes");
+	}
+
+	for (Measure* m : { &lex, &parse, &parallelParse, &dumps[0], &dumps[1], &dumps[2], &analyze, &teardown, &pipeline }) {
+		results.push_back(m->result());
+	}
+
+	if (kind == CorpusKind::Malformed) benchScaling(kind, options, results);
+	else benchIncremental(kind, options, results);
+}
+
+static int64_t twice(int64_t x) { return x * 2; }
+
+static const char* s_vmScript = R"(
+pub func fib(n) {
+	if (n < 2) { return n; }
+	return fib(n - 1) + fib(n - 2);
+}
+
+pub func add(a, b) {
+	return a + b;
+}
+
+pub func scriptCalls(n) {
+	let s = 0;
+	for i in 0..n { s = add(s, i); }
+	return s;
+}
+
+pub func natives(n) {
+	let s = 0;
+	for i in 0..n { s = s + twice(i); }
+	return s;
+}
+
+pub func count(n) {
+	let s = 0;
+	for i in 0..n { s += i; }
+	return s;
+}
+
+func upto(n) {
+	for i in 0..n { yield i; }
+}
+
+pub func generated(n) {
+	let s = 0;
+	for i in upto(n) { s += i; }
+	return s;
+}
+
+pub func parallelCount(n) {
+	let s = 0;
+	parallel for i in 0..n reduce(+: s) { s += i; }
+	return s;
+}
+
+let xs = f64(0);
+let ys = f64(0);
+
+func ramp(n) {
+	let a = f64(n);
+	for i in 0..n { a[i] = i * 0.5; }
+	return a;
+}
+
+pub func arrays(n) {
+	xs = ramp(n);
+	ys = ramp(n);
+}
+
+pub func axpy(k, reps) {
+	let r = ys;
+	for i in 0..reps { r = xs * k + r; }
+	return r[0];
+}
+
+pub func dots(reps) {
+	let s = 0.0;
+	for i in 0..reps { s += dot(xs, ys); }
+	return s;
+}
+
+pub func elementDots(reps) {
+	let s = 0.0;
+	for i in 0..reps {
+		for j in 0..len(xs) { s += xs[j] * ys[j]; }
+	}
+	return s;
+}
+)";
+
+// The array measures against the same loops in C++, as the compiler makes
+// them without -ffast-math.
+static double nativeAxpy(const std::vector<double>& x, const std::vector<double>& y, double k, int reps) {
+	std::vector<double> r = y;
+	for (int i = 0; i < reps; i++) {
+		for (size_t j = 0; j < x.size(); j++) r[j] = x[j] * k + r[j];
+	}
+	return r.back();
+}
+
+static double nativeDots(const std::vector<double>& x, const std::vector<double>& y, int reps) {
+	double s = 0;
+	for (int i = 0; i < reps; i++) {
+		for (size_t j = 0; j < x.size(); j++) s += x[j] * y[j];
+	}
+	return s;
+}
+
+// Script calls from C++, C++ calls from script, script calls and a plain
+// loop, sequential, under a budget, parallel and over a generator, all
+// through the host API; then the same fib as concurrent jobs on one
+// isolate per hardware thread. The array measures run whole-array
+// operators, element-by-element script loops and native loops over the
+// same 64K doubles.
+static void benchVm(const Options& options, std::vector<Result>& results) {
+	const int calls = 1000000, fibN = 25, fibCalls = 242785;
+
+	Runtime runtime;
+	runtime.define<&twice>("twice");
+	if (!runtime.load(s_vmScript)) return;
+	auto fib = runtime.function<int64_t(int64_t)>("fib");
+	auto add = runtime.function<double(double, double)>("add");
+	auto adds = runtime.function<int64_t(int64_t)>("scriptCalls");
+	auto natives = runtime.function<int64_t(int64_t)>("natives");
+	auto count = runtime.function<int64_t(int64_t)>("count");
+	auto parallelCount = runtime.function<int64_t(int64_t)>("parallelCount");
+	auto generated = runtime.function<int64_t(int64_t)>("generated");
+	auto axpy = runtime.function<double(double, int)>("axpy");
+	auto dots = runtime.function<double(int)>("dots");
+	auto elementDots = runtime.function<double(int)>("elementDots");
+
+	const int elements = 1 << 16, reps = 200;
+	runtime.function<void(int64_t)>("arrays")(elements);
+	std::vector<double> nativeX(elements), nativeY(elements);
+	for (int i = 0; i < elements; i++) nativeX[i] = nativeY[i] = i * 0.5;
+	volatile double sink = 0;
+
+	Measure fibs("vm/fib", 0), hostCalls("vm/host-calls", 0), scriptCalls("vm/script-calls", 0), nativeCalls("vm/native-calls", 0), loop("vm/loop", 0),
+		budgetLoop("vm/loop-budget", 0), parallelLoop("vm/parallel-loop", 0), generator("vm/generator", 0), arrayAxpy("vm/array-axpy", 0),
+		arrayDot("vm/array-dot", 0), elementDot("vm/array-element-dot", 0), nativeAxpyLoop("vm/native-axpy", 0),
+		nativeDot("vm/native-dot", 0);
+	for (int i = 0; i < options.repeat; i++) {
+		fibs.start();
+		fib(fibN);
+		fibs.stop(fibCalls, "calls");
+
+		hostCalls.start();
+		double sum = 0;
+		for (int j = 0; j < calls; j++) sum = add(sum, 1);
+		hostCalls.stop(calls, "calls");
+
+		scriptCalls.start();
+		adds(calls);
+		scriptCalls.stop(calls, "calls");
+
+		nativeCalls.start();
+		natives(calls);
+		nativeCalls.stop(calls, "calls");
+
+		loop.start();
+		count(calls * 10);
+		loop.stop(calls * 10, "iters");
+
+		// The same loop with every limit set, none of them reached.
+		Budget budget;
+		budget.steps = uint64_t(calls) * 100;
+		budget.time = std::chrono::hours(1);
+		budget.heapBytes = size_t(1) << 32;
+		runtime.vm().setBudget(budget);
+		budgetLoop.start();
+		count(calls * 10);
+		budgetLoop.stop(calls * 10, "iters");
+		runtime.vm().setBudget(Budget());
+
+		parallelLoop.start();
+		parallelCount(calls * 10);
+		parallelLoop.stop(calls * 10, "iters");
+
+		generator.start();
+		generated(calls * 10);
+		generator.stop(calls * 10, "iters");
+
+		arrayAxpy.start();
+		sink = sink + axpy(2.0, reps);
+		arrayAxpy.stop(int64_t(elements) * reps, "elements");
+
+		arrayDot.start();
+		sink = sink + dots(reps);
+		arrayDot.stop(int64_t(elements) * reps, "elements");
+
+		elementDot.start();
+		sink = sink + elementDots(10);
+		elementDot.stop(int64_t(elements) * 10, "elements");
+
+		nativeAxpyLoop.start();
+		sink = sink + nativeAxpy(nativeX, nativeY, 2.0, reps);
+		nativeAxpyLoop.stop(int64_t(elements) * reps, "elements");
+
+		nativeDot.start();
+		sink = sink + nativeDots(nativeX, nativeY, reps);
+		nativeDot.stop(int64_t(elements) * reps, "elements");
+	}
+
+	const int jobs = 64;
+	RuntimePool pool(0, [](Runtime& rt) { rt.define<&twice>("twice"); });
+	if (!pool.load(s_vmScript)) return;
+
+	Measure pooled("vm/pool", 0);
+	for (int i = 0; i < options.repeat; i++) {
+		pooled.start();
+		for (int j = 0; j < jobs; j++) {
+			pool.submit([](Runtime& rt) { rt.function<int64_t(int64_t)>("fib")(fibN); });
+		}
+		pool.wait();
+		pooled.stop(int64_t(jobs) * fibCalls, "calls");
+	}
+
+	for (Measure* m : { &fibs, &hostCalls, &scriptCalls, &nativeCalls, &loop, &budgetLoop, &parallelLoop, &generator, &arrayAxpy, &arrayDot,
+		&elementDot, &nativeAxpyLoop, &nativeDot, &pooled })
+	{
+		results.push_back(m->result());
+	}
+}
+
+static void writeJson(std::ostream& out, const Options& options, const std::vector<Result>& results) {
+	// One result per line keeps readBaseline() trivial and diffs readable.
+	out << "{\"version\":1,\"size\":" << options.size << ",\"repeat\":" << options.repeat <<
+		",\"peak_rss_kb\":" << Stats::peakRssKb() << ",\"results\":[\n";
+	for (size_t i = 0; i < results.size(); i++) {
+		const Result& res = results[i];
+		out << "{\"name\":\"" << res.name << "\",\"ms\":" << res.ms <<
+			",\"mb_per_s\":" << res.mbPerSec << ",\"per_s\":" << res.itemsPerSec <<
+			",\"unit\":\"" << res.unit << "\",\"alloc_bytes\":" << res.bytes << "}" <<
+			(i + 1 < results.size() ? "," : "") << "\n";
+	}
+	out << "]}" << std::endl;
+}
+
+static std::map<std::string, double> readBaseline(const std::string& path) {
+	std::map<std::string, double> times;
+	std::ifstream in(path);
+	std::string line;
+	while (std::getline(in, line)) {
+		size_t name = line.find("\"name\":\"");
+		size_t ms = line.find("\"ms\":");
+		if (name == std::string::npos || ms == std::string::npos) continue;
+
+		name += 8;
+		times[line.substr(name, line.find('"', name) - name)] = std::atof(line.c_str() + ms + 5);
+	}
+	return times;
+}
+
+static int usage() {
+	std::cerr << "usage: lang_bench [--size 1M] [--kind all|vm|" ;
+	for (CorpusKind kind : allCorpusKinds()) {
+		std::cerr << corpusKindName(kind) << (kind == allCorpusKinds().back() ? "" : "|");
+	}
+	std::cerr << "] [--repeat 5] [--json out.json] [--baseline old.json [--threshold 10]] [--emit dir]" << std::endl;
+	return 2;
+}
+
+int main(int argc, char** argv) {
+	Options options;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (i + 1 >= argc) return usage();
+		std::string value = argv[++i];
+
+		if (arg == "--size") {
+			if (!parseSize(value, options.size)) return usage();
+		} else if (arg == "--kind") {
+			CorpusKind kind;
+			if (value == "all") options.kinds = allCorpusKinds(), options.vm = true;
+			else if (value == "vm") options.vm = true;
+			else if (corpusKindFromName(value, kind)) options.kinds.push_back(kind);
+			else return usage();
+		} else if (arg == "--repeat") {
+			options.repeat = std::max(1, std::atoi(value.c_str()));
+		} else if (arg == "--json") {
+			options.json = value;
+		} else if (arg == "--baseline") {
+			options.baseline = value;
+		} else if (arg == "--threshold") {
+			options.threshold = std::atof(value.c_str());
+		} else if (arg == "--emit") {
+			options.emit = value;
+		} else {
+			return usage();
+		}
+	}
+	if (options.kinds.empty() && !options.vm) {
+		options.kinds = allCorpusKinds();
+		options.vm = true;
+	}
+
+	if (!options.emit.empty()) {
+		for (CorpusKind kind : options.kinds) {
+			std::ofstream out(options.emit + "/" + corpusKindName(kind) + ".rs", std::ios::binary);
+			out << generateCorpus(kind, options.size);
+		}
+		return 0;
+	}
+
+	std::vector<Result> results;
+	for (CorpusKind kind : options.kinds) {
+		benchKind(kind, options, results);
+	}
+	if (options.vm) benchVm(options, results);
+
+	std::map<std::string, double> baseline;
+	if (!options.baseline.empty()) baseline = readBaseline(options.baseline);
+
+	int regressions = 0;
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << std::left << std::setw(22) << "benchmark" << std::right << std::setw(12) << "ms" <<
+		std::setw(10) << "MB/s" << std::setw(16) << "rate" << std::setw(16) << "allocated" <<
+		(baseline.empty() ? "" : "    vs baseline") << std::endl;
+	for (auto&& res : results) {
+		std::cout << std::left << std::setw(22) << res.name << std::right << std::setw(12) << res.ms <<
+			std::setw(10) << res.mbPerSec << std::setw(10) << std::setprecision(0) << res.itemsPerSec <<
+			" " << std::setw(5) << std::left << res.unit << std::right << std::setw(16) << res.bytes << std::setprecision(2);
+
+		auto it = baseline.find(res.name);
+		if (it != baseline.end() && it->second > 0) {
+			double change = (res.ms / it->second - 1) * 100;
+			std::cout << std::setw(10) << std::showpos << change << "%" << std::noshowpos;
+			if (change > options.threshold) {
+				std::cout << " REGRESSION";
+				regressions++;
+			}
+		}
+		std::cout << std::endl;
+	}
+	std::cout << "peak RSS " << Stats::peakRssKb() << " KB" << std::endl;
+
+	if (!options.json.empty()) {
+		std::ofstream out(options.json);
+		writeJson(out, options, results);
+	}
+	return regressions > 0 ? 1 : 0;
+}
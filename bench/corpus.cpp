@@ -0,0 +1,261 @@
+#include "corpus.h"
+
+// splitmix64: tiny, fast and identical everywhere, unlike the standard
+// library distributions.
+class Random {
+public:
+	Random(uint64_t seed) : m_state(seed) {}
+
+	uint64_t next() {
+		uint64_t z = (m_state += 0x9e3779b97f4a7c15ull);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		return z ^ (z >> 31);
+	}
+
+	int below(int n) { return int(next() % uint64_t(n)); }
+
+private:
+	uint64_t m_state;
+};
+
+class Generator {
+public:
+	Generator(uint64_t seed) : m_rand(seed) {}
+
+	std::string& out() { return m_out; }
+
+	void name(const char* prefix) {
+		m_out += prefix;
+		m_out += std::to_string(m_rand.below(1000));
+	}
+
+	void number() {
+		switch (m_rand.below(4)) {
+			case 0: m_out += std::to_string(m_rand.below(100000)); break;
+			case 1: m_out += std::to_string(m_rand.below(1000)) + "." + std::to_string(m_rand.below(1000)); break;
+			case 2: m_out += "0x" + std::to_string(m_rand.below(0xffff)); break;
+			default: m_out += std::to_string(m_rand.below(100)) + ".5e" + std::to_string(m_rand.below(20)); break;
+		}
+	}
+
+	void string(int length) {
+		static const char* words[] = { "lorem", "ipsum", "dolor", "sit", "amet", "\\t", "\\n", "\\\"quoted\\\"", "\\u00e9" };
+		m_out += '"';
+		int start = m_out.size();
+		while (int(m_out.size()) - start < length) {
+			m_out += words[m_rand.below(9)];
+			m_out += ' ';
+		}
+		m_out += '"';
+	}
+
+	void operand() {
+		switch (m_rand.below(3)) {
+			case 0: number(); break;
+			case 1: name("v"); break;
+			default: name("f"); m_out += "("; name("v"); m_out += ")"; break;
+		}
+	}
+
+	// Chains are always parenthesized, (a + b) * c rather than a + b + c,
+	// so every level of the tree takes parentheses to parse.
+	void expression(int depth) {
+		static const char* ops[] = { " + ", " - ", " * ", " / ", " % ", " << ", " & ", " | ", " == ", " < ", " && " };
+		if (depth <= 0) {
+			operand();
+			return;
+		}
+
+		for (int i = 0; i < 2; i++) {
+			if (i > 0) m_out += ops[m_rand.below(11)];
+			if (m_rand.below(3) > 0) {
+				m_out += "(";
+				expression(depth - 1);
+				m_out += ")";
+			} else {
+				operand();
+			}
+		}
+	}
+
+	void indent(int depth) { m_out.append(depth, '\t'); }
+
+	void statement(int depth, int nesting) {
+		indent(depth);
+		switch (m_rand.below(nesting > 0 ? 6 : 4)) {
+			case 0: m_out += "let "; name("v"); m_out += " = "; expression(2); m_out += ";\n"; break;
+			case 1: name("v"); m_out += " = "; expression(2); m_out += ";\n"; break;
+			case 2: name("v"); m_out += " += "; number(); m_out += ";\n"; break;
+			case 3: m_out += "return "; expression(1); m_out += ";\n"; break;
+			case 4: loop(depth, nesting - 1); break;
+			default:
+				m_out += "if ("; expression(1); m_out += ") {\n";
+				statement(depth + 1, nesting - 1);
+				indent(depth); m_out += "} else {\n";
+				statement(depth + 1, nesting - 1);
+				indent(depth); m_out += "}\n";
+				break;
+		}
+	}
+
+	void loop(int depth, int nesting) {
+		if (m_rand.below(2)) {
+			m_out += "for "; name("i"); m_out += " in 0.."; number(); m_out += " {\n";
+		} else {
+			m_out += "while ("; name("v"); m_out += " < "; number(); m_out += ") {\n";
+		}
+		int count = 1 + m_rand.below(3);
+		for (int i = 0; i < count; i++) {
+			statement(depth + 1, nesting);
+		}
+		indent(depth);
+		m_out += "}\n";
+	}
+
+	void function(int statements, int nesting) {
+		m_out += m_rand.below(4) == 0 ? "pub func " : "func ";
+		name("f");
+		m_out += "(a, b: int, c = 1) {\n";
+		for (int i = 0; i < statements; i++) {
+			statement(1, nesting);
+		}
+		m_out += "}\n\n";
+	}
+
+	void comment() {
+		if (m_rand.below(2)) {
+			m_out += "// ";
+			string(60);
+			m_out += "\n";
+		} else {
+			m_out += "/*\n\t";
+			string(200);
+			m_out += "\n*/\n";
+		}
+	}
+
+	// A statement or function with one token dropped or one stray token
+	// put in, or nested far deeper than the parser accepts.
+	void malformed() {
+		switch (m_rand.below(8)) {
+			case 0: {
+				int depth = 200 + m_rand.below(800);
+				m_out += "let "; name("v"); m_out += " = ";
+				m_out.append(depth, '(');
+				operand();
+				m_out.append(depth, ')');
+				m_out += ";\n";
+				break;
+			}
+			case 1: {
+				int depth = 200 + m_rand.below(400);
+				m_out += "func "; name("f"); m_out += "() {\n";
+				for (int i = 0; i < depth; i++) {
+					m_out += "if ("; name("v"); m_out += ") { ";
+				}
+				m_out.append(depth, '}');
+				m_out += "\n}\n";
+				break;
+			}
+			default: {
+				size_t start = m_out.size();
+				if (m_rand.below(2)) function(2 + m_rand.below(4), 2);
+				else statement(0, 2);
+				damage(start);
+				break;
+			}
+		}
+	}
+
+	// Drops a ';', ')', ']' or '}' after `start` or puts a stray token in
+	// front of it. Strings never contain those, so literals stay whole.
+	void damage(size_t start) {
+		static const char* stray[] = { " else ", " } ", " ) ", " = ", " let ", " , ", " ( ", " ; " };
+		size_t at = m_out.find_first_of(";)]}", start + m_rand.below(int(m_out.size() - start)));
+		if (at == std::string::npos) return;
+		if (m_rand.below(2)) m_out.erase(at, 1);
+		else m_out.insert(at, stray[m_rand.below(8)]);
+	}
+
+	void unit(CorpusKind kind) {
+		switch (kind) {
+			case CorpusKind::Mixed:
+				switch (m_rand.below(5)) {
+					case 0: comment(); break;
+					case 1: m_out += "pub let "; name("g"); m_out += " = "; number(); m_out += ";\n"; break;
+					case 2: name("f"); m_out += "("; number(); m_out += ", "; string(12); m_out += ");\n"; break;
+					default: function(2 + m_rand.below(4), 2); break;
+				}
+				break;
+			case CorpusKind::Deep:
+				m_out += "let "; name("v"); m_out += " = "; expression(6); m_out += ";\n";
+				break;
+			case CorpusKind::Literals:
+				m_out += "let "; name("s"); m_out += " = "; string(100 + m_rand.below(400));
+				m_out += ", "; name("n"); m_out += " = "; number(); m_out += ";\n";
+				break;
+			case CorpusKind::Comments:
+				comment();
+				if (m_rand.below(4) == 0) { m_out += "let "; name("v"); m_out += " = "; number(); m_out += ";\n"; }
+				break;
+			case CorpusKind::Functions:
+				function(1 + m_rand.below(3), 0);
+				break;
+			case CorpusKind::Loops:
+				m_out += "func "; name("f"); m_out += "() {\n\t";
+				loop(1, 4);
+				m_out += "}\n";
+				break;
+			case CorpusKind::Malformed:
+				malformed();
+				break;
+		}
+	}
+
+private:
+	Random m_rand;
+	std::string m_out;
+};
+
+static const std::vector<CorpusKind> s_kinds {
+	CorpusKind::Mixed, CorpusKind::Deep, CorpusKind::Literals,
+	CorpusKind::Comments, CorpusKind::Functions, CorpusKind::Loops,
+	CorpusKind::Malformed
+};
+
+const std::vector<CorpusKind>& allCorpusKinds() {
+	return s_kinds;
+}
+
+const char* corpusKindName(CorpusKind kind) {
+	switch (kind) {
+		case CorpusKind::Mixed: return "mixed";
+		case CorpusKind::Deep: return "deep";
+		case CorpusKind::Literals: return "literals";
+		case CorpusKind::Comments: return "comments";
+		case CorpusKind::Functions: return "functions";
+		case CorpusKind::Loops: return "loops";
+		case CorpusKind::Malformed: return "malformed";
+	}
+	return "unknown";
+}
+
+bool corpusKindFromName(const std::string& name, CorpusKind& kind) {
+	for (CorpusKind k : s_kinds) {
+		if (name == corpusKindName(k)) {
+			kind = k;
+			return true;
+		}
+	}
+	return false;
+}
+
+std::string generateCorpus(CorpusKind kind, size_t bytes, uint64_t seed) {
+	Generator gen(seed ^ (uint64_t(kind) << 32));
+	gen.out().reserve(bytes + 4096);
+	while (gen.out().size() < bytes) {
+		gen.unit(kind);
+	}
+	return std::move(gen.out());
+}
@@ -0,0 +1,28 @@
+#ifndef LANG_CORPUS_H
+#define LANG_CORPUS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Synthetic lang.rs-style source for benchmarks. The output depends only
+// on the kind, size and seed, so runs on different machines and days lex
+// and parse exactly the same text.
+enum class CorpusKind {
+	Mixed,       // a bit of everything, like lang.rs
+	Deep,        // long and deeply parenthesized expressions
+	Literals,    // long string and number literals
+	Comments,    // mostly line and block comments
+	Functions,   // many small functions
+	Loops,       // nested for/while loops
+	Malformed    // broken statements and nesting past the parser's limit
+};
+
+const char* corpusKindName(CorpusKind kind);
+bool corpusKindFromName(const std::string& name, CorpusKind& kind);
+const std::vector<CorpusKind>& allCorpusKinds();
+
+// At least `bytes` of source made of whole top-level statements.
+std::string generateCorpus(CorpusKind kind, size_t bytes, uint64_t seed = 1);
+
+#endif // LANG_CORPUS_H
\ No newline at end of file
@@ -27,15 +27,20 @@ program : block? EOF;
 return_stmt : 'return' test? ';';
 
 if_stmt
-	: 'if' test '{' stmt* '}' ('else if' test '{' stmt* '}')* ('else' '{' stmt* '}')?
+	: 'if' test body ('else if' test body)* ('else' body)?
+	;
+
+body
+	: '{' stmt* '}'
+	| stmt
 	;
 
 for_stmt
-	: 'for' idlist 'in' (range | test) '{' stmt* '}'
+	: 'for' idlist 'in' (range | test) body
 	;
 
 while_stmt
-	: 'while' test '{' stmt* '}'
+	: 'while' test body
 	;
 
 range
@@ -43,7 +48,11 @@ range
 	;
 
 param
-	: ID ('=' test)?
+	: ID (':' type_name)? ('=' test)?
+	;
+
+type_name
+	: 'number' | 'int' | 'string' | 'bool' | 'char' | 'nil' | 'any'
 	;
 params : param (',' param)*;
 block : stmt+;
@@ -60,6 +69,10 @@ lambda_def_stmt
 	: '|' params? '|' '{' block? '}' ';'
 	;
 
+import_stmt
+	: 'import' ID ('.' ID)* ('(' ID (',' ID)* ')')? ';'
+	;
+
 let_def_stmt
 	: 'pub'? ('const' | 'let') params ';'
 	;
@@ -80,6 +93,7 @@ stmt
 	| while_stmt
 	| lambda_def_stmt
 	| return_stmt
+	| import_stmt
 	;
 
 test: or_test ('?' test ':' test)?
@@ -113,7 +127,7 @@ factor: ('+'|'-'|'~') factor | power
 power: atom trailer* ('**' factor)?
 	;
 
-atom : ID | NUMBER | STRING | '(' test ')';
+atom : ID | NUMBER | INTEGER | STRING | '(' test ')';
 
 trailer
 	: '(' (arglist)? ')' | '[' test ']' | '.' ID
@@ -133,11 +147,15 @@ ID : [a-zA-Z_][a-zA-Z0-9_]*;
 STRING : '"' (ESC_SEQ | ~('\\'|'"'))* '"';
 CHAR : '\'' (ESC_SEQ | ~('\\'|'\'')) '\'';
 
+INTEGER
+	: SIGN? [0-9]+
+	| SIGN? HEX_NUMBER
+	;
+
 NUMBER
-	: SIGN? [0-9]+ EXPONENT?
+	: SIGN? [0-9]+ EXPONENT
 	| SIGN? [0-9]+ '.' [0-9]+ EXPONENT? 'f'?
 	| SIGN? '.' [0-9]+ EXPONENT? 'f'?
-	| SIGN? HEX_NUMBER
 	;
 
 fragment
@@ -169,6 +187,10 @@ WS
    : [ \r\n\t]+ -> skip
    ;
 
+COMMENT
+   : ('//' ~[\r\n]* | '/*' .*? '*/') -> skip
+   ;
+
 fragment
 SIGN
 	: [+-]
@@ -0,0 +1,166 @@
+#include "constfold.h"
+
+#include "../parser/detail/atom.hpp"
+#include "../parser/detail/ops.hpp"
+#include "../parser/detail/stmts.hpp"
+#include "../util/profiler.h"
+
+void ConstantFolder::run(Program* program) {
+	m_folded = 0;
+	if (program) program->visit(*this);
+}
+
+void ConstantFolder::fold(NodePtr& slot) {
+	if (!slot) return;
+
+	m_replacement = nullptr;
+	slot->visit(*this);
+	if (m_replacement) {
+		slot.reset(m_replacement);
+		m_replacement = nullptr;
+		m_folded++;
+	}
+}
+
+void ConstantFolder::block(NodeList& stmts) {
+	for (auto&& stmt : stmts) {
+		if (stmt) profileLine(stmt->line);
+		fold(stmt);
+	}
+}
+
+bool ConstantFolder::literal(Node* node, Value& out) {
+	if (IntegerAtom* n = dynamic_cast<IntegerAtom*>(node)) {
+		out = Value::integer(n->value);
+	} else if (NumberAtom* n = dynamic_cast<NumberAtom*>(node)) {
+		out = Value::number(n->value);
+	} else if (BoolAtom* n = dynamic_cast<BoolAtom*>(node)) {
+		out = Value::boolean(n->value);
+	} else if (CharAtom* n = dynamic_cast<CharAtom*>(node)) {
+		out = Value::character(n->value);
+	} else {
+		return false;
+	}
+	return true;
+}
+
+Node* ConstantFolder::makeLiteral(const Value& value) {
+	switch (value.type) {
+		case ValueType::Integer: return new IntegerAtom(value.integerValue);
+		case ValueType::Number: return new NumberAtom(value.numberValue);
+		case ValueType::Bool: return new BoolAtom(value.boolValue);
+		case ValueType::Char: return new CharAtom(value.charValue);
+		default: return nullptr;
+	}
+}
+
+void ConstantFolder::visit(Program& node) {
+	block(node.stmts);
+}
+
+void ConstantFolder::visit(BinOp& node) {
+	fold(node.left);
+	fold(node.right);
+
+	if (node.op == "+") {
+		StringAtom* a = dynamic_cast<StringAtom*>(node.left.get());
+		StringAtom* b = dynamic_cast<StringAtom*>(node.right.get());
+		if (a && b) {
+			m_replacement = new StringAtom(a->value + b->value);
+			return;
+		}
+	}
+
+	Value a, b, res;
+	if (!literal(node.left.get(), a) || !literal(node.right.get(), b)) return;
+	if (binaryOp(binaryArithOp(node.op), a, b, res)) {
+		m_replacement = makeLiteral(res);
+	}
+}
+
+void ConstantFolder::visit(UnOp& node) {
+	fold(node.right);
+
+	Value a, res;
+	if (!literal(node.right.get(), a)) return;
+	if (unaryOp(unaryArithOp(node.op), a, res)) {
+		m_replacement = makeLiteral(res);
+	}
+}
+
+void ConstantFolder::visit(TernaryOp& node) {
+	fold(node.cond);
+	fold(node.left);
+	fold(node.right);
+
+	Value cond;
+	if (literal(node.cond.get(), cond)) {
+		m_replacement = cond.truthy() ? node.left.release() : node.right.release();
+	}
+}
+
+void ConstantFolder::visit(CallOp& node) {
+	fold(node.func);
+	block(node.items);
+}
+
+void ConstantFolder::visit(IndexOp& node) {
+	fold(node.obj);
+	fold(node.index);
+}
+
+void ConstantFolder::visit(AssignmentStmt& node) {
+	// The object and index of an element target are expressions too.
+	if (dynamic_cast<IndexOp*>(node.left.get())) fold(node.left);
+	fold(node.right);
+}
+
+void ConstantFolder::visit(IfStmt& node) {
+	fold(node.cond);
+	block(node.stmts);
+	for (auto&& elseif : node.elseIfs) {
+		elseif->visit(*this);
+	}
+	if (node.elseStmt) node.elseStmt->visit(*this);
+}
+
+void ConstantFolder::visit(ParamStmt& node) {
+	fold(node.value);
+}
+
+void ConstantFolder::visit(LetStmt& node) {
+	for (auto&& var : node.variableList) {
+		var->visit(*this);
+	}
+}
+
+void ConstantFolder::visit(FuncDefStmt& node) {
+	ProfileScope scope(node.name, node.line);
+	for (auto&& param : node.paramList) {
+		param->visit(*this);
+	}
+	block(node.body());
+}
+
+void ConstantFolder::visit(ReturnStmt& node) {
+	fold(node.value);
+}
+
+void ConstantFolder::visit(YieldStmt& node) {
+	fold(node.value);
+}
+
+void ConstantFolder::visit(ForStmt& node) {
+	fold(node.iter);
+	block(node.stmts);
+}
+
+void ConstantFolder::visit(RangeStmt& node) {
+	fold(node.from);
+	fold(node.to);
+}
+
+void ConstantFolder::visit(WhileStmt& node) {
+	fold(node.cond);
+	block(node.stmts);
+}
\ No newline at end of file
@@ -0,0 +1,49 @@
+#ifndef LANG_CONSTFOLD_H
+#define LANG_CONSTFOLD_H
+
+#include "../parser/parser.h"
+#include "../runtime/value.h"
+
+// Replaces operators whose operands are all literals with the literal
+// result, using the same arithmetic as the runtime (integer operations stay
+// integers and only promote to numbers on overflow).
+class ConstantFolder : public NodeVisitor {
+public:
+	ConstantFolder() = default;
+	~ConstantFolder() = default;
+
+	void run(Program* program);
+
+	int folded() const { return m_folded; }
+
+	void visit(Program& node);
+
+	void visit(BinOp& node);
+	void visit(UnOp& node);
+	void visit(TernaryOp& node);
+	void visit(CallOp& node);
+	void visit(IndexOp& node);
+
+	void visit(AssignmentStmt& node);
+	void visit(IfStmt& node);
+	void visit(ParamStmt& node);
+	void visit(LetStmt& node);
+	void visit(FuncDefStmt& node);
+	void visit(ReturnStmt& node);
+	void visit(YieldStmt& node);
+	void visit(ForStmt& node);
+	void visit(RangeStmt& node);
+	void visit(WhileStmt& node);
+
+private:
+	Node* m_replacement = nullptr;
+	int m_folded = 0;
+
+	void fold(NodePtr& slot);
+	void block(NodeList& stmts);
+
+	bool literal(Node* node, Value& out);
+	Node* makeLiteral(const Value& value);
+};
+
+#endif // LANG_CONSTFOLD_H
\ No newline at end of file
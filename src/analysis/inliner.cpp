@@ -0,0 +1,413 @@
+#include "inliner.h"
+
+#include <vector>
+
+#include "../parser/detail/atom.hpp"
+#include "../parser/detail/ops.hpp"
+#include "../parser/detail/stmts.hpp"
+
+namespace {
+
+// The size of an expression, whether it calls anything and how often each
+// name occurs in it, in all and where && || ?: may skip it.
+struct ExprInfo : public NodeVisitor {
+	int nodes = 0;
+	bool calls = false;
+	std::map<std::string, int> uses, conditional;
+	int branches = 0;
+
+	void run(Node* node) {
+		if (!node) return;
+		nodes++;
+		node->visit(*this);
+	}
+
+	void visit(IdentifierAtom& node) {
+		uses[node.name]++;
+		if (branches > 0) conditional[node.name]++;
+	}
+
+	void visit(BinOp& node) {
+		bool lazy = node.op == "&&" || node.op == "||";
+		run(node.left.get());
+		branches += lazy;
+		run(node.right.get());
+		branches -= lazy;
+	}
+
+	void visit(UnOp& node) { run(node.right.get()); }
+
+	void visit(TernaryOp& node) {
+		run(node.cond.get());
+		branches++;
+		run(node.left.get());
+		run(node.right.get());
+		branches--;
+	}
+
+	void visit(CallOp& node) {
+		calls = true;
+		run(node.func.get());
+		for (auto&& item : node.items) run(item.get());
+	}
+
+	void visit(IndexOp& node) {
+		run(node.obj.get());
+		run(node.index.get());
+	}
+};
+
+// Copies an expression, replacing the identifiers in `values` with copies
+// of what they map to. `failed` is set by anything that is not an
+// expression.
+struct Cloner : public NodeVisitor {
+	const std::map<std::string, Node*>& values;
+	Node* result = nullptr;
+	bool failed = false;
+
+	Cloner(const std::map<std::string, Node*>& values) : values(values) {}
+
+	Node* clone(Node* node) {
+		if (!node) return nullptr;
+		result = nullptr;
+		node->visit(*this);
+		if (!result) {
+			failed = true;
+		} else {
+			result->line = node->line;
+			result->pos = node->pos;
+		}
+		return result;
+	}
+
+	void visit(BoolAtom& node) { result = new BoolAtom(node.value); }
+	void visit(NumberAtom& node) { result = new NumberAtom(node.value); }
+	void visit(IntegerAtom& node) { result = new IntegerAtom(node.value); }
+	void visit(StringAtom& node) { result = new StringAtom(node.value); }
+	void visit(CharAtom& node) { result = new CharAtom(node.value); }
+
+	void visit(IdentifierAtom& node) {
+		auto it = values.find(node.name);
+		if (it == values.end()) {
+			result = new IdentifierAtom(node.name);
+			return;
+		}
+		// Arguments belong to the caller: copied as they are.
+		static const std::map<std::string, Node*> none;
+		Cloner copy(none);
+		result = copy.clone(it->second);
+		failed |= copy.failed;
+	}
+
+	void visit(BinOp& node) {
+		BinOp* op = new BinOp(clone(node.left.get()), nullptr, node.op);
+		op->right.reset(clone(node.right.get()));
+		result = op;
+	}
+
+	void visit(UnOp& node) { result = new UnOp(clone(node.right.get()), node.op); }
+
+	void visit(TernaryOp& node) {
+		TernaryOp* op = new TernaryOp();
+		op->cond.reset(clone(node.cond.get()));
+		op->left.reset(clone(node.left.get()));
+		op->right.reset(clone(node.right.get()));
+		result = op;
+	}
+
+	void visit(CallOp& node) {
+		CallOp* op = new CallOp();
+		op->func.reset(clone(node.func.get()));
+		for (auto&& item : node.items) {
+			op->items.push_back(NodePtr(clone(item.get())));
+		}
+		result = op;
+	}
+
+	void visit(IndexOp& node) {
+		IndexOp* op = new IndexOp();
+		op->obj.reset(clone(node.obj.get()));
+		op->index.reset(clone(node.index.get()));
+		result = op;
+	}
+};
+
+// Every name a function declares for itself: parameters, variables, loop
+// variables, reductions and nested functions, in any block.
+struct LocalNames : public NodeVisitor {
+	std::set<std::string>& names;
+
+	LocalNames(std::set<std::string>& names) : names(names) {}
+
+	void run(NodeList& stmts) {
+		for (auto&& stmt : stmts) {
+			if (stmt) stmt->visit(*this);
+		}
+	}
+
+	void visit(IfStmt& node) {
+		run(node.stmts);
+		for (auto&& elseIf : node.elseIfs) elseIf->visit(*this);
+		if (node.elseStmt) node.elseStmt->visit(*this);
+	}
+
+	void visit(LetStmt& node) {
+		for (auto&& var : node.variableList) names.insert(var->name);
+	}
+
+	void visit(FuncDefStmt& node) {
+		names.insert(node.name);
+	}
+
+	void visit(ForStmt& node) {
+		for (auto&& var : node.vars) {
+			if (ParamStmt* param = dynamic_cast<ParamStmt*>(var.get())) names.insert(param->name);
+		}
+		for (auto&& reduction : node.reductions) names.insert(reduction.name);
+		run(node.stmts);
+	}
+
+	void visit(WhileStmt& node) {
+		run(node.stmts);
+	}
+};
+
+bool literal(Node* node) {
+	return dynamic_cast<IntegerAtom*>(node) || dynamic_cast<NumberAtom*>(node) || dynamic_cast<BoolAtom*>(node) ||
+		dynamic_cast<CharAtom*>(node) || dynamic_cast<StringAtom*>(node);
+}
+
+} // namespace
+
+void Inliner::run(Program* program) {
+	m_inlined = 0;
+	if (!program) return;
+
+	m_functions.clear();
+	for (auto&& stmt : program->stmts) {
+		if (FuncDefStmt* func = dynamic_cast<FuncDefStmt*>(stmt.get())) m_functions[func->name] = func;
+	}
+	program->visit(*this);
+}
+
+void Inliner::rewrite(NodePtr& slot) {
+	if (!slot) return;
+
+	m_replacement = nullptr;
+	slot->visit(*this);
+	if (!m_replacement) return;
+
+	slot.reset(m_replacement);
+	m_replacement = nullptr;
+	m_inlined++;
+
+	// The callee's own calls, now in the caller.
+	if (m_depth < MaxDepth) {
+		m_depth++;
+		rewrite(slot);
+		m_depth--;
+	}
+}
+
+void Inliner::block(NodeList& stmts) {
+	for (auto&& stmt : stmts) rewrite(stmt);
+}
+
+// The expression `func` returns, if it qualifies as a callee.
+Node* Inliner::returned(FuncDefStmt* func) {
+	NodeList& body = func->body();
+	if (body.size() != 1) return nullptr;
+
+	ReturnStmt* ret = dynamic_cast<ReturnStmt*>(body[0].get());
+	if (!ret || !ret->value) return nullptr;
+
+	ExprInfo info;
+	info.run(ret->value.get());
+	if (info.nodes > MaxCalleeNodes || info.uses.count(func->name)) return nullptr;
+	return ret->value.get();
+}
+
+Node* Inliner::expand(CallOp& call) {
+	IdentifierAtom* target = dynamic_cast<IdentifierAtom*>(call.func.get());
+	if (!target || m_locals.count(target->name)) return nullptr;
+
+	auto found = m_functions.find(target->name);
+	if (found == m_functions.end()) return nullptr;
+	FuncDefStmt* func = found->second;
+
+	Node* expr = returned(func);
+	ParamList& params = func->paramList;
+	if (!expr || call.items.size() > params.size()) return nullptr;
+
+	ExprInfo info;
+	info.run(expr);
+	if (m_growth + info.nodes > MaxGrowth) return nullptr;
+
+	// What each parameter stands for: its argument or its default.
+	std::map<std::string, Node*> values;
+	for (size_t i = 0; i < params.size(); i++) {
+		Node* value = i < call.items.size() ? call.items[i].get() : params[i]->value.get();
+		if (!value) return nullptr;
+
+		if (i >= call.items.size() && !literal(value)) {
+			IdentifierAtom* name = dynamic_cast<IdentifierAtom*>(value);
+			if (!name) return nullptr;
+
+			auto earlier = values.find(name->name);
+			if (earlier != values.end()) {
+				value = earlier->second;
+			} else {
+				for (auto&& param : params) {
+					if (param->name == name->name) return nullptr;
+				}
+				if (m_locals.count(name->name)) return nullptr;
+			}
+		}
+		values[params[i]->name] = value;
+	}
+
+	// The callee's globals must mean the same in the caller.
+	for (auto&& use : info.uses) {
+		if (!values.count(use.first) && m_locals.count(use.first)) return nullptr;
+	}
+
+	for (auto&& param : params) {
+		Node* value = values[param->name];
+		if (literal(value)) continue;
+
+		IdentifierAtom* name = dynamic_cast<IdentifierAtom*>(value);
+		if (name && (m_locals.count(name->name) || !info.calls)) continue;
+
+		// A default standing for an earlier parameter adds to its uses.
+		int uses = 0, conditional = 0;
+		for (auto&& other : params) {
+			if (values[other->name] != value) continue;
+			uses += info.uses[other->name];
+			conditional += info.conditional[other->name];
+		}
+
+		ExprInfo arg;
+		arg.run(value);
+		if (uses != 1 || conditional > 0 || arg.calls || info.calls) return nullptr;
+	}
+
+	Cloner cloner(values);
+	Node* result = cloner.clone(expr);
+	if (cloner.failed) {
+		delete result;
+		return nullptr;
+	}
+	result->line = call.line;
+	result->pos = call.pos;
+	m_growth += info.nodes;
+	return result;
+}
+
+void Inliner::visit(Program& node) {
+	m_locals.clear();
+	for (auto&& stmt : node.stmts) {
+		// Top-level variables and functions are the globals themselves.
+		if (dynamic_cast<LetStmt*>(stmt.get()) || dynamic_cast<FuncDefStmt*>(stmt.get())) continue;
+		LocalNames names(m_locals);
+		stmt->visit(names);
+	}
+
+	m_growth = 0;
+	block(node.stmts);
+}
+
+void Inliner::visit(BinOp& node) {
+	rewrite(node.left);
+	rewrite(node.right);
+}
+
+void Inliner::visit(UnOp& node) {
+	rewrite(node.right);
+}
+
+void Inliner::visit(TernaryOp& node) {
+	rewrite(node.cond);
+	rewrite(node.left);
+	rewrite(node.right);
+}
+
+void Inliner::visit(CallOp& node) {
+	rewrite(node.func);
+	block(node.items);
+	m_replacement = expand(node);
+}
+
+void Inliner::visit(IndexOp& node) {
+	rewrite(node.obj);
+	rewrite(node.index);
+}
+
+void Inliner::visit(AssignmentStmt& node) {
+	if (dynamic_cast<IndexOp*>(node.left.get())) rewrite(node.left);
+	rewrite(node.right);
+}
+
+void Inliner::visit(IfStmt& node) {
+	rewrite(node.cond);
+	block(node.stmts);
+	for (auto&& elseIf : node.elseIfs) {
+		elseIf->visit(*this);
+	}
+	if (node.elseStmt) node.elseStmt->visit(*this);
+}
+
+void Inliner::visit(ParamStmt& node) {
+	rewrite(node.value);
+}
+
+void Inliner::visit(LetStmt& node) {
+	for (auto&& var : node.variableList) {
+		var->visit(*this);
+	}
+}
+
+// A top-level function starts from its own names; a nested one cannot use
+// the enclosing function's locals either, so it adds to them.
+void Inliner::visit(FuncDefStmt& node) {
+	std::set<std::string> locals = m_locals;
+	int growth = m_growth;
+	if (m_functions.count(node.name) && m_functions[node.name] == &node) m_locals.clear();
+
+	for (auto&& param : node.paramList) {
+		m_locals.insert(param->name);
+	}
+	LocalNames names(m_locals);
+	names.run(node.body());
+
+	m_growth = 0;
+	for (auto&& param : node.paramList) {
+		param->visit(*this);
+	}
+	block(node.body());
+
+	m_locals = std::move(locals);
+	m_growth = growth;
+}
+
+void Inliner::visit(ReturnStmt& node) {
+	rewrite(node.value);
+}
+
+void Inliner::visit(YieldStmt& node) {
+	rewrite(node.value);
+}
+
+void Inliner::visit(ForStmt& node) {
+	rewrite(node.iter);
+	block(node.stmts);
+}
+
+void Inliner::visit(RangeStmt& node) {
+	rewrite(node.from);
+	rewrite(node.to);
+}
+
+void Inliner::visit(WhileStmt& node) {
+	rewrite(node.cond);
+	block(node.stmts);
+}
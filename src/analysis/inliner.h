@@ -0,0 +1,79 @@
+#ifndef LANG_INLINER_H
+#define LANG_INLINER_H
+
+#include <map>
+#include <set>
+#include <string>
+
+#include "../parser/parser.h"
+
+// Replaces calls of small top-level functions with the expression they
+// return, the arguments substituted for the parameters:
+//
+//     func add(a, b) { return a + b; }    add(i, 1)  ->  i + 1
+//
+// Runs before ConstantFolder, so constant arguments fold through. A callee
+// qualifies when its body is a single `return` of at most MaxCalleeNodes
+// nodes that does not name the callee itself. A call site qualifies when:
+// - the arguments fit the parameters; a missing one takes its default,
+//   which must be a literal or the name of a global or earlier parameter;
+// - no local of the caller shadows the callee or a global it uses;
+// - every argument is still evaluated exactly when the call would have
+//   evaluated it. Literals and the caller's locals can be copied to any
+//   number of uses, as can globals if the callee calls nothing that could
+//   assign them. Anything else must be free of calls and used exactly once,
+//   outside && || and ?:, by a callee that calls nothing.
+// Inlined code is inlined into again, up to MaxDepth levels, and each
+// function grows by at most MaxGrowth nodes.
+class Inliner : public NodeVisitor {
+public:
+	static const int MaxCalleeNodes = 24;
+	static const int MaxDepth = 3;
+	static const int MaxGrowth = 512;
+
+	Inliner() = default;
+	~Inliner() = default;
+
+	void run(Program* program);
+
+	int inlined() const { return m_inlined; }
+
+	void visit(Program& node);
+
+	void visit(BinOp& node);
+	void visit(UnOp& node);
+	void visit(TernaryOp& node);
+	void visit(CallOp& node);
+	void visit(IndexOp& node);
+
+	void visit(AssignmentStmt& node);
+	void visit(IfStmt& node);
+	void visit(ParamStmt& node);
+	void visit(LetStmt& node);
+	void visit(FuncDefStmt& node);
+	void visit(ReturnStmt& node);
+	void visit(YieldStmt& node);
+	void visit(ForStmt& node);
+	void visit(RangeStmt& node);
+	void visit(WhileStmt& node);
+
+private:
+	std::map<std::string, FuncDefStmt*> m_functions;
+
+	// Names declared anywhere in the function being rewritten, which hide
+	// globals of the same name.
+	std::set<std::string> m_locals;
+	int m_growth = 0;
+	int m_depth = 0;
+
+	Node* m_replacement = nullptr;
+	int m_inlined = 0;
+
+	void rewrite(NodePtr& slot);
+	void block(NodeList& stmts);
+
+	Node* returned(FuncDefStmt* func);
+	Node* expand(CallOp& call);
+};
+
+#endif // LANG_INLINER_H
\ No newline at end of file
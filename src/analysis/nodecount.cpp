@@ -0,0 +1,132 @@
+#include "nodecount.h"
+
+#include "../parser/detail/atom.hpp"
+#include "../parser/detail/ops.hpp"
+#include "../parser/detail/stmts.hpp"
+
+void NodeCounter::run(Node* node) {
+	if (node) node->visit(*this);
+}
+
+void NodeCounter::count(const char* kind) {
+	m_counts[kind]++;
+	m_total++;
+}
+
+void NodeCounter::visit(Program& node) {
+	count("Program");
+	all(node.stmts);
+}
+
+void NodeCounter::visit(EOFAtom& /* node */) { count("EOFAtom"); }
+void NodeCounter::visit(BoolAtom& /* node */) { count("BoolAtom"); }
+void NodeCounter::visit(IdentifierAtom& /* node */) { count("IdentifierAtom"); }
+void NodeCounter::visit(NumberAtom& /* node */) { count("NumberAtom"); }
+void NodeCounter::visit(IntegerAtom& /* node */) { count("IntegerAtom"); }
+void NodeCounter::visit(StringAtom& /* node */) { count("StringAtom"); }
+void NodeCounter::visit(CharAtom& /* node */) { count("CharAtom"); }
+
+void NodeCounter::visit(BinOp& node) {
+	count("BinOp");
+	run(node.left.get());
+	run(node.right.get());
+}
+
+void NodeCounter::visit(UnOp& node) {
+	count("UnOp");
+	run(node.right.get());
+}
+
+void NodeCounter::visit(TernaryOp& node) {
+	count("TernaryOp");
+	run(node.cond.get());
+	run(node.left.get());
+	run(node.right.get());
+}
+
+void NodeCounter::visit(CallOp& node) {
+	count("CallOp");
+	run(node.func.get());
+	all(node.items);
+}
+
+void NodeCounter::visit(IndexOp& node) {
+	count("IndexOp");
+	run(node.obj.get());
+	run(node.index.get());
+}
+
+void NodeCounter::visit(SemicolonStmt& /* node */) { count("SemicolonStmt"); }
+void NodeCounter::visit(BreakStmt& /* node */) { count("BreakStmt"); }
+void NodeCounter::visit(ContinueStmt& /* node */) { count("ContinueStmt"); }
+
+void NodeCounter::visit(AssignmentStmt& node) {
+	count("AssignmentStmt");
+	run(node.left.get());
+	run(node.right.get());
+}
+
+void NodeCounter::visit(IncrementStmt& node) {
+	count("IncrementStmt");
+	run(node.node.get());
+}
+
+void NodeCounter::visit(DecrementStmt& node) {
+	count("DecrementStmt");
+	run(node.node.get());
+}
+
+void NodeCounter::visit(IfStmt& node) {
+	count("IfStmt");
+	run(node.cond.get());
+	all(node.stmts);
+	all(node.elseIfs);
+	run(node.elseStmt.get());
+}
+
+void NodeCounter::visit(ParamStmt& node) {
+	count("ParamStmt");
+	run(node.value.get());
+}
+
+void NodeCounter::visit(LetStmt& node) {
+	count("LetStmt");
+	all(node.variableList);
+}
+
+void NodeCounter::visit(FuncDefStmt& node) {
+	count("FuncDefStmt");
+	all(node.paramList);
+	if (node.parsed) all(node.stmts);
+}
+
+void NodeCounter::visit(ReturnStmt& node) {
+	count("ReturnStmt");
+	run(node.value.get());
+}
+
+void NodeCounter::visit(YieldStmt& node) {
+	count("YieldStmt");
+	run(node.value.get());
+}
+
+void NodeCounter::visit(ForStmt& node) {
+	count("ForStmt");
+	all(node.vars);
+	run(node.iter.get());
+	all(node.stmts);
+}
+
+void NodeCounter::visit(RangeStmt& node) {
+	count("RangeStmt");
+	run(node.from.get());
+	run(node.to.get());
+}
+
+void NodeCounter::visit(WhileStmt& node) {
+	count("WhileStmt");
+	run(node.cond.get());
+	all(node.stmts);
+}
+
+void NodeCounter::visit(ImportStmt& /* node */) { count("ImportStmt"); }
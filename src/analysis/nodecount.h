@@ -0,0 +1,66 @@
+#ifndef LANG_NODECOUNT_H
+#define LANG_NODECOUNT_H
+
+#include <map>
+#include <string>
+
+#include "../parser/parser.h"
+
+// Counts the nodes of a tree by kind. Bodies that are still unparsed are
+// not forced, so the counts reflect what is actually in memory.
+class NodeCounter : public NodeVisitor {
+public:
+	NodeCounter() = default;
+	~NodeCounter() = default;
+
+	void run(Node* node);
+
+	const std::map<std::string, int>& counts() const { return m_counts; }
+	int total() const { return m_total; }
+
+	void visit(Program& node);
+
+	void visit(EOFAtom& node);
+	void visit(BoolAtom& node);
+	void visit(IdentifierAtom& node);
+	void visit(NumberAtom& node);
+	void visit(IntegerAtom& node);
+	void visit(StringAtom& node);
+	void visit(CharAtom& node);
+
+	void visit(BinOp& node);
+	void visit(UnOp& node);
+	void visit(TernaryOp& node);
+	void visit(CallOp& node);
+	void visit(IndexOp& node);
+
+	void visit(SemicolonStmt& node);
+	void visit(BreakStmt& node);
+	void visit(ContinueStmt& node);
+	void visit(AssignmentStmt& node);
+	void visit(IncrementStmt& node);
+	void visit(DecrementStmt& node);
+	void visit(IfStmt& node);
+	void visit(ParamStmt& node);
+	void visit(LetStmt& node);
+	void visit(FuncDefStmt& node);
+	void visit(ReturnStmt& node);
+	void visit(YieldStmt& node);
+	void visit(ForStmt& node);
+	void visit(RangeStmt& node);
+	void visit(WhileStmt& node);
+	void visit(ImportStmt& node);
+
+private:
+	std::map<std::string, int> m_counts;
+	int m_total = 0;
+
+	void count(const char* kind);
+
+	template <typename T>
+	void all(std::vector<std::unique_ptr<T>>& nodes) {
+		for (auto&& n : nodes) run(n.get());
+	}
+};
+
+#endif // LANG_NODECOUNT_H
\ No newline at end of file
@@ -0,0 +1,227 @@
+#include "treeshake.h"
+
+#include "../parser/moduleloader.h"
+#include "../parser/detail/atom.hpp"
+#include "../parser/detail/ops.hpp"
+#include "../parser/detail/stmts.hpp"
+
+void TreeShaker::run(Program* program) {
+	if (!program) return;
+
+	m_loader = nullptr;
+	m_definitions.clear();
+	for (auto&& stmt : program->stmts) {
+		if (LetStmt* let = dynamic_cast<LetStmt*>(stmt.get())) {
+			for (auto&& var : let->variableList) {
+				m_definitions[var->name] = var.get();
+			}
+		} else if (FuncDefStmt* func = dynamic_cast<FuncDefStmt*>(stmt.get())) {
+			m_definitions[func->name] = func;
+		}
+	}
+
+	roots(program, nullptr, true);
+	drain();
+	sweep(program, nullptr);
+}
+
+void TreeShaker::run(ModuleLoader& loader, Module* entry) {
+	if (!entry) return;
+
+	m_loader = &loader;
+	for (Module* module : loader.order()) {
+		for (auto&& def : module->definitions) {
+			m_owners[def.second] = module;
+		}
+	}
+
+	for (Module* module : loader.order()) {
+		if (module->program) roots(module->program.get(), module, module == entry);
+	}
+	drain();
+	for (Module* module : loader.order()) {
+		if (module->program) sweep(module->program.get(), module);
+	}
+}
+
+void TreeShaker::roots(Program* program, Module* module, bool entry) {
+	for (auto&& stmt : program->stmts) {
+		if (LetStmt* let = dynamic_cast<LetStmt*>(stmt.get())) {
+			for (auto&& var : let->variableList) {
+				m_names.clear();
+				m_calls = false;
+				walk(var->value.get());
+				if (m_calls || (entry && let->publicLet)) reach(var.get());
+			}
+		} else if (FuncDefStmt* func = dynamic_cast<FuncDefStmt*>(stmt.get())) {
+			if (entry && func->publicFunc) reach(func);
+		} else {
+			scan(stmt.get(), module);
+		}
+	}
+}
+
+void TreeShaker::scan(Node* node, Module* module) {
+	m_names.clear();
+	m_calls = false;
+	walk(node);
+
+	for (auto&& name : m_names) {
+		Node* target = nullptr;
+		if (m_loader) {
+			target = m_loader->resolve(module, name);
+		} else {
+			auto it = m_definitions.find(name);
+			if (it != m_definitions.end()) target = it->second;
+		}
+		if (target) reach(target);
+	}
+}
+
+void TreeShaker::reach(Node* node) {
+	if (m_reached.insert(node).second) m_work.push_back(node);
+}
+
+void TreeShaker::drain() {
+	while (!m_work.empty()) {
+		Node* node = m_work.back();
+		m_work.pop_back();
+
+		auto owner = m_owners.find(node);
+		scan(node, owner != m_owners.end() ? owner->second : nullptr);
+	}
+}
+
+// Drops what was not reached from `program` and from the tables of its
+// module, keeping the order of everything else.
+void TreeShaker::sweep(Program* program, Module* module) {
+	auto forget = [module](const std::string& name, Node* node) {
+		if (!module) return;
+		auto def = module->definitions.find(name);
+		if (def == module->definitions.end() || def->second != node) return;
+		module->definitions.erase(def);
+		module->exports.erase(name);
+	};
+
+	NodeList& stmts = program->stmts;
+	size_t kept = 0;
+	for (size_t i = 0; i < stmts.size(); i++) {
+		Node* stmt = stmts[i].get();
+		if (FuncDefStmt* func = dynamic_cast<FuncDefStmt*>(stmt)) {
+			if (!m_reached.count(func)) {
+				forget(func->name, func);
+				m_removedFunctions++;
+				continue;
+			}
+		} else if (LetStmt* let = dynamic_cast<LetStmt*>(stmt)) {
+			ParamList& vars = let->variableList;
+			size_t live = 0;
+			for (size_t j = 0; j < vars.size(); j++) {
+				if (!m_reached.count(vars[j].get())) {
+					forget(vars[j]->name, vars[j].get());
+					m_removedVariables++;
+					continue;
+				}
+				if (live != j) vars[live] = std::move(vars[j]);
+				live++;
+			}
+			vars.resize(live);
+			if (vars.empty()) continue;
+		}
+		if (kept != i) stmts[kept] = std::move(stmts[i]);
+		kept++;
+	}
+	stmts.resize(kept);
+}
+
+void TreeShaker::visit(IdentifierAtom& node) {
+	m_names.push_back(node.name);
+}
+
+void TreeShaker::visit(BinOp& node) {
+	walk(node.left.get());
+	walk(node.right.get());
+}
+
+void TreeShaker::visit(UnOp& node) {
+	walk(node.right.get());
+}
+
+void TreeShaker::visit(TernaryOp& node) {
+	walk(node.cond.get());
+	walk(node.left.get());
+	walk(node.right.get());
+}
+
+void TreeShaker::visit(CallOp& node) {
+	m_calls = true;
+	walk(node.func.get());
+	all(node.items);
+}
+
+void TreeShaker::visit(IndexOp& node) {
+	walk(node.obj.get());
+	walk(node.index.get());
+}
+
+void TreeShaker::visit(AssignmentStmt& node) {
+	walk(node.left.get());
+	walk(node.right.get());
+}
+
+void TreeShaker::visit(IncrementStmt& node) {
+	walk(node.node.get());
+}
+
+void TreeShaker::visit(DecrementStmt& node) {
+	walk(node.node.get());
+}
+
+void TreeShaker::visit(IfStmt& node) {
+	walk(node.cond.get());
+	all(node.stmts);
+	all(node.elseIfs);
+	walk(node.elseStmt.get());
+}
+
+void TreeShaker::visit(ParamStmt& node) {
+	walk(node.value.get());
+}
+
+void TreeShaker::visit(LetStmt& node) {
+	all(node.variableList);
+}
+
+// Only reached functions get here, so this is the one place a body is
+// parsed; nested definitions are kept with their enclosing function.
+void TreeShaker::visit(FuncDefStmt& node) {
+	all(node.paramList);
+	all(node.body());
+}
+
+void TreeShaker::visit(ReturnStmt& node) {
+	walk(node.value.get());
+}
+
+void TreeShaker::visit(YieldStmt& node) {
+	walk(node.value.get());
+}
+
+void TreeShaker::visit(ForStmt& node) {
+	all(node.vars);
+	walk(node.iter.get());
+	all(node.stmts);
+	for (auto&& reduction : node.reductions) {
+		m_names.push_back(reduction.name);
+	}
+}
+
+void TreeShaker::visit(RangeStmt& node) {
+	walk(node.from.get());
+	walk(node.to.get());
+}
+
+void TreeShaker::visit(WhileStmt& node) {
+	walk(node.cond.get());
+	all(node.stmts);
+}
@@ -0,0 +1,91 @@
+#ifndef LANG_TREESHAKE_H
+#define LANG_TREESHAKE_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "../parser/parser.h"
+
+class ModuleLoader;
+struct Module;
+
+// Removes the top-level functions and variables a program can never reach.
+// Starting from the roots, every identifier in a reached definition marks
+// the definition it names, so the call graph (CallOp targets are
+// identifiers too) and global references are followed until nothing new is
+// reached. Bodies of functions that are never reached stay unparsed.
+//
+// The roots are the top-level statements that are not definitions, every
+// variable whose initializer calls something (its side effects must still
+// happen) and the entry's `pub` definitions, which a host may use. A local
+// that shadows a global keeps the global alive; that only costs precision.
+class TreeShaker : public NodeVisitor {
+public:
+	TreeShaker() = default;
+	~TreeShaker() = default;
+
+	// Shakes one program on its own, as compileScript() does.
+	void run(Program* program);
+
+	// Shakes every module `loader` has loaded for `entry`. Only the entry's
+	// `pub` definitions are roots; other modules keep what the entry uses,
+	// and removed definitions leave their module's exports too.
+	void run(ModuleLoader& loader, Module* entry);
+
+	int removedFunctions() const { return m_removedFunctions; }
+	int removedVariables() const { return m_removedVariables; }
+
+	void visit(IdentifierAtom& node);
+
+	void visit(BinOp& node);
+	void visit(UnOp& node);
+	void visit(TernaryOp& node);
+	void visit(CallOp& node);
+	void visit(IndexOp& node);
+
+	void visit(AssignmentStmt& node);
+	void visit(IncrementStmt& node);
+	void visit(DecrementStmt& node);
+	void visit(IfStmt& node);
+	void visit(ParamStmt& node);
+	void visit(LetStmt& node);
+	void visit(FuncDefStmt& node);
+	void visit(ReturnStmt& node);
+	void visit(YieldStmt& node);
+	void visit(ForStmt& node);
+	void visit(RangeStmt& node);
+	void visit(WhileStmt& node);
+
+private:
+	ModuleLoader* m_loader = nullptr;
+	std::map<std::string, Node*> m_definitions;  // without a loader
+	std::map<Node*, Module*> m_owners;
+
+	// Reached definitions; the ones still to scan are queued in m_work.
+	std::set<Node*> m_reached;
+	std::vector<Node*> m_work;
+
+	// Filled while scanning one node.
+	std::vector<std::string> m_names;
+	bool m_calls = false;
+
+	int m_removedFunctions = 0;
+	int m_removedVariables = 0;
+
+	void roots(Program* program, Module* module, bool entry);
+	void scan(Node* node, Module* module);
+	void reach(Node* node);
+	void drain();
+	void sweep(Program* program, Module* module);
+
+	void walk(Node* node) { if (node) node->visit(*this); }
+
+	template <typename T>
+	void all(std::vector<std::unique_ptr<T>>& nodes) {
+		for (auto&& n : nodes) walk(n.get());
+	}
+};
+
+#endif // LANG_TREESHAKE_H
\ No newline at end of file
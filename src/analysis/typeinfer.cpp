@@ -0,0 +1,469 @@
+#include "typeinfer.h"
+
+#include <algorithm>
+
+#include "../parser/detail/atom.hpp"
+#include "../parser/detail/ops.hpp"
+#include "../parser/detail/stmts.hpp"
+#include "../util/profiler.h"
+
+// joinTypes(), except that an int and a number join to number.
+static ValueType join(ValueType a, ValueType b) {
+	if (a != b && isNumericType(a) && isNumericType(b)) return ValueType::Number;
+	return joinTypes(a, b);
+}
+
+// Whether a value of type `type` fits a `declared` annotation.
+static bool fits(ValueType type, ValueType declared) {
+	return type == declared || declared == ValueType::Any || !isConcreteType(type) ||
+		(declared == ValueType::Number && type == ValueType::Integer);
+}
+
+// Globals can be reassigned from inside functions, and a call's type comes
+// from the callee's return type, so the whole program is re-analyzed until
+// those settle. Both are only ever joined with what earlier passes found,
+// so they can only widen and the lattice bounds the number of passes.
+void TypeInference::run(Program* program) {
+	if (program == nullptr) return;
+
+	m_globals.clear();
+	m_returnTypes.clear();
+	for (;;) {
+		m_functions.clear();
+		m_errors.clear();
+		m_globalsChanged = false;
+
+		auto returnTypes = m_returnTypes;
+		program->visit(*this);
+
+		for (auto&& func : m_functions) {
+			ValueType& type = m_returnTypes[func.name];
+			type = join(type, func.returnType);
+		}
+		if (!m_globalsChanged && returnTypes == m_returnTypes) break;
+	}
+
+	// Only the last pass saw the settled types.
+	for (auto&& message : m_errors) {
+		error("ERROR: " << message);
+	}
+}
+
+void TypeInference::typeError(const std::string& message) {
+	// Loop bodies are visited until they settle, report each problem once.
+	if (std::find(m_errors.begin(), m_errors.end(), message) == m_errors.end()) {
+		m_errors.push_back(message);
+	}
+}
+
+void TypeInference::report(std::ostream& out) const {
+	int count = 0;
+	for (auto&& func : m_functions) {
+		if (func.specialized) count++;
+	}
+
+	out << "Type inference: " << count << "/" << m_functions.size() << " function(s) specialized" << std::endl;
+	for (auto&& func : m_functions) {
+		out << "    " << func.name << "(";
+		for (size_t i = 0; i < func.params.size(); i++) {
+			if (i > 0) out << ", ";
+			out << func.params[i].first << ": " << valueTypeName(func.params[i].second);
+		}
+		out << ") -> " << valueTypeName(func.returnType);
+		if (func.specialized) {
+			out << " [specialized]" << std::endl;
+		} else {
+			out << " [generic: " << func.reason << "]" << std::endl;
+		}
+	}
+}
+
+FunctionTypeInfo* TypeInference::function() {
+	if (m_scope.func < 0) return nullptr;
+	return &m_functions[m_scope.func];
+}
+
+ValueType TypeInference::infer(Node* node) {
+	m_result = ValueType::Unknown;
+	if (node == nullptr) return ValueType::Unknown;
+	node->visit(*this);
+	return m_result;
+}
+
+void TypeInference::block(NodeList& stmts) {
+	for (auto&& stmt : stmts) {
+		if (stmt == nullptr) continue;
+		profileLine(stmt->line);
+		stmt->visit(*this);
+	}
+}
+
+void TypeInference::loop(NodeList& stmts, Node* cond) {
+	// The body may run zero or more times, so every iteration starts from
+	// the join of the entry state and the states at the end of the last one
+	// and at its `continue`s. That join only widens, so this ends.
+	bool returned = m_scope.returned;
+	m_scope.loops.emplace_back();
+	for (;;) {
+		Env entry = m_scope.env;
+		if (cond) infer(cond);
+		block(stmts);
+		if (m_scope.loops.back().continued) merge(m_scope.loops.back().continues);
+		merge(entry);
+		if (m_scope.env == entry) break;
+	}
+
+	// After the loop: its condition failed at the head, or it broke out.
+	Exits exits = std::move(m_scope.loops.back());
+	m_scope.loops.pop_back();
+	if (exits.broke) merge(exits.breaks);
+	m_scope.returned = returned;
+}
+
+// Joins the current state into the state at a loop exit.
+void TypeInference::exit(Env& into, bool& taken) {
+	if (!taken) {
+		into = m_scope.env;
+		taken = true;
+		return;
+	}
+	for (auto&& kv : m_scope.env) {
+		ValueType& type = into[kv.first];
+		type = join(type, kv.second);
+	}
+}
+
+ValueType TypeInference::lookup(const std::string& name) {
+	auto it = m_scope.env.find(name);
+	if (it != m_scope.env.end()) return it->second;
+
+	auto git = m_globals.find(name);
+	if (git != m_globals.end()) return git->second;
+	return ValueType::Any;
+}
+
+void TypeInference::declare(ParamStmt* param, ValueType type) {
+	if (param->type != ValueType::Unknown) {
+		if (!fits(type, param->type)) {
+			typeError(
+				"Type mismatch for \"" + param->name + "\". Declared " +
+				valueTypeName(param->type) + ", got " + valueTypeName(type) + "."
+			);
+		}
+		type = param->type;
+	}
+
+	m_scope.env[param->name] = type;
+	if (FunctionTypeInfo* func = function()) {
+		ValueType& local = func->locals[param->name];
+		local = join(local, type);
+	} else {
+		ValueType old = m_globals[param->name];
+		m_globals[param->name] = join(old, type);
+		if (old != m_globals[param->name]) m_globalsChanged = true;
+	}
+}
+
+void TypeInference::assign(const std::string& name, ValueType type) {
+	auto it = m_scope.env.find(name);
+	if (it != m_scope.env.end()) {
+		it->second = type;
+		if (FunctionTypeInfo* func = function()) {
+			ValueType& local = func->locals[name];
+			local = join(local, type);
+			return;
+		}
+	}
+
+	ValueType old = m_globals[name];
+	m_globals[name] = join(old, type);
+	if (old != m_globals[name]) m_globalsChanged = true;
+}
+
+void TypeInference::merge(const Env& other) {
+	for (auto&& kv : other) {
+		auto it = m_scope.env.find(kv.first);
+		if (it == m_scope.env.end()) continue;
+		it->second = join(it->second, kv.second);
+	}
+}
+
+void TypeInference::markOperands(ValueType& slot, ValueType type) {
+	slot = type;
+	if (!isConcreteType(type)) m_scope.dynamicOps = true;
+}
+
+void TypeInference::visit(Program& node) {
+	m_scope = Scope();
+	for (auto&& kv : m_globals) {
+		m_scope.env[kv.first] = kv.second;
+	}
+	block(node.stmts);
+}
+
+void TypeInference::visit(EOFAtom& /* node */) { m_result = ValueType::Nil; }
+void TypeInference::visit(BoolAtom& /* node */) { m_result = ValueType::Bool; }
+void TypeInference::visit(NumberAtom& /* node */) { m_result = ValueType::Number; }
+void TypeInference::visit(IntegerAtom& /* node */) { m_result = ValueType::Integer; }
+void TypeInference::visit(StringAtom& /* node */) { m_result = ValueType::String; }
+void TypeInference::visit(CharAtom& /* node */) { m_result = ValueType::Char; }
+
+void TypeInference::visit(IdentifierAtom& node) {
+	m_result = lookup(node.name);
+}
+
+void TypeInference::visit(BinOp& node) {
+	ValueType left = infer(node.left.get());
+	ValueType right = infer(node.right.get());
+	ValueType both = left == right ? left : ValueType::Any;
+	if (both == ValueType::Any && isNumericType(left) && isNumericType(right)) {
+		both = ValueType::Number;
+	}
+	const std::string& op = node.op;
+
+	if (op == "&&" || op == "||") {
+		node.operandType = both;
+		m_result = ValueType::Bool;
+	} else if (op == "<" || op == ">" || op == "<=" || op == ">=" ||
+			   op == "==" || op == "!=" || op == "is" || op == "has")
+	{
+		markOperands(node.operandType, both);
+		m_result = ValueType::Bool;
+	} else if (op == "+" && both == ValueType::String) {
+		node.operandType = both;
+		m_result = ValueType::String;
+	} else if (!isNumericType(left) || !isNumericType(right)) {
+		markOperands(node.operandType, ValueType::Any);
+		m_result = ValueType::Any;
+	} else if (op == "&" || op == "|" || op == "^" || op == "<<" || op == ">>") {
+		// Bitwise operators always produce integers, but only integer operands
+		// avoid the double -> int conversion.
+		markOperands(node.operandType, both == ValueType::Integer ? both : ValueType::Any);
+		m_result = ValueType::Integer;
+	} else if (op == "/" || op == "**") {
+		markOperands(node.operandType, ValueType::Number);
+		m_result = ValueType::Number;
+	} else {
+		// Mixed integer/number arithmetic promotes the integer side, and
+		// integer +, - and * promote when they overflow.
+		ValueType type = both == ValueType::Integer ? both : ValueType::Number;
+		markOperands(node.operandType, type);
+		m_result = type == ValueType::Integer && op != "%" ? ValueType::Number : type;
+	}
+}
+
+void TypeInference::visit(UnOp& node) {
+	ValueType right = infer(node.right.get());
+	if (node.op == "!") {
+		node.operandType = right;
+		m_result = ValueType::Bool;
+	} else if (node.op == "~") {
+		markOperands(node.operandType, right == ValueType::Integer ? right : ValueType::Any);
+		m_result = isNumericType(right) ? ValueType::Integer : ValueType::Any;
+	} else {
+		ValueType type = isNumericType(right) ? right : ValueType::Any;
+		markOperands(node.operandType, type);
+
+		// Negating the smallest integer overflows.
+		m_result = node.op == "-" && type == ValueType::Integer ? ValueType::Number : type;
+	}
+}
+
+void TypeInference::visit(TernaryOp& node) {
+	infer(node.cond.get());
+	ValueType left = infer(node.left.get());
+	ValueType right = infer(node.right.get());
+	m_result = join(left, right);
+}
+
+void TypeInference::visit(CallOp& node) {
+	for (auto&& arg : node.items) {
+		infer(arg.get());
+	}
+
+	ValueType type = ValueType::Any;
+	IdentifierAtom* callee = dynamic_cast<IdentifierAtom*>(node.func.get());
+	if (callee && m_scope.env.find(callee->name) == m_scope.env.end()) {
+		auto it = m_returnTypes.find(callee->name);
+		if (it != m_returnTypes.end() && it->second != ValueType::Unknown) {
+			type = it->second;
+		}
+	}
+	m_result = type;
+}
+
+// Elements are ints or numbers depending on the array, and a string gives
+// chars: nothing is known statically.
+void TypeInference::visit(IndexOp& node) {
+	infer(node.obj.get());
+	infer(node.index.get());
+	m_result = ValueType::Any;
+}
+
+void TypeInference::visit(BreakStmt& /* node */) {
+	if (!m_scope.loops.empty()) exit(m_scope.loops.back().breaks, m_scope.loops.back().broke);
+}
+
+void TypeInference::visit(ContinueStmt& /* node */) {
+	if (!m_scope.loops.empty()) exit(m_scope.loops.back().continues, m_scope.loops.back().continued);
+}
+
+void TypeInference::visit(AssignmentStmt& node) {
+	ValueType type = infer(node.right.get());
+	IdentifierAtom* id = dynamic_cast<IdentifierAtom*>(node.left.get());
+	if (id) {
+		assign(id->name, type);
+	} else {
+		infer(node.left.get());
+	}
+}
+
+// An integer promotes on overflow like it does for + and -.
+void TypeInference::visit(IncrementStmt& node) {
+	IdentifierAtom* id = dynamic_cast<IdentifierAtom*>(node.node.get());
+	if (id) assign(id->name, isNumericType(lookup(id->name)) ? ValueType::Number : ValueType::Any);
+}
+
+void TypeInference::visit(DecrementStmt& node) {
+	IdentifierAtom* id = dynamic_cast<IdentifierAtom*>(node.node.get());
+	if (id) assign(id->name, isNumericType(lookup(id->name)) ? ValueType::Number : ValueType::Any);
+}
+
+// Control only stops here if there is an `else` and every branch returns.
+void TypeInference::visit(IfStmt& node) {
+	if (node.cond) infer(node.cond.get());
+
+	bool returned = m_scope.returned;
+	Env entry = m_scope.env;
+	m_scope.returned = false;
+	block(node.stmts);
+	Env result = m_scope.env;
+	bool allReturn = m_scope.returned;
+
+	for (auto&& elseif : node.elseIfs) {
+		m_scope.env = entry;
+		m_scope.returned = false;
+		if (elseif->cond) infer(elseif->cond.get());
+		block(elseif->stmts);
+		allReturn = allReturn && m_scope.returned;
+		merge(result);
+		result = m_scope.env;
+	}
+
+	m_scope.env = entry;
+	m_scope.returned = false;
+	if (node.elseStmt) {
+		block(node.elseStmt->stmts);
+	}
+	allReturn = allReturn && node.elseStmt && m_scope.returned;
+	merge(result);
+	m_scope.returned = returned || allReturn;
+}
+
+void TypeInference::visit(LetStmt& node) {
+	for (auto&& var : node.variableList) {
+		ValueType type = var->value ? infer(var->value.get()) : ValueType::Nil;
+		declare(var.get(), type);
+	}
+}
+
+void TypeInference::visit(FuncDefStmt& node) {
+	ProfileScope scope(node.name, node.line);
+	Scope outer = m_scope;
+
+	m_functions.emplace_back();
+	int index = m_functions.size() - 1;
+	m_functions[index].name = node.name;
+
+	m_scope = Scope();
+	m_scope.func = index;
+
+	for (auto&& param : node.paramList) {
+		// Callers can pass anything to an unannotated parameter.
+		ValueType type = param->type != ValueType::Unknown ? param->type : ValueType::Any;
+		if (param->value) {
+			ValueType def = infer(param->value.get());
+			if (isConcreteType(param->type) && !fits(def, param->type)) {
+				typeError(
+					"Default value of \"" + param->name + "\" in \"" + node.name + "\" is " +
+					valueTypeName(def) + ", declared " + valueTypeName(param->type) + "."
+				);
+			}
+		}
+		m_scope.env[param->name] = type;
+		function()->locals[param->name] = type;
+		function()->params.push_back({ param->name, type });
+	}
+
+	block(node.body());
+
+	// Nested definitions may have grown the vector, so re-fetch the entry.
+	// Falling off the end returns nil, but a generator returns itself.
+	FunctionTypeInfo& info = m_functions[index];
+	if (!m_scope.returned && info.returnType != ValueType::Generator) {
+		info.returnType = join(info.returnType, ValueType::Nil);
+	}
+
+	info.specialized = true;
+	for (auto&& kv : info.locals) {
+		if (!isConcreteType(kv.second)) {
+			info.specialized = false;
+			info.reason = kv.first + " is " + valueTypeName(kv.second);
+			break;
+		}
+	}
+	if (info.specialized && m_scope.dynamicOps) {
+		info.specialized = false;
+		info.reason = "untyped arithmetic";
+	}
+	if (info.specialized && !isConcreteType(info.returnType)) {
+		info.specialized = false;
+		info.reason = std::string("returns ") + valueTypeName(info.returnType);
+	}
+
+	m_scope = outer;
+}
+
+void TypeInference::visit(ReturnStmt& node) {
+	ValueType type = node.value ? infer(node.value.get()) : ValueType::Nil;
+	if (FunctionTypeInfo* func = function()) {
+		func->returnType = join(func->returnType, type);
+		m_scope.returned = true;
+	}
+}
+
+// A generator returns the generator object, whatever it yields.
+void TypeInference::visit(YieldStmt& node) {
+	if (node.value) infer(node.value.get());
+	if (FunctionTypeInfo* func = function()) {
+		func->returnType = joinTypes(func->returnType, ValueType::Generator);
+	}
+}
+
+void TypeInference::visit(ForStmt& node) {
+	ValueType type = infer(node.iter.get());
+	ValueType item = dynamic_cast<RangeStmt*>(node.iter.get()) ? type : ValueType::Any;
+	if (type == ValueType::String) item = ValueType::Char;
+
+	for (auto&& var : node.vars) {
+		ParamStmt* param = dynamic_cast<ParamStmt*>(var.get());
+		if (param) declare(param, item);
+	}
+	loop(node.stmts, nullptr);
+}
+
+void TypeInference::visit(RangeStmt& node) {
+	ValueType from = infer(node.from.get());
+	ValueType to = infer(node.to.get());
+	if (from == to && isNumericType(from)) {
+		m_result = from;
+	} else if (isNumericType(from) && isNumericType(to)) {
+		m_result = ValueType::Number;
+	} else {
+		m_result = ValueType::Any;
+	}
+}
+
+void TypeInference::visit(WhileStmt& node) {
+	loop(node.stmts, node.cond.get());
+}
\ No newline at end of file
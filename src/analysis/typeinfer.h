@@ -0,0 +1,121 @@
+#ifndef LANG_TYPEINFER_H
+#define LANG_TYPEINFER_H
+
+#include <map>
+#include <vector>
+
+#include "../parser/parser.h"
+
+struct FunctionTypeInfo {
+	std::string name;
+	std::vector<std::pair<std::string, ValueType>> params;
+	std::map<std::string, ValueType> locals;
+	ValueType returnType = ValueType::Unknown;
+
+	// True when every parameter, local and arithmetic operation in the
+	// function has a single proven type, so the compiler emits every
+	// operation in it quickened for that type.
+	bool specialized = false;
+	std::string reason;
+};
+
+// Flow-sensitive local type inference.
+// Walks each function in statement order, tracking the type every variable
+// holds at the current point. Branches are merged with joinTypes() and loop
+// bodies are re-run until the types stop changing; the state at a `break`
+// flows to after the loop and the state at a `continue` to its next
+// iteration. Int is treated as a subtype of number: integer +, - and *
+// promote on overflow, so their result is a number, and an int and a
+// number join to number. A function that can reach its end without a
+// `return` also returns nil.
+//
+// Proven operand types are written back into BinOp/UnOp::operandType, where
+// the compiler reads them to emit quickened instructions from the start.
+// Those keep the VM's guards: annotations are trusted here but not checked
+// at calls, so a wrong argument still deoptimizes instead of misbehaving.
+class TypeInference : public NodeVisitor {
+public:
+	TypeInference() = default;
+	~TypeInference() = default;
+
+	void run(Program* program);
+
+	const std::vector<FunctionTypeInfo>& functions() const { return m_functions; }
+	void report(std::ostream& out) const;
+
+	void visit(Program& node);
+
+	void visit(EOFAtom& node);
+	void visit(BoolAtom& node);
+	void visit(IdentifierAtom& node);
+	void visit(NumberAtom& node);
+	void visit(IntegerAtom& node);
+	void visit(StringAtom& node);
+	void visit(CharAtom& node);
+
+	void visit(BinOp& node);
+	void visit(UnOp& node);
+	void visit(TernaryOp& node);
+	void visit(CallOp& node);
+	void visit(IndexOp& node);
+
+	void visit(BreakStmt& node);
+	void visit(ContinueStmt& node);
+	void visit(AssignmentStmt& node);
+	void visit(IncrementStmt& node);
+	void visit(DecrementStmt& node);
+	void visit(IfStmt& node);
+	void visit(LetStmt& node);
+	void visit(FuncDefStmt& node);
+	void visit(ReturnStmt& node);
+	void visit(YieldStmt& node);
+	void visit(ForStmt& node);
+	void visit(RangeStmt& node);
+	void visit(WhileStmt& node);
+
+private:
+	using Env = std::map<std::string, ValueType>;
+
+	// The joined states at the `break`s and `continue`s of one loop.
+	struct Exits {
+		Env breaks, continues;
+		bool broke = false, continued = false;
+	};
+
+	struct Scope {
+		Env env;
+		int func = -1;
+		bool dynamicOps = false;
+
+		// Every path to the current statement returned.
+		bool returned = false;
+		std::vector<Exits> loops;
+	};
+
+	Scope m_scope;
+	ValueType m_result = ValueType::Unknown;
+
+	Env m_globals;
+	std::map<std::string, ValueType> m_returnTypes;
+	bool m_globalsChanged = false;
+
+	std::vector<FunctionTypeInfo> m_functions;
+	std::vector<std::string> m_errors;
+
+	FunctionTypeInfo* function();
+	void typeError(const std::string& message);
+
+	ValueType infer(Node* node);
+	void block(NodeList& stmts);
+	void loop(NodeList& stmts, Node* cond);
+
+	ValueType lookup(const std::string& name);
+	void declare(ParamStmt* param, ValueType type);
+	void assign(const std::string& name, ValueType type);
+	void merge(const Env& other);
+	void exit(Env& into, bool& taken);
+
+	void markOperands(ValueType& slot, ValueType type);
+};
+
+#endif // LANG_TYPEINFER_H
\ No newline at end of file
@@ -0,0 +1,284 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#include <unistd.h>
+
+#include "lexer/lexer.h"
+#include "parser/parser.h"
+#include "parser/dump.h"
+#include "analysis/constfold.h"
+#include "analysis/inliner.h"
+#include "analysis/nodecount.h"
+#include "analysis/treeshake.h"
+#include "analysis/typeinfer.h"
+#include "parser/modulecache.h"
+#include "parser/moduleloader.h"
+#include "parser/serialize.h"
+#include "runtime/host.h"
+#include "util/profiler.h"
+#include "util/stats.h"
+#include "util/threadpool.h"
+
+namespace fs = std::filesystem;
+
+BatchDriver::BatchDriver(const BatchOptions& options) : m_options(options) {
+	if (!options.cacheDir.empty()) m_cache.reset(new ModuleCache(options.cacheDir));
+	if (options.stats != BatchOptions::NoStats) m_stats.reset(new Stats());
+}
+
+BatchDriver::~BatchDriver() = default;
+
+bool BatchDriver::add(const std::string& path) {
+	std::error_code ec;
+	if (fs::is_directory(path, ec)) {
+		std::vector<std::string> found;
+		for (auto&& entry : fs::recursive_directory_iterator(path, ec)) {
+			if (entry.is_regular_file(ec) && entry.path().extension() == ".rs") {
+				found.push_back(entry.path().string());
+			}
+		}
+		std::sort(found.begin(), found.end());
+		m_paths.insert(m_paths.end(), found.begin(), found.end());
+		return true;
+	}
+	if (!fs::exists(path, ec)) return false;
+
+	m_paths.push_back(path);
+	return true;
+}
+
+void BatchDriver::check(FileResult& result) {
+	DiagnosticCapture capture;
+	ProfileScope scope(result.path);
+	Stats* stats = m_stats.get();
+
+	std::ostringstream text;
+	bool read;
+	{
+		Stats::Phase timer(stats, "read");
+		std::ifstream file(result.path, std::ios::binary);
+		read = bool(file);
+		if (read) text << file.rdbuf();
+	}
+
+	if (!read) {
+		reportError() << "ERROR: Cannot read file." << std::endl;
+	} else {
+		std::unique_ptr<Program> program;
+		if (m_cache) {
+			ProfileScope phase("load");
+			Stats::Phase timer(stats, "load");
+			program = m_cache->load(text.str(), &result.cached);
+		} else {
+			LangLexer lex(text.str());
+			{
+				ProfileScope phase("lex");
+				Stats::Phase timer(stats, "lex");
+				lex.tokenize();
+			}
+
+			std::unique_ptr<LangParser> par;
+			{
+				ProfileScope phase("parse");
+				Stats::Phase timer(stats, "parse");
+
+				// Bodies are parsed eagerly so errors inside functions are
+				// reported even when nothing calls them.
+				par.reset(new LangParser(lex.tokens()));
+				par->setLazyBodies(false);
+				par->parse();
+			}
+			program = par->takeProgram();
+
+			if (m_options.dumpTokens) {
+				ProfileScope phase("dump");
+				Stats::Phase timer(stats, "dump");
+				OutputBuffer buffer;
+				dumpTokens(lex.tokens(), m_options.tokenFormat, buffer);
+				result.dump += buffer.data();
+			}
+
+			if (stats) {
+				const std::vector<Token>& tokens = lex.tokens();
+				uint64_t bytes = tokens.capacity() * sizeof(Token);
+				for (auto&& tok : tokens) {
+					if (tok.lexeme.capacity() > 15) bytes += tok.lexeme.capacity() + 1;
+				}
+				stats->count("lex", tokens.size(), "tokens");
+				stats->add("memory", "token bytes", bytes);
+			}
+		}
+		result.statements = program->stmts.size();
+
+		if (m_options.dumpAst) {
+			ProfileScope phase("dump");
+			Stats::Phase timer(stats, "dump");
+			OutputBuffer buffer;
+			dumpProgram(program.get(), m_options.astFormat, buffer);
+			result.dump += buffer.data();
+		}
+
+		if (stats) {
+			NodeCounter counter;
+			counter.run(program.get());
+			stats->count(m_cache ? "load" : "parse", counter.total(), "nodes");
+			for (auto&& kind : counter.counts()) {
+				stats->add("nodes", kind.first, kind.second);
+			}
+		}
+
+		// compileProgram() inlines and folds by itself, so with --analyze
+		// it gets a copy of the tree as parsed.
+		std::unique_ptr<Program> unanalyzed;
+		if (m_options.compile && m_options.analyze) {
+			std::string ast;
+			writeProgram(program.get(), ast);
+			unanalyzed = readProgram(ast.data(), ast.size());
+		}
+
+		if (m_options.analyze) {
+			{
+				ProfileScope phase("inline");
+				Stats::Phase timer(stats, "inline");
+				Inliner inliner;
+				inliner.run(program.get());
+			}
+
+			{
+				ProfileScope phase("fold");
+				Stats::Phase timer(stats, "fold");
+				ConstantFolder folder;
+				folder.run(program.get());
+			}
+
+			ProfileScope phase("infer");
+			Stats::Phase timer(stats, "infer");
+			TypeInference types;
+			types.run(program.get());
+
+			std::ostringstream report;
+			types.report(report);
+			result.report = report.str();
+		}
+
+		// Like compileScript(), nothing is compiled after a syntax error.
+		if (m_options.compile && capture.errors() == 0) {
+			ProfileScope phase("compile");
+			Stats::Phase timer(stats, "compile");
+			compileProgram(unanalyzed ? std::move(unanalyzed) : std::move(program));
+		}
+
+		Stats::Phase timer(stats, "teardown");
+		program.reset();
+	}
+
+	result.diagnostics = capture.text();
+	result.errors = capture.errors();
+}
+
+int BatchDriver::run(std::ostream& out) {
+	auto start = std::chrono::steady_clock::now();
+	if (!m_options.profile.empty()) Profiler::start();
+
+	std::vector<FileResult> results(m_paths.size());
+	{
+		ThreadPool pool(m_options.jobs);
+		for (size_t i = 0; i < m_paths.size(); i++) {
+			results[i].path = m_paths[i];
+			pool.submit([this, &results, i] { check(results[i]); });
+		}
+		pool.wait();
+	}
+
+	// Dumps bypass `out` and go to standard output in large writes.
+	out.flush();
+	OutputBuffer dump(STDOUT_FILENO);
+
+	int statements = 0, errors = 0, failed = 0, cached = 0;
+	for (auto&& result : results) {
+		statements += result.statements;
+		if (result.cached) cached++;
+		errors += result.errors;
+		if (result.errors > 0) failed++;
+
+		if (!result.diagnostics.empty() || !result.report.empty()) {
+			dump.flush();
+			out << result.path << ":\n" << result.diagnostics << result.report << std::flush;
+		}
+		dump.append(result.dump);
+	}
+	dump.flush();
+
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	out << results.size() << " files, " << statements << " statements, " <<
+		errors << " errors in " << failed << " files";
+	if (m_cache) out << ", " << cached << " cached";
+	out << " (" << ms << " ms)" << std::endl;
+
+	if (!m_options.profile.empty()) {
+		Profiler::stop();
+		std::ofstream collapsed(m_options.profile);
+		Profiler::writeCollapsed(collapsed);
+		Profiler::writeTop(out);
+	}
+
+	if (m_options.stats == BatchOptions::TextStats) m_stats->print(out);
+	else if (m_options.stats == BatchOptions::JsonStats) m_stats->writeJson(out);
+	return failed;
+}
+
+int BatchDriver::link(std::ostream& out) {
+	// One snapshot per entry would overwrite each other.
+	if (!m_options.saveSnapshot.empty() && m_paths.size() > 1) {
+		out << "ERROR: --save-snapshot takes a single entry script." << std::endl;
+		return 1;
+	}
+
+	ThreadPool pool(m_options.jobs);
+
+	int errors = 0;
+	for (auto&& path : m_paths) {
+		// Bodies are parsed eagerly, as when checking single files, so
+		// their errors are reported and keep a snapshot from being saved.
+		ModuleLoader loader(pool, m_options.searchPaths);
+		loader.setLazyBodies(false);
+		if (!m_options.snapshot.empty() && !loader.restoreSnapshot(m_options.snapshot)) {
+			out << "ERROR: Cannot restore snapshot \"" << m_options.snapshot << "\"." << std::endl;
+			return errors + 1;
+		}
+		Module* entry = loader.load(path);
+
+		for (Module* module : loader.order()) {
+			out << module->name << " (" << module->path << "): " << module->exports.size() << " exports";
+			if (module->restored) out << " [snapshot]";
+			out << std::endl << module->diagnostics;
+		}
+		errors += loader.errors();
+
+		if (m_options.treeShake && loader.errors() == 0) {
+			TreeShaker shaker;
+			shaker.run(loader, entry);
+			out << "tree shaking removed " << shaker.removedFunctions() << " functions and " << shaker.removedVariables() << " variables" << std::endl;
+		}
+
+		if (!m_options.saveSnapshot.empty() && loader.errors() == 0) {
+			// Globals are stored already folded, restored modules were
+			// folded when their snapshot was made.
+			for (Module* module : loader.order()) {
+				if (module->restored) continue;
+				ConstantFolder folder;
+				folder.run(module->program.get());
+			}
+			if (!loader.saveSnapshot(m_options.saveSnapshot)) {
+				out << "ERROR: Cannot write snapshot \"" << m_options.saveSnapshot << "\"." << std::endl;
+				errors++;
+			}
+		}
+	}
+	return errors;
+}
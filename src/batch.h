@@ -0,0 +1,83 @@
+#ifndef LANG_BATCH_H
+#define LANG_BATCH_H
+
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "util/outbuffer.h"
+
+class ModuleCache;
+class Stats;
+
+struct BatchOptions {
+	int jobs = 0;          // worker threads, 0 for one per hardware thread
+	bool analyze = false;  // also run inlining, constant folding and type inference, and print its report
+	bool compile = false;  // also compile to bytecode with compileProgram(), unless the file has errors
+	std::string cacheDir;  // reuse parsed scripts from this ModuleCache directory
+	std::string profile;   // sample while running, write collapsed stacks here
+
+	// Per-phase timing, allocation and node statistics after the summary.
+	enum StatsFormat { NoStats, TextStats, JsonStats } stats = NoStats;
+
+	// Treat every file as a program entry point and load its imports.
+	bool link = false;
+	std::vector<std::string> searchPaths;
+
+	// Start from the modules in this snapshot / save the loaded, folded
+	// modules to a snapshot (see ModuleLoader).
+	std::string snapshot;
+	std::string saveSnapshot;
+
+	// Drop what each entry cannot reach from its loaded modules, before a
+	// snapshot is saved (see TreeShaker). The snapshot then only serves
+	// that entry.
+	bool treeShake = false;
+
+	// Write each file's tokens and/or AST to standard output, in path order.
+	// Scripts loaded from the cache have no tokens to dump.
+	bool dumpTokens = false, dumpAst = false;
+	DumpFormat tokenFormat = DumpFormat::Text, astFormat = DumpFormat::Text;
+};
+
+// Checks many scripts at once: every file is lexed, parsed and optionally
+// analyzed and compiled as its own task on a work-stealing pool. Diagnostics are
+// buffered per file and printed in path order, so the output does not
+// depend on scheduling.
+class BatchDriver {
+public:
+	BatchDriver(const BatchOptions& options);
+	~BatchDriver();
+
+	// A directory adds every *.rs file below it. Returns false if the path
+	// does not exist.
+	bool add(const std::string& path);
+
+	// Returns the number of files that reported errors.
+	int run(std::ostream& out);
+
+	// For BatchOptions::link: loads each entry's module graph and prints
+	// the modules in dependency order. Returns the number of errors.
+	int link(std::ostream& out);
+
+private:
+	struct FileResult {
+		std::string path;
+		std::string diagnostics;
+		std::string report;
+		int errors = 0;
+		int statements = 0;
+		bool cached = false;
+		std::string dump;
+	};
+
+	BatchOptions m_options;
+	std::vector<std::string> m_paths;
+	std::unique_ptr<ModuleCache> m_cache;
+	std::unique_ptr<Stats> m_stats;
+
+	void check(FileResult& result);
+};
+
+#endif // LANG_BATCH_H
\ No newline at end of file
@@ -1,22 +1,26 @@
 #include "lexer.h"
+#include "../util/diagnostics.h"
 
 #include <iostream>
 #include <cctype>
-#include <regex>
+#include <cstring>
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+
+#include <unistd.h>
 
 Scanner::Scanner(const std::string& input)
 	: m_input(input), m_pos(0)
-{
-	std::cout << "INPUT:\n" << input << std::endl;
-}
+{}
 
 char Scanner::next() {
-	if (m_pos >= m_input.size()) return '\0';
+	if (size_t(m_pos) >= m_input.size()) return '\0';
 	return m_input[m_pos++];
 }
 
 char Scanner::peek() const {
-	if (m_pos+1 >= m_input.size()) return '\0';
+	if (size_t(m_pos + 1) >= m_input.size()) return '\0';
 	return m_input[m_pos + 1];
 }
 
@@ -26,86 +30,228 @@ char Scanner::prev() const {
 }
 
 void Scanner::advance(int n) {
-	if (m_pos+n >= m_input.size()) return;
 	m_pos += n;
+	if (size_t(m_pos) > m_input.size()) m_pos = int(m_input.size());
 }
 
 LangLexer::LangLexer(const std::string& input)
 	: m_scanner(Scanner(input))
 {}
 
+static bool isSymbol(char c) {
+	return c != '\0' && std::strchr("-!$%^&*()_+|~=`{}[]:<>?,./\\", c) != nullptr;
+}
+
+static bool isDigit(char c) { return c >= '0' && c <= '9'; }
+static bool isHexDigit(char c) { return isDigit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'); }
+static bool isIdentChar(char c) { return std::isalnum((unsigned char) c) || c == '_'; }
+
+// Scans a NUMBER or INTEGER literal starting at `begin`:
+//   0[xX] hex+
+//   digit* ('.' digit+)? ([eE] [+-]? digit+)? 'f'?
+// Returns the end of the literal, or nullptr when it is malformed (in which
+// case `end` is moved past the offending characters).
+static const char* scanNumber(const char* begin, const char* end, Token& tok) {
+	const char* p = begin;
+
+	if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X') && isHexDigit(p[2])) {
+		const char* digits = p + 2;
+		p = digits;
+		while (p < end && isHexDigit(*p)) p++;
+		if (p < end && isIdentChar(*p)) return nullptr;
+
+		auto res = std::from_chars(digits, p, tok.integerValue, 16);
+		if (res.ec == std::errc()) {
+			tok.type = TokenType::INTEGER;
+		} else {
+			// Too big for 64 bits: promote to a double.
+			double value = 0.0;
+			for (const char* d = digits; d < p; d++) {
+				value = value * 16.0 + (isDigit(*d) ? *d - '0' : (*d | 0x20) - 'a' + 10);
+			}
+			tok.type = TokenType::NUMBER;
+			tok.numberValue = value;
+		}
+		return p;
+	}
+
+	bool integer = true;
+	while (p < end && isDigit(*p)) p++;
+	if (p + 1 < end && p[0] == '.' && isDigit(p[1])) {
+		integer = false;
+		p++;
+		while (p < end && isDigit(*p)) p++;
+	}
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		const char* e = p + 1;
+		if (e < end && (*e == '+' || *e == '-')) e++;
+		if (e < end && isDigit(*e)) {
+			integer = false;
+			p = e;
+			while (p < end && isDigit(*p)) p++;
+		}
+	}
+
+	const char* literalEnd = p;
+	if (p < end && *p == 'f') {
+		integer = false;
+		p++;
+	}
+	if (p < end && isIdentChar(*p)) return nullptr;
+
+	if (integer) {
+		auto res = std::from_chars(begin, literalEnd, tok.integerValue);
+		if (res.ec == std::errc()) {
+			tok.type = TokenType::INTEGER;
+			return p;
+		}
+	}
+
+	auto res = std::from_chars(begin, literalEnd, tok.numberValue);
+	if (res.ec == std::errc::result_out_of_range) {
+		// from_chars leaves the value alone then. This is rare enough to let
+		// strtod pick infinity, a subnormal or zero.
+		tok.numberValue = std::strtod(std::string(begin, literalEnd).c_str(), nullptr);
+	} else if (res.ec != std::errc()) {
+		return nullptr;
+	}
+	tok.type = TokenType::NUMBER;
+	return p;
+}
+
+static void appendUtf8(std::string& out, unsigned cp) {
+	if (cp < 0x80) {
+		out += char(cp);
+	} else if (cp < 0x800) {
+		out += char(0xC0 | (cp >> 6));
+		out += char(0x80 | (cp & 0x3F));
+	} else {
+		out += char(0xE0 | (cp >> 12));
+		out += char(0x80 | ((cp >> 6) & 0x3F));
+		out += char(0x80 | (cp & 0x3F));
+	}
+}
+
+// Decodes the body of a string or char literal, `begin` pointing just past
+// the opening quote. Bodies without escapes are copied as one span.
+// Returns the position of the closing quote, or nullptr if there is none.
+static const char* scanString(const char* begin, const char* end, char quote, std::string& out, int& lines) {
+	const char* p = begin;
+	while (p < end && *p != quote && *p != '\\') {
+		if (*p == '\n') lines++;
+		p++;
+	}
+	out.assign(begin, p);
+	if (p < end && *p == quote) return p;
+
+	while (p < end && *p != quote) {
+		if (*p != '\\') {
+			const char* run = p;
+			while (p < end && *p != quote && *p != '\\') {
+				if (*p == '\n') lines++;
+				p++;
+			}
+			out.append(run, p);
+			continue;
+		}
+
+		if (++p >= end) break;
+		switch (*p) {
+			case 'b': out += '\b'; break;
+			case 'n': out += '\n'; break;
+			case 't': out += '\t'; break;
+			case 'f': out += '\f'; break;
+			case 'r': out += '\r'; break;
+			case '"': out += '"'; break;
+			case '\'': out += '\''; break;
+			case '\\': out += '\\'; break;
+			case 'u': {
+				unsigned cp = 0;
+				if (end - p > 4 &&
+					std::from_chars(p + 1, p + 5, cp, 16).ptr == p + 5)
+				{
+					appendUtf8(out, cp);
+					p += 4;
+				}
+			} break;
+			default: break;
+		}
+		p++;
+	}
+	return p < end ? p : nullptr;
+}
+
 void LangLexer::tokenize() {
 	m_tokens.clear();
 
-	const std::regex symbolRE("[-!$%^&*()_+|~=`{}\\[\\]:<>?,.\\/\\\\]");
-
 #define C m_scanner.current()
 #define P m_scanner.prev()
 #define N m_scanner.next()
 #define S std::string(1, C)
+#define HERE (m_scanner.data() + m_scanner.position())
 
 	int line = 0;
 	int pos = 0;
 
 	while (m_scanner.hasNext()) {
 		if (std::isalpha(C) || C == '_') {
-			std::string res = "";
-			while ((std::isalnum(C) || C == '_') && m_scanner.hasNext()) {
-				res += C;
-				m_scanner.next();
-			}
+			const char* begin = HERE;
+			const char* p = begin;
+			while (p < m_scanner.end() && isIdentChar(*p)) p++;
+
 			Token tok{};
-			tok.lexeme = res;
-			tok.type = res == "has" || res == "is" ? TokenType::OTHER : TokenType::ID;
-			tok.line = line; tok.pos = (pos += res.size());
+			tok.lexeme.assign(begin, p);
+			tok.type = tok.lexeme == "has" || tok.lexeme == "is" ? TokenType::OTHER : TokenType::ID;
+			tok.line = line; tok.pos = (pos += p - begin);
+			tok.offset = begin - m_scanner.data(); tok.length = p - begin;
 			m_tokens.push_back(tok);
-		} else if (std::isdigit(C) || C == '.') {
-			const std::regex re("[0-9a-fA-F.eExX+-]");
-			std::string res = "";
-			while (std::regex_match(S, re) && m_scanner.hasNext()) {
-				res += C;
-				m_scanner.next();
-			}
+			m_scanner.advance(p - begin);
+		} else if (std::isdigit(C) || (C == '.' && std::isdigit(m_scanner.peek()))) {
+			const char* begin = HERE;
 			Token tok{};
-			tok.lexeme = res;
-			tok.type = TokenType::NUMBER;
-			tok.numberValue = std::stod(res);
-			tok.line = line; tok.pos = (pos += res.size());
+			const char* p = scanNumber(begin, m_scanner.end(), tok);
+			if (p == nullptr) {
+				p = begin;
+				while (p < m_scanner.end() && (isIdentChar(*p) || *p == '.')) p++;
+				reportError() << "ERROR(" << line << ":" << pos << "): Malformed number \"" << std::string(begin, p) << "\"." << std::endl;
+				tok.type = TokenType::NUMBER;
+				tok.numberValue = 0.0;
+			}
+			tok.lexeme.assign(begin, p);
+			tok.line = line; tok.pos = (pos += p - begin);
+			tok.offset = begin - m_scanner.data(); tok.length = p - begin;
 			m_tokens.push_back(tok);
+			m_scanner.advance(p - begin);
 		} else if (C == '"' || C == '\'') {
-			bool isChar = C == '\'';
-			std::string res = "";
-			m_scanner.next();
-			while (C != '"' && C != '\'' && m_scanner.hasNext()) {
-				if (C == '\\') {
-					m_scanner.next();
-					switch (C) {
-						case 'b': res += '\b'; break;
-						case 'n': res += '\n'; break;
-						case 't': res += '\t'; break;
-						case 'f': res += '\f'; break;
-						case 'r': res += '\r'; break;
-						case '"': res += '"'; break;
-						case '\'': res += '\''; break;
-						default: break;
-					}
-					m_scanner.next();
-				} else {
-					res += C;
-					m_scanner.next();
-				}
-			}
+			char quote = C;
+			bool isChar = quote == '\'';
+			const char* begin = HERE + 1;
+
 			Token tok{};
+			int lines = 0;
+			std::string res;
+			const char* p = scanString(begin, m_scanner.end(), quote, res, lines);
+			if (p == nullptr) {
+				reportError() << "ERROR(" << line << ":" << pos << "): Unterminated " << (isChar ? "character" : "string") << "." << std::endl;
+				p = m_scanner.end();
+			}
+
 			tok.lexeme = res;
 			tok.type = isChar ? TokenType::CHAR : TokenType::STRING;
 			if (isChar) {
-				tok.charValue = res[0];
+				tok.charValue = res.empty() ? '\0' : res[0];
 			} else {
-				tok.stringValue = res;
+				tok.stringValue = std::move(res);
 			}
-			tok.line = line; tok.pos = (pos += res.size() + 2);
+			// Columns start over past the last newline inside the literal.
+			const char* newline = p;
+			while (newline > begin && newline[-1] != '\n') newline--;
+			pos = newline > begin ? int(p - newline) + 1 : pos + int(p - begin) + 2;
+			tok.line = line; tok.pos = pos;
+			tok.offset = m_scanner.position(); tok.length = (p - begin) + 2;
 			m_tokens.push_back(tok);
-			m_scanner.next();
+			m_scanner.advance((p - begin) + 2);
+			line += lines;
 		} else if (std::isspace(C)) {
 			if (C == '\n') {
 				line++;
@@ -117,6 +263,7 @@ void LangLexer::tokenize() {
 			tok.lexeme = ";";
 			tok.type = TokenType::SEMI;
 			tok.line = line; tok.pos = pos;
+			tok.offset = m_scanner.position(); tok.length = 1;
 			m_tokens.push_back(tok);
 			m_scanner.next();
 			pos++;
@@ -125,35 +272,154 @@ void LangLexer::tokenize() {
 			tok.lexeme = S;
 			tok.type = TokenType::OTHER;
 			tok.line = line; tok.pos = pos;
+			tok.offset = m_scanner.position(); tok.length = 1;
 			m_tokens.push_back(tok);
 			m_scanner.next();
 			pos++;
-		} else if (std::regex_match(S, symbolRE)) {
-			std::string res = "";
-			while (std::regex_match(S, symbolRE) && m_scanner.hasNext()) {
-				res += C;
-				m_scanner.next();
+		} else if (C == '/' && (m_scanner.peek() == '/' || m_scanner.peek() == '*')) {
+			// Comments leave no tokens: `//` runs to the end of the line,
+			// `/*` to the next `*/`.
+			bool block = m_scanner.peek() == '*';
+			const char* begin = HERE;
+			const char* p = begin + 2;
+			int startLine = line, startPos = pos;
+			pos += 2;
+			if (!block) {
+				while (p < m_scanner.end() && *p != '\n') p++;
+				pos += p - (begin + 2);
+			} else {
+				while (p < m_scanner.end() && !(*p == '*' && p + 1 < m_scanner.end() && p[1] == '/')) {
+					if (*p == '\n') {
+						line++;
+						pos = 0;
+					} else pos++;
+					p++;
+				}
+				if (p < m_scanner.end()) {
+					p += 2;
+					pos += 2;
+				} else {
+					reportError() << "ERROR(" << startLine << ":" << startPos << "): Unterminated comment." << std::endl;
+				}
 			}
+			m_scanner.advance(p - begin);
+		} else if (isSymbol(C)) {
+			const char* begin = HERE;
+			const char* p = begin;
+			while (p < m_scanner.end() && isSymbol(*p) && std::strchr("()[]{}", *p) == nullptr) p++;
+
 			Token tok{};
-			tok.lexeme = res;
+			tok.lexeme.assign(begin, p);
 			tok.type = TokenType::OTHER;
-			tok.line = line; tok.pos = (pos += res.size());
+			tok.line = line; tok.pos = (pos += p - begin);
+			tok.offset = begin - m_scanner.data(); tok.length = p - begin;
 			m_tokens.push_back(tok);
+			m_scanner.advance(p - begin);
 		} else {
 			m_scanner.next();
 			pos++;
 		}
 	}
 
+#undef HERE
+
 	Token tok{};
 	tok.type = TokenType::END;
 	tok.line = line+1; tok.pos = 0;
+	tok.offset = m_scanner.end() - m_scanner.data(); tok.length = 0;
 	m_tokens.push_back(tok);
 }
 
 void LangLexer::printTokens() {
-	for (auto&& tok : m_tokens) {
-		std::cout << tok.toString() << " ";
+	std::cout.flush();
+	OutputBuffer out(STDOUT_FILENO);
+	dumpTokens(m_tokens, DumpFormat::Text, out);
+}
+
+static const char* tokenTypeName(TokenType type) {
+	switch (type) {
+		case END: return "END";
+		case OTHER: return "OTHER";
+		case ID: return "ID";
+		case STRING: return "STRING";
+		case CHAR: return "CHAR";
+		case NUMBER: return "NUMBER";
+		case INTEGER: return "INTEGER";
+		case SEMI: return "SEMI";
+	}
+	return "?";
+}
+
+// Same text as Token::toString(), without the stringstream.
+static void textToken(const Token& tok, OutputBuffer& out) {
+	switch (tok.type) {
+		case END: out.literal("END"); break;
+		case ID: out.literal("ID("); out.append(tok.lexeme); out.put(')'); break;
+		case NUMBER: out.literal("NUM("); out.number(tok.numberValue, 6); out.put(')'); break;
+		case INTEGER: out.literal("INT("); out.integer(tok.integerValue); out.put(')'); break;
+		case CHAR: out.literal("CHR('"); out.put(tok.charValue); out.literal("')"); break;
+		case STRING: out.literal("STR(\""); out.append(tok.stringValue); out.literal("\")"); break;
+		case SEMI: out.put(';'); break;
+		case OTHER: out.append(tok.lexeme); break;
+	}
+}
+
+static void jsonToken(const Token& tok, OutputBuffer& out) {
+	out.literal("{\"type\":\"");
+	out.append(tokenTypeName(tok.type));
+	out.literal("\",\"line\":");
+	out.integer(tok.line);
+	out.literal(",\"pos\":");
+	out.integer(tok.pos);
+	out.literal(",\"offset\":");
+	out.integer(tok.offset);
+	out.literal(",\"length\":");
+	out.integer(tok.length);
+	switch (tok.type) {
+		case NUMBER:
+			// JSON has no infinities or NaN.
+			out.literal(",\"value\":");
+			if (std::isfinite(tok.numberValue)) out.number(tok.numberValue);
+			else out.literal("null");
+			break;
+		case INTEGER: out.literal(",\"value\":"); out.integer(tok.integerValue); break;
+		case CHAR: out.literal(",\"value\":"); out.quoted(std::string(1, tok.charValue)); break;
+		case STRING: out.literal(",\"value\":"); out.quoted(tok.stringValue); break;
+		case END: break;
+		default: out.literal(",\"text\":"); out.quoted(tok.lexeme); break;
+	}
+	out.literal("}\n");
+}
+
+static void binaryToken(const Token& tok, OutputBuffer& out) {
+	uint32_t fields[] = { uint32_t(tok.line), uint32_t(tok.pos), uint32_t(tok.offset), uint32_t(tok.length) };
+	out.put(char(tok.type));
+	out.append((const char*) fields, sizeof(fields));
+	switch (tok.type) {
+		case NUMBER: out.append((const char*) &tok.numberValue, 8); break;
+		case INTEGER: out.append((const char*) &tok.integerValue, 8); break;
+		case CHAR: out.put(tok.charValue); break;
+		default: {
+			const std::string& value = tok.type == STRING ? tok.stringValue : tok.lexeme;
+			uint32_t size = value.size();
+			out.append((const char*) &size, 4);
+			out.append(value);
+			break;
+		}
+	}
+}
+
+void dumpTokens(const std::vector<Token>& tokens, DumpFormat format, OutputBuffer& out) {
+	if (format == DumpFormat::Binary) {
+		uint32_t count = tokens.size();
+		out.append((const char*) &count, 4);
+	}
+	for (auto&& tok : tokens) {
+		switch (format) {
+			case DumpFormat::Text: textToken(tok, out); out.put(' '); break;
+			case DumpFormat::Json: jsonToken(tok, out); break;
+			case DumpFormat::Binary: binaryToken(tok, out); break;
+		}
 	}
-	std::cout << std::endl;
+	if (format == DumpFormat::Text) out.put('\n');
 }
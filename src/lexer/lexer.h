@@ -2,6 +2,7 @@
 #define LANG_LEXER_H
 
 #include "tokens.h"
+#include "../util/outbuffer.h"
 
 #include <vector>
 
@@ -16,13 +17,17 @@ public:
 	char current() const { return m_input[m_pos]; }
 	char peek() const;
 	char prev() const;
-	bool hasNext() const { return m_pos < m_input.size(); }
+	bool hasNext() const { return size_t(m_pos) < m_input.size(); }
+
+	void advance(int n = 1);
+
+	int position() const { return m_pos; }
+	const char* data() const { return m_input.data(); }
+	const char* end() const { return m_input.data() + m_input.size(); }
 
 private:
 	std::string m_input;
 	int m_pos;
-
-	void advance(int n = 1);
 };
 
 class LangLexer {
@@ -33,7 +38,7 @@ public:
 	LangLexer(const std::string& input);
 	void tokenize();
 
-	std::vector<Token> tokens() const { return m_tokens; }
+	const std::vector<Token>& tokens() const { return m_tokens; }
 
 	void printTokens();
 
@@ -42,4 +47,10 @@ private:
 	Scanner m_scanner;
 };
 
+// Writes `tokens` in `format`. Text is what printTokens() shows; binary is
+// a u32 count, then per token its type (u8), line, pos, offset and length
+// (u32) and its value: 8 bytes for numbers and integers, one byte for
+// characters and a length-prefixed string for everything else.
+void dumpTokens(const std::vector<Token>& tokens, DumpFormat format, OutputBuffer& out);
+
 #endif // LANG_LEXER_H
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <sstream>
+#include <cstdint>
 
 enum TokenType {
 	END = 0,
@@ -11,6 +12,7 @@ enum TokenType {
 	STRING,
 	CHAR,
 	NUMBER,
+	INTEGER,
 	SEMI
 };
 
@@ -19,7 +21,11 @@ struct Token {
 	std::string lexeme;
 	int line, pos;
 
+	// Byte range of the token in the source text.
+	int offset, length;
+
 	double numberValue;
+	int64_t integerValue;
 	std::string stringValue;
 	char charValue;
 
@@ -29,6 +35,7 @@ struct Token {
 			case END: ret << "END"; break;
 			case ID: ret << "ID(" << lexeme << ")"; break;
 			case NUMBER: ret << "NUM(" << numberValue << ")"; break;
+			case INTEGER: ret << "INT(" << integerValue << ")"; break;
 			case CHAR: ret << "CHR('" << charValue << "')"; break;
 			case STRING: ret << "STR(\"" << stringValue << "\")"; break;
 			case SEMI: ret << ";"; break;
@@ -1,19 +1,182 @@
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
 
+#include <unistd.h>
+
 #include "lexer/lexer.h"
 #include "parser/parser.h"
+#include "parser/dump.h"
+#include "analysis/constfold.h"
+#include "analysis/typeinfer.h"
+#include "batch.h"
+#include "server.h"
+#include "runtime/host.h"
+#include "util/profiler.h"
+
+static int usage() {
+	std::cerr << "usage: lang --run [--disasm] [--histogram] [--no-fuse] [--profile out] [--max-steps n] [--max-time ms] [--max-heap bytes] <file>" << std::endl;
+	std::cerr << "       lang [-j jobs] [--analyze] [--compile] [--cache dir] [--profile out] [--stats[=json]] [--link [-I dir]... [--snapshot file] [--save-snapshot file] [--tree-shake]] [--dump text|json|binary] [--dump-tokens text|json|binary] <file|directory>..." << std::endl;
+	std::cerr << "       lang --server [-j jobs] <socket>" << std::endl;
+	std::cerr << "       lang --client <socket> tokens|parse|check|compile|shutdown [<file>...]" << std::endl;
+	return 2;
+}
+
+// lang <files or directories> checks every script on all cores.
+static int batch(int argc, char** argv) {
+	BatchOptions options;
+	std::vector<std::string> paths;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "-j" && i + 1 < argc) options.jobs = std::atoi(argv[++i]);
+		else if (arg == "--analyze") options.analyze = true;
+		else if (arg == "--compile") options.compile = true;
+		else if (arg == "--cache" && i + 1 < argc) options.cacheDir = argv[++i];
+		else if (arg == "--profile" && i + 1 < argc) options.profile = argv[++i];
+		else if (arg == "--stats") options.stats = BatchOptions::TextStats;
+		else if (arg == "--stats=json") options.stats = BatchOptions::JsonStats;
+		else if (arg == "--link") options.link = true;
+		else if (arg == "-I" && i + 1 < argc) options.searchPaths.push_back(argv[++i]);
+		else if (arg == "--snapshot" && i + 1 < argc) options.snapshot = argv[++i];
+		else if (arg == "--save-snapshot" && i + 1 < argc) options.saveSnapshot = argv[++i];
+		else if (arg == "--tree-shake") options.treeShake = true;
+		else if (arg == "--dump" && i + 1 < argc) {
+			if (!dumpFormatFromName(argv[++i], options.astFormat)) return usage();
+			options.dumpAst = true;
+		} else if (arg == "--dump-tokens" && i + 1 < argc) {
+			if (!dumpFormatFromName(argv[++i], options.tokenFormat)) return usage();
+			options.dumpTokens = true;
+		}
+		else if (!arg.empty() && arg[0] == '-') return usage();
+		else paths.push_back(arg);
+	}
+	if (paths.empty()) return usage();
+
+	BatchDriver driver(options);
+	for (auto&& path : paths) {
+		if (!driver.add(path)) {
+			std::cerr << "ERROR: No such file or directory \"" << path << "\"." << std::endl;
+			return 2;
+		}
+	}
+	if (options.link) return driver.link(std::cout) > 0 ? 1 : 0;
+	return driver.run(std::cout) > 0 ? 1 : 0;
+}
+
+// lang --run <file> compiles a script and runs it. --histogram then prints
+// the instructions and instruction pairs it executed most; with --no-fuse
+// they are the ones the compiler emits, before superinstructions.
+// --profile samples the script's functions and lines as batch mode samples
+// its phases, writes collapsed stacks to the file and prints the hottest.
+// The --max options set the script's Budget.
+static int run(int argc, char** argv) {
+	bool disasm = false, histogram = false, fuse = true;
+	Budget budget;
+	std::string path, profile;
+	for (int i = 2; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--disasm") disasm = true;
+		else if (arg == "--histogram") histogram = true;
+		else if (arg == "--no-fuse") fuse = false;
+		else if (arg == "--profile" && i + 1 < argc) profile = argv[++i];
+		else if (arg == "--max-steps" && i + 1 < argc) budget.steps = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--max-time" && i + 1 < argc) budget.time = std::chrono::milliseconds(std::atoll(argv[++i]));
+		else if (arg == "--max-heap" && i + 1 < argc) budget.heapBytes = std::strtoull(argv[++i], nullptr, 10);
+		else if (path.empty() && !arg.empty() && arg[0] != '-') path = arg;
+		else return usage();
+	}
+	if (path.empty()) return usage();
+
+	Runtime runtime;
+	runtime.setSuperinstructions(fuse);
+	runtime.vm().setBudget(budget);
+	std::unique_ptr<OpcodeHistogram> counts;
+	if (histogram) {
+		counts.reset(new OpcodeHistogram());
+		runtime.vm().setHistogram(counts.get());
+	}
+	if (!profile.empty()) Profiler::start();
+	bool ok;
+	{
+		ProfileScope scope(path);
+		ok = runtime.loadFile(path);
+	}
+	if (disasm && runtime.script()) runtime.script()->disassemble(std::cout);
+	if (counts) counts->report(std::cout);
+	if (!profile.empty()) {
+		Profiler::stop();
+		std::ofstream collapsed(profile);
+		Profiler::writeCollapsed(collapsed);
+		Profiler::writeTop(std::cout);
+	}
+	return ok ? 0 : 1;
+}
+
+// lang --server <socket> keeps every file it is asked about loaded and
+// answers requests on a Unix domain socket until told to shut down.
+static int server(int argc, char** argv) {
+	ServerOptions options;
+	std::string socketPath;
+	for (int i = 2; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "-j" && i + 1 < argc) options.jobs = std::atoi(argv[++i]);
+		else if (socketPath.empty() && !arg.empty() && arg[0] != '-') socketPath = arg;
+		else return usage();
+	}
+	if (socketPath.empty()) return usage();
+
+	CompileServer server(options);
+	if (!server.serve(socketPath)) {
+		std::cerr << "ERROR: Cannot listen on \"" << socketPath << "\"." << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+// lang --client <socket> <op> <files> sends one request to a server and
+// prints the replies like batch mode.
+static int client(int argc, char** argv) {
+	if (argc < 4) return usage();
+	std::string socketPath = argv[2], name = argv[3];
+
+	ServerOp op;
+	if (name == "tokens") op = ServerOp::Tokens;
+	else if (name == "parse") op = ServerOp::Parse;
+	else if (name == "check") op = ServerOp::Check;
+	else if (name == "compile") op = ServerOp::Compile;
+	else if (name == "shutdown") op = ServerOp::Shutdown;
+	else return usage();
+
+	std::vector<std::string> paths(argv + 4, argv + argc);
+	if (paths.empty() != (op == ServerOp::Shutdown)) return usage();
+
+	int failed = queryServer(socketPath, op, paths, std::cout);
+	if (failed < 0) {
+		std::cerr << "ERROR: No server on \"" << socketPath << "\"." << std::endl;
+		return 2;
+	}
+	return failed > 0 ? 1 : 0;
+}
 
 int main(int argc, char** argv) {
-	LangLexer lex(R"(
-let foo = "\tHello World! \"test\"";
+	if (argc > 1 && std::string(argv[1]) == "--run") return run(argc, argv);
+	if (argc > 1 && std::string(argv[1]) == "--server") return server(argc, argv);
+	if (argc > 1 && std::string(argv[1]) == "--client") return client(argc, argv);
+	if (argc > 1) return batch(argc, argv);
+
+	const std::string input = R"(
+let foo = "\tHello World! \"test\" \u00e9";
 
-func add(a, b) {
+func add(a: number, b: number) {
 	return a + b;
 }
 
 add(2.5f, 10);
 
-)");
+)";
+	std::cout << "INPUT:\n" << input << std::endl;
+
+	LangLexer lex(input);
 
 	lex.tokenize();
 	lex.printTokens();
@@ -21,6 +184,18 @@ add(2.5f, 10);
 	LangParser par(lex.tokens());
 	par.parse();
 
+	ConstantFolder folder;
+	folder.run(par.program());
+	{
+		std::cout.flush();
+		OutputBuffer out(STDOUT_FILENO);
+		dumpProgram(par.program(), DumpFormat::Text, out);
+	}
+
+	TypeInference types;
+	types.run(par.program());
+	types.report(std::cout);
+
 	getchar();
 	return 0;
 }
\ No newline at end of file
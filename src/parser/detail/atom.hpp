@@ -4,6 +4,8 @@
 #include "../parser.h"
 
 struct EOFAtom : public Node {
+	void visit(NodeVisitor& v) { v.visit(*this); }
+
 	void print(int pad = 0) {
 		std::cout << std::string(pad, ' ') << "EOF" << std::endl;
 	}
@@ -15,6 +17,8 @@ struct BoolAtom : public Node {
 	BoolAtom() = default;
 	BoolAtom(bool value) : value(value) {}
 
+	void visit(NodeVisitor& v) { v.visit(*this); }
+
 	void print(int pad = 0) {
 		std::cout << std::string(pad, ' ') << "BOOL(" << value << ")" << std::endl;
 	}
@@ -26,6 +30,8 @@ struct IdentifierAtom : public Node {
 	IdentifierAtom() = default;
 	IdentifierAtom(const std::string& name) : name(name) {}
 
+	void visit(NodeVisitor& v) { v.visit(*this); }
+
 	void print(int pad = 0) {
 		std::cout << std::string(pad, ' ') << "ID(" << name << ")" << std::endl;
 	}
@@ -37,17 +43,34 @@ struct NumberAtom : public Node {
 	NumberAtom() = default;
 	NumberAtom(double value) : value(value) {}
 
+	void visit(NodeVisitor& v) { v.visit(*this); }
+
 	void print(int pad = 0) {
 		std::cout << std::string(pad, ' ') << "NUM(" << value << ")" << std::endl;
 	}
 };
 
+struct IntegerAtom : public Node {
+	int64_t value;
+
+	IntegerAtom() = default;
+	IntegerAtom(int64_t value) : value(value) {}
+
+	void visit(NodeVisitor& v) { v.visit(*this); }
+
+	void print(int pad = 0) {
+		std::cout << std::string(pad, ' ') << "INT(" << value << ")" << std::endl;
+	}
+};
+
 struct StringAtom : public Node {
 	std::string value;
 
 	StringAtom() = default;
 	StringAtom(const std::string& value) : value(value) {}
 
+	void visit(NodeVisitor& v) { v.visit(*this); }
+
 	void print(int pad = 0) {
 		std::cout << std::string(pad, ' ') << "STR(" << value << ")" << std::endl;
 	}
@@ -59,6 +82,8 @@ struct CharAtom : public Node {
 	CharAtom() = default;
 	CharAtom(char value) : value(value) {}
 
+	void visit(NodeVisitor& v) { v.visit(*this); }
+
 	void print(int pad = 0) {
 		std::cout << std::string(pad, ' ') << "CHR(" << value << ")" << std::endl;
 	}
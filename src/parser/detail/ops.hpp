@@ -7,11 +7,18 @@ struct BinOp : public Node {
 	NodePtr left, right;
 	std::string op;
 
+	// Filled by the type inference pass. A concrete type here means both
+	// operands can be evaluated as that type (integers are widened to numbers
+	// when mixed); the compiler then emits the quickened form for it.
+	ValueType operandType = ValueType::Unknown;
+
 	BinOp() = default;
 	BinOp(Node* left, Node* right, const std::string& op)
 		: left(NodePtr(left)), right(NodePtr(right)), op(op)
 	{}
 
+	void visit(NodeVisitor& v) { v.visit(*this); }
+
 	void print(int pad = 0) {
 		std::cout << std::string(pad, ' ') << "BinOp(" << std::endl;
 		left->print(pad + 4);
@@ -25,10 +32,14 @@ struct UnOp : public Node {
 	NodePtr right;
 	std::string op;
 
+	ValueType operandType = ValueType::Unknown;
+
 	UnOp() = default;
 	UnOp(Node* right, const std::string& op)
 		: right(NodePtr(right)), op(op) {}
 
+	void visit(NodeVisitor& v) { v.visit(*this); }
+
 	void print(int pad = 0) {
 		std::cout << std::string(pad, ' ') << "UnOp(" << std::endl;
 		std::cout << std::string(pad + 4, ' ') << op << std::endl;
@@ -45,6 +56,8 @@ struct TernaryOp : public Node {
 		: cond(NodePtr(cond)), left(NodePtr(left)), right(NodePtr(right))
 	{}
 
+	void visit(NodeVisitor& v) { v.visit(*this); }
+
 	void print(int pad = 0) {
 		std::cout << std::string(pad, ' ') << "TernaryOp(" << std::endl;
 		cond->print(pad + 4);
@@ -82,6 +95,8 @@ struct CallOp : public Node {
 		}
 	}
 
+	void visit(NodeVisitor& v) { v.visit(*this); }
+
 	void print(int pad = 0) {
 		std::cout << std::string(pad, ' ') << "CallOp(" << std::endl;
 		func->print(pad + 4);
@@ -94,4 +109,23 @@ struct CallOp : public Node {
 	}
 };
 
+// obj[index]; also the target of `obj[index] = value;`.
+struct IndexOp : public Node {
+	NodePtr obj, index;
+
+	IndexOp() = default;
+	IndexOp(Node* obj, Node* index) : obj(NodePtr(obj)), index(NodePtr(index)) {}
+
+	void visit(NodeVisitor& v) { v.visit(*this); }
+
+	void print(int pad = 0) {
+		std::cout << std::string(pad, ' ') << "IndexOp(" << std::endl;
+		obj->print(pad + 4);
+		std::cout << std::string(pad + 4, ' ') << "[" << std::endl;
+		index->print(pad + 8);
+		std::cout << std::string(pad + 4, ' ') << "]" << std::endl;
+		std::cout << std::string(pad, ' ') << ")" << std::endl;
+	}
+};
+
 #endif // LANG_OPS_HPP
\ No newline at end of file
@@ -1,21 +1,30 @@
 #ifndef LANG_STMT_HPP
 #define LANG_STMT_HPP
 
+#include <atomic>
+#include <mutex>
+
 #include "../parser.h"
 
 struct SemicolonStmt : public Node {
+	void visit(NodeVisitor& v) { v.visit(*this); }
+
 	void print(int pad = 0) {
 		std::cout << std::string(pad, ' ') << ";" << std::endl;
 	}
 };
 
 struct BreakStmt : public Node {
+	void visit(NodeVisitor& v) { v.visit(*this); }
+
 	void print(int pad = 0) {
 		std::cout << std::string(pad, ' ') << "BREAK" << std::endl;
 	}
 };
 
 struct ContinueStmt : public Node {
+	void visit(NodeVisitor& v) { v.visit(*this); }
+
 	void print(int pad = 0) {
 		std::cout << std::string(pad, ' ') << "CONT" << std::endl;
 	}
@@ -29,6 +38,8 @@ struct AssignmentStmt : public Node {
 		: left(NodePtr(left)), right(NodePtr(right))
 	{}
 
+	void visit(NodeVisitor& v) { v.visit(*this); }
+
 	void print(int pad = 0) {
 		std::cout << std::string(pad, ' ') << "AssignmentStmt(" << std::endl;
 		left->print(pad + 4);
@@ -43,7 +54,9 @@ struct IncrementStmt : public Node {
 	NodePtr node;
 
 	IncrementStmt() = default;
-	IncrementStmt(Node* node, bool pre) : node(NodePtr(node)), pre(pre) {}
+	IncrementStmt(Node* node, bool pre) : pre(pre), node(NodePtr(node)) {}
+
+	void visit(NodeVisitor& v) { v.visit(*this); }
 
 	void print(int pad = 0) {
 		std::cout << std::string(pad, ' ') << "IncrementStmt(" << std::endl;
@@ -63,7 +76,9 @@ struct DecrementStmt : public Node {
 	NodePtr node;
 
 	DecrementStmt() = default;
-	DecrementStmt(Node* node, bool pre) : node(NodePtr(node)), pre(pre) {}
+	DecrementStmt(Node* node, bool pre) : pre(pre), node(NodePtr(node)) {}
+
+	void visit(NodeVisitor& v) { v.visit(*this); }
 
 	void print(int pad = 0) {
 		std::cout << std::string(pad, ' ') << "DecrementStmt(" << std::endl;
@@ -89,6 +104,8 @@ struct IfStmt : public Node {
 	
 	IfStmt() = default;
 
+	void visit(NodeVisitor& v) { v.visit(*this); }
+
 	void print(int pad = 0) {
 		std::cout << std::string(pad, ' ') << "IfStmt(" << std::endl;
 		if (cond) cond->print(pad + 4);
@@ -113,14 +130,22 @@ struct ParamStmt : public Node {
 	std::string name;
 	NodePtr value;
 
+	// Optional annotation, e.g. "let a: number". Empty when omitted.
+	std::string typeName;
+	ValueType type = ValueType::Unknown;
+
 	ParamStmt() = default;
 	ParamStmt(const std::string& name, Node* value)
 		: name(name), value(NodePtr(value))
 	{}
 
+	void visit(NodeVisitor& v) { v.visit(*this); }
+
 	void print(int pad = 0) {
 		std::cout << std::string(pad, ' ') << "ParamStmt(" << std::endl;
-		std::cout << std::string(pad + 4, ' ') << name << std::endl;
+		std::cout << std::string(pad + 4, ' ') << name;
+		if (!typeName.empty()) std::cout << ": " << typeName;
+		std::cout << std::endl;
 		if (value) {
 			value->print(pad + 4);
 		}
@@ -136,6 +161,8 @@ struct LetStmt : public Node {
 
 	LetStmt() = default;
 
+	void visit(NodeVisitor& v) { v.visit(*this); }
+
 	void print(int pad = 0) {
 		std::cout << std::string(pad, ' ') << "LetStmt(" << std::endl;
 		std::cout << std::string(pad + 4, ' ') << "[" << std::endl;
@@ -153,8 +180,26 @@ struct FuncDefStmt : public Node {
 	NodeList stmts;
 	bool publicFunc;
 
+	// Set while the body is still unparsed: the tokens it spans. Threads
+	// that share the AST may force the body at the same time, so the
+	// first one parses it under bodyMutex and `parsed` publishes the result.
+	TokenStream source;
+	int bodyBegin = 0, bodyEnd = 0;
+	std::atomic<bool> parsed { true };
+	std::mutex bodyMutex;
+
+	// Errors reported while parsing the body. A lazy body reports them
+	// on whichever thread and DiagnosticCapture forces it, so this is how
+	// everyone else can tell it is broken.
+	int bodyErrors = 0;
+
 	FuncDefStmt() = default;
 
+	// The body statements, parsed on first access.
+	NodeList& body();
+
+	void visit(NodeVisitor& v) { v.visit(*this); }
+
 	void print(int pad = 0) {
 		std::cout << std::string(pad, ' ') << "FuncDefStmt(" << std::endl;
 		std::cout << std::string(pad + 4, ' ') << name << std::endl;
@@ -173,6 +218,8 @@ struct ReturnStmt : public Node {
 	ReturnStmt() = default;
 	ReturnStmt(Node* val) : value(NodePtr(val)) {}
 
+	void visit(NodeVisitor& v) { v.visit(*this); }
+
 	void print(int pad = 0) {
 		std::cout << std::string(pad, ' ') << "ReturnStmt(" << std::endl;
 		if (value) value->print(pad + 4);
@@ -180,14 +227,44 @@ struct ReturnStmt : public Node {
 	}
 };
 
+// Suspends the enclosing generator function, handing `value` to the loop
+// iterating it. A function containing one is a generator.
+struct YieldStmt : public Node {
+	NodePtr value;
+
+	YieldStmt() = default;
+	YieldStmt(Node* val) : value(NodePtr(val)) {}
+
+	void visit(NodeVisitor& v) { v.visit(*this); }
+
+	void print(int pad = 0) {
+		std::cout << std::string(pad, ' ') << "YieldStmt(" << std::endl;
+		if (value) value->print(pad + 4);
+		std::cout << std::string(pad, ' ') << ")" << std::endl;
+	}
+};
+
+// `reduce(+: total)` on a parallel loop: every worker accumulates its own
+// `total` with `op`, and the partial results are combined afterwards.
+struct Reduction {
+	std::string op, name;
+};
+
 struct ForStmt : public Node {
 	NodeList vars, stmts;
 	NodePtr iter;
 
+	// `parallel for`: iterations may run concurrently on several threads.
+	bool parallel = false;
+	std::vector<Reduction> reductions;
+
 	ForStmt() = default;
 
+	void visit(NodeVisitor& v) { v.visit(*this); }
+
 	void print(int pad = 0) {
 		std::cout << std::string(pad, ' ') << "ForStmt(" << std::endl;
+		if (parallel) std::cout << std::string(pad + 4, ' ') << "parallel" << std::endl;
 		iter->print(pad + 4);
 		std::cout << std::string(pad, ' ') << ")" << std::endl;
 	}
@@ -199,6 +276,8 @@ struct RangeStmt : public Node {
 	RangeStmt() = default;
 	RangeStmt(Node* from, Node* to) : from(NodePtr(from)), to(NodePtr(to)) {}
 
+	void visit(NodeVisitor& v) { v.visit(*this); }
+
 	void print(int pad = 0) {
 		std::cout << std::string(pad, ' ') << "RangeStmt(" << std::endl;
 		from->print(pad + 4);
@@ -213,6 +292,8 @@ struct WhileStmt : public Node {
 
 	WhileStmt() = default;
 
+	void visit(NodeVisitor& v) { v.visit(*this); }
+
 	void print(int pad = 0) {
 		std::cout << std::string(pad, ' ') << "WhileStmt(" << std::endl;
 		cond->print(pad + 4);
@@ -220,4 +301,25 @@ struct WhileStmt : public Node {
 	}
 };
 
+// import a.b; or import a.b (x, y);
+struct ImportStmt : public Node {
+	std::string module;
+
+	// Names picked from the module's exports. Empty imports every export.
+	std::vector<std::string> names;
+
+	ImportStmt() = default;
+
+	void visit(NodeVisitor& v) { v.visit(*this); }
+
+	void print(int pad = 0) {
+		std::cout << std::string(pad, ' ') << "ImportStmt(" << module;
+		for (size_t i = 0; i < names.size(); i++) {
+			std::cout << (i == 0 ? " [" : ", ") << names[i];
+		}
+		if (!names.empty()) std::cout << "]";
+		std::cout << ")" << std::endl;
+	}
+};
+
 #endif // LANG_STMT_HPP
\ No newline at end of file
@@ -0,0 +1,528 @@
+#include "dump.h"
+
+#include <cmath>
+
+#include "serialize.h"
+#include "detail/atom.hpp"
+#include "detail/ops.hpp"
+#include "detail/stmts.hpp"
+
+// Indented text, one line per node or operator.
+class TextDumper : public NodeVisitor {
+public:
+	TextDumper(OutputBuffer& out) : m_out(out) {}
+
+	void node(Node* node, int pad) {
+		if (node == nullptr) return;
+		int saved = m_pad;
+		m_pad = pad;
+		node->visit(*this);
+		m_pad = saved;
+	}
+
+	// "[", the nodes two levels deeper, "]".
+	template <typename T>
+	void list(std::vector<std::unique_ptr<T>>& nodes) {
+		line(m_pad + 4, "[");
+		for (auto&& n : nodes) node(n.get(), m_pad + 8);
+		line(m_pad + 4, "]");
+	}
+
+	void visit(Program& node) {
+		for (auto&& stmt : node.stmts) this->node(stmt.get(), m_pad);
+	}
+
+	void visit(EOFAtom& /* node */) { line(m_pad, "EOF"); }
+
+	void visit(BoolAtom& node) {
+		m_out.pad(m_pad);
+		m_out.literal("BOOL(");
+		m_out.put(node.value ? '1' : '0');
+		m_out.literal(")\n");
+	}
+
+	void visit(IdentifierAtom& node) { value("ID(", node.name); }
+
+	void visit(NumberAtom& node) {
+		m_out.pad(m_pad);
+		m_out.literal("NUM(");
+		m_out.number(node.value, 6);
+		m_out.literal(")\n");
+	}
+
+	void visit(IntegerAtom& node) {
+		m_out.pad(m_pad);
+		m_out.literal("INT(");
+		m_out.integer(node.value);
+		m_out.literal(")\n");
+	}
+
+	void visit(StringAtom& node) { value("STR(", node.value); }
+
+	void visit(CharAtom& node) {
+		m_out.pad(m_pad);
+		m_out.literal("CHR(");
+		m_out.put(node.value);
+		m_out.literal(")\n");
+	}
+
+	void visit(BinOp& node) {
+		line(m_pad, "BinOp(");
+		this->node(node.left.get(), m_pad + 4);
+		line(m_pad + 4, node.op);
+		this->node(node.right.get(), m_pad + 4);
+		line(m_pad, ")");
+	}
+
+	void visit(UnOp& node) {
+		line(m_pad, "UnOp(");
+		line(m_pad + 4, node.op);
+		this->node(node.right.get(), m_pad + 4);
+		line(m_pad, ")");
+	}
+
+	void visit(TernaryOp& node) {
+		line(m_pad, "TernaryOp(");
+		this->node(node.cond.get(), m_pad + 4);
+		line(m_pad + 4, "?");
+		this->node(node.left.get(), m_pad + 4);
+		line(m_pad + 4, ":");
+		this->node(node.right.get(), m_pad + 4);
+		line(m_pad, ")");
+	}
+
+	void visit(CallOp& node) {
+		line(m_pad, "CallOp(");
+		this->node(node.func.get(), m_pad + 4);
+		list(node.items);
+		line(m_pad, ")");
+	}
+
+	void visit(IndexOp& node) {
+		line(m_pad, "IndexOp(");
+		this->node(node.obj.get(), m_pad + 4);
+		line(m_pad + 4, "[");
+		this->node(node.index.get(), m_pad + 8);
+		line(m_pad + 4, "]");
+		line(m_pad, ")");
+	}
+
+	void visit(SemicolonStmt& /* node */) { line(m_pad, ";"); }
+	void visit(BreakStmt& /* node */) { line(m_pad, "BREAK"); }
+	void visit(ContinueStmt& /* node */) { line(m_pad, "CONT"); }
+
+	void visit(AssignmentStmt& node) {
+		line(m_pad, "AssignmentStmt(");
+		this->node(node.left.get(), m_pad + 4);
+		line(m_pad + 4, "=");
+		this->node(node.right.get(), m_pad + 4);
+		line(m_pad, ")");
+	}
+
+	void visit(IncrementStmt& node) { step("IncrementStmt(", "++", node.node.get(), node.pre); }
+	void visit(DecrementStmt& node) { step("DecrementStmt(", "--", node.node.get(), node.pre); }
+
+	void visit(IfStmt& node) {
+		line(m_pad, "IfStmt(");
+		this->node(node.cond.get(), m_pad + 4);
+		list(node.stmts);
+		for (auto&& elseIf : node.elseIfs) {
+			m_out.pad(m_pad + 4);
+			m_out.literal("[else if]");
+			this->node(elseIf.get(), m_pad + 4);
+		}
+		if (node.elseStmt) {
+			m_out.pad(m_pad + 4);
+			m_out.literal("[else]");
+			this->node(node.elseStmt.get(), m_pad + 4);
+		}
+		line(m_pad, ")");
+	}
+
+	void visit(ParamStmt& node) {
+		line(m_pad, "ParamStmt(");
+		m_out.pad(m_pad + 4);
+		m_out.append(node.name);
+		if (!node.typeName.empty()) {
+			m_out.literal(": ");
+			m_out.append(node.typeName);
+		}
+		m_out.put('\n');
+		this->node(node.value.get(), m_pad + 4);
+		line(m_pad, ")");
+	}
+
+	void visit(LetStmt& node) {
+		line(m_pad, "LetStmt(");
+		list(node.variableList);
+		line(m_pad, ")");
+	}
+
+	void visit(FuncDefStmt& node) {
+		line(m_pad, "FuncDefStmt(");
+		line(m_pad + 4, node.name);
+		list(node.paramList);
+		list(node.body());
+		line(m_pad, ")");
+	}
+
+	void visit(ReturnStmt& node) {
+		line(m_pad, "ReturnStmt(");
+		this->node(node.value.get(), m_pad + 4);
+		line(m_pad, ")");
+	}
+
+	void visit(YieldStmt& node) {
+		line(m_pad, "YieldStmt(");
+		this->node(node.value.get(), m_pad + 4);
+		line(m_pad, ")");
+	}
+
+	void visit(ForStmt& node) {
+		line(m_pad, "ForStmt(");
+		if (node.parallel) line(m_pad + 4, "parallel");
+		for (auto&& reduction : node.reductions) line(m_pad + 4, "reduce " + reduction.op + ": " + reduction.name);
+		list(node.vars);
+		this->node(node.iter.get(), m_pad + 4);
+		list(node.stmts);
+		line(m_pad, ")");
+	}
+
+	void visit(RangeStmt& node) {
+		line(m_pad, "RangeStmt(");
+		this->node(node.from.get(), m_pad + 4);
+		this->node(node.to.get(), m_pad + 4);
+		line(m_pad, ")");
+	}
+
+	void visit(WhileStmt& node) {
+		line(m_pad, "WhileStmt(");
+		this->node(node.cond.get(), m_pad + 4);
+		list(node.stmts);
+		line(m_pad, ")");
+	}
+
+	void visit(ImportStmt& node) {
+		m_out.pad(m_pad);
+		m_out.literal("ImportStmt(");
+		m_out.append(node.module);
+		for (size_t i = 0; i < node.names.size(); i++) {
+			m_out.append(i == 0 ? " [" : ", ");
+			m_out.append(node.names[i]);
+		}
+		if (!node.names.empty()) m_out.put(']');
+		m_out.literal(")\n");
+	}
+
+private:
+	OutputBuffer& m_out;
+	int m_pad = 0;
+
+	void line(int pad, const char* text) {
+		m_out.pad(pad);
+		m_out.append(text);
+		m_out.put('\n');
+	}
+
+	void line(int pad, const std::string& text) {
+		m_out.pad(pad);
+		m_out.append(text);
+		m_out.put('\n');
+	}
+
+	void value(const char* prefix, const std::string& value) {
+		m_out.pad(m_pad);
+		m_out.append(prefix);
+		m_out.append(value);
+		m_out.literal(")\n");
+	}
+
+	void step(const char* name, const char* op, Node* target, bool pre) {
+		line(m_pad, name);
+		if (pre) line(m_pad + 4, op);
+		node(target, m_pad + 4);
+		if (!pre) line(m_pad + 4, op);
+		line(m_pad, ")");
+	}
+};
+
+// {"node":"BinOp","line":1,"pos":4,...}, children nested in place.
+class JsonDumper : public NodeVisitor {
+public:
+	JsonDumper(OutputBuffer& out) : m_out(out) {}
+
+	void node(Node* node) {
+		if (node == nullptr) {
+			m_out.literal("null");
+			return;
+		}
+		node->visit(*this);
+	}
+
+	template <typename T>
+	void list(std::vector<std::unique_ptr<T>>& nodes) {
+		m_out.put('[');
+		for (size_t i = 0; i < nodes.size(); i++) {
+			if (i > 0) m_out.put(',');
+			node(nodes[i].get());
+		}
+		m_out.put(']');
+	}
+
+	void visit(Program& node) {
+		for (auto&& stmt : node.stmts) {
+			this->node(stmt.get());
+			m_out.put('\n');
+		}
+	}
+
+	void visit(EOFAtom& node) { open("EOFAtom", node); close(); }
+
+	void visit(BoolAtom& node) {
+		open("BoolAtom", node);
+		key("value");
+		m_out.append(node.value ? "true" : "false");
+		close();
+	}
+
+	void visit(IdentifierAtom& node) { open("IdentifierAtom", node); field("name", node.name); close(); }
+
+	void visit(NumberAtom& node) {
+		open("NumberAtom", node);
+		key("value");
+		// JSON has no infinities or NaN.
+		if (std::isfinite(node.value)) m_out.number(node.value);
+		else m_out.literal("null");
+		close();
+	}
+
+	void visit(IntegerAtom& node) {
+		open("IntegerAtom", node);
+		key("value");
+		m_out.integer(node.value);
+		close();
+	}
+
+	void visit(StringAtom& node) { open("StringAtom", node); field("value", node.value); close(); }
+	void visit(CharAtom& node) { open("CharAtom", node); field("value", std::string(1, node.value)); close(); }
+
+	void visit(BinOp& node) {
+		open("BinOp", node);
+		field("op", node.op);
+		field("operandType", valueTypeName(node.operandType));
+		child("left", node.left.get());
+		child("right", node.right.get());
+		close();
+	}
+
+	void visit(UnOp& node) {
+		open("UnOp", node);
+		field("op", node.op);
+		field("operandType", valueTypeName(node.operandType));
+		child("right", node.right.get());
+		close();
+	}
+
+	void visit(TernaryOp& node) {
+		open("TernaryOp", node);
+		child("cond", node.cond.get());
+		child("left", node.left.get());
+		child("right", node.right.get());
+		close();
+	}
+
+	void visit(CallOp& node) {
+		open("CallOp", node);
+		child("func", node.func.get());
+		key("items");
+		list(node.items);
+		close();
+	}
+
+	void visit(IndexOp& node) {
+		open("IndexOp", node);
+		child("obj", node.obj.get());
+		child("index", node.index.get());
+		close();
+	}
+
+	void visit(SemicolonStmt& node) { open("SemicolonStmt", node); close(); }
+	void visit(BreakStmt& node) { open("BreakStmt", node); close(); }
+	void visit(ContinueStmt& node) { open("ContinueStmt", node); close(); }
+
+	void visit(AssignmentStmt& node) {
+		open("AssignmentStmt", node);
+		child("left", node.left.get());
+		child("right", node.right.get());
+		close();
+	}
+
+	void visit(IncrementStmt& node) {
+		open("IncrementStmt", node);
+		flag("pre", node.pre);
+		child("node", node.node.get());
+		close();
+	}
+
+	void visit(DecrementStmt& node) {
+		open("DecrementStmt", node);
+		flag("pre", node.pre);
+		child("node", node.node.get());
+		close();
+	}
+
+	void visit(IfStmt& node) {
+		open("IfStmt", node);
+		child("cond", node.cond.get());
+		key("stmts");
+		list(node.stmts);
+		key("elseIfs");
+		list(node.elseIfs);
+		child("else", node.elseStmt.get());
+		close();
+	}
+
+	void visit(ParamStmt& node) {
+		open("ParamStmt", node);
+		field("name", node.name);
+		field("typeName", node.typeName);
+		field("type", valueTypeName(node.type));
+		child("value", node.value.get());
+		close();
+	}
+
+	void visit(LetStmt& node) {
+		open("LetStmt", node);
+		flag("public", node.publicLet);
+		key("variables");
+		list(node.variableList);
+		close();
+	}
+
+	void visit(FuncDefStmt& node) {
+		open("FuncDefStmt", node);
+		field("name", node.name);
+		flag("public", node.publicFunc);
+		key("params");
+		list(node.paramList);
+		key("stmts");
+		list(node.body());
+		close();
+	}
+
+	void visit(ReturnStmt& node) {
+		open("ReturnStmt", node);
+		child("value", node.value.get());
+		close();
+	}
+
+	void visit(YieldStmt& node) {
+		open("YieldStmt", node);
+		child("value", node.value.get());
+		close();
+	}
+
+	void visit(ForStmt& node) {
+		open("ForStmt", node);
+		flag("parallel", node.parallel);
+		key("reductions");
+		m_out.put('[');
+		for (size_t i = 0; i < node.reductions.size(); i++) {
+			if (i > 0) m_out.put(',');
+			m_out.literal("{\"op\":");
+			m_out.quoted(node.reductions[i].op);
+			m_out.literal(",\"name\":");
+			m_out.quoted(node.reductions[i].name);
+			m_out.put('}');
+		}
+		m_out.put(']');
+		key("vars");
+		list(node.vars);
+		child("iter", node.iter.get());
+		key("stmts");
+		list(node.stmts);
+		close();
+	}
+
+	void visit(RangeStmt& node) {
+		open("RangeStmt", node);
+		child("from", node.from.get());
+		child("to", node.to.get());
+		close();
+	}
+
+	void visit(WhileStmt& node) {
+		open("WhileStmt", node);
+		child("cond", node.cond.get());
+		key("stmts");
+		list(node.stmts);
+		close();
+	}
+
+	void visit(ImportStmt& node) {
+		open("ImportStmt", node);
+		field("module", node.module);
+		key("names");
+		m_out.put('[');
+		for (size_t i = 0; i < node.names.size(); i++) {
+			if (i > 0) m_out.put(',');
+			m_out.quoted(node.names[i]);
+		}
+		m_out.put(']');
+		close();
+	}
+
+private:
+	OutputBuffer& m_out;
+
+	void open(const char* kind, Node& node) {
+		m_out.literal("{\"node\":\"");
+		m_out.append(kind);
+		m_out.literal("\",\"line\":");
+		m_out.integer(node.line);
+		m_out.literal(",\"pos\":");
+		m_out.integer(node.pos);
+	}
+
+	void close() { m_out.put('}'); }
+
+	void key(const char* name) {
+		m_out.literal(",\"");
+		m_out.append(name);
+		m_out.literal("\":");
+	}
+
+	void field(const char* name, const std::string& value) { key(name); m_out.quoted(value); }
+
+	void field(const char* name, const char* value) {
+		key(name);
+		m_out.put('"');
+		m_out.append(value);
+		m_out.put('"');
+	}
+
+	void flag(const char* name, bool value) { key(name); m_out.append(value ? "true" : "false"); }
+	void child(const char* name, Node* value) { key(name); node(value); }
+};
+
+void dumpProgram(Program* program, DumpFormat format, OutputBuffer& out) {
+	switch (format) {
+		case DumpFormat::Text: {
+			TextDumper dumper(out);
+			dumper.node(program, 0);
+			break;
+		}
+		case DumpFormat::Json: {
+			JsonDumper dumper(out);
+			dumper.node(program);
+			break;
+		}
+		case DumpFormat::Binary: {
+			uint32_t version = AstFormatVersion;
+			out.append((const char*) &version, 4);
+			writeProgram(program, out.data());
+			out.check();
+			break;
+		}
+	}
+}
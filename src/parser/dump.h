@@ -0,0 +1,19 @@
+#ifndef LANG_DUMP_H
+#define LANG_DUMP_H
+
+#include "../util/outbuffer.h"
+
+struct Program;
+
+// Writes `program` to `out` without going through Node::print().
+//
+// Text is indented like Node::print(), but complete: loop and function
+// bodies are included. JSON has one object per top-level statement per
+// line, each node as {"node": kind, "line", "pos", fields...}. Binary is
+// the u32 AstFormatVersion followed by writeProgram()'s encoding, so it
+// reads back with readProgram().
+//
+// Lazy function bodies are parsed first.
+void dumpProgram(Program* program, DumpFormat format, OutputBuffer& out);
+
+#endif // LANG_DUMP_H
\ No newline at end of file
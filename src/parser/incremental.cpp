@@ -0,0 +1,256 @@
+#include "incremental.h"
+
+#include <algorithm>
+
+#include "../util/diagnostics.h"
+
+// Replaces `count` items at `at` with `items`. Typical edits re-parse into
+// as many statements as they replaced, so overwrite in place first and only
+// shift the tail of the vector when the counts differ.
+template <typename T>
+static void splice(std::vector<T>& vec, int at, int count, std::vector<T>& items) {
+	int common = std::min(count, int(items.size()));
+	for (int i = 0; i < common; i++) {
+		vec[at + i] = std::move(items[i]);
+	}
+
+	if (count > common) {
+		vec.erase(vec.begin() + at + common, vec.begin() + at + count);
+	} else if (int(items.size()) > common) {
+		vec.insert(
+			vec.begin() + at + common,
+			std::make_move_iterator(items.begin() + common),
+			std::make_move_iterator(items.end())
+		);
+	}
+}
+
+// Whether `tok`, at `offset` in `text`, has its pos counted on its first
+// line and so depends on where that line starts. A literal spanning lines
+// counts it on its last line instead.
+static bool onFirstLine(const std::string& text, int offset, const Token& tok) {
+	int end = std::min(int(text.size()), offset + tok.length);
+	return std::find(text.begin() + std::min(offset, end), text.begin() + end, '\n') == text.begin() + end;
+}
+
+// True if `text` from `at` on, which holds no tokens, ends inside a comment
+// that would have run on into the text after it.
+static bool endsInComment(const std::string& text, size_t at) {
+	while (at < text.size()) {
+		if (text.compare(at, 2, "//") == 0) {
+			at = text.find('\n', at);
+			if (at == std::string::npos) return true;
+		} else if (text.compare(at, 2, "/*") == 0) {
+			at = text.find("*/", at + 2);
+			if (at == std::string::npos) return true;
+			at += 2;
+		} else at++;
+	}
+	return false;
+}
+
+// True if the parser could not have continued `seg` into `next`: it ended
+// on a ';' or '}' and `next` does not continue an if statement.
+bool IncrementalParser::endsCleanly(const Segment& seg, const Segment& next) {
+	if (!seg.tokens.empty()) {
+		const Token& tok = seg.tokens.back();
+		if (tok.type != TokenType::SEMI && !(tok.type == TokenType::OTHER && tok.lexeme == "}")) return false;
+	}
+	return next.tokens.empty() || next.tokens.front().lexeme != "else";
+}
+
+void IncrementalParser::parse(const std::string& source) {
+	m_source = source;
+	m_segments.clear();
+	m_program.stmts.clear();
+
+	parseRegion(0, m_source.size(), 0, 0, true, m_segments, m_program.stmts);
+	m_reused = 0;
+	m_reparsed = m_segments.size();
+}
+
+void IncrementalParser::edit(const TextEdit& edit) {
+	int offset = std::max(0, std::min(edit.offset, int(m_source.size())));
+	int removed = std::max(0, std::min(edit.removed, int(m_source.size()) - offset));
+	int delta = int(edit.inserted.size()) - removed;
+
+	if (m_segments.empty()) {
+		std::string source = m_source;
+		source.replace(offset, removed, edit.inserted);
+		parse(source);
+		return;
+	}
+
+	int lineDelta = std::count(edit.inserted.begin(), edit.inserted.end(), '\n') -
+		std::count(m_source.begin() + offset, m_source.begin() + offset + removed, '\n');
+	m_source.replace(offset, removed, edit.inserted);
+
+	// Segments tile the text, so the one holding a byte is the last one
+	// starting at or before it.
+	auto segmentAt = [&](int at) {
+		auto it = std::upper_bound(
+			m_segments.begin(), m_segments.end(), at,
+			[](int value, const Segment& seg) { return value < seg.begin; }
+		);
+		return std::max(0, int(it - m_segments.begin()) - 1);
+	};
+
+	int count = m_segments.size();
+	int first = segmentAt(offset);
+	int last = segmentAt(offset + removed);
+
+	// The parser looks one token ahead, so the statement before the edit may
+	// parse differently once the first token after it changes.
+	if (first > 0) first--;
+
+	// Each attempt's diagnostics are held back; only the accepted one's are
+	// reported, as a region that is grown again was parsed out of context.
+	std::vector<Segment> segments;
+	NodeList nodes;
+	std::string diagnostics;
+	int errors = 0;
+	while (true) {
+		bool whole = first == 0 && last == count - 1;
+		int begin = m_segments[first].begin;
+		int end = m_segments[last].end + delta;
+
+		segments.clear();
+		nodes.clear();
+		DiagnosticCapture capture;
+		if (parseRegion(begin, end, m_segments[first].line, m_segments[first].col, whole, segments, nodes) &&
+			(last == count - 1 || endsCleanly(segments.back(), m_segments[last + 1])))
+		{
+			diagnostics = capture.text();
+			errors = capture.errors();
+			break;
+		}
+
+		// The damage reaches past these statements, grow the region
+		// geometrically so a large unbalanced edit stays linear overall.
+		int grow = last - first + 1;
+		first = std::max(0, first - grow);
+		last = std::min(count - 1, last + grow);
+	}
+
+	reportCaptured(diagnostics, errors);
+
+	int stmtsBefore = 0, stmtsDamaged = 0;
+	for (int i = 0; i < first; i++) {
+		if (m_segments[i].hasNode) stmtsBefore++;
+	}
+	for (int i = first; i <= last; i++) {
+		if (m_segments[i].hasNode) stmtsDamaged++;
+	}
+
+	int regionEnd = segments.back().end;
+	splice(m_program.stmts, stmtsBefore, stmtsDamaged, nodes);
+	splice(m_segments, first, last - first + 1, segments);
+
+	int after = first + segments.size();
+	bool sameLine = true;
+	for (int i = after; i < int(m_segments.size()); i++) {
+		Segment& seg = m_segments[i];
+		seg.begin += delta;
+		seg.end += delta;
+		seg.line += lineDelta;
+
+		// Only statements sharing a line with the edited region move sideways.
+		if (sameLine) {
+			int lineStart = seg.begin;
+			while (lineStart > 0 && m_source[lineStart - 1] != '\n') lineStart--;
+			seg.col = seg.begin - lineStart;
+			sameLine = lineStart <= regionEnd;
+		}
+	}
+
+	m_reused = count - (last - first + 1);
+	m_reparsed = segments.size();
+}
+
+bool IncrementalParser::parseRegion(int begin, int end, int line, int col, bool force, std::vector<Segment>& segments, NodeList& nodes) {
+	const std::string text = m_source.substr(begin, end - begin);
+
+	LangLexer lexer(text);
+	lexer.tokenize();
+	std::vector<Token> tokens = lexer.tokens();
+
+	if (!force) {
+		// An unterminated literal runs to the end of the region, and would
+		// have swallowed the text after it too; so would a comment.
+		const Token& lastToken = tokens[tokens.size() - 1 - (tokens.size() > 1)];
+		if (lastToken.offset + lastToken.length > int(text.size())) return false;
+		if (end < int(m_source.size()) && endsInComment(text, tokens.size() > 1 ? lastToken.offset + lastToken.length : 0)) return false;
+
+		int balance = 0;
+		for (auto&& tok : tokens) {
+			if (tok.type != TokenType::OTHER) continue;
+			if (tok.lexeme == "{") balance++;
+			else if (tok.lexeme == "}" && --balance < 0) return false;
+		}
+		if (balance != 0) return false;
+	}
+
+	// Bodies are parsed eagerly here: a segment is small, and lazily parsed
+	// bodies would report positions relative to the segment.
+	TokenStream stream = std::make_shared<const std::vector<Token>>(tokens);
+	LangParser parser(stream, 0, tokens.size() - 1);
+	parser.setLazyBodies(false);
+	std::vector<LangParser::StatementRange> ranges = parser.parseStatementRanges();
+
+	if (ranges.empty()) {
+		segments.push_back({ begin, end, line, col, {}, false });
+		return true;
+	}
+
+	int curLine = 0, curCol = 0, scanned = 0;
+	for (size_t i = 0; i < ranges.size(); i++) {
+		const LangParser::StatementRange& range = ranges[i];
+		int segBegin = i == 0 ? 0 : tokens[range.begin].offset;
+		int segEnd = i + 1 < ranges.size() ? tokens[ranges[i + 1].begin].offset : text.size();
+
+		for (; scanned < segBegin; scanned++) {
+			if (text[scanned] == '\n') {
+				curLine++;
+				curCol = 0;
+			} else curCol++;
+		}
+
+		Segment seg;
+		seg.begin = begin + segBegin;
+		seg.end = begin + segEnd;
+		seg.line = line + curLine;
+		seg.col = curLine == 0 ? col + curCol : curCol;
+		seg.hasNode = range.node != nullptr;
+
+		for (int t = range.begin; t < range.end; t++) {
+			Token tok = tokens[t];
+			tok.offset -= segBegin;
+			if (tok.line == curLine && onFirstLine(text, tokens[t].offset, tok)) tok.pos -= curCol;
+			tok.line -= curLine;
+			seg.tokens.push_back(tok);
+		}
+
+		if (range.node) nodes.push_back(NodePtr(range.node));
+		segments.push_back(std::move(seg));
+	}
+	return true;
+}
+
+std::vector<Token> IncrementalParser::tokens() const {
+	std::vector<Token> tokens;
+	for (auto&& seg : m_segments) {
+		for (Token tok : seg.tokens) {
+			tok.offset += seg.begin;
+			if (tok.line == 0 && onFirstLine(m_source, tok.offset, tok)) tok.pos += seg.col;
+			tok.line += seg.line;
+			tokens.push_back(tok);
+		}
+	}
+
+	Token tok{};
+	tok.type = TokenType::END;
+	tok.line = std::count(m_source.begin(), m_source.end(), '\n') + 1;
+	tok.offset = m_source.size();
+	tokens.push_back(tok);
+	return tokens;
+}
\ No newline at end of file
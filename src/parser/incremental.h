@@ -0,0 +1,62 @@
+#ifndef LANG_INCREMENTAL_H
+#define LANG_INCREMENTAL_H
+
+#include "parser.h"
+
+// Replace `removed` bytes at `offset` (in the current text) with `inserted`.
+struct TextEdit {
+	int offset;
+	int removed;
+	std::string inserted;
+};
+
+// Keeps the text, tokens and AST of one file and updates them in place.
+// The file is split into segments, one per top-level statement. An edit
+// re-lexes and re-parses only the segments it touches (grown until braces
+// balance again) and reuses every other segment's tokens and Node subtree.
+// Node::line and pos are not kept up to date here, as that would mean
+// walking every reused subtree; tokens() has the current positions.
+// Diagnostics come from the re-parsed statements only, so an edit reports
+// the errors in the text it touched, not those left elsewhere in the file.
+class IncrementalParser {
+public:
+	IncrementalParser() = default;
+	~IncrementalParser() = default;
+
+	void parse(const std::string& source);
+	void edit(const TextEdit& edit);
+
+	const std::string& source() const { return m_source; }
+	Program* program() { return &m_program; }
+
+	// Materializes the token stream with absolute positions.
+	std::vector<Token> tokens() const;
+
+	// Statistics for the last parse()/edit() call.
+	int reusedStatements() const { return m_reused; }
+	int reparsedStatements() const { return m_reparsed; }
+
+private:
+	struct Segment {
+		int begin, end;
+		int line, col;
+
+		// Tokens with offsets and lines relative to the segment start.
+		std::vector<Token> tokens;
+		bool hasNode;
+	};
+
+	std::string m_source;
+	std::vector<Segment> m_segments;
+	Program m_program;
+
+	int m_reused = 0, m_reparsed = 0;
+
+	// Re-lexes and re-parses m_source[begin, end) as a run of segments.
+	// Returns false if the text does not end on a statement boundary
+	// (unbalanced braces or an unterminated literal).
+	bool parseRegion(int begin, int end, int line, int col, bool force, std::vector<Segment>& segments, NodeList& nodes);
+	static bool endsCleanly(const Segment& seg, const Segment& next);
+};
+
+#endif // LANG_INCREMENTAL_H
\ No newline at end of file
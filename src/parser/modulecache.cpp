@@ -0,0 +1,120 @@
+#include "modulecache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "serialize.h"
+
+static const char CacheMagic[8] = { 'L', 'A', 'N', 'G', 'A', 'S', 'T', 0 };
+
+struct CacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t key;
+	uint64_t sourceSize;
+};
+
+ModuleCache::ModuleCache(const std::string& dir) : m_dir(dir) {
+	std::error_code ec;
+	std::filesystem::create_directories(dir, ec);
+}
+
+uint64_t ModuleCache::key(const std::string& source) {
+	uint64_t hash = 14695981039346656037ull ^ AstFormatVersion;
+	for (unsigned char c : source) {
+		hash ^= c;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+std::string ModuleCache::entryPath(uint64_t key) const {
+	char name[32];
+	std::snprintf(name, sizeof(name), "%016llx.ast", (unsigned long long) key);
+	return m_dir + "/" + name;
+}
+
+std::unique_ptr<Program> ModuleCache::load(const std::string& source, bool* hit) {
+	uint64_t hash = key(source);
+	std::string path = entryPath(hash);
+
+	std::unique_ptr<Program> program = read(path, hash, source.size());
+	if (hit) *hit = program != nullptr;
+	if (program) return program;
+
+	int errors = reportedErrors();
+
+	LangLexer lex(source);
+	lex.tokenize();
+
+	// The entry has to hold every body anyway.
+	LangParser par(lex.tokens());
+	par.setLazyBodies(false);
+	par.parse();
+
+	program = par.takeProgram();
+	if (reportedErrors() == errors) write(path, hash, source.size(), program.get());
+	return program;
+}
+
+std::unique_ptr<Program> ModuleCache::read(const std::string& path, uint64_t key, uint64_t sourceSize) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) return nullptr;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(CacheHeader)) {
+		close(fd);
+		return nullptr;
+	}
+
+	size_t size = st.st_size;
+	void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) return nullptr;
+
+	// A stale or foreign entry is simply ignored and overwritten.
+	std::unique_ptr<Program> program;
+	CacheHeader header;
+	std::memcpy(&header, data, sizeof(header));
+	if (std::memcmp(header.magic, CacheMagic, sizeof(CacheMagic)) == 0 &&
+		header.version == AstFormatVersion && header.key == key && header.sourceSize == sourceSize)
+	{
+		program = readProgram((const char*) data + sizeof(header), size - sizeof(header));
+	}
+
+	munmap(data, size);
+	return program;
+}
+
+void ModuleCache::write(const std::string& path, uint64_t key, uint64_t sourceSize, Program* program) {
+	CacheHeader header{};
+	std::memcpy(header.magic, CacheMagic, sizeof(CacheMagic));
+	header.version = AstFormatVersion;
+	header.key = key;
+	header.sourceSize = sourceSize;
+
+	std::string data((const char*) &header, sizeof(header));
+	writeProgram(program, data);
+
+	std::string tmp = path + "." + std::to_string(getpid()) + "." +
+		std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+	{
+		std::ofstream out(tmp, std::ios::binary);
+		if (!out.write(data.data(), data.size())) {
+			out.close();
+			std::remove(tmp.c_str());
+			return;
+		}
+	}
+	if (std::rename(tmp.c_str(), path.c_str()) != 0) std::remove(tmp.c_str());
+}
@@ -0,0 +1,35 @@
+#ifndef LANG_MODULECACHE_H
+#define LANG_MODULECACHE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "parser.h"
+
+// Directory of parsed scripts keyed by a hash of their text and the AST
+// format version. A hit maps the entry file and decodes the tree straight
+// from it without running the lexer or parser. Scripts with errors are
+// never stored, so their diagnostics are reported on every run.
+// Entries are written to a temporary file and renamed into place, so
+// several processes or threads can share one directory.
+class ModuleCache {
+public:
+	ModuleCache(const std::string& dir);
+	~ModuleCache() = default;
+
+	// The parsed `source`, from the cache if possible. `hit` tells which.
+	std::unique_ptr<Program> load(const std::string& source, bool* hit = nullptr);
+
+	// FNV-1a over the text, seeded with AstFormatVersion.
+	static uint64_t key(const std::string& source);
+
+private:
+	std::string m_dir;
+
+	std::string entryPath(uint64_t key) const;
+	std::unique_ptr<Program> read(const std::string& path, uint64_t key, uint64_t sourceSize);
+	void write(const std::string& path, uint64_t key, uint64_t sourceSize, Program* program);
+};
+
+#endif // LANG_MODULECACHE_H
\ No newline at end of file
@@ -0,0 +1,446 @@
+#include "moduleloader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <sstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "detail/stmts.hpp"
+#include "modulecache.h"
+#include "serialize.h"
+#include "../util/threadpool.h"
+
+namespace fs = std::filesystem;
+
+ModuleLoader::ModuleLoader(ThreadPool& pool, const std::vector<std::string>& searchPaths)
+	: m_pool(pool), m_searchPaths(searchPaths)
+{}
+
+ModuleLoader::~ModuleLoader() = default;
+
+static std::string canonicalPath(const std::string& path) {
+	std::error_code ec;
+	std::string key = fs::weakly_canonical(path, ec).string();
+	return ec ? path : key;
+}
+
+// The source text of `path`, or false if it cannot be read.
+static bool readSource(const std::string& path, std::string& text) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file) return false;
+	std::ostringstream buffer;
+	buffer << file.rdbuf();
+	text = buffer.str();
+	return true;
+}
+
+Module* ModuleLoader::add(const std::string& name, const std::string& path) {
+	std::string key = canonicalPath(path);
+
+	auto it = m_byPath.find(key);
+	if (it != m_byPath.end()) return it->second;
+
+	Module* module = new Module();
+	module->name = name;
+	module->path = key;
+	m_modules.emplace_back(module);
+	m_byPath[key] = module;
+	return module;
+}
+
+static std::string relativePath(const std::string& name) {
+	std::string rel = name;
+	std::replace(rel.begin(), rel.end(), '.', '/');
+	return rel + ".rs";
+}
+
+std::string ModuleLoader::find(const std::string& name, const std::string& from) const {
+	std::string rel = relativePath(name);
+
+	std::vector<fs::path> roots { fs::path(from).parent_path(), m_root };
+	for (auto&& dir : m_searchPaths) {
+		roots.push_back(dir);
+	}
+
+	std::error_code ec;
+	for (auto&& root : roots) {
+		fs::path candidate = root / rel;
+		if (fs::is_regular_file(candidate, ec)) return candidate.string();
+	}
+	return "";
+}
+
+Module* ModuleLoader::findRestored(const std::string& name) const {
+	auto it = m_restored.find(name);
+	if (it != m_restored.end()) return it->second;
+
+	// A snapshot's entry module is named after its file only, so match
+	// "std.prelude" against ".../std/prelude.rs" as well.
+	std::string suffix = "/" + relativePath(name);
+	for (auto&& restored : m_restored) {
+		const std::string& path = restored.second->path;
+		if (path.size() >= suffix.size() && path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0) {
+			return restored.second;
+		}
+	}
+	return nullptr;
+}
+
+// Takes `module` and every restored module that imports it, directly or
+// not, back out of the snapshot's modules: their links point into it.
+void ModuleLoader::unrestore(Module* module) {
+	std::set<Module*> dropped { module };
+	for (bool grew = true; grew;) {
+		grew = false;
+		for (auto&& other : m_modules) {
+			if (!other->restored || dropped.count(other.get())) continue;
+			for (auto&& import : other->imports) {
+				if (dropped.count(import.second)) {
+					dropped.insert(other.get());
+					grew = true;
+					break;
+				}
+			}
+		}
+	}
+
+	for (Module* gone : dropped) {
+		if (m_restored.count(gone->name) && m_restored[gone->name] == gone) m_restored.erase(gone->name);
+		if (m_byPath.count(gone->path) && m_byPath[gone->path] == gone) m_byPath.erase(gone->path);
+	}
+	m_modules.erase(std::remove_if(m_modules.begin(), m_modules.end(), [&dropped](const std::unique_ptr<Module>& m) {
+		return dropped.count(m.get()) > 0;
+	}), m_modules.end());
+}
+
+void ModuleLoader::parse(Module* module) {
+	DiagnosticCapture capture;
+
+	std::string text;
+	if (!readSource(module->path, text)) {
+		error("ERROR: Cannot read module \"" << module->name << "\" (" << module->path << ").");
+	} else {
+		module->hash = ModuleCache::key(text);
+
+		LangLexer lex(text);
+		lex.tokenize();
+
+		LangParser par(lex.tokens());
+		par.setLazyBodies(m_lazyBodies);
+		par.parse();
+		module->program = par.takeProgram();
+		collect(module);
+	}
+
+	module->diagnostics += capture.text();
+	module->errors += capture.errors();
+}
+
+void ModuleLoader::collect(Module* module) {
+	for (auto&& stmt : module->program->stmts) {
+		if (LetStmt* let = dynamic_cast<LetStmt*>(stmt.get())) {
+			for (auto&& var : let->variableList) {
+				module->definitions[var->name] = var.get();
+				if (let->publicLet) module->exports[var->name] = var.get();
+			}
+		} else if (FuncDefStmt* func = dynamic_cast<FuncDefStmt*>(stmt.get())) {
+			module->definitions[func->name] = func;
+			if (func->publicFunc) module->exports[func->name] = func;
+		}
+	}
+}
+
+Module* ModuleLoader::load(const std::string& path) {
+	std::error_code ec;
+	if (!fs::is_regular_file(path, ec)) return nullptr;
+
+	// The entry is what is being checked or run, so it always comes from
+	// its source.
+	auto restored = m_byPath.find(canonicalPath(path));
+	if (restored != m_byPath.end() && restored->second->restored) unrestore(restored->second);
+
+	Module* entry = add(fs::path(path).stem().string(), path);
+	m_root = fs::path(entry->path).parent_path().string();
+
+	std::vector<Module*> wave { entry };
+	while (!wave.empty()) {
+		for (Module* module : wave) {
+			m_pool.submit([this, module] { parse(module); });
+		}
+		m_pool.wait();
+
+		// Modules first seen in this wave make up the next one.
+		std::vector<Module*> next;
+		for (Module* module : wave) {
+			if (!module->program) continue;
+
+			DiagnosticCapture capture;
+			for (auto&& stmt : module->program->stmts) {
+				ImportStmt* import = dynamic_cast<ImportStmt*>(stmt.get());
+				if (import == nullptr) continue;
+
+				if (Module* restored = findRestored(import->module)) {
+					module->imports.push_back({ import, restored });
+					continue;
+				}
+
+				std::string file = find(import->module, module->path);
+				if (file.empty()) {
+					error("ERROR(" << import->line << ":" << import->pos << "): Cannot find module \"" << import->module << "\".");
+					continue;
+				}
+
+				size_t known = m_modules.size();
+				Module* dep = add(import->module, file);
+				if (m_modules.size() > known) next.push_back(dep);
+				module->imports.push_back({ import, dep });
+			}
+			module->diagnostics += capture.text();
+			module->errors += capture.errors();
+		}
+		wave = std::move(next);
+	}
+
+	for (auto&& module : m_modules) {
+		if (!module->restored) link(module.get());
+	}
+
+	m_order.clear();
+	std::map<Module*, int> state;
+	for (auto&& module : m_modules) {
+		sort(module.get(), state);
+	}
+	return entry;
+}
+
+void ModuleLoader::link(Module* module) {
+	DiagnosticCapture capture;
+	for (auto&& import : module->imports) {
+		ImportStmt* stmt = import.first;
+		Module* dep = import.second;
+		if (!dep->program) continue;
+
+		for (auto&& name : stmt->names) {
+			if (dep->exports.count(name)) continue;
+
+			if (dep->definitions.count(name)) {
+				error("ERROR(" << stmt->line << ":" << stmt->pos << "): \"" << name << "\" is not public in module \"" << dep->name << "\".");
+			} else {
+				error("ERROR(" << stmt->line << ":" << stmt->pos << "): Module \"" << dep->name << "\" has no export \"" << name << "\".");
+			}
+		}
+	}
+	module->diagnostics += capture.text();
+	module->errors += capture.errors();
+}
+
+void ModuleLoader::sort(Module* module, std::map<Module*, int>& state) {
+	// 1 while the module's imports are being visited, 2 once it is placed.
+	int& mark = state[module];
+	if (mark != 0) return;
+	mark = 1;
+
+	DiagnosticCapture capture;
+	for (auto&& import : module->imports) {
+		if (state[import.second] == 1) {
+			error("ERROR(" << import.first->line << ":" << import.first->pos << "): Import cycle through module \"" << import.second->name << "\".");
+			continue;
+		}
+		sort(import.second, state);
+	}
+	module->diagnostics += capture.text();
+	module->errors += capture.errors();
+
+	state[module] = 2;
+	m_order.push_back(module);
+}
+
+int ModuleLoader::errors() const {
+	int count = 0;
+	for (auto&& module : m_modules) {
+		count += module->errors;
+	}
+	return count;
+}
+
+Node* ModuleLoader::resolve(Module* module, const std::string& name) const {
+	auto def = module->definitions.find(name);
+	if (def != module->definitions.end()) return def->second;
+
+	for (auto&& import : module->imports) {
+		const std::vector<std::string>& names = import.first->names;
+		if (!names.empty() && std::find(names.begin(), names.end(), name) == names.end()) continue;
+
+		auto it = import.second->exports.find(name);
+		if (it != import.second->exports.end()) return it->second;
+	}
+	return nullptr;
+}
+
+// Snapshot layout: magic, SnapshotVersion, AstFormatVersion, module count,
+// then per module its name, path, source hash (u64), imports as (statement
+// index, module index) pairs and the writeProgram() payload. Nothing
+// refers to addresses, so the file can be mapped anywhere.
+static const char SnapshotMagic[8] = { 'L', 'A', 'N', 'G', 'S', 'N', 'A', 'P' };
+static const uint32_t SnapshotVersion = 2;
+
+static void put32(std::string& out, uint32_t value) { out.append((const char*) &value, 4); }
+static void put64(std::string& out, uint64_t value) { out.append((const char*) &value, 8); }
+static void putString(std::string& out, const std::string& value) {
+	put32(out, value.size());
+	out.append(value);
+}
+
+struct SnapshotReader {
+	const char* pos;
+	const char* end;
+	bool failed = false;
+
+	bool take(void* out, size_t size) {
+		if (failed || size_t(end - pos) < size) {
+			failed = true;
+			return false;
+		}
+		std::memcpy(out, pos, size);
+		pos += size;
+		return true;
+	}
+	uint32_t u32() { uint32_t v = 0; take(&v, 4); return v; }
+	uint64_t u64() { uint64_t v = 0; take(&v, 8); return v; }
+	std::string str() {
+		uint32_t size = u32();
+		if (failed || size_t(end - pos) < size) {
+			failed = true;
+			return "";
+		}
+		std::string value(pos, size);
+		pos += size;
+		return value;
+	}
+};
+
+bool ModuleLoader::saveSnapshot(const std::string& path) {
+	if (errors() > 0) return false;
+
+	std::map<Module*, uint32_t> index;
+	for (size_t i = 0; i < m_order.size(); i++) {
+		index[m_order[i]] = i;
+	}
+
+	std::string data(SnapshotMagic, sizeof(SnapshotMagic));
+	put32(data, SnapshotVersion);
+	put32(data, AstFormatVersion);
+	put32(data, m_order.size());
+	for (Module* module : m_order) {
+		putString(data, module->name);
+		putString(data, module->path);
+		put64(data, module->hash);
+
+		NodeList& stmts = module->program->stmts;
+		put32(data, module->imports.size());
+		for (auto&& import : module->imports) {
+			uint32_t stmt = 0;
+			while (stmts[stmt].get() != import.first) stmt++;
+			put32(data, stmt);
+			put32(data, index[import.second]);
+		}
+
+		std::string program;
+		writeProgram(module->program.get(), program);
+		put32(data, program.size());
+		data += program;
+	}
+
+	std::string tmp = path + ".tmp";
+	{
+		std::ofstream out(tmp, std::ios::binary);
+		if (!out.write(data.data(), data.size())) return false;
+	}
+	return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+bool ModuleLoader::restoreSnapshot(const std::string& path) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+	size_t size = st.st_size;
+	void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) return false;
+
+	SnapshotReader in { (const char*) data, (const char*) data + size };
+	char magic[sizeof(SnapshotMagic)];
+	in.take(magic, sizeof(magic));
+	bool valid = !in.failed && std::memcmp(magic, SnapshotMagic, sizeof(magic)) == 0 &&
+		in.u32() == SnapshotVersion && in.u32() == AstFormatVersion;
+
+	std::vector<std::unique_ptr<Module>> modules;
+	std::vector<std::vector<std::pair<uint32_t, uint32_t>>> imports;
+	uint32_t count = valid ? in.u32() : 0;
+	for (uint32_t i = 0; i < count && !in.failed; i++) {
+		Module* module = new Module();
+		modules.emplace_back(module);
+		module->name = in.str();
+		module->path = in.str();
+		module->hash = in.u64();
+		module->restored = true;
+
+		imports.emplace_back();
+		uint32_t importCount = in.u32();
+		for (uint32_t j = 0; j < importCount && !in.failed; j++) {
+			uint32_t stmt = in.u32();
+			imports.back().push_back({ stmt, in.u32() });
+		}
+
+		uint32_t programSize = in.u32();
+		if (in.failed || size_t(in.end - in.pos) < programSize) break;
+		module->program = readProgram(in.pos, programSize);
+		in.pos += programSize;
+		if (!module->program) break;
+	}
+	munmap(data, size);
+
+	if (!valid || in.failed || modules.size() != count || (count > 0 && !modules.back()->program)) return false;
+
+	for (uint32_t i = 0; i < count; i++) {
+		Module* module = modules[i].get();
+		NodeList& stmts = module->program->stmts;
+		for (auto&& import : imports[i]) {
+			ImportStmt* stmt = import.first < stmts.size() ? dynamic_cast<ImportStmt*>(stmts[import.first].get()) : nullptr;
+			if (stmt == nullptr || import.second >= count) return false;
+			module->imports.push_back({ stmt, modules[import.second].get() });
+		}
+		collect(module);
+	}
+
+	std::vector<Module*> stale;
+	for (auto&& module : modules) {
+		std::string text;
+		if (!readSource(module->path, text) || ModuleCache::key(text) != module->hash) stale.push_back(module.get());
+
+		m_restored[module->name] = module.get();
+		m_byPath[module->path] = module.get();
+		m_modules.push_back(std::move(module));
+	}
+	for (Module* module : stale) {
+		// Possibly gone already, as an importer of an earlier one.
+		for (auto&& kept : m_modules) {
+			if (kept.get() != module) continue;
+			unrestore(module);
+			break;
+		}
+	}
+	return true;
+}
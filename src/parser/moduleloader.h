@@ -0,0 +1,105 @@
+#ifndef LANG_MODULELOADER_H
+#define LANG_MODULELOADER_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "parser.h"
+
+class ThreadPool;
+struct ImportStmt;
+
+struct Module {
+	std::string name;    // as imported, e.g. "util.strings"
+	std::string path;
+	std::unique_ptr<Program> program;
+
+	// Resolved targets of the module's import statements, in source order.
+	std::vector<std::pair<ImportStmt*, Module*>> imports;
+
+	// `pub let` variables (ParamStmt) and `pub func` definitions by name.
+	std::map<std::string, Node*> exports;
+
+	// Everything defined at the top level, public or not.
+	std::map<std::string, Node*> definitions;
+
+	// Errors from loading and linking, buffered so they print in order.
+	std::string diagnostics;
+	int errors = 0;
+
+	// Came from a snapshot instead of its source file.
+	bool restored = false;
+
+	// ModuleCache::key() of the source, so a snapshot can tell whether the
+	// file changed since it was saved.
+	uint64_t hash = 0;
+};
+
+// Loads a module and everything it imports. `import a.b` refers to a/b.rs
+// next to the importing file, next to the entry module, or below one of
+// the search paths.
+// The import graph is discovered wave by wave: all modules found in one
+// wave are independent of each other and are parsed in parallel. Function
+// bodies are only brace-matched while loading (see setLazyBodies()) and
+// are parsed the first time they are used (FuncDefStmt::body()), so
+// unused code costs a scan.
+class ModuleLoader {
+public:
+	ModuleLoader(ThreadPool& pool, const std::vector<std::string>& searchPaths = {});
+	~ModuleLoader();
+
+	// Returns the entry module, or null if `path` cannot be read.
+	Module* load(const std::string& path);
+
+	// Every loaded module, dependencies before their importers. A module in
+	// an import cycle is reported and placed where the cycle was entered.
+	const std::vector<Module*>& order() const { return m_order; }
+
+	int errors() const;
+
+	// Parse function bodies while loading, so errors inside them count
+	// towards errors() even if nothing forces them.
+	void setLazyBodies(bool lazy) { m_lazyBodies = lazy; }
+
+	// The node `name` refers to at the top level of `module`: its own
+	// definition, else a public one from a module it imports.
+	Node* resolve(Module* module, const std::string& name) const;
+
+	// Writes every loaded module, fully parsed and linked, to one file.
+	// Fails if any module reported errors.
+	bool saveSnapshot(const std::string& path);
+
+	// Maps a snapshot and adopts its modules before load() is called. An
+	// import whose name matches a restored module binds to it without
+	// parsing, so a prelude costs one mmap, a hash of its source and a
+	// decode. A module whose source changed or is gone is not adopted, nor
+	// is anything that imports it; load() parses those again. The entry
+	// passed to load() is never taken from the snapshot.
+	bool restoreSnapshot(const std::string& path);
+
+private:
+	ThreadPool& m_pool;
+	std::vector<std::string> m_searchPaths;
+	std::string m_root;
+	bool m_lazyBodies = true;
+
+	std::vector<std::unique_ptr<Module>> m_modules;
+	std::map<std::string, Module*> m_byPath;
+	std::map<std::string, Module*> m_restored;
+	std::vector<Module*> m_order;
+
+	Module* add(const std::string& name, const std::string& path);
+	std::string find(const std::string& name, const std::string& from) const;
+	Module* findRestored(const std::string& name) const;
+	void unrestore(Module* module);
+
+	void parse(Module* module);
+	void collect(Module* module);
+	void link(Module* module);
+	void sort(Module* module, std::map<Module*, int>& state);
+};
+
+#endif // LANG_MODULELOADER_H
\ No newline at end of file
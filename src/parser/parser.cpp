@@ -1,30 +1,59 @@
 #include "parser.h"
 
-#include <regex>
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "detail/atom.hpp"
 #include "detail/ops.hpp"
 #include "detail/stmts.hpp"
+#include "../util/profiler.h"
+#include "../util/threadpool.h"
 
 LangParser::LangParser(const std::vector<Token>& tokens)
-	: m_tokens(tokens), m_pos(0)
+	: LangParser(std::make_shared<const std::vector<Token>>(tokens), 0, tokens.size())
 {}
 
-bool LangParser::accept(TokenType type, const std::string& param, bool regex, bool forceCheck) {
-	if (m_pos >= m_tokens.size()) return false;
-	if (current().type == type) {
-		if (type == TokenType::OTHER || forceCheck) {
-			bool test = regex ? std::regex_match(current().lexeme, std::regex(param)) : current().lexeme == param;
-			if (test) return next();
-			else return false;
-		}
-		return next();
+LangParser::LangParser(const TokenStream& tokens, int begin, int end)
+	: m_tokens(tokens), m_pos(begin), m_begin(begin), m_end(end)
+{
+	m_endToken.type = TokenType::END;
+	if (end > 0) {
+		m_endToken.line = (*tokens)[end - 1].line;
+		m_endToken.pos = (*tokens)[end - 1].pos;
 	}
-	return false;
+
+	// The lexer's END token belongs to no statement.
+	if (end > begin && (*tokens)[end - 1].type == TokenType::END) m_end--;
+}
+
+LangParser::Nested::Nested(LangParser& parser) : parser(parser) {
+	ok = ++parser.m_nesting <= MaxNesting;
+	if (!ok) {
+		parser.fail("Nesting is too deep.");
+		parser.m_tooDeep = true;
+	}
+}
+
+const Token& LangParser::peek() const {
+	return m_pos + 1 < m_end ? (*m_tokens)[m_pos + 1] : m_endToken;
+}
+
+bool LangParser::check(TokenType type, const char* lexeme) const {
+	if (m_pos >= m_end) return false;
+	const Token& tok = (*m_tokens)[m_pos];
+	return tok.type == type && (lexeme == nullptr || tok.lexeme == lexeme);
 }
 
-bool LangParser::expect(TokenType type, const std::string& param, bool regex, bool forceCheck) {
-	if (accept(type, param, regex, forceCheck)) {
+bool LangParser::accept(TokenType type, const char* lexeme) {
+	if (!check(type, lexeme)) return false;
+	next();
+	return true;
+}
+
+bool LangParser::expect(TokenType type, const char* lexeme) {
+	if (accept(type, lexeme)) {
 		return true;
 	}
 
@@ -32,6 +61,7 @@ bool LangParser::expect(TokenType type, const std::string& param, bool regex, bo
 	switch (type) {
 		case TokenType::ID: expc = "Identifier"; break;
 		case TokenType::NUMBER: expc = "Number"; break;
+		case TokenType::INTEGER: expc = "Integer"; break;
 		case TokenType::STRING: expc = "String"; break;
 		case TokenType::CHAR: expc = "Character"; break;
 		case TokenType::OTHER: expc = "Symbol"; break;
@@ -39,104 +69,279 @@ bool LangParser::expect(TokenType type, const std::string& param, bool regex, bo
 		case TokenType::END: expc = "EOF"; break;
 		default: break;
 	}
+	if (lexeme != nullptr) expc = lexeme;
 
-	error(
-		"ERROR(" <<
-		current().line << 
-		":" <<
-		current().pos <<
-		"): Unexpected symbol \"" <<
-		current().lexeme <<
-		"\". Expected \"" <<
-		expc <<
-		"\"."
-	);
+	unexpected("\"" + expc + "\"");
 	return false;
 }
 
-bool LangParser::next() {
-	if (m_pos >= m_tokens.size()) return false;
-	m_pos++;
-	return true;
+void LangParser::next() {
+	if (m_pos < m_end) m_pos++;
+}
+
+void LangParser::fail(const std::string& message) {
+	if (!m_panic) {
+		error(
+			"ERROR(" <<
+			current().line <<
+			":" <<
+			current().pos <<
+			"): " <<
+			message
+		);
+	}
+	m_panic = true;
+}
+
+void LangParser::unexpected(const std::string& expected) {
+	if (atEnd()) {
+		fail("Unexpected end of input. Expected " + expected + ".");
+	} else {
+		fail("Unexpected symbol \"" + current().lexeme + "\". Expected " + expected + ".");
+	}
 }
 
-void LangParser::stepBack() {
-	if (m_pos - 1 < 0) return;
-	m_pos--;
+// Keywords that start a statement, where recovery can pick up again.
+static bool isStatementKeyword(const std::string& word) {
+	static const std::unordered_set<std::string> keywords {
+		"let", "const", "pub", "func", "if", "for", "while", "return", "break", "continue", "import", "yield"
+	};
+	return keywords.count(word) > 0;
 }
 
-Token& LangParser::last() {
-	if (m_pos - 1 < 0) return m_tokens[m_pos];
-	return m_tokens[m_pos - 1];
+// Keywords that can never be a name in an expression.
+static bool isReserved(const std::string& word) {
+	return isStatementKeyword(word) || word == "else" || word == "in";
+}
+
+// Each token is skipped once and nothing is parsed, so recovery costs no
+// more than the tokens it throws away. Nested blocks are skipped whole.
+void LangParser::synchronize() {
+	// Past a statement nested too deep, its keywords only nest deeper.
+	bool keywords = !m_tooDeep;
+	int depth = 0;
+	while (!atEnd()) {
+		const Token& tok = current();
+		if (tok.type == TokenType::SEMI) {
+			next();
+			if (depth == 0 && !check(TokenType::ID, "else")) break;
+		} else if (tok.type == TokenType::OTHER && tok.lexeme == "{") {
+			depth++;
+			next();
+		} else if (tok.type == TokenType::OTHER && tok.lexeme == "}") {
+			// The enclosing block's own '}' is left for it to close.
+			if (depth == 0) break;
+			next();
+			if (--depth == 0 && !check(TokenType::ID, "else")) break;
+		} else if (keywords && depth == 0 && tok.type == TokenType::ID && isStatementKeyword(tok.lexeme)) {
+			break;
+		} else {
+			next();
+		}
+	}
+
+	// Every statement still open at the end of input fails on the same
+	// missing token, which the first error already reported.
+	if (atEnd()) return;
+	m_panic = false;
+	m_tooDeep = false;
+}
+
+const Token& LangParser::last() const {
+	if (m_pos - 1 < m_begin) return current();
+	return (*m_tokens)[m_pos - 1];
 }
 
 void LangParser::parse() {
+	std::vector<Node*> stmts = parseStatements();
+
+	m_ast = std::unique_ptr<Program>(new Program());
+	for (Node* n : stmts) {
+		m_ast->stmts.push_back(NodePtr(n));
+	}
+}
+
+void LangParser::parseParallel(int threads) {
+	ThreadPool pool(threads);
+	parseParallel(pool);
+}
+
+void LangParser::parseParallel(ThreadPool& pool) {
+	// A top-level statement ends after a ';' or a '}' that closes depth 0,
+	// unless an `else` continues it. No statement looks further ahead and
+	// recovery never skips past such a boundary, so each chunk parses
+	// exactly as it would inside the whole stream.
+	std::vector<int> cuts;
+	int depth = 0;
+	for (int i = m_pos; i < m_end; i++) {
+		const Token& tok = (*m_tokens)[i];
+		bool boundary = false;
+		bool continued = i + 1 < m_end && (*m_tokens)[i + 1].lexeme == "else";
+		if (tok.type == TokenType::SEMI) {
+			boundary = depth == 0 && !continued;
+		} else if (tok.type == TokenType::OTHER && tok.lexeme == "{") {
+			depth++;
+		} else if (tok.type == TokenType::OTHER && tok.lexeme == "}") {
+			if (depth > 0) depth--;
+			boundary = depth == 0 && !continued;
+		}
+		if (boundary) cuts.push_back(i + 1);
+	}
+
+	// A few chunks per worker keeps them busy when statement sizes vary,
+	// without paying for a task per statement.
+	int chunkSize = std::max(1, (m_end - m_pos) / (pool.size() * 4));
+	std::vector<std::pair<int, int>> chunks;
+	int begin = m_pos;
+	for (int cut : cuts) {
+		if (cut - begin < chunkSize) continue;
+		chunks.push_back({ begin, cut });
+		begin = cut;
+	}
+	if (begin < m_end) chunks.push_back({ begin, m_end });
+
+	// Each chunk's diagnostics are collected on its worker and reported
+	// here in source order, as parse() would have printed them.
+	struct Part {
+		std::vector<Node*> stmts;
+		std::string diagnostics;
+		int errors = 0;
+	};
+	std::vector<Part> parts(chunks.size());
+	for (size_t i = 0; i < chunks.size(); i++) {
+		pool.submit([this, &chunks, &parts, i] {
+			DiagnosticCapture capture;
+			LangParser parser(m_tokens, chunks[i].first, chunks[i].second);
+			parser.setLazyBodies(m_lazyBodies);
+
+			// Input ending inside the last chunk is reported where parse()
+			// reports it, at the lexer's END token.
+			if (i + 1 == chunks.size()) parser.m_endToken = m_endToken;
+			parts[i].stmts = parser.parseStatements();
+			parts[i].diagnostics = capture.text();
+			parts[i].errors = capture.errors();
+		});
+	}
+	pool.wait();
+	m_pos = m_end;
+	for (auto&& part : parts) {
+		reportCaptured(part.diagnostics, part.errors);
+	}
+
+	m_ast = std::unique_ptr<Program>(new Program());
+	for (auto&& part : parts) {
+		for (Node* n : part.stmts) {
+			m_ast->stmts.push_back(NodePtr(n));
+		}
+	}
+}
+
+std::vector<Node*> LangParser::parseStatements() {
 	std::vector<Node*> stmts;
-	while (m_pos < m_tokens.size()) {
-		stmts.push_back(stmt());
+	for (auto&& range : parseStatementRanges()) {
+		if (range.node != nullptr) stmts.push_back(range.node);
 	}
+	return stmts;
+}
 
-	std::unique_ptr<Program> prog(new Program());
-	for (Node* n : stmts) {
-		if (n == nullptr) continue;
-		prog->stmts.push_back(NodePtr(n));
+std::vector<LangParser::StatementRange> LangParser::parseStatementRanges() {
+	std::vector<StatementRange> ranges;
+	while (m_pos < m_end) {
+		int start = m_pos;
+		Node* n = nullptr;
+		if (check(TokenType::OTHER, "}")) {
+			unexpected("a statement");
+			next();
+			m_panic = false;
+		} else {
+			n = located();
+			if (m_panic) synchronize();
+		}
+
+		// Recovery may stop where the failed statement began.
+		if (m_pos == start) next();
+		ranges.push_back({ n, start, m_pos });
 	}
-	prog->print();
+	return ranges;
 }
 
 Node* LangParser::atom() {
 	if (accept(TokenType::NUMBER)) {
 		return new NumberAtom(last().numberValue);
+	} else if (accept(TokenType::INTEGER)) {
+		return new IntegerAtom(last().integerValue);
 	} else if (accept(TokenType::STRING)) {
 		return new StringAtom(last().stringValue);
 	} else if (accept(TokenType::CHAR)) {
 		return new CharAtom(last().charValue);
-	} else if (accept(TokenType::ID)) {
-		return new IdentifierAtom(last().lexeme);
-	} else if (accept(TokenType::OTHER, "(", false)) {
-		Node* res = test();
-		expect(TokenType::OTHER, ")", false);
-		return res;
-	} else if (accept(TokenType::ID, "true", false, true)) {
+	} else if (accept(TokenType::ID, "true")) {
 		return new BoolAtom(true);
-	} else if (accept(TokenType::ID, "false", false, true)) {
+	} else if (accept(TokenType::ID, "false")) {
 		return new BoolAtom(false);
-	} else {
+	} else if (check(TokenType::ID) && !isReserved(current().lexeme)) {
 		next();
-		return nullptr;
+		return new IdentifierAtom(last().lexeme);
+	} else if (accept(TokenType::OTHER, "(")) {
+		Node* res = test();
+		if (res == nullptr) return nullptr;
+		if (!expect(TokenType::OTHER, ")")) {
+			delete res;
+			return nullptr;
+		}
+		return res;
 	}
+
+	// Nothing is consumed: recovery decides what to skip.
+	unexpected("an expression");
+	return nullptr;
 }
 
 Node* LangParser::power() {
 	Node* left = atom();
 	if (left == nullptr) return nullptr;
 
-	if (accept(TokenType::OTHER, "(", false)) {
-		std::vector<Node*> args;
-		if (current().lexeme != ")") {
-			args = argList();
-		}
-		Node* node = new CallOp(left, args);
-		if (!expect(TokenType::OTHER, ")", false)) {
-			delete node;
+	// Calls and indexing chain: f(x)[i](y).
+	for (;;) {
+		if (accept(TokenType::OTHER, "(")) {
+			std::vector<Node*> args;
+			if (!check(TokenType::OTHER, ")")) {
+				args = argList();
+				if (args.empty()) {
+					delete left;
+					return nullptr;
+				}
+			}
+			left = new CallOp(left, args);
+			if (!expect(TokenType::OTHER, ")")) {
+				delete left;
+				return nullptr;
+			}
+		} else if (accept(TokenType::OTHER, "[")) {
+			Node* index = test();
+			if (index == nullptr) {
+				delete left;
+				return nullptr;
+			}
+			left = new IndexOp(left, index);
+			if (!expect(TokenType::OTHER, "]")) {
+				delete left;
+				return nullptr;
+			}
+		} else if (check(TokenType::OTHER, ".")) {
+			fail("Member access is not supported.");
+			delete left;
 			return nullptr;
+		} else {
+			break;
 		}
-		return node;
-	} else if (accept(TokenType::OTHER, "[", false)) {
-		Node* node = test();
-		if (node == nullptr) return nullptr;
-		if (!expect(TokenType::OTHER, "]", false)) return nullptr;
-		return node;
-	} else if (accept(TokenType::OTHER, ".", false)) {
-		expect(TokenType::ID);
-		Node* right = atom();
-		if (right == nullptr) return nullptr;
-		return right;
 	}
 
-	if (accept(TokenType::OTHER, "**", false)) {
+	if (accept(TokenType::OTHER, "**")) {
 		Node* right = factor();
-		if (right == nullptr) return nullptr;
+		if (right == nullptr) {
+			delete left;
+			return nullptr;
+		}
 
 		return new BinOp(left, right, "**");
 	}
@@ -145,8 +350,12 @@ Node* LangParser::power() {
 }
 
 Node* LangParser::factor() {
-	if (accept(TokenType::OTHER, "[+\\-~]")) {
-		std::string op = last().lexeme;
+	if (check(TokenType::OTHER, "+") || check(TokenType::OTHER, "-") || check(TokenType::OTHER, "~")) {
+		std::string op = current().lexeme;
+		next();
+
+		Nested nested(*this);
+		if (!nested.ok) return nullptr;
 		Node* right = factor();
 		if (right == nullptr) return nullptr;
 
@@ -156,502 +365,558 @@ Node* LangParser::factor() {
 	}
 }
 
-Node* LangParser::term() {
-	Node* left = factor();
-	if (left == nullptr) return nullptr;
-
-	if (accept(TokenType::OTHER, "[*\/%]")) {
-		std::string op = last().lexeme;
-		Node* right = factor();
-		if (right == nullptr) return nullptr;
-
-		return new BinOp(left, right, op);
-	}
-
-	return left;
+static const int ComparisonPrecedence = 3;
+
+// How tightly a binary operator binds, 0 for any other token.
+static int precedence(const Token& tok) {
+	static const std::unordered_map<std::string, int> levels {
+		{ "||", 1 }, { "&&", 2 },
+		{ "<=", 3 }, { ">=", 3 }, { "!=", 3 }, { "==", 3 }, { "is", 3 }, { "has", 3 }, { ">", 3 }, { "<", 3 },
+		{ "|", 4 }, { "^", 5 }, { "&", 6 }, { "<<", 7 }, { ">>", 7 },
+		{ "+", 8 }, { "-", 8 }, { "*", 9 }, { "/", 9 }, { "%", 9 }
+	};
+	if (tok.type != TokenType::OTHER) return 0;
+	auto it = levels.find(tok.lexeme);
+	return it != levels.end() ? it->second : 0;
 }
 
-Node* LangParser::arithExpr() {
-	Node* left = term();
-	if (left == nullptr) return nullptr;
-
-	if (accept(TokenType::OTHER, "[+-]")) {
-		std::string op = last().lexeme;
-		Node* right = term();
+Node* LangParser::binary(int min) {
+	Node* left = nullptr;
+	if (min <= ComparisonPrecedence && accept(TokenType::OTHER, "!")) {
+		Nested nested(*this);
+		if (!nested.ok) return nullptr;
+		Node* right = binary(ComparisonPrecedence);
 		if (right == nullptr) return nullptr;
-
-		return new BinOp(left, right, op);
+		left = new UnOp(right, "!");
+	} else {
+		left = factor();
+		if (left == nullptr) return nullptr;
 	}
 
-	return left;
-}
-
-Node* LangParser::shiftExpr() {
-	Node* left = arithExpr();
-	if (left == nullptr) return nullptr;
-
-	if (accept(TokenType::OTHER, "(>>|<<)")) {
-		std::string op = last().lexeme;
-		Node* right = arithExpr();
-		if (right == nullptr) return nullptr;
+	// Each operator is consumed before its right side is parsed, one level
+	// tighter, so a chain like a - b - c groups to the left.
+	for (int prec = precedence(current()); prec >= min; prec = precedence(current())) {
+		std::string op = current().lexeme;
+		next();
 
-		return new BinOp(left, right, op);
+		Node* right = binary(prec + 1);
+		if (right == nullptr) {
+			delete left;
+			return nullptr;
+		}
+		left = new BinOp(left, right, op);
 	}
 
 	return left;
 }
 
-Node* LangParser::andExpr() {
-	Node* left = shiftExpr();
-	if (left == nullptr) return nullptr;
+Node* LangParser::test() {
+	Nested nested(*this);
+	if (!nested.ok) return nullptr;
 
-	if (accept(TokenType::OTHER, "&", false)) {
-		std::string op = last().lexeme;
-		Node* right = shiftExpr();
-		if (right == nullptr) return nullptr;
+	Node* cond = binary(1);
+	if (cond == nullptr || !accept(TokenType::OTHER, "?")) return cond;
 
-		return new BinOp(left, right, op);
+	Node* left = test();
+	Node* right = nullptr;
+	if (left != nullptr && expect(TokenType::OTHER, ":")) right = test();
+	if (right == nullptr) {
+		delete cond;
+		delete left;
+		return nullptr;
 	}
 
-	return left;
+	return new TernaryOp(cond, left, right);
 }
 
-Node* LangParser::xorExpr() {
-	Node* left = andExpr();
-	if (left == nullptr) return nullptr;
-
-	if (accept(TokenType::OTHER, "^", false)) {
-		std::string op = last().lexeme;
-		Node* right = andExpr();
-		if (right == nullptr) return nullptr;
-
-		return new BinOp(left, right, op);
-	}
+std::vector<Node*> LangParser::argList() {
+	std::vector<Node*> nodes;
+	do {
+		Node* arg = test();
+		if (arg == nullptr) {
+			for (Node* node : nodes) delete node;
+			return {};
+		}
+		nodes.push_back(arg);
+	} while (accept(TokenType::OTHER, ","));
 
-	return left;
+	return nodes;
 }
 
-Node* LangParser::expr() {
-	Node* left = xorExpr();
-	if (left == nullptr) return nullptr;
+Node* LangParser::located() {
+	int line = current().line, pos = current().pos;
+	profileLine(line);
 
-	if (accept(TokenType::OTHER, "|", false)) {
-		std::string op = last().lexeme;
-		Node* right = xorExpr();
-		if (right == nullptr) return nullptr;
-
-		return new BinOp(left, right, op);
+	Node* n = stmt();
+	if (n != nullptr) {
+		n->line = line;
+		n->pos = pos;
 	}
-
-	return left;
+	return n;
 }
 
-Node* LangParser::comparison() {
-	Node* left = expr();
-	if (left == nullptr) return nullptr;
+// A copy of a name or an int literal, which reads the same however often
+// it is evaluated; null for anything else.
+static Node* copySimple(Node* node) {
+	if (IdentifierAtom* id = dynamic_cast<IdentifierAtom*>(node)) return new IdentifierAtom(id->name);
+	if (IntegerAtom* integer = dynamic_cast<IntegerAtom*>(node)) return new IntegerAtom(integer->value);
+	return nullptr;
+}
 
-	if (accept(TokenType::OTHER, "(<=|>=|!=|==|is|has|>|<)")) {
-		std::string op = last().lexeme;
-		Node* right = expr();
-		if (right == nullptr) return nullptr;
-		return new BinOp(left, right, op);
+// A second copy of the target of a compound assignment, to read it with:
+// a name, or an element a[i] whose array and index are simple. Null for
+// anything else.
+static Node* readTarget(Node* target) {
+	IndexOp* element = dynamic_cast<IndexOp*>(target);
+	if (element == nullptr) {
+		IdentifierAtom* id = dynamic_cast<IdentifierAtom*>(target);
+		return id ? new IdentifierAtom(id->name) : nullptr;
+	}
+
+	Node* obj = copySimple(element->obj.get());
+	Node* index = copySimple(element->index.get());
+	if (obj == nullptr || index == nullptr) {
+		delete obj;
+		delete index;
+		return nullptr;
 	}
+	return new IndexOp(obj, index);
+}
 
-	return left;
+// Whether `tok` is a compound assignment operator such as "+=".
+static bool isAugmented(const Token& tok) {
+	static const std::unordered_set<std::string> ops {
+		"+=", "-=", "*=", "/=", "%=", "&=", "|=", "^=", "<<=", ">>=", "**="
+	};
+	return tok.type == TokenType::OTHER && ops.count(tok.lexeme) > 0;
 }
 
-Node* LangParser::notTest() {
-	if (accept(TokenType::OTHER, "!", false)) {
-		Node* right = comparison();
-		if (right == nullptr) return nullptr;
-		return new UnOp(right, "!");
-	} else {
-		return comparison();
-	}
+Node* LangParser::terminated(Node* node) {
+	if (node == nullptr) return nullptr;
+	if (expect(TokenType::SEMI)) return node;
+	delete node;
 	return nullptr;
 }
 
-Node* LangParser::andTest() {
-	Node* left = notTest();
-	if (left == nullptr) return nullptr;
-
-	if (accept(TokenType::OTHER, "&&", false)) {
-		Node* right = notTest();
+Node* LangParser::stmt() {
+	// An empty statement.
+	if (accept(TokenType::SEMI)) return nullptr;
+
+	if (accept(TokenType::ID, "break")) {
+		return terminated(new BreakStmt());
+	} else if (accept(TokenType::ID, "continue")) {
+		return terminated(new ContinueStmt());
+	} else if (accept(TokenType::ID, "return")) {
+		Node* val = nullptr;
+		if (!check(TokenType::SEMI) && (val = test()) == nullptr) return nullptr;
+		return terminated(new ReturnStmt(val));
+	} else if (accept(TokenType::ID, "yield")) {
+		Node* val = nullptr;
+		if (!check(TokenType::SEMI) && (val = test()) == nullptr) return nullptr;
+		return terminated(new YieldStmt(val));
+	} else if (accept(TokenType::OTHER, "++")) {
+		Node* right = test();
 		if (right == nullptr) return nullptr;
-
-		return new BinOp(left, right, "&&");
-	}
-
-	return left;
-}
-
-Node* LangParser::orTest() {
-	Node* left = andTest();
-	if (left == nullptr) return nullptr;
-
-	if (accept(TokenType::OTHER, "||", false)) {
-		Node* right = andTest();
+		return terminated(new IncrementStmt(right, true));
+	} else if (accept(TokenType::OTHER, "--")) {
+		Node* right = test();
 		if (right == nullptr) return nullptr;
-
-		return new BinOp(left, right, "||");
+		return terminated(new DecrementStmt(right, true));
+	} else if (accept(TokenType::ID, "if")) {
+		return ifStmt();
+	} else if (accept(TokenType::ID, "import")) {
+		return importStmt();
+	} else if (check(TokenType::ID, "let") || check(TokenType::ID, "const")) {
+		return letStmt(false);
+	} else if (check(TokenType::ID, "func")) {
+		return funcDef(false);
+	} else if (accept(TokenType::ID, "pub")) {
+		if (check(TokenType::ID, "let") || check(TokenType::ID, "const")) return letStmt(true);
+		if (check(TokenType::ID, "func")) return funcDef(true);
+		unexpected("\"let\", \"const\" or \"func\"");
+		return nullptr;
+	} else if (accept(TokenType::ID, "for")) {
+		return forStmt();
+	} else if (accept(TokenType::ID, "while")) {
+		return whileStmt();
+	} else if (check(TokenType::ID, "parallel") && peek().type == TokenType::ID && peek().lexeme == "for") {
+		// Only a keyword in front of "for"; an ordinary name otherwise.
+		next();
+		next();
+		return forStmt(true);
 	}
 
-	return left;
-}
-
-Node* LangParser::test() {
-	Node* cond = orTest();
-	if (cond == nullptr) return nullptr;
+	Node* left = test();
+	if (left == nullptr) return nullptr;
 
-	if (accept(TokenType::OTHER, "?", false)) {
-		Node* left = test();
-		if (left == nullptr) return nullptr;
-		next();
+	if (accept(TokenType::OTHER, "=")) {
 		Node* right = test();
-		if (right == nullptr) return nullptr;
-
-		return new TernaryOp(cond, left, right);
-	}
+		if (right == nullptr) {
+			delete left;
+			return nullptr;
+		}
+		return terminated(new AssignmentStmt(left, right));
+	} else if (isAugmented(current())) {
+		std::string lex = current().lexeme;
+		std::string op = lex.substr(0, lex.find_last_of('='));
+		next();
 
-	return cond;
-}
+		Node* right = test();
+		if (right == nullptr) {
+			delete left;
+			return nullptr;
+		}
 
-std::vector<Node*> LangParser::argList() {
-	std::vector<Node*> nodes;
-	Node* arg = test();
-	if (arg == nullptr) return nodes;
+		// The target is read and written, but each side needs its own node
+		// since both are owned.
+		Node* target = readTarget(left);
+		if (target == nullptr) {
+			error(
+				"ERROR(" <<
+				last().line <<
+				":" <<
+				last().pos <<
+				"): Invalid target for \"" <<
+				lex <<
+				"\"."
+			);
+			delete left;
+			delete right;
+			accept(TokenType::SEMI);
+			return nullptr;
+		}
 
-	nodes.push_back(arg);
-	while (accept(TokenType::OTHER, ",", false)) {
-		Node* next = test();
-		if (next == nullptr) continue;
-		nodes.push_back(next);
+		return terminated(new AssignmentStmt(left, new BinOp(target, right, op)));
+	} else if (accept(TokenType::OTHER, "++")) {
+		return terminated(new IncrementStmt(left, false));
+	} else if (accept(TokenType::OTHER, "--")) {
+		return terminated(new DecrementStmt(left, false));
 	}
 
-	return nodes;
+	return terminated(left);
 }
 
-Node* LangParser::stmt() {
-	if (accept(TokenType::OTHER, "}", false)) {
-		stepBack();
+Node* LangParser::ifStmt() {
+	Node* cond = test();
+	if (cond == nullptr) return nullptr;
+
+	IfStmt* ifstmt = new IfStmt();
+	ifstmt->cond = NodePtr(cond);
+	if (!body(ifstmt->stmts)) {
+		delete ifstmt;
 		return nullptr;
 	}
 
-	if (accept(TokenType::OTHER, ";", false)) {
-		return new SemicolonStmt();
-	} else if (accept(TokenType::ID, "break", false, true)) {
-		Node* node = new BreakStmt();
-		if (expect(TokenType::SEMI)) return node;
-		else {
-			delete node;
-			return nullptr;
-		}
-	} else if (accept(TokenType::ID, "continue", false, true)) {
-		Node* node = new ContinueStmt();
-		if (expect(TokenType::SEMI)) return node;
-		else {
-			delete node;
-			return nullptr;
-		}
-	} else if (accept(TokenType::ID, "return", false, true)) {
-		Node* val = test();
-		Node* node = new ReturnStmt(val);
-		if (expect(TokenType::SEMI)) return node;
-		else {
-			delete node;
-			return nullptr;
+	while (accept(TokenType::ID, "else")) {
+		IfStmtPtr branch(new IfStmt());
+		bool elseIf = accept(TokenType::ID, "if");
+		if (elseIf) {
+			branch->cond = NodePtr(test());
+			if (!branch->cond) {
+				delete ifstmt;
+				return nullptr;
+			}
 		}
-	} else if (accept(TokenType::OTHER, "++", false)) {
-		Node* right = test();
-		if (right == nullptr) return nullptr;
-
-		Node* node = new IncrementStmt(right, true);
-		if (expect(TokenType::SEMI)) return node;
-		else {
-			delete node;
+		if (!body(branch->stmts)) {
+			delete ifstmt;
 			return nullptr;
 		}
-	} else if (accept(TokenType::OTHER, "--", false)) {
-		Node* right = test();
-		if (right == nullptr) return nullptr;
 
-		Node* node = new DecrementStmt(right, true);
-		if (expect(TokenType::SEMI)) return node;
-		else {
-			delete node;
-			return nullptr;
+		if (!elseIf) {
+			ifstmt->elseStmt = std::move(branch);
+			break;
 		}
-	} else if (accept(TokenType::ID, "if", false, true)) {
-		return ifStmt();
+		ifstmt->elseIfs.push_back(std::move(branch));
 	}
+	return ifstmt;
+}
 
-	Node* letDef = letStmt();
-	if (letDef != nullptr) {
-		return letDef;
-	}
+bool LangParser::body(NodeList& stmts) {
+	if (check(TokenType::OTHER, "{")) return block(stmts);
+
+	Nested nested(*this);
+	if (!nested.ok) return false;
+
+	Node* n = located();
+	if (n != nullptr) stmts.push_back(NodePtr(n));
+	return !m_panic;
+}
 
-	Node* forDef = forStmt();
-	if (forDef != nullptr) {
-		return forDef;
+bool LangParser::block(NodeList& stmts) {
+	if (!expect(TokenType::OTHER, "{")) return false;
+
+	Nested nested(*this);
+	if (!nested.ok) {
+		// Dropped whole, so the code around it still parses.
+		for (int depth = 1; !atEnd() && depth > 0; next()) {
+			if (check(TokenType::OTHER, "{")) depth++;
+			else if (check(TokenType::OTHER, "}")) depth--;
+		}
+		m_panic = m_tooDeep = false;
+		return true;
 	}
 
-	Node* whileDef = whileStmt();
-	if (whileDef != nullptr) {
-		return whileDef;
+	while (!atEnd() && !check(TokenType::OTHER, "}")) {
+		int start = m_pos;
+		Node* n = located();
+		if (n != nullptr) stmts.push_back(NodePtr(n));
+		if (m_panic) synchronize();
+		if (m_pos == start) next();
 	}
+	return expect(TokenType::OTHER, "}");
+}
 
-	Node* func = funcDef();
-	if (func != nullptr) {
-		return func;
+Node* LangParser::letStmt(bool publicLet) {
+	next();
+	if (!check(TokenType::ID)) {
+		fail("Expected variable list.");
+		return nullptr;
 	}
 
-	Node* left = test();
-	if (accept(TokenType::OTHER, "=", false)) {
-		Node* right = test();
-		if (right == nullptr) return nullptr;
-		if (expect(TokenType::SEMI)) return new AssignmentStmt(left, right);
-	} else if (accept(TokenType::OTHER, "(\\+=|-=|\\*=|\\/=|%=|&=|\\|=|^=|<<=|>>=|\\*\\*=)")) {
-		std::string lex = last().lexeme;
-		std::string op = lex.substr(0, lex.find_last_of('='));
-		Node* right = test();
-		if (right == nullptr) return nullptr;
+	std::vector<Node*> params = paramList();
+	if (params.empty()) return nullptr;
 
-		Node* node = new AssignmentStmt(left, new BinOp(left, right, op));
-		if (expect(TokenType::SEMI)) return node;
-		else {
-			delete node;
-			return nullptr;
-		}
-	} else {
-		return left;
+	LetStmt* let = new LetStmt();
+	for (Node* node : params) {
+		let->variableList.push_back(ParamPtr((ParamStmt*) node));
 	}
+	let->publicLet = publicLet;
 
-	return new EOFAtom();
+	return terminated(let);
 }
 
-// 'if' test '{' stmt* '}' ('else if' test '{' stmt* '}')* ('else' '{' stmt* '}')?
-Node* LangParser::ifStmt() {
-	IfStmt* ifstmt = new IfStmt();
-	Node* cond = test();
-	if (cond == nullptr) stepBack();
+Node* LangParser::funcDef(bool publicFunc) {
+	next();
+	if (!expect(TokenType::ID)) return nullptr;
+	std::string name = last().lexeme;
 
-	if (expect(TokenType::OTHER, "{", false)) {
-		if (cond != nullptr) ifstmt->cond = NodePtr(cond);
-
-		std::vector<Node*> stmts0 = stmtList();
-		for (Node* node : stmts0) {
-			if (node == nullptr) continue;
-			ifstmt->stmts.push_back(NodePtr(node));
-		}
+	if (!expect(TokenType::OTHER, "(")) return nullptr;
+	std::vector<Node*> params;
+	if (!check(TokenType::OTHER, ")")) {
+		params = paramList();
+		if (params.empty()) return nullptr;
+	}
 
-		bool hasElseIf = false;
-		while (accept(TokenType::ID, "else", false, true) &&
-			   accept(TokenType::ID, "if", false, true))
-		{
-			IfStmt* elseifstmt = new IfStmt();
-			elseifstmt->cond = NodePtr(test());
+	FuncDefStmt* func = new FuncDefStmt();
+	for (Node* node : params) {
+		func->paramList.push_back(ParamPtr((ParamStmt*) node));
+	}
+	func->publicFunc = publicFunc;
+	func->name = name;
 
-			next();
-			std::vector<Node*> stmts1 = stmtList();
-			for (Node* node : stmts1) {
-				if (node == nullptr) continue;
-				elseifstmt->stmts.push_back(NodePtr(node));
-			}
+	if (!expect(TokenType::OTHER, ")")) {
+		delete func;
+		return nullptr;
+	}
 
-			ifstmt->elseIfs.push_back(IfStmtPtr(elseifstmt));
-			hasElseIf = true;
-		}
+	if (!m_lazyBodies) {
+		ProfileScope scope(name);
+		int errors = reportedErrors();
+		bool ok = block(func->stmts);
+		func->bodyErrors = reportedErrors() - errors;
+		if (ok) return func;
+		delete func;
+		return nullptr;
+	}
 
-		if (hasElseIf) {
-			stepBack();
-		}
+	if (!expect(TokenType::OTHER, "{")) {
+		delete func;
+		return nullptr;
+	}
 
-		if (accept(TokenType::ID, "else", false, true)) {
-			IfStmt* elsestmt = new IfStmt();
+	// Pre-parse: only match braces and remember where the body is.
+	int begin = m_pos;
+	int balance = 1;
+	while (m_pos < m_end) {
+		const Token& tok = current();
+		if (tok.type == TokenType::OTHER && tok.lexeme == "{") balance++;
+		else if (tok.type == TokenType::OTHER && tok.lexeme == "}" && --balance == 0) break;
+		next();
+	}
+	func->source = m_tokens;
+	func->bodyBegin = begin;
+	func->bodyEnd = m_pos;
+	func->parsed = false;
 
-			next();
-			std::vector<Node*> stmts1 = stmtList();
-			for (Node* node : stmts1) {
-				if (node == nullptr) continue;
-				elsestmt->stmts.push_back(NodePtr(node));
-			}
-			ifstmt->elseStmt = IfStmtPtr(elsestmt);
-		}
-	} else {
-		delete ifstmt;
+	if (!expect(TokenType::OTHER, "}")) {
+		delete func;
 		return nullptr;
 	}
-	return ifstmt;
+	return func;
 }
 
-std::vector<Node*> LangParser::stmtList() {
-	std::vector<Node*> stmts;
-	int balance = 1;
-	stepBack();
-	if (accept(TokenType::OTHER, "{", false)) {
-		while (balance > 0) {
-			Node* n = stmt();
-			if (n != nullptr) stmts.push_back(n);
-			if (current().lexeme == "{") {
-				balance++;
-			} else if (current().lexeme == "}") {
-				balance--;
-			}
+NodeList& FuncDefStmt::body() {
+	if (parsed.load(std::memory_order_acquire)) return stmts;
+
+	std::lock_guard<std::mutex> lock(bodyMutex);
+	if (!parsed.load(std::memory_order_relaxed)) {
+		ProfileScope scope(name);
+		int errors = reportedErrors();
+		LangParser parser(source, bodyBegin, bodyEnd);
+		for (Node* n : parser.parseStatements()) {
+			stmts.push_back(NodePtr(n));
 		}
-		next();
+		bodyErrors = reportedErrors() - errors;
+		source.reset();
+		parsed.store(true, std::memory_order_release);
 	}
 	return stmts;
 }
 
-Node* LangParser::letStmt() {
-	bool publicLet = false;
-	if (accept(TokenType::ID, "pub", false, true)) {
-		publicLet = true;
-	}
-	if (accept(TokenType::ID, "let", false, true) ||
-		accept(TokenType::ID, "const", false, true))
-	{
-		std::vector<Node*> params = paramList();
-		if (params.empty()) {
-			error(
-				"ERROR(" <<
-				current().line <<
-				":" <<
-				current().pos <<
-				"): Expected variable list."
-			);
+Node* LangParser::importStmt() {
+	ImportStmt* node = new ImportStmt();
+
+	do {
+		if (!expect(TokenType::ID)) {
+			delete node;
 			return nullptr;
 		}
+		if (!node->module.empty()) node->module += ".";
+		node->module += last().lexeme;
+	} while (accept(TokenType::OTHER, "."));
+
+	if (accept(TokenType::OTHER, "(")) {
+		do {
+			if (!expect(TokenType::ID)) {
+				delete node;
+				return nullptr;
+			}
+			node->names.push_back(last().lexeme);
+		} while (accept(TokenType::OTHER, ","));
 
-		LetStmt* let = new LetStmt();
-		for (Node* node : params) {
-			let->variableList.push_back(ParamPtr((ParamStmt*) node));
+		if (!expect(TokenType::OTHER, ")")) {
+			delete node;
+			return nullptr;
 		}
-		let->publicLet = publicLet;
-
-		return let;
-	}
-	return nullptr;
-}
-
-Node* LangParser::funcDef() {
-	bool publicFunc = false;
-	if (accept(TokenType::ID, "pub", false, true)) {
-		publicFunc = true;
 	}
 
-	if (accept(TokenType::ID, "func", false, true)) {
-		std::string name = current().lexeme;
-		next();
+	return terminated(node);
+}
 
-		if (expect(TokenType::OTHER, "(", false)) {
-			std::vector<Node*> params;
-			if (current().lexeme != ")")
-				params = paramList();
-			next();
+// A reduction operator, "+" or "+:" since "+:" lexes as one symbol.
+static bool isReduction(const Token& tok) {
+	if (tok.type != TokenType::OTHER) return false;
+	const std::string& lex = tok.lexeme;
+	size_t size = lex.size() == 2 && lex[1] == ':' ? 1 : lex.size();
+	return size == 1 && std::strchr("+*&|^", lex[0]) != nullptr;
+}
 
-			FuncDefStmt* func = new FuncDefStmt();
-			
-			for (Node* node : params) {
-				func->paramList.push_back(ParamPtr((ParamStmt*) node));
-			}
-			func->publicFunc = publicFunc;
-			func->name = name;
+Node* LangParser::forStmt(bool parallel) {
+	std::vector<Node*> idList = paramList(false);
+	if (idList.empty()) return nullptr;
 
-			std::vector<Node*> stmts;
-			if (expect(TokenType::OTHER, "{", false)) {
-				stmts = stmtList();
-			}
+	ForStmt* forStmt = new ForStmt();
+	forStmt->parallel = parallel;
+	for (Node* n : idList) {
+		forStmt->vars.push_back(NodePtr(n));
+	}
 
-			for (Node* n : stmts) {
-				func->stmts.push_back(NodePtr(n));
-			}
+	if (!expect(TokenType::ID, "in")) {
+		delete forStmt;
+		return nullptr;
+	}
 
-			return func;
-		}
+	forStmt->iter = NodePtr(test());
+	if (forStmt->iter && accept(TokenType::OTHER, "..")) {
+		Node* to = test();
+		if (to != nullptr) forStmt->iter = NodePtr(new RangeStmt(forStmt->iter.release(), to));
+		else forStmt->iter.reset();
+	}
+	if (!forStmt->iter) {
+		delete forStmt;
+		return nullptr;
 	}
-	return nullptr;
-}
 
-Node* LangParser::forStmt() {
-	if (accept(TokenType::ID, "for", false, true)) {
-		std::vector<Node*> idList = paramList(false);
-		if (expect(TokenType::ID, "in", false, true)) {
-			Node* a = test();
-			Node* iter = a;
-			if (accept(TokenType::OTHER, "..", false)) {
-				Node* b = test();
-				if (b == nullptr) return nullptr;
-				iter = new RangeStmt(a, b);
+	if (parallel && accept(TokenType::ID, "reduce")) {
+		bool ok = expect(TokenType::OTHER, "(");
+		while (ok) {
+			if (!isReduction(current())) {
+				unexpected("a reduction operator");
+				ok = false;
+				break;
 			}
+			std::string op = current().lexeme;
+			next();
+			if (op.back() == ':') op.pop_back();
+			else if (!expect(TokenType::OTHER, ":")) ok = false;
 
-			std::vector<Node*> stmts;
-			if (expect(TokenType::OTHER, "{", false)) {
-				stmts = stmtList();
+			if (ok && expect(TokenType::ID)) {
+				forStmt->reductions.push_back({ op, last().lexeme });
+			} else {
+				ok = false;
 			}
+			if (!ok || !accept(TokenType::OTHER, ",")) break;
+		}
+		if (!ok || !expect(TokenType::OTHER, ")")) {
+			delete forStmt;
+			return nullptr;
+		}
+	}
 
-			ForStmt* forStmt = new ForStmt();
-			forStmt->iter = NodePtr(iter);
-			
-			for (Node* n : idList) {
-				forStmt->vars.push_back(NodePtr(n));
-			}
+	if (!body(forStmt->stmts)) {
+		delete forStmt;
+		return nullptr;
+	}
+	return forStmt;
+}
 
-			for (Node* n : stmts) {
-				forStmt->stmts.push_back(NodePtr(n));
-			}
+Node* LangParser::whileStmt() {
+	Node* cond = test();
+	if (cond == nullptr) return nullptr;
 
-			return forStmt;
-		}
+	WhileStmt* whileStmt = new WhileStmt();
+	whileStmt->cond = NodePtr(cond);
+	if (!body(whileStmt->stmts)) {
+		delete whileStmt;
+		return nullptr;
 	}
-	return nullptr;
+	return whileStmt;
 }
 
-Node* LangParser::whileStmt() {
-	if (accept(TokenType::ID, "while", false, true)) {
-		Node* cond = test();
-		if (cond == nullptr) return nullptr;
+Node* LangParser::param(bool defaults) {
+	if (!expect(TokenType::ID)) return nullptr;
 
-		std::vector<Node*> stmts;
-		if (expect(TokenType::OTHER, "{", false)) {
-			stmts = stmtList();
+	ParamStmt* p = new ParamStmt();
+	p->name = last().lexeme;
+	if (accept(TokenType::OTHER, ":")) {
+		if (!expect(TokenType::ID)) {
+			delete p;
+			return nullptr;
 		}
-
-		WhileStmt* whileStmt = new WhileStmt();
-		whileStmt->cond = NodePtr(cond);
-		for (Node* n : stmts) {
-			whileStmt->stmts.push_back(NodePtr(n));
+		p->typeName = last().lexeme;
+		p->type = valueTypeFromName(p->typeName);
+		if (p->type == ValueType::Unknown) {
+			error(
+				"ERROR(" <<
+				last().line <<
+				":" <<
+				last().pos <<
+				"): Unknown type \"" <<
+				p->typeName <<
+				"\"."
+			);
 		}
-
-		return whileStmt;
 	}
-	return nullptr;
-}
-
-Node* LangParser::param(bool checkAssign) {
-	if (expect(TokenType::ID)) {
-		ParamStmt* p = new ParamStmt();
-		p->name = last().lexeme;
-		if (accept(TokenType::OTHER, "=", false) && checkAssign) {
-			Node* val = test();
-			p->value = NodePtr(val);
+	if (defaults && accept(TokenType::OTHER, "=")) {
+		p->value = NodePtr(test());
+		if (!p->value) {
+			delete p;
+			return nullptr;
 		}
-		return p;
 	}
-	return nullptr;
+	return p;
 }
 
-std::vector<Node*> LangParser::paramList(bool checkAssign) {
+std::vector<Node*> LangParser::paramList(bool defaults) {
 	std::vector<Node*> nodes;
-	Node* arg = param(checkAssign);
-	if (arg == nullptr) return nodes;
-
-	nodes.push_back(arg);
-	while (accept(TokenType::OTHER, ",", false)) {
-		Node* next = param(checkAssign);
-		if (next == nullptr) continue;
-		nodes.push_back(next);
-	}
+	do {
+		Node* p = param(defaults);
+		if (p == nullptr) {
+			for (Node* node : nodes) delete node;
+			return {};
+		}
+		nodes.push_back(p);
+	} while (accept(TokenType::OTHER, ","));
 
 	return nodes;
 }
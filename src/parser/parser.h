@@ -4,16 +4,26 @@
 #include <iostream>
 #include <memory>
 #include "../lexer/lexer.h"
+#include "../util/diagnostics.h"
+#include "visitor.h"
+#include "valuetype.h"
 
 #define log(x) std::cout << x << std::endl
-#define error(x) std::cerr << x << std::endl
+#define error(x) reportError() << x << std::endl
+
+class ThreadPool;
 
 struct Node;
 using NodePtr = std::unique_ptr<Node>;
 using NodeList = std::vector<NodePtr>;
+using TokenStream = std::shared_ptr<const std::vector<Token>>;
 struct Node {
-	virtual void visit() {}
-	virtual void print(int pad = 0) { log("NaN"); }
+	// Position of the first token, set for statements.
+	int line = 0, pos = 0;
+
+	virtual ~Node() = default;
+	virtual void visit(NodeVisitor& /* v */) {}
+	virtual void print(int /* pad */ = 0) { log("NaN"); }
 };
 
 struct Program : public Node {
@@ -21,11 +31,18 @@ struct Program : public Node {
 
 	Program() = default;
 
+	void visit(NodeVisitor& v) { v.visit(*this); }
+
 	void print(int pad = 0) {
 		for (auto&& node : stmts) node->print(pad);
 	}
 };
 
+// A recursive descent parser that never backtracks: every token is looked at
+// a bounded number of times, so parsing is linear in the input, malformed or
+// not. A syntax error puts the parser in panic mode, which silences further
+// errors until synchronize() has skipped to the next statement; parsing then
+// goes on, so one pass reports every error.
 class LangParser {
 public:
 	LangParser() = default;
@@ -33,60 +50,127 @@ public:
 
 	LangParser(const std::vector<Token>& tokens);
 
-	bool accept(TokenType type, const std::string& param = "", bool regex = true, bool forceCheck = false);
-	bool expect(TokenType type, const std::string& param = "", bool regex = true, bool forceCheck = false);
-
-	bool next();
-	void stepBack();
+	// Parses only the tokens in [begin, end), e.g. a function body.
+	LangParser(const TokenStream& tokens, int begin, int end);
 
-	Token& current() { return m_tokens[m_pos]; }
-	Token& last();
+	const Token& current() const { return m_pos < m_end ? (*m_tokens)[m_pos] : m_endToken; }
+	const Token& last() const;
 
 	void parse();
+	std::vector<Node*> parseStatements();
+
+	// Same result as parse(). A brace-matching pre-scan splits the tokens at
+	// top-level statement boundaries and the chunks are parsed on `pool`,
+	// then stitched back together in source order, diagnostics included.
+	void parseParallel(ThreadPool& pool);
+	void parseParallel(int threads = 0);
+
+	// A statement and the token range [begin, end) it was parsed from.
+	// `node` is null for tokens that did not produce a statement.
+	struct StatementRange {
+		Node* node;
+		int begin, end;
+	};
+	std::vector<StatementRange> parseStatementRanges();
+
+	Program* program() { return m_ast.get(); }
+	std::unique_ptr<Program> takeProgram() { return std::move(m_ast); }
+
+	// When set (the default), function bodies are only brace-matched during
+	// parse() and built on first use through FuncDefStmt::body().
+	void setLazyBodies(bool lazy) { m_lazyBodies = lazy; }
+
+	// Blocks and expressions nested deeper than this are an error, which
+	// keeps the recursion off the end of the stack.
+	static const int MaxNesting = 256;
 
 private:
-	std::vector<Token> m_tokens;
-	int m_pos;
+	TokenStream m_tokens;
+	int m_pos, m_begin, m_end;
+	Token m_endToken;
+	bool m_lazyBodies = true;
 
-	std::unique_ptr<Node> m_ast;
+	// Set by the first error of a statement, cleared by synchronize().
+	// m_tooDeep also marks that error as nesting past MaxNesting.
+	bool m_panic = false, m_tooDeep = false;
+	int m_nesting = 0;
 
-	Node* atom();
-	Node* power();
-	Node* factor();
+	std::unique_ptr<Program> m_ast;
+
+	// One level of nesting while alive; `ok` is false past MaxNesting.
+	struct Nested {
+		LangParser& parser;
+		bool ok;
+
+		Nested(LangParser& parser);
+		~Nested() { parser.m_nesting--; }
+	};
 
-	// term: factor (('*'|'/'|'%') factor)*
-	Node* term();
-	Node* arithExpr();
-
-	Node* shiftExpr();
-	Node* andExpr();
-	Node* xorExpr();
-	Node* expr();
-
-	// augassign (\+=|-=|\*=|\/=|%=|&=|\|=|^=|<<=|>>=|\*\*=)
-	// comp (<=|>=|!=|==|is|has|>|<)
-	Node* comparison();
-	Node* notTest();
-	Node* andTest();
-	Node* orTest();
+	bool atEnd() const { return m_pos >= m_end; }
+	const Token& peek() const;
+
+	// A null `lexeme` matches any token of `type`.
+	bool check(TokenType type, const char* lexeme = nullptr) const;
+	bool accept(TokenType type, const char* lexeme = nullptr);
+	bool expect(TokenType type, const char* lexeme = nullptr);
+	void next();
+
+	// Reports `message` at the current token unless already in panic mode.
+	void fail(const std::string& message);
+	void unexpected(const std::string& expected);
+
+	// Skips to where the next statement can start: after a ';' or a closed
+	// block, or before a '}' or statement keyword of the enclosing block.
+	void synchronize();
+
+	// test: binary(1) ('?' test ':' test)?
 	Node* test();
 
+	// Operators of precedence `min` and up, left-associative:
+	//   1 ||   2 &&   3 <= >= != == is has > <   4 |   5 ^   6 &
+	//   7 << >>   8 + -   9 * / %
+	// A prefix '!' applies to a whole level 3 expression: !a == b is !(a == b).
+	Node* binary(int min);
+
+	// factor: ('+'|'-'|'~') factor | power
+	Node* factor();
+
+	// power: atom ('(' argList? ')' | '[' test ']')* ('**' factor)?
+	Node* power();
+	Node* atom();
+
 	std::vector<Node*> argList();
 
+	// stmt() plus the position of its first token.
+	Node* located();
 	Node* stmt();
+
+	// Expects the ';' ending `node`; deletes it and returns null without one.
+	Node* terminated(Node* node);
+
+	// 'if' test body ('else' 'if' test body)* ('else' body)?
 	Node* ifStmt();
-	std::vector<Node*> stmtList();
 
-	Node* letStmt();
+	// '{' stmt* '}', or a single statement.
+	bool body(NodeList& stmts);
+	bool block(NodeList& stmts);
+
+	// ('let'|'const') paramList ';'
+	Node* letStmt(bool publicLet);
 
-	Node* param(bool checkAssign = true);
-	std::vector<Node*> paramList(bool checkAssign = true);
+	Node* param(bool defaults = true);
+	std::vector<Node*> paramList(bool defaults = true);
 
-	Node* funcDef();
+	// 'func' ID '(' paramList? ')' '{' stmt* '}'
+	Node* funcDef(bool publicFunc);
 
-	Node* forStmt();
+	// ('parallel')? 'for' paramList 'in' test ('..' test)?
+	//     ('reduce' '(' op ':' ID (',' op ':' ID)* ')')? body
+	Node* forStmt(bool parallel = false);
 	Node* whileStmt();
 
+	// import ID ('.' ID)* ('(' ID (',' ID)* ')')? ';'
+	Node* importStmt();
 };
 
 #endif // LANG_PARSER_H
\ No newline at end of file
@@ -0,0 +1,457 @@
+#include "serialize.h"
+
+#include <cstring>
+
+#include "detail/atom.hpp"
+#include "detail/ops.hpp"
+#include "detail/stmts.hpp"
+
+enum class NodeTag : uint8_t {
+	Null = 0,
+	Program,
+	EOFAtom, BoolAtom, IdentifierAtom, NumberAtom, IntegerAtom, StringAtom, CharAtom,
+	BinOp, UnOp, TernaryOp, CallOp,
+	SemicolonStmt, BreakStmt, ContinueStmt, AssignmentStmt, IncrementStmt, DecrementStmt,
+	IfStmt, ParamStmt, LetStmt, FuncDefStmt, ReturnStmt, ForStmt, RangeStmt, WhileStmt,
+	ImportStmt, YieldStmt, IndexOp,
+	Last
+};
+
+class AstWriter : public NodeVisitor {
+public:
+	AstWriter(std::string& out) : m_out(out) {}
+
+	void node(Node* node) {
+		if (node == nullptr) {
+			tag(NodeTag::Null);
+			return;
+		}
+		node->visit(*this);
+		u32(node->line);
+		u32(node->pos);
+	}
+
+	template <typename T>
+	void list(std::vector<std::unique_ptr<T>>& nodes) {
+		u32(nodes.size());
+		for (auto&& n : nodes) node(n.get());
+	}
+
+	void visit(Program& node) { tag(NodeTag::Program); list(node.stmts); }
+
+	void visit(EOFAtom& /* node */) { tag(NodeTag::EOFAtom); }
+	void visit(BoolAtom& node) { tag(NodeTag::BoolAtom); u8(node.value); }
+	void visit(IdentifierAtom& node) { tag(NodeTag::IdentifierAtom); str(node.name); }
+	void visit(NumberAtom& node) { tag(NodeTag::NumberAtom); raw(&node.value, 8); }
+	void visit(IntegerAtom& node) { tag(NodeTag::IntegerAtom); raw(&node.value, 8); }
+	void visit(StringAtom& node) { tag(NodeTag::StringAtom); str(node.value); }
+	void visit(CharAtom& node) { tag(NodeTag::CharAtom); u8(node.value); }
+
+	void visit(BinOp& node) {
+		tag(NodeTag::BinOp);
+		str(node.op);
+		u8(uint8_t(node.operandType));
+		this->node(node.left.get());
+		this->node(node.right.get());
+	}
+
+	void visit(UnOp& node) {
+		tag(NodeTag::UnOp);
+		str(node.op);
+		u8(uint8_t(node.operandType));
+		this->node(node.right.get());
+	}
+
+	void visit(TernaryOp& node) {
+		tag(NodeTag::TernaryOp);
+		this->node(node.cond.get());
+		this->node(node.left.get());
+		this->node(node.right.get());
+	}
+
+	void visit(CallOp& node) {
+		tag(NodeTag::CallOp);
+		this->node(node.func.get());
+		list(node.items);
+	}
+
+	void visit(IndexOp& node) {
+		tag(NodeTag::IndexOp);
+		this->node(node.obj.get());
+		this->node(node.index.get());
+	}
+
+	void visit(SemicolonStmt& /* node */) { tag(NodeTag::SemicolonStmt); }
+	void visit(BreakStmt& /* node */) { tag(NodeTag::BreakStmt); }
+	void visit(ContinueStmt& /* node */) { tag(NodeTag::ContinueStmt); }
+
+	void visit(AssignmentStmt& node) {
+		tag(NodeTag::AssignmentStmt);
+		this->node(node.left.get());
+		this->node(node.right.get());
+	}
+
+	void visit(IncrementStmt& node) {
+		tag(NodeTag::IncrementStmt);
+		u8(node.pre);
+		this->node(node.node.get());
+	}
+
+	void visit(DecrementStmt& node) {
+		tag(NodeTag::DecrementStmt);
+		u8(node.pre);
+		this->node(node.node.get());
+	}
+
+	void visit(IfStmt& node) {
+		tag(NodeTag::IfStmt);
+		this->node(node.cond.get());
+		list(node.stmts);
+		list(node.elseIfs);
+		this->node(node.elseStmt.get());
+	}
+
+	void visit(ParamStmt& node) {
+		tag(NodeTag::ParamStmt);
+		str(node.name);
+		str(node.typeName);
+		u8(uint8_t(node.type));
+		this->node(node.value.get());
+	}
+
+	void visit(LetStmt& node) {
+		tag(NodeTag::LetStmt);
+		u8(node.publicLet);
+		list(node.variableList);
+	}
+
+	void visit(FuncDefStmt& node) {
+		tag(NodeTag::FuncDefStmt);
+		str(node.name);
+		u8(node.publicFunc);
+		list(node.paramList);
+		list(node.body());
+	}
+
+	void visit(ReturnStmt& node) {
+		tag(NodeTag::ReturnStmt);
+		this->node(node.value.get());
+	}
+
+	void visit(YieldStmt& node) {
+		tag(NodeTag::YieldStmt);
+		this->node(node.value.get());
+	}
+
+	void visit(ForStmt& node) {
+		tag(NodeTag::ForStmt);
+		list(node.vars);
+		this->node(node.iter.get());
+		list(node.stmts);
+		u8(node.parallel);
+		u32(node.reductions.size());
+		for (auto&& reduction : node.reductions) {
+			str(reduction.op);
+			str(reduction.name);
+		}
+	}
+
+	void visit(RangeStmt& node) {
+		tag(NodeTag::RangeStmt);
+		this->node(node.from.get());
+		this->node(node.to.get());
+	}
+
+	void visit(WhileStmt& node) {
+		tag(NodeTag::WhileStmt);
+		this->node(node.cond.get());
+		list(node.stmts);
+	}
+
+	void visit(ImportStmt& node) {
+		tag(NodeTag::ImportStmt);
+		str(node.module);
+		u32(node.names.size());
+		for (auto&& name : node.names) str(name);
+	}
+
+private:
+	std::string& m_out;
+
+	void raw(const void* data, size_t size) { m_out.append((const char*) data, size); }
+	void u8(uint8_t value) { m_out.push_back(char(value)); }
+	void u32(uint32_t value) { raw(&value, 4); }
+	void tag(NodeTag tag) { u8(uint8_t(tag)); }
+	void str(const std::string& value) { u32(value.size()); m_out.append(value); }
+};
+
+class AstReader {
+public:
+	AstReader(const char* data, size_t size) : m_pos(data), m_end(data + size) {}
+
+	bool failed() const { return m_failed; }
+	bool atEnd() const { return m_pos == m_end; }
+
+	// A node's fields, then its position. Nodes nested deeper than the
+	// parser allows (LangParser::MaxNesting) fail the read rather than
+	// the stack; the few scripts that get there, such as long operator
+	// chains, are parsed again instead.
+	Node* node() {
+		if (++m_depth > LangParser::MaxNesting) m_failed = true;
+		Node* n = fields(NodeTag(u8()));
+		if (n != nullptr) {
+			n->line = u32();
+			n->pos = u32();
+		}
+		m_depth--;
+		return n;
+	}
+
+	// A child the parser always sets. Null here means the data is corrupt,
+	// and would only crash a later pass.
+	Node* required() {
+		if (peek() == uint8_t(NodeTag::Null)) m_failed = true;
+		return m_failed ? nullptr : node();
+	}
+
+	// A child that must be of type T (else-if branches, parameters), or
+	// null where it is `optional`.
+	template <typename T>
+	T* node(NodeTag expected, bool optional = false) {
+		if (peek() != uint8_t(expected) && !(optional && peek() == uint8_t(NodeTag::Null))) m_failed = true;
+		return m_failed ? nullptr : (T*) node();
+	}
+
+	template <typename T>
+	void list(std::vector<std::unique_ptr<T>>& nodes, NodeTag expected) {
+		uint32_t count = u32();
+		// Every node takes at least one byte, which bounds a corrupt count.
+		if (count > size_t(m_end - m_pos)) m_failed = true;
+		for (uint32_t i = 0; i < count && !m_failed; i++) {
+			nodes.emplace_back(node<T>(expected));
+		}
+	}
+
+	void list(NodeList& nodes) {
+		uint32_t count = u32();
+		if (count > size_t(m_end - m_pos)) m_failed = true;
+		for (uint32_t i = 0; i < count && !m_failed; i++) {
+			nodes.emplace_back(required());
+		}
+	}
+
+private:
+	const char* m_pos;
+	const char* m_end;
+	bool m_failed = false;
+	int m_depth = 0;
+	bool m_elseBranch = false;  // the next IfStmt is an else branch
+
+	Node* fields(NodeTag tag);
+
+	bool raw(void* out, size_t size) {
+		if (m_failed || size_t(m_end - m_pos) < size) {
+			m_failed = true;
+			std::memset(out, 0, size);
+			return false;
+		}
+		std::memcpy(out, m_pos, size);
+		m_pos += size;
+		return true;
+	}
+
+	uint8_t peek() { return m_pos < m_end ? uint8_t(*m_pos) : uint8_t(NodeTag::Last); }
+	uint8_t u8() { uint8_t v; raw(&v, 1); return v; }
+	uint32_t u32() { uint32_t v; raw(&v, 4); return v; }
+
+	std::string str() {
+		uint32_t size = u32();
+		if (m_failed || size_t(m_end - m_pos) < size) {
+			m_failed = true;
+			return "";
+		}
+		std::string value(m_pos, size);
+		m_pos += size;
+		return value;
+	}
+
+	ValueType type() {
+		uint8_t v = u8();
+		if (v > uint8_t(ValueType::Any)) m_failed = true;
+		return ValueType(v);
+	}
+};
+
+Node* AstReader::fields(NodeTag tag) {
+	if (m_failed) return nullptr;
+
+	switch (tag) {
+		case NodeTag::Null: return nullptr;
+		case NodeTag::Program: {
+			Program* n = new Program();
+			list(n->stmts);
+			return n;
+		}
+
+		case NodeTag::EOFAtom: return new EOFAtom();
+		case NodeTag::BoolAtom: return new BoolAtom(u8() != 0);
+		case NodeTag::IdentifierAtom: return new IdentifierAtom(str());
+		case NodeTag::NumberAtom: {
+			NumberAtom* n = new NumberAtom();
+			raw(&n->value, 8);
+			return n;
+		}
+		case NodeTag::IntegerAtom: {
+			IntegerAtom* n = new IntegerAtom();
+			raw(&n->value, 8);
+			return n;
+		}
+		case NodeTag::StringAtom: return new StringAtom(str());
+		case NodeTag::CharAtom: return new CharAtom(char(u8()));
+
+		case NodeTag::BinOp: {
+			BinOp* n = new BinOp();
+			n->op = str();
+			n->operandType = type();
+			n->left.reset(required());
+			n->right.reset(required());
+			return n;
+		}
+		case NodeTag::UnOp: {
+			UnOp* n = new UnOp();
+			n->op = str();
+			n->operandType = type();
+			n->right.reset(required());
+			return n;
+		}
+		case NodeTag::TernaryOp: {
+			TernaryOp* n = new TernaryOp();
+			n->cond.reset(required());
+			n->left.reset(required());
+			n->right.reset(required());
+			return n;
+		}
+		case NodeTag::CallOp: {
+			CallOp* n = new CallOp();
+			n->func.reset(required());
+			list(n->items);
+			return n;
+		}
+		case NodeTag::IndexOp: {
+			IndexOp* n = new IndexOp();
+			n->obj.reset(required());
+			n->index.reset(required());
+			return n;
+		}
+
+		case NodeTag::SemicolonStmt: return new SemicolonStmt();
+		case NodeTag::BreakStmt: return new BreakStmt();
+		case NodeTag::ContinueStmt: return new ContinueStmt();
+		case NodeTag::AssignmentStmt: {
+			AssignmentStmt* n = new AssignmentStmt();
+			n->left.reset(required());
+			n->right.reset(required());
+			return n;
+		}
+		case NodeTag::IncrementStmt: {
+			IncrementStmt* n = new IncrementStmt();
+			n->pre = u8() != 0;
+			n->node.reset(required());
+			return n;
+		}
+		case NodeTag::DecrementStmt: {
+			DecrementStmt* n = new DecrementStmt();
+			n->pre = u8() != 0;
+			n->node.reset(required());
+			return n;
+		}
+		case NodeTag::IfStmt: {
+			// Only the else branch, an IfStmt itself, has no condition.
+			bool elseBranch = m_elseBranch;
+			m_elseBranch = false;
+			IfStmt* n = new IfStmt();
+			n->cond.reset(elseBranch ? node() : required());
+			list(n->stmts);
+			list(n->elseIfs, NodeTag::IfStmt);
+			m_elseBranch = true;
+			n->elseStmt.reset(node<IfStmt>(NodeTag::IfStmt, true));
+			m_elseBranch = false;
+			return n;
+		}
+		case NodeTag::ParamStmt: {
+			ParamStmt* n = new ParamStmt();
+			n->name = str();
+			n->typeName = str();
+			n->type = type();
+			n->value.reset(node());
+			return n;
+		}
+		case NodeTag::LetStmt: {
+			LetStmt* n = new LetStmt();
+			n->publicLet = u8() != 0;
+			list(n->variableList, NodeTag::ParamStmt);
+			return n;
+		}
+		case NodeTag::FuncDefStmt: {
+			FuncDefStmt* n = new FuncDefStmt();
+			n->name = str();
+			n->publicFunc = u8() != 0;
+			list(n->paramList, NodeTag::ParamStmt);
+			list(n->stmts);
+			return n;
+		}
+		case NodeTag::ReturnStmt: return new ReturnStmt(node());
+		case NodeTag::YieldStmt: return new YieldStmt(node());
+		case NodeTag::ForStmt: {
+			ForStmt* n = new ForStmt();
+			list(n->vars);
+			n->iter.reset(required());
+			list(n->stmts);
+			n->parallel = u8() != 0;
+			for (uint32_t i = u32(); i > 0 && !m_failed; i--) {
+				std::string op = str();
+				n->reductions.push_back({ op, str() });
+			}
+			return n;
+		}
+		case NodeTag::RangeStmt: {
+			RangeStmt* n = new RangeStmt();
+			n->from.reset(required());
+			n->to.reset(required());
+			return n;
+		}
+		case NodeTag::WhileStmt: {
+			WhileStmt* n = new WhileStmt();
+			n->cond.reset(required());
+			list(n->stmts);
+			return n;
+		}
+		case NodeTag::ImportStmt: {
+			ImportStmt* n = new ImportStmt();
+			n->module = str();
+			uint32_t count = u32();
+			for (uint32_t i = 0; i < count && !m_failed; i++) {
+				n->names.push_back(str());
+			}
+			return n;
+		}
+
+		default:
+			m_failed = true;
+			return nullptr;
+	}
+}
+
+void writeProgram(Program* program, std::string& out) {
+	AstWriter writer(out);
+	writer.node(program);
+}
+
+std::unique_ptr<Program> readProgram(const char* data, size_t size) {
+	AstReader reader(data, size);
+	if (size == 0 || uint8_t(data[0]) != uint8_t(NodeTag::Program)) return nullptr;
+
+	std::unique_ptr<Program> program((Program*) reader.node());
+	if (reader.failed() || !reader.atEnd()) return nullptr;
+	return program;
+}
@@ -0,0 +1,23 @@
+#ifndef LANG_SERIALIZE_H
+#define LANG_SERIALIZE_H
+
+#include <cstdint>
+#include <string>
+
+#include "parser.h"
+
+// Compact binary form of a Program, used by the module cache. Nodes are
+// written in pre-order as a one byte tag followed by their fields and
+// their line and position;
+// integers are little-endian, strings and lists are length-prefixed.
+// Bump AstFormatVersion whenever a node gains, loses or reorders a field.
+static const uint32_t AstFormatVersion = 6;
+
+// Appends `program` to `out`. Lazy function bodies are parsed first.
+void writeProgram(Program* program, std::string& out);
+
+// Rebuilds a Program from [data, data + size). Returns null if the data is
+// truncated or malformed.
+std::unique_ptr<Program> readProgram(const char* data, size_t size);
+
+#endif // LANG_SERIALIZE_H
\ No newline at end of file
@@ -0,0 +1,71 @@
+#ifndef LANG_VALUETYPE_H
+#define LANG_VALUETYPE_H
+
+#include <string>
+
+// Static type of a variable or expression, as written in an annotation
+// ("let a: number") or proven by the type inference pass.
+// Unknown means nothing is known yet, Any means the value can take more
+// than one type and must stay boxed.
+// Integer arithmetic that overflows is promoted to Number at runtime, so code
+// specialized on Integer operands must keep the overflow check.
+enum class ValueType {
+	Unknown = 0,
+	Nil,
+	Bool,
+	Integer,
+	Number,
+	String,
+	Char,
+	Any,
+
+	// Runtime only, not valid annotations: script and native functions,
+	// suspended generator calls and typed numeric arrays.
+	Function,
+	Generator,
+	Array
+};
+
+inline const char* valueTypeName(ValueType type) {
+	switch (type) {
+		case ValueType::Unknown: return "unknown";
+		case ValueType::Nil: return "nil";
+		case ValueType::Bool: return "bool";
+		case ValueType::Integer: return "int";
+		case ValueType::Number: return "number";
+		case ValueType::String: return "string";
+		case ValueType::Char: return "char";
+		case ValueType::Any: return "any";
+		case ValueType::Function: return "function";
+		case ValueType::Generator: return "generator";
+		case ValueType::Array: return "array";
+	}
+	return "unknown";
+}
+
+inline ValueType valueTypeFromName(const std::string& name) {
+	if (name == "nil") return ValueType::Nil;
+	if (name == "bool") return ValueType::Bool;
+	if (name == "int") return ValueType::Integer;
+	if (name == "number") return ValueType::Number;
+	if (name == "string") return ValueType::String;
+	if (name == "char") return ValueType::Char;
+	if (name == "any") return ValueType::Any;
+	return ValueType::Unknown;
+}
+
+inline ValueType joinTypes(ValueType a, ValueType b) {
+	if (a == ValueType::Unknown) return b;
+	if (b == ValueType::Unknown) return a;
+	return a == b ? a : ValueType::Any;
+}
+
+inline bool isNumericType(ValueType type) {
+	return type == ValueType::Integer || type == ValueType::Number;
+}
+
+inline bool isConcreteType(ValueType type) {
+	return type != ValueType::Unknown && type != ValueType::Any;
+}
+
+#endif // LANG_VALUETYPE_H
\ No newline at end of file
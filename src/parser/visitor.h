@@ -0,0 +1,76 @@
+#ifndef LANG_VISITOR_H
+#define LANG_VISITOR_H
+
+struct Program;
+
+struct EOFAtom;
+struct BoolAtom;
+struct IdentifierAtom;
+struct NumberAtom;
+struct IntegerAtom;
+struct StringAtom;
+struct CharAtom;
+
+struct BinOp;
+struct UnOp;
+struct TernaryOp;
+struct CallOp;
+struct IndexOp;
+
+struct SemicolonStmt;
+struct BreakStmt;
+struct ContinueStmt;
+struct AssignmentStmt;
+struct IncrementStmt;
+struct DecrementStmt;
+struct IfStmt;
+struct ParamStmt;
+struct LetStmt;
+struct FuncDefStmt;
+struct ReturnStmt;
+struct YieldStmt;
+struct ForStmt;
+struct RangeStmt;
+struct WhileStmt;
+struct ImportStmt;
+
+// Walks the AST. Every Node overrides visit() to dispatch to the matching
+// overload here, so passes only implement the node types they care about.
+struct NodeVisitor {
+	virtual ~NodeVisitor() = default;
+
+	virtual void visit(Program& /* node */) {}
+
+	virtual void visit(EOFAtom& /* node */) {}
+	virtual void visit(BoolAtom& /* node */) {}
+	virtual void visit(IdentifierAtom& /* node */) {}
+	virtual void visit(NumberAtom& /* node */) {}
+	virtual void visit(IntegerAtom& /* node */) {}
+	virtual void visit(StringAtom& /* node */) {}
+	virtual void visit(CharAtom& /* node */) {}
+
+	virtual void visit(BinOp& /* node */) {}
+	virtual void visit(UnOp& /* node */) {}
+	virtual void visit(TernaryOp& /* node */) {}
+	virtual void visit(CallOp& /* node */) {}
+	virtual void visit(IndexOp& /* node */) {}
+
+	virtual void visit(SemicolonStmt& /* node */) {}
+	virtual void visit(BreakStmt& /* node */) {}
+	virtual void visit(ContinueStmt& /* node */) {}
+	virtual void visit(AssignmentStmt& /* node */) {}
+	virtual void visit(IncrementStmt& /* node */) {}
+	virtual void visit(DecrementStmt& /* node */) {}
+	virtual void visit(IfStmt& /* node */) {}
+	virtual void visit(ParamStmt& /* node */) {}
+	virtual void visit(LetStmt& /* node */) {}
+	virtual void visit(FuncDefStmt& /* node */) {}
+	virtual void visit(ReturnStmt& /* node */) {}
+	virtual void visit(YieldStmt& /* node */) {}
+	virtual void visit(ForStmt& /* node */) {}
+	virtual void visit(RangeStmt& /* node */) {}
+	virtual void visit(WhileStmt& /* node */) {}
+	virtual void visit(ImportStmt& /* node */) {}
+};
+
+#endif // LANG_VISITOR_H
\ No newline at end of file
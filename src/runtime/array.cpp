@@ -0,0 +1,335 @@
+#include "array.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <sstream>
+#include <type_traits>
+
+#include "builtins.h"
+
+ArrayObject::ArrayObject(ElementType element, size_t length, bool zeroed)
+	: Object(ObjectKind::Array), element(element), length(length), data(nullptr)
+{
+	if (length == 0) return;
+	size_t size = elementSize(element);
+	if (length > (std::numeric_limits<size_t>::max() - Alignment) / size) throw std::bad_alloc();
+
+	// aligned_alloc() takes whole multiples of the alignment.
+	size_t bytes = (length * size + Alignment - 1) / Alignment * Alignment;
+	data = std::aligned_alloc(Alignment, bytes);
+	if (data == nullptr) throw std::bad_alloc();
+	if (zeroed) std::memset(data, 0, bytes);
+}
+
+ArrayObject::~ArrayObject() {
+	std::free(data);
+}
+
+// Calls `f` with a null pointer to the C++ type of `type`, so generic code
+// can be instantiated once per element type.
+template <typename F>
+static auto dispatch(ElementType type, F f) {
+	switch (type) {
+		case ElementType::F64: return f(static_cast<double*>(nullptr));
+		case ElementType::F32: return f(static_cast<float*>(nullptr));
+		case ElementType::I64: return f(static_cast<int64_t*>(nullptr));
+		default: return f(static_cast<int32_t*>(nullptr));
+	}
+}
+
+template <typename T>
+using Element = std::remove_pointer_t<T>;
+
+// Whether the integer part of `d` is a T. The bounds are powers of two,
+// exact as doubles; NaN fails both comparisons.
+template <typename T>
+static bool fits(double d) {
+	return d >= double(std::numeric_limits<T>::min()) && d < -double(std::numeric_limits<T>::min());
+}
+
+// One element of an array of `type`, from a script value. Integers only
+// take integral numbers in their range.
+static bool toElement(const Value& v, ElementType type, void* out) {
+	if (!v.isNumeric()) return false;
+	return dispatch(type, [&](auto* p) {
+		using T = Element<decltype(p)>;
+		if constexpr (std::is_floating_point<T>::value) {
+			*static_cast<T*>(out) = T(v.toNumber());
+		} else if (v.type == ValueType::Integer) {
+			if (v.integerValue < std::numeric_limits<T>::min() || v.integerValue > std::numeric_limits<T>::max()) return false;
+			*static_cast<T*>(out) = T(v.integerValue);
+		} else {
+			if (v.numberValue != std::trunc(v.numberValue) || !fits<T>(v.numberValue)) return false;
+			*static_cast<T*>(out) = T(v.numberValue);
+		}
+		return true;
+	});
+}
+
+static std::string describe(const Value& v) {
+	if (!v.isNumeric()) return std::string("a value of type ") + valueTypeName(v.type);
+	std::ostringstream out;
+	printValue(out, v);
+	return out.str();
+}
+
+static bool cannotStore(VM& vm, const Value& v, ElementType type) {
+	return vm.fail("Cannot store " + describe(v) + " in an " + elementTypeName(type) + " array.");
+}
+
+// A new array of `type` with the elements of `array`. Floats become
+// integers by truncation, and must be in range.
+static ArrayObject* convert(VM& vm, const ArrayObject* array, ElementType type) {
+	ArrayObject* result = vm.array(type, array->length, false);
+	if (result == nullptr) return nullptr;
+
+	size_t bad = dispatch(array->element, [&](auto* from) {
+		using From = Element<decltype(from)>;
+		return dispatch(type, [&](auto* to) {
+			using To = Element<decltype(to)>;
+			const From* in = array->as<From>();
+			To* out = result->as<To>();
+			for (size_t i = 0; i < array->length; i++) {
+				if constexpr (std::is_integral<To>::value && sizeof(To) < sizeof(From)) {
+					if (!fits<To>(double(in[i]))) return i;
+				} else if constexpr (std::is_integral<To>::value && std::is_floating_point<From>::value) {
+					if (!fits<To>(in[i])) return i;
+				}
+				out[i] = To(in[i]);
+			}
+			return array->length;
+		});
+	});
+	if (bad < array->length) {
+		cannotStore(vm, array->get(bad), type);
+		return nullptr;
+	}
+	return result;
+}
+
+static bool checkIndex(VM& vm, const Value& index, size_t length) {
+	if (index.type != ValueType::Integer) {
+		return vm.fail(std::string("An index must be an int, got ") + valueTypeName(index.type) + ".");
+	}
+	if (index.integerValue < 0 || uint64_t(index.integerValue) >= length) {
+		return vm.fail("Index " + std::to_string(index.integerValue) + " is out of range for length " +
+			std::to_string(length) + ".");
+	}
+	return true;
+}
+
+bool indexValue(VM& vm, const Value& object, const Value& index, Value& out) {
+	if (object.type == ValueType::Array) {
+		const ArrayObject* array = asArray(object);
+		if (!checkIndex(vm, index, array->length)) return false;
+		out = array->get(index.integerValue);
+		return true;
+	}
+	if (object.type == ValueType::String) {
+		const std::string& str = asString(object)->value;
+		if (!checkIndex(vm, index, str.size())) return false;
+		out = Value::character(str[index.integerValue]);
+		return true;
+	}
+	return vm.fail(std::string("Cannot index a value of type ") + valueTypeName(object.type) + ".");
+}
+
+bool storeIndex(VM& vm, const Value& object, const Value& index, const Value& value) {
+	if (object.type != ValueType::Array) {
+		return vm.fail(std::string("Cannot assign to an element of a value of type ") + valueTypeName(object.type) + ".");
+	}
+	ArrayObject* array = asArray(object);
+	if (!checkIndex(vm, index, array->length)) return false;
+
+	char* at = static_cast<char*>(array->data) + index.integerValue * elementSize(array->element);
+	return toElement(value, array->element, at) || cannotStore(vm, value, array->element);
+}
+
+static int kernelOp(ArithOp op) {
+	switch (op) {
+		case ArithOp::Add: return int(KernelOp::Add);
+		case ArithOp::Sub: return int(KernelOp::Sub);
+		case ArithOp::Mul: return int(KernelOp::Mul);
+		case ArithOp::Div: return int(KernelOp::Div);
+		default: return -1;
+	}
+}
+
+// `scalarFirst` is for `s op a`, which compares like `a op' s`.
+static int compareOp(ArithOp op, bool scalarFirst) {
+	switch (op) {
+		case ArithOp::Lt: return int(scalarFirst ? CompareOp::Gt : CompareOp::Lt);
+		case ArithOp::Gt: return int(scalarFirst ? CompareOp::Lt : CompareOp::Gt);
+		case ArithOp::Le: return int(scalarFirst ? CompareOp::Ge : CompareOp::Le);
+		case ArithOp::Ge: return int(scalarFirst ? CompareOp::Le : CompareOp::Ge);
+		case ArithOp::Eq: return int(CompareOp::Eq);
+		case ArithOp::Ne: return int(CompareOp::Ne);
+		default: return -1;
+	}
+}
+
+bool arrayOperator(ArithOp op) {
+	return kernelOp(op) >= 0 || compareOp(op, false) >= 0;
+}
+
+bool arrayOp(VM& vm, ArithOp op, const Value& a, const Value& b, Value& out) {
+	const SimdKernels& kernels = simdKernels();
+	int kernel = kernelOp(op);
+	bool scalarFirst = a.type != ValueType::Array;
+
+	ArrayObject* x = asArray(scalarFirst ? b : a);
+	const Value& other = scalarFirst ? a : b;
+	ElementType type = x->element;
+
+	// Every int operand of `/` is divided as a double, like ints are.
+	bool toFloat = !isFloatElement(type) && op == ArithOp::Div;
+
+	if (other.type == ValueType::Array) {
+		ArrayObject* y = asArray(other);
+		if (y->element != type) {
+			return vm.fail(std::string("Cannot combine arrays of different element types: ") + elementTypeName(type) +
+				" and " + elementTypeName(y->element) + ".");
+		}
+		if (y->length != x->length) {
+			return vm.fail("Cannot combine arrays of different lengths: " + std::to_string(x->length) + " and " +
+				std::to_string(y->length) + ".");
+		}
+		if (toFloat) {
+			type = ElementType::F64;
+			if ((x = convert(vm, x, type)) == nullptr || (y = convert(vm, y, type)) == nullptr) return false;
+		}
+
+		ArrayObject* result = vm.array(kernel >= 0 ? type : ElementType::I32, x->length, false);
+		if (result == nullptr) return false;
+		if (kernel >= 0) kernels.binary[int(type)][kernel](x->data, y->data, result->data, x->length);
+		else kernels.compare[int(type)][compareOp(op, false)](x->data, y->data, result->as<int32_t>(), x->length);
+		out = Value::object(ValueType::Array, result);
+		return true;
+	}
+
+	if (!other.isNumeric()) {
+		return vm.fail(std::string("Cannot combine an array with a value of type ") + valueTypeName(other.type) + ".");
+	}
+	if (toFloat || (!isFloatElement(type) && other.type == ValueType::Number)) {
+		type = ElementType::F64;
+		if ((x = convert(vm, x, type)) == nullptr) return false;
+	}
+
+	union { double f64; float f32; int64_t i64; int32_t i32; } scalar;
+	if (!toElement(other, type, &scalar)) {
+		return vm.fail(describe(other) + " does not fit in an " + elementTypeName(type) + " array.");
+	}
+
+	ArrayObject* result = vm.array(kernel >= 0 ? type : ElementType::I32, x->length, false);
+	if (result == nullptr) return false;
+	if (kernel >= 0) {
+		(scalarFirst ? kernels.broadcastLeft : kernels.broadcast)[int(type)][kernel](x->data, &scalar, result->data, x->length);
+	} else {
+		kernels.compareBroadcast[int(type)][compareOp(op, scalarFirst)](x->data, &scalar, result->as<int32_t>(), x->length);
+	}
+	out = Value::object(ValueType::Array, result);
+	return true;
+}
+
+bool arrayNegate(VM& vm, const Value& a, Value& out) {
+	return arrayOp(vm, ArithOp::Mul, a, Value::integer(-1), out);
+}
+
+static bool arrayArgument(VM& vm, const char* name, const Value& v, ArrayObject*& out) {
+	if (v.type != ValueType::Array) {
+		return vm.fail(std::string(name) + "() takes an array, got " + valueTypeName(v.type) + ".");
+	}
+	out = asArray(v);
+	return true;
+}
+
+// What a reduction kernel writes: a double for float elements, an int64_t
+// for integer ones.
+union Reduced {
+	double number;
+	int64_t integer;
+};
+
+static Value reduced(ElementType type, const Reduced& result) {
+	return isFloatElement(type) ? Value::number(result.number) : Value::integer(result.integer);
+}
+
+// f64(n), f32(n), i64(n), i32(n).
+template <ElementType type>
+static bool makeArray(VM& vm, const void* /* data */, Value* args, int /* argc */, Value& result) {
+	ArrayObject* array;
+	if (args[0].type == ValueType::Array) {
+		array = convert(vm, asArray(args[0]), type);
+	} else if (args[0].type == ValueType::Integer && args[0].integerValue >= 0) {
+		array = vm.array(type, size_t(args[0].integerValue));
+	} else {
+		return vm.fail(std::string(elementTypeName(type)) + "() takes an array or a length, got " + describe(args[0]) + ".");
+	}
+	if (array == nullptr) return false;
+	result = Value::object(ValueType::Array, array);
+	return true;
+}
+
+static bool len(VM& vm, const void* /* data */, Value* args, int /* argc */, Value& result) {
+	if (args[0].type == ValueType::String) {
+		result = Value::integer(asString(args[0])->value.size());
+		return true;
+	}
+	ArrayObject* array;
+	if (!arrayArgument(vm, "len", args[0], array)) return false;
+	result = Value::integer(array->length);
+	return true;
+}
+
+static bool sum(VM& vm, const void* /* data */, Value* args, int /* argc */, Value& result) {
+	ArrayObject* array;
+	if (!arrayArgument(vm, "sum", args[0], array)) return false;
+	Reduced total;
+	simdKernels().sum[int(array->element)](array->data, array->length, &total);
+	result = reduced(array->element, total);
+	return true;
+}
+
+// min() and max().
+template <bool isMax>
+static bool extreme(VM& vm, const void* /* data */, Value* args, int /* argc */, Value& result) {
+	const char* name = isMax ? "max" : "min";
+	ArrayObject* array;
+	if (!arrayArgument(vm, name, args[0], array)) return false;
+	if (array->length == 0) return vm.fail(std::string(name) + "() of an empty array.");
+
+	const SimdKernels& kernels = simdKernels();
+	Reduced best;
+	(isMax ? kernels.max : kernels.min)[int(array->element)](array->data, array->length, &best);
+	result = reduced(array->element, best);
+	return true;
+}
+
+static bool dot(VM& vm, const void* /* data */, Value* args, int /* argc */, Value& result) {
+	ArrayObject* a;
+	ArrayObject* b;
+	if (!arrayArgument(vm, "dot", args[0], a) || !arrayArgument(vm, "dot", args[1], b)) return false;
+	if (a->element != b->element || a->length != b->length) {
+		return vm.fail(std::string("dot() takes arrays of the same type and length, got ") + elementTypeName(a->element) +
+			"(" + std::to_string(a->length) + ") and " + elementTypeName(b->element) + "(" + std::to_string(b->length) + ").");
+	}
+	Reduced total;
+	simdKernels().dot[int(a->element)](a->data, b->data, a->length, &total);
+	result = reduced(a->element, total);
+	return true;
+}
+
+void defineArrayBuiltins(VM& vm) {
+	vm.define(std::unique_ptr<NativeFunction>(new NativeFunction("f64", makeArray<ElementType::F64>, 1)));
+	vm.define(std::unique_ptr<NativeFunction>(new NativeFunction("f32", makeArray<ElementType::F32>, 1)));
+	vm.define(std::unique_ptr<NativeFunction>(new NativeFunction("i64", makeArray<ElementType::I64>, 1)));
+	vm.define(std::unique_ptr<NativeFunction>(new NativeFunction("i32", makeArray<ElementType::I32>, 1)));
+	vm.define(std::unique_ptr<NativeFunction>(new NativeFunction("len", len, 1)));
+	vm.define(std::unique_ptr<NativeFunction>(new NativeFunction("sum", sum, 1)));
+	vm.define(std::unique_ptr<NativeFunction>(new NativeFunction("min", extreme<false>, 1)));
+	vm.define(std::unique_ptr<NativeFunction>(new NativeFunction("max", extreme<true>, 1)));
+	vm.define(std::unique_ptr<NativeFunction>(new NativeFunction("dot", dot, 2)));
+}
\ No newline at end of file
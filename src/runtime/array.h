@@ -0,0 +1,42 @@
+#ifndef LANG_ARRAY_H
+#define LANG_ARRAY_H
+
+#include "vm.h"
+
+// Typed numeric arrays (ArrayObject): indexing, the operators on whole
+// arrays and the builtins that make and reduce them. Whole-array loops run
+// on the kernels of runtime/simd.h.
+//
+// An operator takes two arrays of the same element type and length, or an
+// array and a number applied to every element. +, - and * keep the element
+// type: integer elements wrap around like the C++ types they are stored
+// as, unlike Integer values, which become Numbers on overflow. / always
+// gives f64, as on ints. Comparisons give
+// an i32 array of 1 and 0, which sum() counts. An int array combined with
+// a Number becomes f64 first; arrays of different element types must be
+// converted explicitly, e.g. f64(a) + b.
+//
+// Each function reports through VM::fail() and returns false on error.
+
+// object[index] of an array or a string.
+bool indexValue(VM& vm, const Value& object, const Value& index, Value& out);
+
+// object[index] = value of an array. Integer elements only take integral
+// values in their range.
+bool storeIndex(VM& vm, const Value& object, const Value& index, const Value& value);
+
+// Whether arrayOp() implements `op`: + - * / and the comparisons.
+bool arrayOperator(ArithOp op);
+
+// `a op b` where at least one operand is an array.
+bool arrayOp(VM& vm, ArithOp op, const Value& a, const Value& b, Value& out);
+
+// `-a` of an array.
+bool arrayNegate(VM& vm, const Value& a, Value& out);
+
+// f64(n), f32(n), i64(n), i32(n): a zero-filled array of n elements, or a
+// converted copy when given an array. len, sum, min, max, dot; sum and dot
+// of i32 add in 64 bits, those of i64 wrap like its elements.
+void defineArrayBuiltins(VM& vm);
+
+#endif // LANG_ARRAY_H
\ No newline at end of file
@@ -0,0 +1,58 @@
+#include "builtins.h"
+
+#include <iostream>
+
+#include "array.h"
+#include "bytecode.h"
+
+// Elements print() shows of an array before eliding the rest.
+static const size_t PrintedElements = 8;
+
+void printValue(std::ostream& out, const Value& value) {
+	switch (value.type) {
+		case ValueType::Nil: out << "nil"; break;
+		case ValueType::Bool: out << (value.boolValue ? "true" : "false"); break;
+		case ValueType::Integer: out << value.integerValue; break;
+		case ValueType::Number: out << value.numberValue; break;
+		case ValueType::Char: out << value.charValue; break;
+		case ValueType::String: out << asString(value)->value; break;
+		case ValueType::Function:
+			if (value.objectValue->kind == ObjectKind::Native) {
+				out << "<native " << static_cast<NativeFunction*>(value.objectValue)->name << ">";
+			} else {
+				out << "<func " << static_cast<FunctionProto*>(value.objectValue)->name << ">";
+			}
+			break;
+		case ValueType::Generator:
+			out << "<generator " << static_cast<GeneratorObject*>(value.objectValue)->function->name << ">";
+			break;
+		case ValueType::Array: {
+			const ArrayObject* array = asArray(value);
+			out << elementTypeName(array->element) << "[";
+			for (size_t i = 0; i < array->length && i < PrintedElements; i++) {
+				if (i > 0) out << ", ";
+				printValue(out, array->get(i));
+			}
+			if (array->length > PrintedElements) out << ", ... " << array->length << " elements";
+			out << "]";
+			break;
+		}
+		default: out << "<" << valueTypeName(value.type) << ">"; break;
+	}
+}
+
+// print(a, b, ...) writes its arguments separated by spaces and a newline.
+static bool print(VM& /* vm */, const void* /* data */, Value* args, int argc, Value& result) {
+	for (int i = 0; i < argc; i++) {
+		if (i > 0) std::cout << ' ';
+		printValue(std::cout, args[i]);
+	}
+	std::cout << '\n';
+	result = Value();
+	return true;
+}
+
+void defineBuiltins(VM& vm) {
+	vm.define(std::unique_ptr<NativeFunction>(new NativeFunction("print", print, -1)));
+	defineArrayBuiltins(vm);
+}
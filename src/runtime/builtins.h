@@ -0,0 +1,15 @@
+#ifndef LANG_BUILTINS_H
+#define LANG_BUILTINS_H
+
+#include <ostream>
+
+#include "vm.h"
+
+// Writes `value` the way print() shows it.
+void printValue(std::ostream& out, const Value& value);
+
+// Natives every script can use: print(...) and the typed array builtins
+// of runtime/array.h.
+void defineBuiltins(VM& vm);
+
+#endif // LANG_BUILTINS_H
\ No newline at end of file
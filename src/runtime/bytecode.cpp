@@ -0,0 +1,162 @@
+#include "bytecode.h"
+
+#include <iomanip>
+
+const char* opName(Op op) {
+	static const char* names[] = {
+		"Nil", "True", "False",
+		"Const",
+		"Pop",
+		"LoadLocal", "StoreLocal", "LoadGlobal", "StoreGlobal",
+		"Add", "Sub", "Mul", "Div", "Mod", "Pow",
+		"BitAnd", "BitOr", "BitXor", "Shl", "Shr",
+		"Lt", "Gt", "Le", "Ge", "Eq", "Ne",
+		"Neg", "Plus", "BitNot", "Not", "Truth",
+		"Index", "StoreIndex",
+		"Jump", "JumpIfFalse", "JumpIfTrue", "Loop", "ForNext",
+		"Call", "Parallel", "Return", "ReturnNil", "Yield",
+		"AddInt", "SubInt", "MulInt", "ModInt",
+		"BitAndInt", "BitOrInt", "BitXorInt", "ShlInt", "ShrInt", "BitNotInt",
+		"AddNumber", "SubNumber", "MulNumber", "DivNumber", "ModNumber", "PowNumber",
+		"LtInt", "GtInt", "LeInt", "GeInt", "EqInt", "NeInt",
+		"LtNumber", "GtNumber", "LeNumber", "GeNumber",
+		"LoadLocals", "LoadLocalConst", "IncLocal",
+		"JumpUnlessLt", "JumpUnlessGt", "JumpUnlessLe",
+		"JumpUnlessGe", "JumpUnlessEq", "JumpUnlessNe",
+		"LocalsJumpUnlessLt"
+	};
+	static_assert(sizeof(names) / sizeof(names[0]) == size_t(Op::Count), "opName table out of date");
+	return op < Op::Count ? names[size_t(op)] : "?";
+}
+
+Op intForm(Op op) {
+	switch (op) {
+		case Op::Add: return Op::AddInt;
+		case Op::Sub: return Op::SubInt;
+		case Op::Mul: return Op::MulInt;
+		case Op::Mod: return Op::ModInt;
+		case Op::BitAnd: return Op::BitAndInt;
+		case Op::BitOr: return Op::BitOrInt;
+		case Op::BitXor: return Op::BitXorInt;
+		case Op::Shl: return Op::ShlInt;
+		case Op::Shr: return Op::ShrInt;
+		case Op::BitNot: return Op::BitNotInt;
+		case Op::Lt: return Op::LtInt;
+		case Op::Gt: return Op::GtInt;
+		case Op::Le: return Op::LeInt;
+		case Op::Ge: return Op::GeInt;
+		case Op::Eq: return Op::EqInt;
+		case Op::Ne: return Op::NeInt;
+		default: return Op::Count;
+	}
+}
+
+Op numberForm(Op op) {
+	switch (op) {
+		case Op::Add: return Op::AddNumber;
+		case Op::Sub: return Op::SubNumber;
+		case Op::Mul: return Op::MulNumber;
+		case Op::Div: return Op::DivNumber;
+		case Op::Mod: return Op::ModNumber;
+		case Op::Pow: return Op::PowNumber;
+		case Op::Lt: return Op::LtNumber;
+		case Op::Gt: return Op::GtNumber;
+		case Op::Le: return Op::LeNumber;
+		case Op::Ge: return Op::GeNumber;
+		default: return Op::Count;
+	}
+}
+
+Op genericForm(Op op) {
+	switch (op) {
+		case Op::AddInt: case Op::AddNumber: return Op::Add;
+		case Op::SubInt: case Op::SubNumber: return Op::Sub;
+		case Op::MulInt: case Op::MulNumber: return Op::Mul;
+		case Op::DivNumber: return Op::Div;
+		case Op::ModInt: case Op::ModNumber: return Op::Mod;
+		case Op::PowNumber: return Op::Pow;
+		case Op::BitAndInt: return Op::BitAnd;
+		case Op::BitOrInt: return Op::BitOr;
+		case Op::BitXorInt: return Op::BitXor;
+		case Op::ShlInt: return Op::Shl;
+		case Op::ShrInt: return Op::Shr;
+		case Op::BitNotInt: return Op::BitNot;
+		case Op::LtInt: case Op::LtNumber: return Op::Lt;
+		case Op::GtInt: case Op::GtNumber: return Op::Gt;
+		case Op::LeInt: case Op::LeNumber: return Op::Le;
+		case Op::GeInt: case Op::GeNumber: return Op::Ge;
+		case Op::EqInt: return Op::Eq;
+		case Op::NeInt: return Op::Ne;
+		default: return op;
+	}
+}
+
+int Script::global(const std::string& name) const {
+	auto it = m_globalIndex.find(name);
+	return it == m_globalIndex.end() ? -1 : it->second;
+}
+
+static void constant(const Value& value, std::ostream& out) {
+	switch (value.type) {
+		case ValueType::Integer: out << value.integerValue; break;
+		case ValueType::Number: out << value.numberValue; break;
+		case ValueType::String: out << '"' << asString(value)->value << '"'; break;
+		case ValueType::Function: out << "<func " << static_cast<FunctionProto*>(value.objectValue)->name << ">"; break;
+		default: out << valueTypeName(value.type); break;
+	}
+}
+
+void disassemble(const FunctionProto& function, std::ostream& out) {
+	out << (function.generator ? "generator " : "func ") << function.name << " (" << function.params << " params, " <<
+		function.frameSize << " slots, stack " << function.maxStack << ")" << std::endl;
+
+	int line = -1;
+	for (size_t i = 0; i < function.code.size(); i++) {
+		const Instr& ins = function.code[i];
+		Op op = loadOp(ins);
+		out << std::setw(5) << i << " ";
+		if (function.positions[i].line != line) {
+			line = function.positions[i].line;
+			out << std::setw(5) << line << " ";
+		} else {
+			out << "    | ";
+		}
+		out << std::left << std::setw(18) << opName(op) << std::right;
+
+		switch (op) {
+			case Op::Const:
+				out << " " << ins.b << " (";
+				constant(function.constants[ins.b], out);
+				out << ")";
+				break;
+			case Op::LoadLocal: case Op::StoreLocal:
+			case Op::LoadGlobal: case Op::StoreGlobal:
+			case Op::LoadLocals: case Op::LoadLocalConst: case Op::IncLocal: case Op::LocalsJumpUnlessLt:
+			case Op::Jump: case Op::JumpIfFalse: case Op::JumpIfTrue: case Op::Loop:
+				out << " " << ins.b;
+				break;
+			case Op::Call:
+				out << " " << ins.a;
+				break;
+			case Op::Parallel: case Op::ForNext:
+				out << " " << ins.a << " " << ins.b;
+				break;
+			default:
+				break;
+		}
+		out << std::endl;
+	}
+}
+
+void Script::disassemble(std::ostream& out) const {
+	for (size_t i = 0; i < globals.size(); i++) {
+		static const char* kinds[] = { "var", "func", "native" };
+		out << "global " << i << ": " << kinds[globals[i].kind] << " " << globals[i].name;
+		if (globals[i].publicName) out << " (pub)";
+		out << std::endl;
+	}
+	for (auto&& function : functions) {
+		out << std::endl;
+		::disassemble(*function, out);
+	}
+}
@@ -0,0 +1,175 @@
+#ifndef LANG_BYTECODE_H
+#define LANG_BYTECODE_H
+
+#include <map>
+#include <ostream>
+#include <vector>
+
+#include "object.h"
+
+// Stack machine instructions. Operands are in Instr::a / Instr::b as
+// noted; "pops x, y" lists the top of the stack last.
+enum class Op : uint8_t {
+	Nil, True, False,
+	Const,        // b: constant index
+	Pop,
+
+	LoadLocal,    // b: frame slot
+	StoreLocal,   // b: frame slot, pops the value
+	LoadGlobal,   // b: global slot
+	StoreGlobal,  // b: global slot, pops the value
+
+	// Pops x, y and pushes x op y.
+	Add, Sub, Mul, Div, Mod, Pow,
+	BitAnd, BitOr, BitXor, Shl, Shr,
+	Lt, Gt, Le, Ge, Eq, Ne,
+
+	// Pops x and pushes op x. Truth pushes x's truthiness as a Bool.
+	Neg, Plus, BitNot, Not, Truth,
+
+	Index,        // pops x, i and pushes x[i]
+	StoreIndex,   // pops x, i, v and sets x[i] = v
+
+	Jump,         // b: target
+	JumpIfFalse,  // b: target, pops the condition
+	JumpIfTrue,   // b: target, pops the condition
+	Loop,         // b: target before this instruction (loop back-edge)
+	ForNext,      // a: frame slot of a generator, b: target once it is done;
+	              // otherwise resumes it and pushes the value it yields
+
+	Call,         // a: argument count; pops the callee and arguments, pushes the result
+	Parallel,     // a: argument count, b: reductions; pops a loop body and its
+	              // arguments (from, end, captures), pushes each reduction's result
+	Return,       // pops the result
+	ReturnNil,
+	Yield,        // pops a value and suspends the generator, see ForNext
+
+	// Quickened forms: the VM rewrites a generic instruction to one of
+	// these once it has seen its operand types, and back if they change
+	// (see "Quickening" in vm.cpp). The compiler emits them directly where
+	// type inference proved the operand types. Int forms take two Integers
+	// (ModInt a nonzero divisor, BitNotInt one Integer); Number forms two
+	// numbers, not both Integers, except DivNumber and PowNumber, which
+	// take any two.
+	AddInt, SubInt, MulInt, ModInt,
+	BitAndInt, BitOrInt, BitXorInt, ShlInt, ShrInt, BitNotInt,
+	AddNumber, SubNumber, MulNumber, DivNumber, ModNumber, PowNumber,
+	LtInt, GtInt, LeInt, GeInt, EqInt, NeInt,
+	LtNumber, GtNumber, LeNumber, GeNumber,
+
+	// Superinstructions, which the compiler fuses from the sequence noted
+	// (see fuse() in compiler.cpp). One replaces the op of the first
+	// instruction of its sequence, reads the operands of the others where
+	// they are and skips them. Unless its operands are Integers or numbers
+	// it runs as that first instruction, and the others run one by one.
+	LoadLocals,          // LoadLocal, LoadLocal
+	LoadLocalConst,      // LoadLocal, Const
+	IncLocal,            // LoadLocal x, Const, Add, StoreLocal x
+	JumpUnlessLt, JumpUnlessGt, JumpUnlessLe,
+	JumpUnlessGe, JumpUnlessEq, JumpUnlessNe,  // comparison, JumpIfFalse
+	LocalsJumpUnlessLt,  // LoadLocal, LoadLocal, Lt, JumpIfFalse
+
+	Count
+};
+
+const char* opName(Op op);
+
+// The quickened form of a generic op for Integer operands or for numbers;
+// Op::Count if it has none. genericForm() undoes either, and leaves any
+// other op as it is.
+Op intForm(Op op);
+Op numberForm(Op op);
+Op genericForm(Op op);
+
+struct Instr {
+	Op op;
+	uint16_t a = 0;
+	int32_t b = 0;
+
+	Instr(Op op, uint16_t a = 0, int32_t b = 0) : op(op), a(a), b(b) {}
+};
+
+// Every VM running a script executes the same instructions, possibly on
+// other threads, while quickening rewrites them. Ops and the operands that
+// change (Instr::a of quickened instructions) are read and written with
+// these, relaxed: either value is correct to execute.
+inline Op loadOp(const Instr& ins) {
+	return Op(__atomic_load_n(reinterpret_cast<const uint8_t*>(&ins.op), __ATOMIC_RELAXED));
+}
+
+inline void storeOp(Instr& ins, Op op) {
+	__atomic_store_n(reinterpret_cast<uint8_t*>(&ins.op), uint8_t(op), __ATOMIC_RELAXED);
+}
+
+// Statement position of an instruction, for runtime errors.
+struct SourcePos {
+	int line, pos;
+};
+
+struct FunctionProto : public Object {
+	std::string name;
+	bool publicFunc = false;
+	int line = 0, pos = 0;
+
+	// Arguments land in slots [0, params); locals follow up to frameSize.
+	int params = 0, required = 0;
+	int frameSize = 0;
+	int maxStack = 0;
+
+	// Mutable for quickening, which only rewrites ops through storeOp().
+	mutable std::vector<Instr> code;
+	std::vector<SourcePos> positions;  // one per instruction
+	std::vector<Value> constants;
+
+	// Where to start for each argument count in [required, params]: the
+	// prologue evaluates the missing parameters' defaults in order, so a
+	// call with k arguments enters at entries[k - required].
+	std::vector<int> entries;
+
+	// Contains `yield`: a call returns a GeneratorObject instead of running.
+	bool generator = false;
+
+	// The body of a `parallel for`, run on chunks of the range: the hidden
+	// global each reduction accumulates in, and its operator.
+	struct Reduction {
+		std::string name;
+		int global;
+		Op op;
+	};
+	std::vector<Reduction> reductions;
+
+	FunctionProto() : Object(ObjectKind::Function) {}
+};
+
+struct GlobalSlot {
+	enum Kind { Variable, Function, Native } kind = Variable;
+	std::string name;
+	bool publicName = false;
+	FunctionProto* function = nullptr;  // for Function
+};
+
+// The compiled form of one Program. Immutable once compiled but for the
+// quickened ops, so one Script can be loaded into any number of VMs; every
+// global a VM needs is listed in `globals`, natives by name.
+struct Script {
+	std::vector<std::unique_ptr<FunctionProto>> functions;
+	std::vector<std::unique_ptr<StringObject>> strings;
+	std::vector<GlobalSlot> globals;
+
+	// The top-level statements.
+	FunctionProto* main = nullptr;
+
+	// Global slot by name, -1 if absent.
+	int global(const std::string& name) const;
+
+	void disassemble(std::ostream& out) const;
+
+private:
+	friend class Compiler;
+	friend class HeapSnapshot;
+	std::map<std::string, int> m_globalIndex;
+};
+
+void disassemble(const FunctionProto& function, std::ostream& out);
+
+#endif // LANG_BYTECODE_H
\ No newline at end of file
@@ -0,0 +1,894 @@
+#include "compiler.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "../parser/detail/atom.hpp"
+#include "../parser/detail/ops.hpp"
+#include "../parser/detail/stmts.hpp"
+#include "../parser/moduleloader.h"
+
+// Net stack change of each opcode, Call and Parallel excepted.
+static int stackEffect(Op op) {
+	switch (genericForm(op)) {
+		case Op::Nil: case Op::True: case Op::False: case Op::Const:
+		case Op::LoadLocal: case Op::LoadGlobal: case Op::ForNext:
+			return 1;
+		case Op::Pop: case Op::StoreLocal: case Op::StoreGlobal:
+		case Op::JumpIfFalse: case Op::JumpIfTrue: case Op::Return: case Op::Yield:
+			return -1;
+		case Op::Add: case Op::Sub: case Op::Mul: case Op::Div: case Op::Mod: case Op::Pow:
+		case Op::BitAnd: case Op::BitOr: case Op::BitXor: case Op::Shl: case Op::Shr:
+		case Op::Lt: case Op::Gt: case Op::Le: case Op::Ge: case Op::Eq: case Op::Ne:
+		case Op::Index:
+			return -1;
+		case Op::StoreIndex:
+			return -3;
+		default:
+			return 0;
+	}
+}
+
+static Op binaryOpcode(ArithOp op) {
+	switch (op) {
+		case ArithOp::Add: return Op::Add;
+		case ArithOp::Sub: return Op::Sub;
+		case ArithOp::Mul: return Op::Mul;
+		case ArithOp::Div: return Op::Div;
+		case ArithOp::Mod: return Op::Mod;
+		case ArithOp::Pow: return Op::Pow;
+		case ArithOp::BitAnd: return Op::BitAnd;
+		case ArithOp::BitOr: return Op::BitOr;
+		case ArithOp::BitXor: return Op::BitXor;
+		case ArithOp::Shl: return Op::Shl;
+		case ArithOp::Shr: return Op::Shr;
+		case ArithOp::Lt: return Op::Lt;
+		case ArithOp::Gt: return Op::Gt;
+		case ArithOp::Le: return Op::Le;
+		case ArithOp::Ge: return Op::Ge;
+		case ArithOp::Eq: return Op::Eq;
+		case ArithOp::Ne: return Op::Ne;
+		default: return Op::Count;
+	}
+}
+
+static Op jumpUnless(Op compare) {
+	switch (compare) {
+		case Op::Lt: return Op::JumpUnlessLt;
+		case Op::Gt: return Op::JumpUnlessGt;
+		case Op::Le: return Op::JumpUnlessLe;
+		case Op::Ge: return Op::JumpUnlessGe;
+		case Op::Eq: return Op::JumpUnlessEq;
+		case Op::Ne: return Op::JumpUnlessNe;
+		default: return Op::Count;
+	}
+}
+
+// Fuses superinstructions into a finished function. The sequences are the
+// most frequent pairs in a profile of our scripts (lang --run --histogram):
+// loading two locals, or a local and a constant; comparing and branching;
+// the increment of range loops and `x += c`; and, all in one, the test of
+// range loops. The first instruction of a sequence becomes the fused op,
+// the others stay in place, so jumps into the middle of a sequence and the
+// fused op's fallback still find them. Sequences do not overlap.
+static void fuse(FunctionProto& proto) {
+	// The fused ops check their operand types themselves, so a sequence
+	// may contain quickened forms.
+	std::vector<Instr>& code = proto.code;
+	auto at = [&](size_t i, Op op) { return i < code.size() && genericForm(code[i].op) == op; };
+
+	for (size_t i = 0; i < code.size(); ) {
+		Op fused = Op::Count;
+		size_t length = 1;
+		if (at(i, Op::LoadLocal) && at(i + 1, Op::LoadLocal) && at(i + 2, Op::Lt) && at(i + 3, Op::JumpIfFalse)) {
+			fused = Op::LocalsJumpUnlessLt;
+			length = 4;
+		} else if (at(i, Op::LoadLocal) && at(i + 1, Op::Const) && at(i + 2, Op::Add) && at(i + 3, Op::StoreLocal) &&
+			code[i + 3].b == code[i].b)
+		{
+			fused = Op::IncLocal;
+			length = 4;
+		} else if (at(i, Op::LoadLocal) && at(i + 1, Op::LoadLocal)) {
+			fused = Op::LoadLocals;
+			length = 2;
+		} else if (at(i, Op::LoadLocal) && at(i + 1, Op::Const)) {
+			fused = Op::LoadLocalConst;
+			length = 2;
+		} else if (jumpUnless(genericForm(code[i].op)) != Op::Count && at(i + 1, Op::JumpIfFalse)) {
+			fused = jumpUnless(genericForm(code[i].op));
+			length = 2;
+		}
+
+		if (fused != Op::Count) code[i].op = fused;
+		i += length;
+	}
+}
+
+// Whether a function body yields, not counting the functions it defines.
+class YieldFinder : public NodeVisitor {
+public:
+	bool found = false;
+
+	void run(NodeList& stmts) {
+		for (auto&& stmt : stmts) {
+			if (stmt) stmt->visit(*this);
+		}
+	}
+
+	void visit(YieldStmt& /* node */) { found = true; }
+	void visit(ForStmt& node) { run(node.stmts); }
+	void visit(WhileStmt& node) { run(node.stmts); }
+
+	void visit(IfStmt& node) {
+		run(node.stmts);
+		for (auto&& elseIf : node.elseIfs) run(elseIf->stmts);
+		if (node.elseStmt) run(node.elseStmt->stmts);
+	}
+};
+
+std::unique_ptr<Script> Compiler::compile(Program* program) {
+	FunctionProto* main = begin();
+	hoist(*program, "");
+
+	FunctionState state { main, nullptr };
+	m_function = &state;
+	program->visit(*this);
+	emit(Op::ReturnNil);
+	m_function = nullptr;
+	return finish();
+}
+
+std::unique_ptr<Script> Compiler::compile(const ModuleLoader& loader, Module* entry) {
+	FunctionProto* main = begin();
+	m_modules = true;
+
+	// Dependencies come first, so what a module imports is declared by the
+	// time it binds the names.
+	std::map<Module*, std::map<std::string, Name>> names;
+	for (Module* module : loader.order()) {
+		m_names.clear();
+		hoist(*module->program, module == entry ? "" : module->name + ".");
+
+		// Like ModuleLoader::resolve(): own definitions first, then the
+		// first import that exports the name.
+		for (auto&& import : module->imports) {
+			const std::map<std::string, Name>& exporter = names[import.second];
+			for (auto&& exported : import.second->exports) {
+				const std::vector<std::string>& wanted = import.first->names;
+				if (!wanted.empty() && std::find(wanted.begin(), wanted.end(), exported.first) == wanted.end()) continue;
+
+				auto slot = exporter.find(exported.first);
+				if (slot != exporter.end()) m_names.insert({ exported.first, { slot->second.slot, true } });
+			}
+		}
+		names[module] = std::move(m_names);
+	}
+
+	FunctionState state { main, nullptr };
+	m_function = &state;
+	for (Module* module : loader.order()) {
+		m_names = std::move(names[module]);
+		module->program->visit(*this);
+	}
+	emit(Op::ReturnNil);
+	m_function = nullptr;
+	return finish();
+}
+
+FunctionProto* Compiler::begin() {
+	m_script.reset(new Script());
+	m_names.clear();
+	m_natives.clear();
+	m_strings.clear();
+	m_errors = 0;
+	m_modules = false;
+
+	FunctionProto* main = new FunctionProto();
+	main->name = "<main>";
+	main->entries.push_back(0);
+	m_script->functions.emplace_back(main);
+	m_script->main = main;
+	return main;
+}
+
+std::unique_ptr<Script> Compiler::finish() {
+	if (m_superinstructions) {
+		for (auto&& function : m_script->functions) fuse(*function);
+	}
+
+	if (m_errors > 0) m_script.reset();
+	return std::move(m_script);
+}
+
+// Declares the top-level names first so functions can refer to globals and
+// to each other regardless of order. `prefix` qualifies their global names.
+void Compiler::hoist(Program& program, const std::string& prefix) {
+	for (auto&& stmt : program.stmts) {
+		m_line = stmt->line;
+		m_pos = stmt->pos;
+		if (LetStmt* let = dynamic_cast<LetStmt*>(stmt.get())) {
+			for (auto&& var : let->variableList) {
+				m_names[var->name] = { declareGlobal(prefix + var->name, GlobalSlot::Variable, let->publicLet), false };
+			}
+		} else if (FuncDefStmt* func = dynamic_cast<FuncDefStmt*>(stmt.get())) {
+			m_names[func->name] = { declareGlobal(prefix + func->name, GlobalSlot::Function, func->publicFunc), false };
+		}
+	}
+	m_line = m_pos = 0;
+}
+
+void Compiler::compileError(const std::string& message) {
+	m_errors++;
+	error("ERROR(" << m_line << ":" << m_pos << "): " << message);
+}
+
+int Compiler::emit(Op op, int a, int b) {
+	FunctionProto* proto = m_function->proto;
+	proto->code.emplace_back(op, a, b);
+	proto->positions.push_back({ m_line, m_pos });
+
+	switch (op) {
+		case Op::Call: m_function->depth -= a; break;
+		case Op::Parallel: m_function->depth += b - a - 1; break;
+		default: m_function->depth += stackEffect(op); break;
+	}
+	proto->maxStack = std::max(proto->maxStack, m_function->depth);
+	return proto->code.size() - 1;
+}
+
+void Compiler::patch(int at) {
+	m_function->proto->code[at].b = m_function->proto->code.size();
+}
+
+int Compiler::constant(const Value& value) {
+	uint64_t bits = 0;
+	switch (value.type) {
+		case ValueType::Integer: bits = uint64_t(value.integerValue); break;
+		case ValueType::Number: std::memcpy(&bits, &value.numberValue, 8); break;
+		case ValueType::Char: bits = uint8_t(value.charValue); break;
+		default: bits = uint64_t(uintptr_t(value.objectValue)); break;
+	}
+
+	auto key = std::make_pair(int(value.type), bits);
+	auto it = m_function->constants.find(key);
+	if (it != m_function->constants.end()) return it->second;
+
+	std::vector<Value>& constants = m_function->proto->constants;
+	constants.push_back(value);
+	m_function->constants[key] = constants.size() - 1;
+	return constants.size() - 1;
+}
+
+void Compiler::expression(Node* node) {
+	if (node == nullptr) {
+		emit(Op::Nil);
+		return;
+	}
+	node->visit(*this);
+}
+
+void Compiler::statement(Node* node) {
+	if (node == nullptr) return;
+
+	int line = m_line, pos = m_pos;
+	m_line = node->line;
+	m_pos = node->pos;
+
+	int depth = m_function->depth;
+	node->visit(*this);
+
+	// A bare expression used as a statement, e.g. a call.
+	if (m_function->depth > depth) emit(Op::Pop);
+
+	m_line = line;
+	m_pos = pos;
+}
+
+void Compiler::block(NodeList& stmts) {
+	beginScope();
+	for (auto&& stmt : stmts) statement(stmt.get());
+	endScope();
+}
+
+void Compiler::beginScope() {
+	m_function->scopes.push_back(m_function->locals.size());
+}
+
+void Compiler::endScope() {
+	m_function->locals.resize(m_function->scopes.back());
+	m_function->scopes.pop_back();
+}
+
+int Compiler::declareLocal(const std::string& name) {
+	// Slots are reused once their block ends.
+	int slot = m_function->locals.empty() ? 0 : m_function->locals.back().slot + 1;
+	m_function->locals.push_back({ name, slot });
+
+	FunctionProto* proto = m_function->proto;
+	proto->frameSize = std::max(proto->frameSize, slot + 1);
+	return slot;
+}
+
+// Natives are bound by name when the script is loaded. One may share its
+// name with a global of the entry module, which then keeps the name.
+int Compiler::declareNative(const std::string& name) {
+	auto it = m_natives.find(name);
+	if (it != m_natives.end()) return it->second;
+
+	GlobalSlot slot;
+	slot.kind = GlobalSlot::Native;
+	slot.name = name;
+	m_script->globals.push_back(slot);
+	int index = m_script->globals.size() - 1;
+	m_script->m_globalIndex.insert({ name, index });
+	m_natives[name] = index;
+	return index;
+}
+
+int Compiler::resolveLocal(FunctionState* function, const std::string& name) {
+	for (auto it = function->locals.rbegin(); it != function->locals.rend(); ++it) {
+		if (it->name == name) return it->slot;
+	}
+	return -1;
+}
+
+int Compiler::declareGlobal(const std::string& name, GlobalSlot::Kind kind, bool publicName) {
+	auto it = m_script->m_globalIndex.find(name);
+	if (it != m_script->m_globalIndex.end()) {
+		GlobalSlot& slot = m_script->globals[it->second];
+		if (slot.kind != kind) {
+			compileError("\"" + name + "\" is declared both as a variable and as a function.");
+		}
+		slot.publicName = slot.publicName || publicName;
+		return it->second;
+	}
+
+	GlobalSlot slot;
+	slot.kind = kind;
+	slot.name = name;
+	slot.publicName = publicName;
+	m_script->globals.push_back(slot);
+	m_script->m_globalIndex[name] = m_script->globals.size() - 1;
+	return m_script->globals.size() - 1;
+}
+
+void Compiler::load(const std::string& name) {
+	int slot = resolveLocal(m_function, name);
+	if (slot >= 0) {
+		emit(Op::LoadLocal, 0, slot);
+		return;
+	}
+
+	auto reduction = m_function->reductions.find(name);
+	if (reduction != m_function->reductions.end()) {
+		emit(Op::LoadGlobal, 0, reduction->second);
+		return;
+	}
+
+	for (FunctionState* outer = m_function->enclosing; outer != nullptr; outer = outer->enclosing) {
+		if (outer->enclosing != nullptr && resolveLocal(outer, name) >= 0) {
+			compileError("Cannot use \"" + name + "\" from the enclosing function.");
+			emit(Op::Nil);
+			return;
+		}
+	}
+
+	// Not a declared global: a native the VM provides, or an error when
+	// the script is loaded.
+	auto global = m_names.find(name);
+	emit(Op::LoadGlobal, 0, global != m_names.end() ? global->second.slot : declareNative(name));
+}
+
+void Compiler::store(const std::string& name) {
+	for (auto it = m_function->locals.rbegin(); it != m_function->locals.rend(); ++it) {
+		if (it->name != name) continue;
+		if (it->readOnly) {
+			compileError("\"" + name + "\" is shared by the parallel loop and cannot be assigned; reduce it instead.");
+		}
+		emit(Op::StoreLocal, 0, it->slot);
+		return;
+	}
+
+	auto reduction = m_function->reductions.find(name);
+	if (reduction != m_function->reductions.end()) {
+		emit(Op::StoreGlobal, 0, reduction->second);
+		return;
+	}
+
+	auto global = m_names.find(name);
+	if (global == m_names.end()) {
+		compileError("Undefined variable \"" + name + "\".");
+	} else if (m_script->globals[global->second.slot].kind != GlobalSlot::Variable) {
+		compileError("Cannot assign to function \"" + name + "\".");
+	} else if (global->second.imported) {
+		compileError("Cannot assign to \"" + name + "\", which is imported from another module.");
+	} else if (m_function->parallel) {
+		compileError("Global \"" + name + "\" cannot be assigned in a parallel loop; reduce it instead.");
+	}
+	emit(Op::StoreGlobal, 0, global != m_names.end() ? global->second.slot : 0);
+}
+
+void Compiler::visit(Program& node) {
+	for (auto&& stmt : node.stmts) statement(stmt.get());
+}
+
+void Compiler::visit(EOFAtom& /* node */) {}
+
+void Compiler::visit(BoolAtom& node) { emit(node.value ? Op::True : Op::False); }
+void Compiler::visit(IdentifierAtom& node) { load(node.name); }
+void Compiler::visit(NumberAtom& node) { emit(Op::Const, 0, constant(Value::number(node.value))); }
+void Compiler::visit(IntegerAtom& node) { emit(Op::Const, 0, constant(Value::integer(node.value))); }
+void Compiler::visit(CharAtom& node) { emit(Op::Const, 0, constant(Value::character(node.value))); }
+
+void Compiler::visit(StringAtom& node) {
+	auto it = m_strings.find(node.value);
+	if (it == m_strings.end()) {
+		m_script->strings.emplace_back(new StringObject(node.value));
+		it = m_strings.emplace(node.value, m_script->strings.size() - 1).first;
+	}
+	StringObject* str = m_script->strings[it->second].get();
+	emit(Op::Const, 0, constant(Value::object(ValueType::String, str)));
+}
+
+void Compiler::visit(BinOp& node) {
+	if (node.op == "&&" || node.op == "||") {
+		// Short-circuit, but still yield a Bool like the folder does.
+		expression(node.left.get());
+		int skip = emit(node.op == "&&" ? Op::JumpIfFalse : Op::JumpIfTrue);
+		expression(node.right.get());
+		emit(Op::Truth);
+		int end = emit(Op::Jump);
+		patch(skip);
+		m_function->depth--;
+		emit(node.op == "&&" ? Op::False : Op::True);
+		patch(end);
+		return;
+	}
+
+	Op op = binaryOpcode(binaryArithOp(node.op));
+	if (op == Op::Count) {
+		compileError("Unsupported operator \"" + node.op + "\".");
+	}
+	expression(node.left.get());
+	expression(node.right.get());
+
+	// Where type inference proved the operand types the instruction starts
+	// out quickened, still behind the same guards: annotations are not
+	// checked at calls, Integers promote when they overflow, and a proven
+	// number may still be an Integer (which requickens the site once).
+	Op typed = Op::Count;
+	if (node.operandType == ValueType::Integer) typed = intForm(op);
+	if (node.operandType == ValueType::Number || (typed == Op::Count && (op == Op::Div || op == Op::Pow))) {
+		typed = numberForm(op);
+	}
+	emit(op == Op::Count ? Op::Eq : typed != Op::Count ? typed : op);
+}
+
+void Compiler::visit(UnOp& node) {
+	expression(node.right.get());
+	switch (unaryArithOp(node.op)) {
+		case ArithOp::Neg: emit(Op::Neg); break;
+		case ArithOp::Plus: emit(Op::Plus); break;
+		case ArithOp::BitNot: emit(Op::BitNot); break;
+		case ArithOp::Not: emit(Op::Not); break;
+		default: compileError("Unsupported operator \"" + node.op + "\"."); break;
+	}
+}
+
+void Compiler::visit(TernaryOp& node) {
+	expression(node.cond.get());
+	int otherwise = emit(Op::JumpIfFalse);
+	expression(node.left.get());
+	int end = emit(Op::Jump);
+	patch(otherwise);
+	m_function->depth--;
+	expression(node.right.get());
+	patch(end);
+}
+
+void Compiler::visit(CallOp& node) {
+	if (node.items.size() > UINT16_MAX) {
+		compileError("Too many arguments.");
+		return;
+	}
+	expression(node.func.get());
+	for (auto&& arg : node.items) expression(arg.get());
+	emit(Op::Call, node.items.size());
+}
+
+void Compiler::visit(IndexOp& node) {
+	expression(node.obj.get());
+	expression(node.index.get());
+	emit(Op::Index);
+}
+
+void Compiler::visit(SemicolonStmt& /* node */) {}
+
+void Compiler::visit(BreakStmt& /* node */) {
+	if (m_function->loops.empty()) {
+		compileError("\"break\" outside of a loop.");
+		return;
+	}
+	if (m_function->loops.back().parallel) {
+		compileError("\"break\" cannot leave a parallel loop.");
+		return;
+	}
+	m_function->loops.back().breaks.push_back(emit(Op::Jump));
+}
+
+void Compiler::visit(ContinueStmt& /* node */) {
+	if (m_function->loops.empty()) {
+		compileError("\"continue\" outside of a loop.");
+		return;
+	}
+	LoopState& loop = m_function->loops.back();
+	if (loop.continueTarget >= 0) emit(Op::Loop, 0, loop.continueTarget);
+	else loop.continues.push_back(emit(Op::Jump));
+}
+
+void Compiler::visit(AssignmentStmt& node) {
+	if (IndexOp* element = dynamic_cast<IndexOp*>(node.left.get())) {
+		expression(element->obj.get());
+		expression(element->index.get());
+		expression(node.right.get());
+		emit(Op::StoreIndex);
+		return;
+	}
+
+	IdentifierAtom* target = dynamic_cast<IdentifierAtom*>(node.left.get());
+	if (target == nullptr) {
+		compileError("Invalid assignment target.");
+		return;
+	}
+	expression(node.right.get());
+	store(target->name);
+}
+
+void Compiler::visit(IncrementStmt& node) {
+	IdentifierAtom* target = dynamic_cast<IdentifierAtom*>(node.node.get());
+	if (target == nullptr) {
+		compileError("Invalid increment target.");
+		return;
+	}
+	load(target->name);
+	emit(Op::Const, 0, constant(Value::integer(1)));
+	emit(Op::Add);
+	store(target->name);
+}
+
+void Compiler::visit(DecrementStmt& node) {
+	IdentifierAtom* target = dynamic_cast<IdentifierAtom*>(node.node.get());
+	if (target == nullptr) {
+		compileError("Invalid decrement target.");
+		return;
+	}
+	load(target->name);
+	emit(Op::Const, 0, constant(Value::integer(1)));
+	emit(Op::Sub);
+	store(target->name);
+}
+
+void Compiler::visit(IfStmt& node) {
+	std::vector<int> ends;
+
+	expression(node.cond.get());
+	int next = emit(Op::JumpIfFalse);
+	block(node.stmts);
+
+	for (auto&& elseIf : node.elseIfs) {
+		ends.push_back(emit(Op::Jump));
+		patch(next);
+		expression(elseIf->cond.get());
+		next = emit(Op::JumpIfFalse);
+		block(elseIf->stmts);
+	}
+
+	if (node.elseStmt) {
+		ends.push_back(emit(Op::Jump));
+		patch(next);
+		block(node.elseStmt->stmts);
+	} else {
+		patch(next);
+	}
+	for (int end : ends) patch(end);
+}
+
+void Compiler::visit(LetStmt& node) {
+	bool global = m_function->enclosing == nullptr && m_function->scopes.empty();
+	for (auto&& var : node.variableList) {
+		expression(var->value.get());
+		if (global) {
+			emit(Op::StoreGlobal, 0, m_names[var->name].slot);
+		} else {
+			// Declared after the initializer, which may read an outer
+			// variable of the same name.
+			emit(Op::StoreLocal, 0, declareLocal(var->name));
+		}
+	}
+}
+
+void Compiler::visit(FuncDefStmt& node) {
+	FunctionProto* proto = function(node);
+	if (m_function->enclosing == nullptr && m_function->scopes.empty()) {
+		GlobalSlot& slot = m_script->globals[m_names[node.name].slot];
+		if (slot.function != nullptr) compileError("Function \"" + node.name + "\" is already defined.");
+		slot.function = proto;
+		return;
+	}
+
+	// A nested function is a local holding the function.
+	emit(Op::Const, 0, constant(Value::object(ValueType::Function, proto)));
+	emit(Op::StoreLocal, 0, declareLocal(node.name));
+}
+
+FunctionProto* Compiler::function(FuncDefStmt& node) {
+	FunctionProto* proto = new FunctionProto();
+	proto->name = node.name;
+	proto->publicFunc = node.publicFunc;
+	proto->line = node.line;
+	proto->pos = node.pos;
+	proto->params = node.paramList.size();
+	m_script->functions.emplace_back(proto);
+
+	YieldFinder yields;
+	yields.run(node.body());
+	proto->generator = yields.found;
+
+	// Reported where the body was parsed, possibly on another thread.
+	if (node.bodyErrors > 0) m_errors++;
+
+	FunctionState state { proto, m_function };
+	m_function = &state;
+
+	for (auto&& param : node.paramList) declareLocal(param->name);
+
+	// Everything up to the first default is required; a parameter without
+	// a default after that defaults to nil.
+	proto->required = proto->params;
+	for (int i = 0; i < proto->params; i++) {
+		if (node.paramList[i]->value) {
+			proto->required = i;
+			break;
+		}
+	}
+	for (int i = proto->required; i < proto->params; i++) {
+		proto->entries.push_back(proto->code.size());
+		m_line = node.paramList[i]->line;
+		m_pos = node.paramList[i]->pos;
+		expression(node.paramList[i]->value.get());
+		emit(Op::StoreLocal, 0, i);
+	}
+	proto->entries.push_back(proto->code.size());
+
+	beginScope();
+	for (auto&& stmt : node.body()) statement(stmt.get());
+	endScope();
+	emit(Op::ReturnNil);
+
+	m_function = state.enclosing;
+	return proto;
+}
+
+void Compiler::visit(ReturnStmt& node) {
+	if (m_function->parallel) {
+		compileError("\"return\" cannot leave a parallel loop.");
+		return;
+	}
+	if (node.value && m_function->proto->generator) {
+		compileError("A generator cannot return a value.");
+		return;
+	}
+	if (node.value) {
+		expression(node.value.get());
+		emit(Op::Return);
+	} else {
+		emit(Op::ReturnNil);
+	}
+}
+
+void Compiler::visit(YieldStmt& node) {
+	if (m_function->parallel) {
+		compileError("\"yield\" cannot leave a parallel loop.");
+		return;
+	}
+	if (!m_function->proto->generator) {
+		compileError("\"yield\" outside of a function.");
+		return;
+	}
+	expression(node.value.get());
+	emit(Op::Yield);
+}
+
+void Compiler::visit(ForStmt& node) {
+	if (node.vars.size() != 1) {
+		compileError("A for loop takes exactly one variable.");
+		return;
+	}
+
+	RangeStmt* range = dynamic_cast<RangeStmt*>(node.iter.get());
+	if (range == nullptr && node.parallel) {
+		compileError("A parallel loop can only iterate a range.");
+	} else if (range == nullptr) {
+		iteratorLoop(node);
+	} else if (node.parallel) {
+		parallelLoop(node, *range);
+	} else {
+		rangeLoop(node, *range);
+	}
+}
+
+// for x in g { ... } resumes the generator g for each value of x, so the
+// values are produced one at a time as the loop asks for them.
+void Compiler::iteratorLoop(ForStmt& node) {
+	beginScope();
+	const std::string& name = static_cast<ParamStmt*>(node.vars[0].get())->name;
+
+	expression(node.iter.get());
+	int iter = declareLocal("(iter)");
+	emit(Op::StoreLocal, 0, iter);
+	int var = declareLocal(name);
+
+	int top = m_function->proto->code.size();
+	int exit = emit(Op::ForNext, iter);
+	emit(Op::StoreLocal, 0, var);
+
+	m_function->loops.emplace_back();
+	m_function->loops.back().continueTarget = top;
+	block(node.stmts);
+	LoopState loop = std::move(m_function->loops.back());
+	m_function->loops.pop_back();
+
+	emit(Op::Loop, 0, top);
+	patch(exit);
+	for (int jump : loop.breaks) patch(jump);
+	endScope();
+}
+
+// for x in a..b { ... } counts x from a up to, but not including, b. The
+// bound is evaluated once.
+void Compiler::rangeLoop(ForStmt& node, RangeStmt& range) {
+	beginScope();
+	const std::string& name = static_cast<ParamStmt*>(node.vars[0].get())->name;
+
+	expression(range.from.get());
+	expression(range.to.get());
+	int end = declareLocal("(end)");
+	emit(Op::StoreLocal, 0, end);
+	int var = declareLocal(name);
+	emit(Op::StoreLocal, 0, var);
+
+	rangeBody(node, var, end, false);
+	endScope();
+}
+
+// The test, body and increment of a range loop whose variable and bound are
+// already in the slots `var` and `end`.
+void Compiler::rangeBody(ForStmt& node, int var, int end, bool parallel) {
+	int top = m_function->proto->code.size();
+	emit(Op::LoadLocal, 0, var);
+	emit(Op::LoadLocal, 0, end);
+	emit(Op::Lt);
+	int exit = emit(Op::JumpIfFalse);
+
+	m_function->loops.emplace_back();
+	m_function->loops.back().parallel = parallel;
+	block(node.stmts);
+	LoopState loop = std::move(m_function->loops.back());
+	m_function->loops.pop_back();
+
+	for (int jump : loop.continues) patch(jump);
+	emit(Op::LoadLocal, 0, var);
+	emit(Op::Const, 0, constant(Value::integer(1)));
+	emit(Op::Add);
+	emit(Op::StoreLocal, 0, var);
+	emit(Op::Loop, 0, top);
+
+	patch(exit);
+	for (int jump : loop.breaks) patch(jump);
+}
+
+// parallel for x in a..b reduce(+: s) { ... } compiles the body into a
+// function running x over a chunk [from, end) of the range, which
+// Op::Parallel may call on several threads at once. So that iterations
+// cannot race, x and the body's own locals are private to each call, the
+// enclosing locals are passed in as read-only arguments, and globals cannot
+// be assigned. Each reduction variable instead names a hidden global that
+// starts at the operator's identity in every chunk; Op::Parallel pushes the
+// partial results combined, which are then folded into the real variables.
+void Compiler::parallelLoop(ForStmt& node, RangeStmt& range) {
+	const std::string& name = static_cast<ParamStmt*>(node.vars[0].get())->name;
+
+	std::vector<FunctionProto::Reduction> reductions;
+	for (auto&& reduction : node.reductions) {
+		Op op = binaryOpcode(binaryArithOp(reduction.op));
+		if (op != Op::Add && op != Op::Mul && op != Op::BitAnd && op != Op::BitOr && op != Op::BitXor) {
+			compileError("Cannot reduce with \"" + reduction.op + "\".");
+			continue;
+		}
+		if (reduction.name == name) {
+			compileError("The loop variable \"" + name + "\" cannot be reduced.");
+			continue;
+		}
+		std::string hidden = "(" + reduction.name + "#" + std::to_string(m_script->globals.size()) + ")";
+		reductions.push_back({ reduction.name, declareGlobal(hidden, GlobalSlot::Variable, false), op });
+	}
+
+	// The enclosing locals the body can see, innermost first; reduction
+	// targets and compiler temporaries are left out.
+	std::vector<Local> captures;
+	for (auto it = m_function->locals.rbegin(); it != m_function->locals.rend(); ++it) {
+		bool hidden = it->name == name || it->name[0] == '(';
+		for (auto&& capture : captures) hidden = hidden || capture.name == it->name;
+		for (auto&& reduction : reductions) hidden = hidden || reduction.name == it->name;
+		if (!hidden) captures.push_back(*it);
+	}
+	if (captures.size() + 2 > UINT16_MAX) {
+		compileError("Too many variables in scope of a parallel loop.");
+		return;
+	}
+
+	FunctionProto* proto = new FunctionProto();
+	proto->name = "<parallel for>";
+	proto->line = node.line;
+	proto->pos = node.pos;
+	proto->params = proto->required = captures.size() + 2;
+	proto->entries.push_back(0);
+	proto->reductions = reductions;
+	m_script->functions.emplace_back(proto);
+
+	FunctionState state { proto, m_function };
+	state.parallel = true;
+	for (auto&& reduction : reductions) state.reductions[reduction.name] = reduction.global;
+	m_function = &state;
+
+	int var = declareLocal(name);
+	int end = declareLocal("(end)");
+	for (auto&& capture : captures) {
+		declareLocal(capture.name);
+		state.locals.back().readOnly = true;
+	}
+	rangeBody(node, var, end, true);
+	emit(Op::ReturnNil);
+	m_function = state.enclosing;
+
+	emit(Op::Const, 0, constant(Value::object(ValueType::Function, proto)));
+	expression(range.from.get());
+	expression(range.to.get());
+	for (auto&& capture : captures) emit(Op::LoadLocal, 0, capture.slot);
+	emit(Op::Parallel, captures.size() + 2, reductions.size());
+
+	// Every reduction operator is commutative, so the partial result can be
+	// the left operand.
+	for (auto it = reductions.rbegin(); it != reductions.rend(); ++it) {
+		load(it->name);
+		emit(it->op);
+		store(it->name);
+	}
+}
+
+void Compiler::visit(RangeStmt& /* node */) {
+	compileError("A range can only be used in a for loop.");
+	emit(Op::Nil);
+}
+
+void Compiler::visit(WhileStmt& node) {
+	int top = m_function->proto->code.size();
+	expression(node.cond.get());
+	int exit = emit(Op::JumpIfFalse);
+
+	m_function->loops.emplace_back();
+	m_function->loops.back().continueTarget = top;
+	block(node.stmts);
+	LoopState loop = std::move(m_function->loops.back());
+	m_function->loops.pop_back();
+
+	emit(Op::Loop, 0, top);
+	patch(exit);
+	for (int jump : loop.breaks) patch(jump);
+}
+
+// Bound while hoisting when compiling modules; a single program has no
+// modules to import from.
+void Compiler::visit(ImportStmt& node) {
+	if (!m_modules) compileError("Cannot import \"" + node.module + "\" here: only scripts loaded from a file can import modules.");
+}
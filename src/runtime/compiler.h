@@ -0,0 +1,160 @@
+#ifndef LANG_COMPILER_H
+#define LANG_COMPILER_H
+
+#include <map>
+#include <vector>
+
+#include "../parser/parser.h"
+#include "bytecode.h"
+
+class ModuleLoader;
+struct Module;
+
+// Turns a Program into a Script. Top-level `let`s and functions become
+// globals and are visible everywhere (functions are bound before the
+// top-level code runs, so they can be called before their definition);
+// everything inside a block is a frame slot. Names that are neither are
+// left for the VM to resolve against its registered natives.
+// Functions defined inside functions cannot see the enclosing locals.
+//
+// Modules loaded by a ModuleLoader compile into one Script, whose top-level
+// code runs each module's statements in dependency order. The entry's
+// globals keep their names; another module's are qualified with the module
+// name ("a.b.two"), and a name it imports refers to the exporter's global.
+// A function containing `yield` is a generator, which `for ... in` resumes
+// one value at a time.
+//
+// The body of a `parallel for` becomes a function of its own over a chunk
+// of the range, given the enclosing locals as read-only arguments; see
+// parallelLoop().
+class Compiler : public NodeVisitor {
+public:
+	Compiler() = default;
+	~Compiler() = default;
+
+	// Returns null after reporting every error found.
+	std::unique_ptr<Script> compile(Program* program);
+
+	// Every module `loader` loaded for `entry`, which must have linked
+	// without errors.
+	std::unique_ptr<Script> compile(const ModuleLoader& loader, Module* entry);
+
+	// Whether compile() fuses superinstructions (by default it does); off,
+	// a histogram shows the sequences as the compiler emits them.
+	void setSuperinstructions(bool on) { m_superinstructions = on; }
+
+	void visit(Program& node);
+
+	void visit(EOFAtom& node);
+	void visit(BoolAtom& node);
+	void visit(IdentifierAtom& node);
+	void visit(NumberAtom& node);
+	void visit(IntegerAtom& node);
+	void visit(StringAtom& node);
+	void visit(CharAtom& node);
+
+	void visit(BinOp& node);
+	void visit(UnOp& node);
+	void visit(TernaryOp& node);
+	void visit(CallOp& node);
+	void visit(IndexOp& node);
+
+	void visit(SemicolonStmt& node);
+	void visit(BreakStmt& node);
+	void visit(ContinueStmt& node);
+	void visit(AssignmentStmt& node);
+	void visit(IncrementStmt& node);
+	void visit(DecrementStmt& node);
+	void visit(IfStmt& node);
+	void visit(LetStmt& node);
+	void visit(FuncDefStmt& node);
+	void visit(ReturnStmt& node);
+	void visit(YieldStmt& node);
+	void visit(ForStmt& node);
+	void visit(RangeStmt& node);
+	void visit(WhileStmt& node);
+	void visit(ImportStmt& node);
+
+private:
+	struct Local {
+		std::string name;
+		int slot;
+		bool readOnly = false;
+	};
+
+	struct LoopState {
+		std::vector<int> breaks, continues;
+
+		// Back-edge target for `continue`, or -1 to patch `continues`.
+		int continueTarget = -1;
+
+		// The loop of a parallel body, which `break` cannot leave.
+		bool parallel = false;
+	};
+
+	struct FunctionState {
+		FunctionProto* proto;
+		FunctionState* enclosing;
+
+		FunctionState(FunctionProto* proto, FunctionState* enclosing) : proto(proto), enclosing(enclosing) {}
+
+		std::vector<Local> locals;
+		std::vector<size_t> scopes;  // locals.size() at each block entry
+		std::vector<LoopState> loops;
+		std::map<std::pair<int, uint64_t>, int> constants;
+		int depth = 0;
+
+		// Set for the body of a parallel loop: the hidden global each
+		// reduction variable stands for.
+		bool parallel = false;
+		std::map<std::string, int> reductions;
+	};
+
+	// A top-level name of the module being compiled: its own global, or
+	// the exporting module's for one it imports.
+	struct Name {
+		int slot;
+		bool imported;
+	};
+
+	std::unique_ptr<Script> m_script;
+	FunctionState* m_function = nullptr;
+	std::map<std::string, Name> m_names;
+	std::map<std::string, int> m_natives;
+	std::map<std::string, int> m_strings;
+	bool m_modules = false;
+	int m_line = 0, m_pos = 0;
+	int m_errors = 0;
+	bool m_superinstructions = true;
+
+	void compileError(const std::string& message);
+
+	int emit(Op op, int a = 0, int b = 0);
+	void patch(int at);
+	int constant(const Value& value);
+
+	void expression(Node* node);
+	void statement(Node* node);
+	void block(NodeList& stmts);
+	void beginScope();
+	void endScope();
+
+	int declareLocal(const std::string& name);
+	int resolveLocal(FunctionState* function, const std::string& name);
+	FunctionProto* begin();
+	std::unique_ptr<Script> finish();
+	void hoist(Program& program, const std::string& prefix);
+
+	int declareGlobal(const std::string& name, GlobalSlot::Kind kind, bool publicName);
+	int declareNative(const std::string& name);
+	void load(const std::string& name);
+	void store(const std::string& name);
+
+	FunctionProto* function(FuncDefStmt& node);
+	void rangeLoop(ForStmt& node, RangeStmt& range);
+	void rangeBody(ForStmt& node, int var, int end, bool parallel);
+	void parallelLoop(ForStmt& node, RangeStmt& range);
+	void iteratorLoop(ForStmt& node);
+};
+
+#endif // LANG_COMPILER_H
\ No newline at end of file
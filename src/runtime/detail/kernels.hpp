@@ -0,0 +1,266 @@
+#ifndef LANG_KERNELS_HPP
+#define LANG_KERNELS_HPP
+
+#include <type_traits>
+#include <utility>
+
+#include "../simd.h"
+
+// The kernels of simd.h written once over a "lane traits" class V, which
+// says how to load, store and combine V::N elements of V::T at a time in a
+// register V::R. Each instruction set instantiates them with its own
+// traits, in its own translation unit compiled for that instruction set.
+//
+// Everything here is in an anonymous namespace: the AVX2 instantiations
+// must never be merged with the baseline ones by the linker.
+//
+// Traits provide: load, store, set1, add, sub, mul, div, min, max, madd
+// (a * b + c), compare<CompareOp> (a lane mask) and storeMask (the mask
+// as N int32 0/1 values). For i32 they also provide sumWide and dotWide,
+// which accumulate in 64 bits.
+
+namespace {
+
+template <typename T>
+using Wide = typename std::conditional<std::is_floating_point<T>::value, double, int64_t>::type;
+
+// One element of `a op b`. Integers wrap instead of overflowing.
+template <KernelOp op, typename T>
+inline T apply(T a, T b) {
+	if constexpr (std::is_integral<T>::value) {
+		using U = typename std::make_unsigned<T>::type;
+		switch (op) {
+			case KernelOp::Add: return T(U(a) + U(b));
+			case KernelOp::Sub: return T(U(a) - U(b));
+			case KernelOp::Mul: return T(U(a) * U(b));
+			default: return a / b;
+		}
+	} else {
+		switch (op) {
+			case KernelOp::Add: return a + b;
+			case KernelOp::Sub: return a - b;
+			case KernelOp::Mul: return a * b;
+			default: return a / b;
+		}
+	}
+}
+
+template <CompareOp op, typename T>
+inline bool test(T a, T b) {
+	switch (op) {
+		case CompareOp::Lt: return a < b;
+		case CompareOp::Gt: return a > b;
+		case CompareOp::Le: return a <= b;
+		case CompareOp::Ge: return a >= b;
+		case CompareOp::Eq: return a == b;
+		default: return a != b;
+	}
+}
+
+template <KernelOp op, typename V>
+inline typename V::R vector(typename V::R a, typename V::R b) {
+	switch (op) {
+		case KernelOp::Add: return V::add(a, b);
+		case KernelOp::Sub: return V::sub(a, b);
+		case KernelOp::Mul: return V::mul(a, b);
+		default: return V::div(a, b);
+	}
+}
+
+// Applies `f` lane by lane, for operations an instruction set lacks.
+template <typename V, typename F>
+inline typename V::R lanewise(typename V::R a, typename V::R b, F f) {
+	typename V::T x[V::N], y[V::N];
+	V::store(x, a);
+	V::store(y, b);
+	for (size_t k = 0; k < V::N; k++) x[k] = f(x[k], y[k]);
+	return V::load(x);
+}
+
+inline int64_t sumWideScalar(const int32_t* x, size_t n) {
+	int64_t total = 0;
+	for (size_t i = 0; i < n; i++) total += x[i];
+	return total;
+}
+
+inline int64_t dotWideScalar(const int32_t* x, const int32_t* y, size_t n) {
+	int64_t total = 0;
+	for (size_t i = 0; i < n; i++) total += int64_t(x[i]) * y[i];
+	return total;
+}
+
+// One element at a time: the fallback, and the reference for the others.
+template <typename E>
+struct Scalar {
+	using T = E;
+	using R = E;
+	static const size_t N = 1;
+
+	static R load(const T* p) { return *p; }
+	static void store(T* p, R v) { *p = v; }
+	static R set1(T v) { return v; }
+	static R add(R a, R b) { return apply<KernelOp::Add>(a, b); }
+	static R sub(R a, R b) { return apply<KernelOp::Sub>(a, b); }
+	static R mul(R a, R b) { return apply<KernelOp::Mul>(a, b); }
+	static R div(R a, R b) { return apply<KernelOp::Div>(a, b); }
+	static R min(R a, R b) { return b < a ? b : a; }
+	static R max(R a, R b) { return b > a ? b : a; }
+	static R madd(R a, R b, R c) { return add(mul(a, b), c); }
+
+	template <CompareOp op>
+	static R compare(R a, R b) { return test<op>(a, b) ? R(1) : R(0); }
+	static void storeMask(int32_t* out, R mask) { *out = mask != R(0); }
+
+	static int64_t sumWide(const T* x, size_t n) { return sumWideScalar(x, n); }
+	static int64_t dotWide(const T* x, const T* y, size_t n) { return dotWideScalar(x, y, n); }
+};
+
+template <typename V, KernelOp op>
+void binaryKernel(const void* a, const void* b, void* out, size_t n) {
+	using T = typename V::T;
+	const T* x = static_cast<const T*>(a);
+	const T* y = static_cast<const T*>(b);
+	T* z = static_cast<T*>(out);
+
+	size_t i = 0;
+	for (; i + V::N <= n; i += V::N) V::store(z + i, vector<op, V>(V::load(x + i), V::load(y + i)));
+	for (; i < n; i++) z[i] = apply<op>(x[i], y[i]);
+}
+
+template <typename V, KernelOp op, bool left>
+void broadcastKernel(const void* a, const void* b, void* out, size_t n) {
+	using T = typename V::T;
+	const T* x = static_cast<const T*>(a);
+	T s = *static_cast<const T*>(b);
+	T* z = static_cast<T*>(out);
+	typename V::R v = V::set1(s);
+
+	size_t i = 0;
+	for (; i + V::N <= n; i += V::N) {
+		V::store(z + i, left ? vector<op, V>(v, V::load(x + i)) : vector<op, V>(V::load(x + i), v));
+	}
+	for (; i < n; i++) z[i] = left ? apply<op>(s, x[i]) : apply<op>(x[i], s);
+}
+
+template <typename V, CompareOp op, bool broadcast>
+void compareKernel(const void* a, const void* b, int32_t* out, size_t n) {
+	using T = typename V::T;
+	const T* x = static_cast<const T*>(a);
+	const T* y = static_cast<const T*>(b);
+	typename V::R v = V::set1(broadcast ? *y : T(0));
+
+	size_t i = 0;
+	for (; i + V::N <= n; i += V::N) {
+		V::storeMask(out + i, V::template compare<op>(V::load(x + i), broadcast ? v : V::load(y + i)));
+	}
+	for (; i < n; i++) out[i] = test<op>(x[i], broadcast ? *y : y[i]);
+}
+
+// Four independent accumulators hide the latency of the additions.
+template <typename V>
+void sumKernel(const void* a, size_t n, void* result) {
+	using T = typename V::T;
+	const T* x = static_cast<const T*>(a);
+	if constexpr (std::is_same<T, int32_t>::value) {
+		*static_cast<int64_t*>(result) = V::sumWide(x, n);
+	} else {
+		typename V::R acc[4] = { V::set1(0), V::set1(0), V::set1(0), V::set1(0) };
+		size_t i = 0;
+		for (; i + 4 * V::N <= n; i += 4 * V::N) {
+			for (int k = 0; k < 4; k++) acc[k] = V::add(acc[k], V::load(x + i + k * V::N));
+		}
+		for (; i + V::N <= n; i += V::N) acc[0] = V::add(acc[0], V::load(x + i));
+
+		T lanes[V::N];
+		V::store(lanes, V::add(V::add(acc[0], acc[1]), V::add(acc[2], acc[3])));
+		Wide<T> total = 0;
+		for (size_t k = 0; k < V::N; k++) total = apply<KernelOp::Add, Wide<T>>(total, lanes[k]);
+		for (; i < n; i++) total = apply<KernelOp::Add, Wide<T>>(total, x[i]);
+		*static_cast<Wide<T>*>(result) = total;
+	}
+}
+
+template <typename V, bool isMax>
+void extremeKernel(const void* a, size_t n, void* result) {
+	using T = typename V::T;
+	const T* x = static_cast<const T*>(a);
+
+	T best = x[0];
+	size_t i = 0;
+	if (n >= V::N) {
+		typename V::R acc = V::load(x);
+		for (i = V::N; i + V::N <= n; i += V::N) {
+			acc = isMax ? V::max(acc, V::load(x + i)) : V::min(acc, V::load(x + i));
+		}
+		T lanes[V::N];
+		V::store(lanes, acc);
+		for (size_t k = 0; k < V::N; k++) best = isMax ? (lanes[k] > best ? lanes[k] : best) : (lanes[k] < best ? lanes[k] : best);
+	}
+	for (; i < n; i++) best = isMax ? (x[i] > best ? x[i] : best) : (x[i] < best ? x[i] : best);
+	*static_cast<Wide<T>*>(result) = best;
+}
+
+template <typename V>
+void dotKernel(const void* a, const void* b, size_t n, void* result) {
+	using T = typename V::T;
+	const T* x = static_cast<const T*>(a);
+	const T* y = static_cast<const T*>(b);
+	if constexpr (std::is_same<T, int32_t>::value) {
+		*static_cast<int64_t*>(result) = V::dotWide(x, y, n);
+	} else {
+		typename V::R acc[4] = { V::set1(0), V::set1(0), V::set1(0), V::set1(0) };
+		size_t i = 0;
+		for (; i + 4 * V::N <= n; i += 4 * V::N) {
+			for (int k = 0; k < 4; k++) acc[k] = V::madd(V::load(x + i + k * V::N), V::load(y + i + k * V::N), acc[k]);
+		}
+		for (; i + V::N <= n; i += V::N) acc[0] = V::madd(V::load(x + i), V::load(y + i), acc[0]);
+
+		T lanes[V::N];
+		V::store(lanes, V::add(V::add(acc[0], acc[1]), V::add(acc[2], acc[3])));
+		Wide<T> total = 0;
+		for (size_t k = 0; k < V::N; k++) total = apply<KernelOp::Add, Wide<T>>(total, lanes[k]);
+		for (; i < n; i++) total = apply<KernelOp::Add, Wide<T>>(total, apply<KernelOp::Mul>(x[i], y[i]));
+		*static_cast<Wide<T>*>(result) = total;
+	}
+}
+
+template <typename V, int... op>
+void fillOps(SimdKernels& k, int e, std::integer_sequence<int, op...>) {
+	((k.binary[e][op] = binaryKernel<V, KernelOp(op)>), ...);
+	((k.broadcast[e][op] = broadcastKernel<V, KernelOp(op), false>), ...);
+	((k.broadcastLeft[e][op] = broadcastKernel<V, KernelOp(op), true>), ...);
+}
+
+template <typename V, int... op>
+void fillCompares(SimdKernels& k, int e, std::integer_sequence<int, op...>) {
+	((k.compare[e][op] = compareKernel<V, CompareOp(op), false>), ...);
+	((k.compareBroadcast[e][op] = compareKernel<V, CompareOp(op), true>), ...);
+}
+
+template <typename V>
+void fill(SimdKernels& k, ElementType type) {
+	int e = int(type);
+	fillOps<V>(k, e, std::make_integer_sequence<int, int(KernelOp::Count)>());
+	fillCompares<V>(k, e, std::make_integer_sequence<int, int(CompareOp::Count)>());
+	k.sum[e] = sumKernel<V>;
+	k.min[e] = extremeKernel<V, false>;
+	k.max[e] = extremeKernel<V, true>;
+	k.dot[e] = dotKernel<V>;
+}
+
+template <template <typename> class V>
+SimdKernels makeKernels() {
+	SimdKernels k = {};
+	fill<V<double>>(k, ElementType::F64);
+	fill<V<float>>(k, ElementType::F32);
+	fill<V<int64_t>>(k, ElementType::I64);
+	fill<V<int32_t>>(k, ElementType::I32);
+	return k;
+}
+
+} // namespace
+
+// Defined by simd_avx2.cpp; null when it was not compiled for AVX2.
+const SimdKernels* avx2Kernels();
+
+#endif // LANG_KERNELS_HPP
\ No newline at end of file
@@ -0,0 +1,171 @@
+#include "host.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "builtins.h"
+#include "compiler.h"
+#include "snapshot.h"
+#include "../parser/detail/stmts.hpp"
+#include "../parser/moduleloader.h"
+#include "../analysis/constfold.h"
+#include "../analysis/inliner.h"
+#include "../analysis/treeshake.h"
+#include "../analysis/typeinfer.h"
+#include "../util/threadpool.h"
+
+std::shared_ptr<const Script> compileScript(const std::string& source, bool superinstructions) {
+	int errors = reportedErrors();
+
+	LangLexer lex(source);
+	lex.tokenize();
+	LangParser par(lex.tokens());
+	par.parse();
+	if (reportedErrors() != errors) return nullptr;
+
+	return compileProgram(par.takeProgram(), superinstructions);
+}
+
+std::shared_ptr<const Script> compileProgram(std::unique_ptr<Program> program, bool superinstructions) {
+	int errors = reportedErrors();
+
+	// Shaking first leaves the bodies of unused functions unparsed.
+	TreeShaker shaker;
+	shaker.run(program.get());
+
+	// Helpers inlined at every call are unreachable now.
+	Inliner inliner;
+	inliner.run(program.get());
+	if (inliner.inlined() > 0) TreeShaker().run(program.get());
+
+	ConstantFolder folder;
+	folder.run(program.get());
+
+	// The operand types it proves let the compiler emit quickened forms.
+	TypeInference types;
+	types.run(program.get());
+
+	Compiler compiler;
+	compiler.setSuperinstructions(superinstructions);
+	std::shared_ptr<const Script> script = compiler.compile(program.get());
+
+	// Reachable bodies are parsed on the way, by the passes above.
+	if (reportedErrors() != errors) return nullptr;
+	return script;
+}
+
+std::shared_ptr<const Script> compileModules(ModuleLoader& loader, Module* entry, bool superinstructions) {
+	int errors = reportedErrors();
+
+	TreeShaker shaker;
+	shaker.run(loader, entry);
+
+	// Only calls within a module are inlined: the inliner does not follow
+	// imports.
+	int inlined = 0;
+	for (Module* module : loader.order()) {
+		Inliner inliner;
+		inliner.run(module->program.get());
+		inlined += inliner.inlined();
+	}
+	if (inlined > 0) TreeShaker().run(loader, entry);
+
+	for (Module* module : loader.order()) {
+		ConstantFolder().run(module->program.get());
+		TypeInference().run(module->program.get());
+	}
+
+	Compiler compiler;
+	compiler.setSuperinstructions(superinstructions);
+	std::shared_ptr<const Script> script = compiler.compile(loader, entry);
+
+	if (reportedErrors() != errors) return nullptr;
+	return script;
+}
+
+Runtime::Runtime(int stackSize) : m_vm(stackSize) {
+	defineBuiltins(m_vm);
+}
+
+Runtime::~Runtime() = default;
+
+void Runtime::define(const std::string& name, NativeThunk thunk, int arity, const void* data) {
+	NativeFunction* native = new NativeFunction(name, thunk, arity);
+	native->data = data;
+	m_vm.define(std::unique_ptr<NativeFunction>(native));
+}
+
+bool Runtime::load(const std::string& source) {
+	std::shared_ptr<const Script> script = compileScript(source, m_superinstructions);
+	return script && load(std::move(script));
+}
+
+bool Runtime::load(std::shared_ptr<const Script> script) {
+	// The VM points into the new script from here on, even if binding
+	// fails, so it has to be kept either way.
+	bool ok = m_vm.load(*script);
+	m_script = std::move(script);
+	return ok && m_vm.run();
+}
+
+bool Runtime::loadFile(const std::string& path) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		error("ERROR: Cannot read file \"" << path << "\".");
+		return false;
+	}
+	std::ostringstream text;
+	text << file.rdbuf();
+
+	int errors = reportedErrors();
+	LangLexer lex(text.str());
+	lex.tokenize();
+	LangParser par(lex.tokens());
+	par.setLazyBodies(false);
+	par.parse();
+	if (reportedErrors() != errors) return false;
+
+	// A script that imports nothing compiles on its own. One that does is
+	// loaded again with its modules, which are parsed in parallel.
+	std::unique_ptr<Program> program = par.takeProgram();
+	bool imports = std::any_of(program->stmts.begin(), program->stmts.end(), [](const NodePtr& stmt) {
+		return dynamic_cast<ImportStmt*>(stmt.get()) != nullptr;
+	});
+	std::shared_ptr<const Script> script;
+	if (!imports) {
+		script = compileProgram(std::move(program), m_superinstructions);
+	} else {
+		ThreadPool pool;
+		ModuleLoader loader(pool);
+		loader.setLazyBodies(false);
+		Module* entry = loader.load(path);
+		for (Module* module : loader.order()) {
+			if (!module->diagnostics.empty()) reportCaptured(module->path + ":\n" + module->diagnostics, module->errors);
+		}
+		if (entry == nullptr || loader.errors() > 0) return false;
+		script = compileModules(loader, entry, m_superinstructions);
+	}
+	return script && load(std::move(script));
+}
+
+bool Runtime::saveSnapshot(const std::string& path) const {
+	return HeapSnapshot::save(m_vm, path);
+}
+
+bool Runtime::loadSnapshot(const std::string& path) {
+	std::shared_ptr<const Script> script = HeapSnapshot::restore(m_vm, path);
+	if (!script) return false;
+	m_script = std::move(script);
+	return true;
+}
+
+const Value* Runtime::publicFunction(const std::string& name) {
+	if (!m_script) return nullptr;
+
+	int slot = m_script->global(name);
+	if (slot < 0) return nullptr;
+	const GlobalSlot& global = m_script->globals[slot];
+	if (global.kind != GlobalSlot::Function || !global.publicName) return nullptr;
+	return m_vm.global(name);
+}
@@ -0,0 +1,329 @@
+#ifndef LANG_HOST_H
+#define LANG_HOST_H
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "vm.h"
+
+class ModuleLoader;
+struct Module;
+struct Program;
+
+// Embedding API. A Runtime compiles scripts and runs them in its VM; C++
+// functions are bound with define() and script functions are called
+// through a ScriptFunction<R(A...)>:
+//
+//     static double area(double w, double h) { return w * h; }
+//
+//     Runtime rt;
+//     rt.define<&area>("area");
+//     rt.load("pub func half(w, h) { return area(w, h) / 2; }");
+//     auto half = rt.function<double(double, double)>("half");
+//     double d = half(3, 4);
+//
+// The binder generates one thunk per C++ signature at compile time. Both
+// directions read and write the VM stack directly: arguments are never
+// collected into a vector or boxed, only converted with ValueTraits.
+
+// Conversion of a C++ type to and from a Value. from() fails on a type
+// mismatch; integers widen to double, but a number only becomes an integer
+// if it has no fractional part.
+template <typename T, typename = void>
+struct ValueTraits;
+
+template <>
+struct ValueTraits<Value> {
+	static const char* name() { return "value"; }
+	static bool from(const Value& v, Value& out) { out = v; return true; }
+	static Value to(VM& /* vm */, const Value& v) { return v; }
+};
+
+template <>
+struct ValueTraits<bool> {
+	static const char* name() { return "bool"; }
+	static bool from(const Value& v, bool& out) {
+		if (v.type != ValueType::Bool) return false;
+		out = v.boolValue;
+		return true;
+	}
+	static Value to(VM& /* vm */, bool v) { return Value::boolean(v); }
+};
+
+template <>
+struct ValueTraits<char> {
+	static const char* name() { return "char"; }
+	static bool from(const Value& v, char& out) {
+		if (v.type != ValueType::Char) return false;
+		out = v.charValue;
+		return true;
+	}
+	static Value to(VM& /* vm */, char v) { return Value::character(v); }
+};
+
+template <typename T>
+struct ValueTraits<T, std::enable_if_t<std::is_floating_point<T>::value>> {
+	static const char* name() { return "number"; }
+	static bool from(const Value& v, T& out) {
+		if (v.type == ValueType::Number) out = T(v.numberValue);
+		else if (v.type == ValueType::Integer) out = T(v.integerValue);
+		else return false;
+		return true;
+	}
+	static Value to(VM& /* vm */, T v) { return Value::number(double(v)); }
+};
+
+template <typename T>
+struct ValueTraits<T, std::enable_if_t<std::is_integral<T>::value && !std::is_same<T, bool>::value && !std::is_same<T, char>::value>> {
+	static const char* name() { return "int"; }
+	static bool from(const Value& v, T& out) {
+		if (v.type == ValueType::Integer) {
+			out = T(v.integerValue);
+		} else if (v.type == ValueType::Number && v.numberValue == double(int64_t(v.numberValue))) {
+			out = T(int64_t(v.numberValue));
+		} else {
+			return false;
+		}
+		return true;
+	}
+	static Value to(VM& /* vm */, T v) { return Value::integer(int64_t(v)); }
+};
+
+// Views into a string argument stay valid until the native returns.
+template <>
+struct ValueTraits<std::string_view> {
+	static const char* name() { return "string"; }
+	static bool from(const Value& v, std::string_view& out) {
+		if (v.type != ValueType::String) return false;
+		out = asString(v)->value;
+		return true;
+	}
+	static Value to(VM& vm, std::string_view v) { return vm.string(std::string(v)); }
+};
+
+template <>
+struct ValueTraits<std::string> {
+	static const char* name() { return "string"; }
+	static bool from(const Value& v, std::string& out) {
+		if (v.type != ValueType::String) return false;
+		out = asString(v)->value;
+		return true;
+	}
+	static Value to(VM& vm, std::string v) { return vm.string(std::move(v)); }
+};
+
+template <>
+struct ValueTraits<const char*> {
+	static const char* name() { return "string"; }
+	static bool from(const Value& v, const char*& out) {
+		if (v.type != ValueType::String) return false;
+		out = asString(v)->value.c_str();
+		return true;
+	}
+	static Value to(VM& vm, const char* v) { return vm.string(std::string(v)); }
+};
+
+namespace detail {
+
+template <typename T>
+using Bare = std::remove_cv_t<std::remove_reference_t<T>>;
+
+template <typename T>
+bool argument(VM& vm, const Value& v, T& out, size_t index) {
+	if (ValueTraits<T>::from(v, out)) return true;
+	return vm.fail("Argument " + std::to_string(index + 1) + " must be " + ValueTraits<T>::name() +
+		", got " + valueTypeName(v.type) + ".");
+}
+
+// Unpacks args[0 .. sizeof...(A)) straight off the VM stack, calls `fn`
+// and stores its result.
+template <typename R, typename... A, typename F, size_t... I>
+bool invoke(VM& vm, const F& fn, Value* args, Value& result, std::index_sequence<I...>) {
+	std::tuple<Bare<A>...> values;
+	if (!(argument(vm, args[I], std::get<I>(values), I) && ...)) return false;
+
+	if constexpr (std::is_void<R>::value) {
+		fn(std::get<I>(values)...);
+		result = Value();
+	} else {
+		result = ValueTraits<Bare<R>>::to(vm, fn(std::get<I>(values)...));
+	}
+	return true;
+}
+
+template <auto F>
+struct StaticThunk;
+
+template <typename R, typename... A, R (*F)(A...)>
+struct StaticThunk<F> {
+	static const int arity = sizeof...(A);
+
+	static bool call(VM& vm, const void* /* data */, Value* args, int /* argc */, Value& result) {
+		return invoke<R, A...>(vm, F, args, result, std::index_sequence_for<A...>());
+	}
+};
+
+// Signature of a lambda or function object, from its operator().
+template <typename F>
+struct CallableTraits : CallableTraits<decltype(&F::operator())> {};
+
+template <typename C, typename R, typename... A>
+struct CallableTraits<R (C::*)(A...) const> {
+	static const int arity = sizeof...(A);
+
+	template <typename F>
+	static bool call(VM& vm, const void* data, Value* args, int /* argc */, Value& result) {
+		return invoke<R, A...>(vm, *static_cast<const F*>(data), args, result, std::index_sequence_for<A...>());
+	}
+};
+
+template <typename C, typename R, typename... A>
+struct CallableTraits<R (C::*)(A...)> : CallableTraits<R (C::*)(A...) const> {};
+
+// A function pointer only known at run time; `data` points to it.
+template <typename R, typename... A>
+struct CallableTraits<R (*)(A...)> {
+	static const int arity = sizeof...(A);
+
+	template <typename F>
+	static bool call(VM& vm, const void* data, Value* args, int argc, Value& result) {
+		return invoke<R, A...>(vm, *static_cast<const F*>(data), args, result, std::index_sequence_for<A...>());
+	}
+};
+
+} // namespace detail
+
+template <typename Signature>
+class ScriptFunction;
+
+// A script function called from C++. Arguments are converted in place on
+// the VM stack and the script runs until it returns.
+template <typename R, typename... A>
+class ScriptFunction<R(A...)> {
+public:
+	ScriptFunction() = default;
+	ScriptFunction(VM* vm, const Value& function) : m_vm(vm), m_function(function) {}
+
+	explicit operator bool() const { return m_vm != nullptr; }
+
+	// False if the last call failed; the error has been reported and the
+	// call returned R().
+	bool ok() const { return m_ok; }
+
+	R operator()(A... args) {
+		Value result;
+		m_ok = m_vm != nullptr && m_vm->canPush(sizeof...(A) + 1);
+		if (m_ok) {
+			m_vm->push(m_function);
+			(m_vm->push(ValueTraits<detail::Bare<A>>::to(*m_vm, args)), ...);
+			m_ok = m_vm->call(sizeof...(A), result);
+		}
+
+		if constexpr (!std::is_void<R>::value) {
+			detail::Bare<R> out {};
+			if (m_ok && !ValueTraits<detail::Bare<R>>::from(result, out)) {
+				m_ok = m_vm->fail(std::string("Expected ") + ValueTraits<detail::Bare<R>>::name() +
+					" from the script, got " + valueTypeName(result.type) + ".");
+			}
+			return out;
+		}
+	}
+
+private:
+	VM* m_vm = nullptr;
+	Value m_function;
+	bool m_ok = true;
+};
+
+// Lexes, parses, inlines, folds, infers types and compiles `source`
+// (see TypeInference for the errors that adds), leaving out the
+// functions and globals it cannot reach (see TreeShaker). Bodies of lazily
+// parsed functions it leaves out are never parsed, so errors inside them
+// are not reported; Runtime::loadFile() parses every body. Returns
+// null after reporting errors. The result can be loaded into any number of
+// Runtimes, on any threads.
+std::shared_ptr<const Script> compileScript(const std::string& source, bool superinstructions = true);
+
+// The same pipeline from an already parsed `program`, which it consumes.
+std::shared_ptr<const Script> compileProgram(std::unique_ptr<Program> program, bool superinstructions = true);
+
+// The same pipeline over every module `loader` loaded for `entry`, into one
+// Script (see Compiler); the modules must have loaded without errors, and
+// are shaken and folded in place.
+std::shared_ptr<const Script> compileModules(ModuleLoader& loader, Module* entry, bool superinstructions = true);
+
+class Runtime {
+public:
+	// The builtins (print, typed arrays) are defined from the start.
+	Runtime(int stackSize = VM::DefaultStackSize);
+	~Runtime();
+
+	// Binds a C++ function, known at compile time, as `name`:
+	//     rt.define<&sqrt2>("sqrt2");
+	template <auto F>
+	void define(const std::string& name) {
+		using Thunk = detail::StaticThunk<F>;
+		m_vm.define(std::unique_ptr<NativeFunction>(new NativeFunction(name, &Thunk::call, Thunk::arity)));
+	}
+
+	// Binds a lambda, function object or function pointer, kept alive by
+	// the runtime.
+	template <typename F>
+	void define(const std::string& name, F fn) {
+		using Traits = detail::CallableTraits<F>;
+		std::shared_ptr<F> holder = std::make_shared<F>(std::move(fn));
+		NativeFunction* native = new NativeFunction(name, &Traits::template call<F>, Traits::arity);
+		native->data = holder.get();
+		native->holder = holder;
+		m_vm.define(std::unique_ptr<NativeFunction>(native));
+	}
+
+	// Binds a thunk that reads the arguments itself; `arity` -1 accepts any
+	// number of them.
+	void define(const std::string& name, NativeThunk thunk, int arity = -1, const void* data = nullptr);
+
+	// Whether load() fuses superinstructions; see Compiler.
+	void setSuperinstructions(bool on) { m_superinstructions = on; }
+
+	// Parses, folds and compiles `source`, then runs its top-level
+	// statements. Natives must be defined before. Returns false after
+	// reporting errors. Only a script loaded from a file can import
+	// modules, which are found next to it. loadFile() parses every function
+	// body, used or not, so it reports every syntax error in the file.
+	bool load(const std::string& source);
+	bool loadFile(const std::string& path);
+
+	// Runs an already compiled script with this runtime's globals and heap;
+	// the script itself is shared, not copied.
+	bool load(std::shared_ptr<const Script> script);
+
+	// Heap snapshots (see HeapSnapshot): saveSnapshot() writes the loaded
+	// script and what its globals hold now; loadSnapshot() loads that
+	// instead of a script, without running anything. Both return false
+	// after reporting errors.
+	bool saveSnapshot(const std::string& path) const;
+	bool loadSnapshot(const std::string& path);
+
+	// A `pub func` of the loaded script; empty (false) if there is none.
+	template <typename Signature>
+	ScriptFunction<Signature> function(const std::string& name) {
+		const Value* fn = publicFunction(name);
+		return fn ? ScriptFunction<Signature>(&m_vm, *fn) : ScriptFunction<Signature>();
+	}
+
+	VM& vm() { return m_vm; }
+	const Script* script() const { return m_script.get(); }
+
+private:
+	VM m_vm;
+	std::shared_ptr<const Script> m_script;
+	bool m_superinstructions = true;
+
+	const Value* publicFunction(const std::string& name);
+};
+
+#endif // LANG_HOST_H
\ No newline at end of file
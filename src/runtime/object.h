@@ -0,0 +1,113 @@
+#ifndef LANG_OBJECT_H
+#define LANG_OBJECT_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "simd.h"
+#include "value.h"
+
+class VM;
+struct FunctionProto;
+
+enum class ObjectKind : uint8_t {
+	String,
+	Function,  // FunctionProto, see bytecode.h
+	Native,
+	Generator,
+	Array
+};
+
+// Header of everything a Value can point to. Objects made while a script
+// runs belong to the VM's heap and are freed by its collector; objects
+// owned by a compiled Script or registered natives are never on the heap
+// and are only read, so a Script can be shared between threads.
+struct Object {
+	ObjectKind kind;
+	bool marked = false;
+
+	// The VM whose heap holds the object, null if none. A VM only marks its
+	// own objects, so workers of a parallel loop can see their parent's.
+	const VM* owner = nullptr;
+	Object* next = nullptr;  // heap list
+
+	Object(ObjectKind kind) : kind(kind) {}
+	virtual ~Object() = default;
+};
+
+struct StringObject : public Object {
+	std::string value;
+
+	StringObject(const std::string& value) : Object(ObjectKind::String), value(value) {}
+	StringObject(std::string&& value) : Object(ObjectKind::String), value(std::move(value)) {}
+};
+
+// Called with the arguments in place on the VM stack. Writes the result to
+// `result` and returns true, or reports through VM::fail() and returns
+// false. `data` is NativeFunction::data.
+using NativeThunk = bool (*)(VM& vm, const void* data, Value* args, int argc, Value& result);
+
+struct NativeFunction : public Object {
+	std::string name;
+	NativeThunk thunk;
+	const void* data = nullptr;
+
+	// Number of arguments, -1 when the thunk checks them itself.
+	int arity = -1;
+
+	// Owns a bound callable, if any; `data` points into it.
+	std::shared_ptr<void> holder;
+
+	NativeFunction(const std::string& name, NativeThunk thunk, int arity)
+		: Object(ObjectKind::Native), name(name), thunk(thunk), arity(arity)
+	{}
+};
+
+// A call of a generator function. Its frame is copied onto the VM stack
+// while it runs and back into `slots` when it yields, so a suspended
+// generator holds no VM stack and can outlive the loop that started it.
+struct GeneratorObject : public Object {
+	enum State : uint8_t { Suspended, Running, Done };
+
+	const FunctionProto* function;
+	std::vector<Value> slots;  // the frame, while suspended
+	int ip = 0;                // where to resume
+	State state = Suspended;
+
+	GeneratorObject(const FunctionProto* function) : Object(ObjectKind::Generator), function(function) {}
+};
+
+// A typed numeric array: `length` elements of one ElementType, contiguous
+// and aligned for the kernels of runtime/simd.h. The length never
+// changes. Elements read back as Numbers (f64, f32) or Integers (i64, i32).
+struct ArrayObject : public Object {
+	static const size_t Alignment = 64;
+
+	ElementType element;
+	size_t length;
+	void* data;
+
+	// Zero-filled unless `zeroed` is false. Throws std::bad_alloc if there
+	// is no memory for the elements.
+	ArrayObject(ElementType element, size_t length, bool zeroed = true);
+	~ArrayObject();
+
+	template <typename T>
+	T* as() const { return static_cast<T*>(data); }
+
+	Value get(size_t i) const {
+		switch (element) {
+			case ElementType::F64: return Value::number(as<double>()[i]);
+			case ElementType::F32: return Value::number(as<float>()[i]);
+			case ElementType::I64: return Value::integer(as<int64_t>()[i]);
+			default: return Value::integer(as<int32_t>()[i]);
+		}
+	}
+};
+
+inline StringObject* asString(const Value& v) { return static_cast<StringObject*>(v.objectValue); }
+inline ArrayObject* asArray(const Value& v) { return static_cast<ArrayObject*>(v.objectValue); }
+
+#endif // LANG_OBJECT_H
\ No newline at end of file
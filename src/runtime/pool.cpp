@@ -0,0 +1,41 @@
+#include "pool.h"
+
+RuntimePool::RuntimePool(int threads, Setup setup, int stackSize)
+	: m_setup(std::move(setup)), m_stackSize(stackSize), m_pool(threads)
+{
+	for (int i = 0; i < m_pool.size(); i++) {
+		m_isolates.emplace_back(new Runtime(m_stackSize));
+		if (m_setup) m_setup(*m_isolates.back());
+	}
+}
+
+RuntimePool::~RuntimePool() {
+	m_pool.wait();
+}
+
+bool RuntimePool::load(const std::string& source) {
+	std::shared_ptr<const Script> script = compileScript(source);
+	return script && load(std::move(script));
+}
+
+bool RuntimePool::load(std::shared_ptr<const Script> script) {
+	wait();
+
+	// Loaded to the side and swapped in together, so a failure in any of
+	// them leaves every isolate as it was.
+	std::vector<std::unique_ptr<Runtime>> isolates;
+	for (size_t i = 0; i < m_isolates.size(); i++) {
+		isolates.emplace_back(new Runtime(m_stackSize));
+		if (m_setup) m_setup(*isolates.back());
+		if (!isolates.back()->load(script)) return false;
+	}
+	m_isolates.swap(isolates);
+	m_script = std::move(script);
+	return true;
+}
+
+void RuntimePool::submit(std::function<void(Runtime&)> job) {
+	m_pool.submit([this, job = std::move(job)] {
+		job(*m_isolates[m_pool.worker()]);
+	});
+}
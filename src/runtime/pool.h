@@ -0,0 +1,70 @@
+#ifndef LANG_POOL_H
+#define LANG_POOL_H
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "host.h"
+#include "../util/threadpool.h"
+
+// Isolates for serving many requests with the same scripts. Every worker
+// thread owns a Runtime with its own stack, globals, heap and natives; the
+// compiled Script (bytecode, constants and interned strings) exists once and
+// all of them run it. The one thing they write to it is quickening: each
+// isolate rewrites the ops of a shared instruction as the operand types it
+// sees change, one relaxed atomic store at a time (see loadOp()). Every form
+// of an op checks its operands itself, so whichever form an isolate reads
+// runs correctly; isolates that disagree about types only cost each other
+// the fast path. A job runs in the isolate of whichever worker takes it, so
+// nothing is locked while scripts execute:
+//
+//     RuntimePool pool(0, [](Runtime& rt) { rt.define<&area>("area"); });
+//     pool.load(source);
+//     pool.submit([](Runtime& rt) { rt.function<double(double)>("handle")(1); });
+//     pool.wait();
+class RuntimePool {
+public:
+	// Prepares each new isolate: natives, budgets, parallelism. It runs
+	// again for the fresh isolates of every load().
+	using Setup = std::function<void(Runtime&)>;
+
+	// threads <= 0 uses one isolate per hardware thread.
+	RuntimePool(int threads = 0, Setup setup = nullptr, int stackSize = VM::DefaultStackSize);
+	~RuntimePool();
+
+	RuntimePool(const RuntimePool&) = delete;
+	RuntimePool& operator=(const RuntimePool&) = delete;
+
+	// Compiles `source` once and loads it into a fresh set of isolates,
+	// each running the top-level statements into its own globals. They
+	// replace the current isolates only once every one of them has loaded,
+	// so after a failure all isolates still run the previous script with
+	// its globals. Waits for submitted jobs first; references returned by
+	// isolate() do not survive a successful load. Returns false after
+	// reporting errors.
+	bool load(const std::string& source);
+	bool load(std::shared_ptr<const Script> script);
+
+	// Runs `job` on some worker, in that worker's isolate. Jobs never share
+	// an isolate at the same time.
+	void submit(std::function<void(Runtime&)> job);
+
+	// Blocks until every submitted job has finished.
+	void wait() { m_pool.wait(); }
+
+	int size() const { return m_isolates.size(); }
+	Runtime& isolate(int index) { return *m_isolates[index]; }
+	const Script* script() const { return m_script.get(); }
+
+private:
+	Setup m_setup;
+	int m_stackSize;
+	std::vector<std::unique_ptr<Runtime>> m_isolates;
+	std::shared_ptr<const Script> m_script;
+
+	// Declared last so the workers stop before the isolates go away.
+	ThreadPool m_pool;
+};
+
+#endif // LANG_POOL_H
\ No newline at end of file
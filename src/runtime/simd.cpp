@@ -0,0 +1,231 @@
+#include "simd.h"
+
+#include <atomic>
+
+#include "detail/kernels.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef __SSE2__
+
+// SSE2 is part of every x86-64 CPU, so these need no runtime check. What
+// it lacks (64-bit multiplies and comparisons, division of integers) goes
+// lane by lane.
+namespace {
+
+template <typename E>
+struct Sse;
+
+template <>
+struct Sse<double> {
+	using T = double;
+	using R = __m128d;
+	static const size_t N = 2;
+
+	static R load(const T* p) { return _mm_loadu_pd(p); }
+	static void store(T* p, R v) { _mm_storeu_pd(p, v); }
+	static R set1(T v) { return _mm_set1_pd(v); }
+	static R add(R a, R b) { return _mm_add_pd(a, b); }
+	static R sub(R a, R b) { return _mm_sub_pd(a, b); }
+	static R mul(R a, R b) { return _mm_mul_pd(a, b); }
+	static R div(R a, R b) { return _mm_div_pd(a, b); }
+	static R min(R a, R b) { return _mm_min_pd(a, b); }
+	static R max(R a, R b) { return _mm_max_pd(a, b); }
+	static R madd(R a, R b, R c) { return _mm_add_pd(_mm_mul_pd(a, b), c); }
+
+	template <CompareOp op>
+	static R compare(R a, R b) {
+		switch (op) {
+			case CompareOp::Lt: return _mm_cmplt_pd(a, b);
+			case CompareOp::Gt: return _mm_cmpgt_pd(a, b);
+			case CompareOp::Le: return _mm_cmple_pd(a, b);
+			case CompareOp::Ge: return _mm_cmpge_pd(a, b);
+			case CompareOp::Eq: return _mm_cmpeq_pd(a, b);
+			default: return _mm_cmpneq_pd(a, b);
+		}
+	}
+
+	static void storeMask(int32_t* out, R mask) {
+		int bits = _mm_movemask_pd(mask);
+		out[0] = bits & 1;
+		out[1] = bits >> 1;
+	}
+};
+
+template <>
+struct Sse<float> {
+	using T = float;
+	using R = __m128;
+	static const size_t N = 4;
+
+	static R load(const T* p) { return _mm_loadu_ps(p); }
+	static void store(T* p, R v) { _mm_storeu_ps(p, v); }
+	static R set1(T v) { return _mm_set1_ps(v); }
+	static R add(R a, R b) { return _mm_add_ps(a, b); }
+	static R sub(R a, R b) { return _mm_sub_ps(a, b); }
+	static R mul(R a, R b) { return _mm_mul_ps(a, b); }
+	static R div(R a, R b) { return _mm_div_ps(a, b); }
+	static R min(R a, R b) { return _mm_min_ps(a, b); }
+	static R max(R a, R b) { return _mm_max_ps(a, b); }
+	static R madd(R a, R b, R c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+
+	template <CompareOp op>
+	static R compare(R a, R b) {
+		switch (op) {
+			case CompareOp::Lt: return _mm_cmplt_ps(a, b);
+			case CompareOp::Gt: return _mm_cmpgt_ps(a, b);
+			case CompareOp::Le: return _mm_cmple_ps(a, b);
+			case CompareOp::Ge: return _mm_cmpge_ps(a, b);
+			case CompareOp::Eq: return _mm_cmpeq_ps(a, b);
+			default: return _mm_cmpneq_ps(a, b);
+		}
+	}
+
+	static void storeMask(int32_t* out, R mask) {
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_and_si128(_mm_castps_si128(mask), _mm_set1_epi32(1)));
+	}
+};
+
+template <>
+struct Sse<int32_t> {
+	using T = int32_t;
+	using R = __m128i;
+	static const size_t N = 4;
+
+	static R load(const T* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+	static void store(T* p, R v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+	static R set1(T v) { return _mm_set1_epi32(v); }
+	static R add(R a, R b) { return _mm_add_epi32(a, b); }
+	static R sub(R a, R b) { return _mm_sub_epi32(a, b); }
+
+	// No 32-bit multiply before SSE4.1: multiply the even and the odd lanes
+	// to 64 bits and keep the low halves.
+	static R mul(R a, R b) {
+		R even = _mm_mul_epu32(a, b);
+		R odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+		return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+	}
+	static R div(R a, R b) { return lanewise<Sse>(a, b, [](T x, T y) { return x / y; }); }
+
+	static R select(R mask, R a, R b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+	static R min(R a, R b) { return select(_mm_cmplt_epi32(a, b), a, b); }
+	static R max(R a, R b) { return select(_mm_cmpgt_epi32(a, b), a, b); }
+	static R madd(R a, R b, R c) { return add(mul(a, b), c); }
+
+	template <CompareOp op>
+	static R compare(R a, R b) {
+		R ones = _mm_set1_epi32(-1);
+		switch (op) {
+			case CompareOp::Lt: return _mm_cmplt_epi32(a, b);
+			case CompareOp::Gt: return _mm_cmpgt_epi32(a, b);
+			case CompareOp::Le: return _mm_xor_si128(_mm_cmpgt_epi32(a, b), ones);
+			case CompareOp::Ge: return _mm_xor_si128(_mm_cmplt_epi32(a, b), ones);
+			case CompareOp::Eq: return _mm_cmpeq_epi32(a, b);
+			default: return _mm_xor_si128(_mm_cmpeq_epi32(a, b), ones);
+		}
+	}
+
+	static void storeMask(int32_t* out, R mask) { store(out, _mm_and_si128(mask, _mm_set1_epi32(1))); }
+
+	static int64_t sumWide(const T* x, size_t n) { return sumWideScalar(x, n); }
+	static int64_t dotWide(const T* x, const T* y, size_t n) { return dotWideScalar(x, y, n); }
+};
+
+template <>
+struct Sse<int64_t> {
+	using T = int64_t;
+	using R = __m128i;
+	static const size_t N = 2;
+
+	static R load(const T* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+	static void store(T* p, R v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+	static R set1(T v) { return _mm_set1_epi64x(v); }
+	static R add(R a, R b) { return _mm_add_epi64(a, b); }
+	static R sub(R a, R b) { return _mm_sub_epi64(a, b); }
+	static R mul(R a, R b) { return lanewise<Sse>(a, b, [](T x, T y) { return apply<KernelOp::Mul>(x, y); }); }
+	static R div(R a, R b) { return lanewise<Sse>(a, b, [](T x, T y) { return x / y; }); }
+	static R min(R a, R b) { return lanewise<Sse>(a, b, [](T x, T y) { return y < x ? y : x; }); }
+	static R max(R a, R b) { return lanewise<Sse>(a, b, [](T x, T y) { return y > x ? y : x; }); }
+	static R madd(R a, R b, R c) { return add(mul(a, b), c); }
+
+	template <CompareOp op>
+	static R compare(R a, R b) { return lanewise<Sse>(a, b, [](T x, T y) { return test<op>(x, y) ? T(-1) : T(0); }); }
+
+	static void storeMask(int32_t* out, R mask) {
+		int bits = _mm_movemask_pd(_mm_castsi128_pd(mask));
+		out[0] = bits & 1;
+		out[1] = bits >> 1;
+	}
+};
+
+} // namespace
+
+#endif // __SSE2__
+
+static const SimdKernels* kernelsFor(SimdLevel level) {
+	switch (level) {
+		case SimdLevel::Scalar: {
+			static const SimdKernels kernels = makeKernels<Scalar>();
+			return &kernels;
+		}
+		case SimdLevel::SSE2: {
+#ifdef __SSE2__
+			static const SimdKernels kernels = makeKernels<Sse>();
+			return &kernels;
+#else
+			return nullptr;
+#endif
+		}
+		case SimdLevel::AVX2: {
+#if defined(__x86_64__) || defined(__i386__)
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return avx2Kernels();
+#endif
+			return nullptr;
+		}
+	}
+	return nullptr;
+}
+
+static std::atomic<const SimdKernels*> s_kernels(nullptr);
+static std::atomic<SimdLevel> s_level(SimdLevel::Scalar);
+
+const char* simdLevelName(SimdLevel level) {
+	switch (level) {
+		case SimdLevel::Scalar: return "scalar";
+		case SimdLevel::SSE2: return "sse2";
+		case SimdLevel::AVX2: return "avx2";
+	}
+	return "?";
+}
+
+bool simdSupported(SimdLevel level) {
+	return kernelsFor(level) != nullptr;
+}
+
+bool setSimdLevel(SimdLevel level) {
+	const SimdKernels* kernels = kernelsFor(level);
+	if (kernels == nullptr) return false;
+	s_level = level;
+	s_kernels = kernels;
+	return true;
+}
+
+const SimdKernels& simdKernels() {
+	const SimdKernels* kernels = s_kernels.load(std::memory_order_acquire);
+	if (kernels != nullptr) return *kernels;
+
+	// First use: the best level available.
+	for (SimdLevel level : { SimdLevel::AVX2, SimdLevel::SSE2 }) {
+		if (setSimdLevel(level)) return *s_kernels;
+	}
+	setSimdLevel(SimdLevel::Scalar);
+	return *s_kernels;
+}
+
+SimdLevel simdLevel() {
+	simdKernels();
+	return s_level;
+}
\ No newline at end of file
@@ -0,0 +1,85 @@
+#ifndef LANG_SIMD_H
+#define LANG_SIMD_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Whole-array loops behind the typed arrays (ArrayObject in object.h), in
+// one version per instruction set. The widest version the CPU supports is
+// picked at startup, so one x86-64 binary still uses AVX2 where it can.
+//
+// Kernels take untyped pointers to `n` elements of the table's element
+// type, need no alignment, and allow `out` to be one of the inputs.
+// Integer elements wrap on overflow, in every version alike (typed arrays
+// are fixed-width, see array.h); integer division expects the caller
+// to have ruled out zero divisors and INT_MIN / -1. Floating-point sums
+// and dot products add in a different order per instruction set, so their
+// last bits can differ between machines.
+//
+// This header is also compiled with -mavx2, so it must not pull in any
+// inline code of the standard library.
+
+enum class ElementType : uint8_t { F64, F32, I64, I32 };
+
+static const int ElementTypes = 4;
+
+inline const char* elementTypeName(ElementType type) {
+	switch (type) {
+		case ElementType::F64: return "f64";
+		case ElementType::F32: return "f32";
+		case ElementType::I64: return "i64";
+		case ElementType::I32: return "i32";
+	}
+	return "?";
+}
+
+inline size_t elementSize(ElementType type) {
+	return type == ElementType::F64 || type == ElementType::I64 ? 8 : 4;
+}
+
+inline bool isFloatElement(ElementType type) {
+	return type == ElementType::F64 || type == ElementType::F32;
+}
+
+// In the order of the matching ArithOps.
+enum class KernelOp : uint8_t { Add, Sub, Mul, Div, Count };
+enum class CompareOp : uint8_t { Lt, Gt, Le, Ge, Eq, Ne, Count };
+
+// out[i] = a[i] op b[i]; the broadcast variants read the single element
+// b[0] instead, as the right (broadcast) or left (broadcastLeft) operand.
+using BinaryKernel = void (*)(const void* a, const void* b, void* out, size_t n);
+
+// out[i] = a[i] op b[i] (or b[0]), as 1 or 0.
+using CompareKernel = void (*)(const void* a, const void* b, int32_t* out, size_t n);
+
+// Reductions write a double for float elements and an int64_t for integer
+// ones. min and max need n > 0.
+using ReduceKernel = void (*)(const void* a, size_t n, void* result);
+using DotKernel = void (*)(const void* a, const void* b, size_t n, void* result);
+
+struct SimdKernels {
+	BinaryKernel binary[ElementTypes][int(KernelOp::Count)];
+	BinaryKernel broadcast[ElementTypes][int(KernelOp::Count)];
+	BinaryKernel broadcastLeft[ElementTypes][int(KernelOp::Count)];
+	CompareKernel compare[ElementTypes][int(CompareOp::Count)];
+	CompareKernel compareBroadcast[ElementTypes][int(CompareOp::Count)];
+	ReduceKernel sum[ElementTypes], min[ElementTypes], max[ElementTypes];
+	DotKernel dot[ElementTypes];
+};
+
+enum class SimdLevel : uint8_t { Scalar, SSE2, AVX2 };
+
+const char* simdLevelName(SimdLevel level);
+
+// The kernels in use, and the instruction set they are for.
+const SimdKernels& simdKernels();
+SimdLevel simdLevel();
+
+// Whether this build and CPU can run `level`.
+bool simdSupported(SimdLevel level);
+
+// Switches every VM to the kernels for `level`, e.g. to compare them in a
+// benchmark. Returns false, changing nothing, if it is not supported.
+bool setSimdLevel(SimdLevel level);
+
+#endif // LANG_SIMD_H
\ No newline at end of file
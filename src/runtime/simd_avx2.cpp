@@ -0,0 +1,198 @@
+// Compiled with -mavx2 -mfma (see CMakeLists.txt) and only called once
+// simd.cpp has checked the CPU. Nothing here may include inline code of
+// the standard library, which the linker could pick over the baseline
+// copy for every caller.
+#include "simd.h"
+
+#ifdef __AVX2__
+
+#include <immintrin.h>
+
+#include "detail/kernels.hpp"
+
+namespace {
+
+template <typename E>
+struct Avx;
+
+template <>
+struct Avx<double> {
+	using T = double;
+	using R = __m256d;
+	static const size_t N = 4;
+
+	static R load(const T* p) { return _mm256_loadu_pd(p); }
+	static void store(T* p, R v) { _mm256_storeu_pd(p, v); }
+	static R set1(T v) { return _mm256_set1_pd(v); }
+	static R add(R a, R b) { return _mm256_add_pd(a, b); }
+	static R sub(R a, R b) { return _mm256_sub_pd(a, b); }
+	static R mul(R a, R b) { return _mm256_mul_pd(a, b); }
+	static R div(R a, R b) { return _mm256_div_pd(a, b); }
+	static R min(R a, R b) { return _mm256_min_pd(a, b); }
+	static R max(R a, R b) { return _mm256_max_pd(a, b); }
+	static R madd(R a, R b, R c) { return _mm256_fmadd_pd(a, b, c); }
+
+	template <CompareOp op>
+	static R compare(R a, R b) {
+		switch (op) {
+			case CompareOp::Lt: return _mm256_cmp_pd(a, b, _CMP_LT_OQ);
+			case CompareOp::Gt: return _mm256_cmp_pd(a, b, _CMP_GT_OQ);
+			case CompareOp::Le: return _mm256_cmp_pd(a, b, _CMP_LE_OQ);
+			case CompareOp::Ge: return _mm256_cmp_pd(a, b, _CMP_GE_OQ);
+			case CompareOp::Eq: return _mm256_cmp_pd(a, b, _CMP_EQ_OQ);
+			default: return _mm256_cmp_pd(a, b, _CMP_NEQ_UQ);
+		}
+	}
+
+	// Gathers the low halves of the four 64-bit lanes into four int32s.
+	static void storeMask(int32_t* out, R mask) {
+		__m256i low = _mm256_permutevar8x32_epi32(_mm256_castpd_si256(mask), _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_and_si128(_mm256_castsi256_si128(low), _mm_set1_epi32(1)));
+	}
+};
+
+template <>
+struct Avx<float> {
+	using T = float;
+	using R = __m256;
+	static const size_t N = 8;
+
+	static R load(const T* p) { return _mm256_loadu_ps(p); }
+	static void store(T* p, R v) { _mm256_storeu_ps(p, v); }
+	static R set1(T v) { return _mm256_set1_ps(v); }
+	static R add(R a, R b) { return _mm256_add_ps(a, b); }
+	static R sub(R a, R b) { return _mm256_sub_ps(a, b); }
+	static R mul(R a, R b) { return _mm256_mul_ps(a, b); }
+	static R div(R a, R b) { return _mm256_div_ps(a, b); }
+	static R min(R a, R b) { return _mm256_min_ps(a, b); }
+	static R max(R a, R b) { return _mm256_max_ps(a, b); }
+	static R madd(R a, R b, R c) { return _mm256_fmadd_ps(a, b, c); }
+
+	template <CompareOp op>
+	static R compare(R a, R b) {
+		switch (op) {
+			case CompareOp::Lt: return _mm256_cmp_ps(a, b, _CMP_LT_OQ);
+			case CompareOp::Gt: return _mm256_cmp_ps(a, b, _CMP_GT_OQ);
+			case CompareOp::Le: return _mm256_cmp_ps(a, b, _CMP_LE_OQ);
+			case CompareOp::Ge: return _mm256_cmp_ps(a, b, _CMP_GE_OQ);
+			case CompareOp::Eq: return _mm256_cmp_ps(a, b, _CMP_EQ_OQ);
+			default: return _mm256_cmp_ps(a, b, _CMP_NEQ_UQ);
+		}
+	}
+
+	static void storeMask(int32_t* out, R mask) {
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_and_si256(_mm256_castps_si256(mask), _mm256_set1_epi32(1)));
+	}
+};
+
+template <>
+struct Avx<int32_t> {
+	using T = int32_t;
+	using R = __m256i;
+	static const size_t N = 8;
+
+	static R load(const T* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+	static void store(T* p, R v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+	static R set1(T v) { return _mm256_set1_epi32(v); }
+	static R add(R a, R b) { return _mm256_add_epi32(a, b); }
+	static R sub(R a, R b) { return _mm256_sub_epi32(a, b); }
+	static R mul(R a, R b) { return _mm256_mullo_epi32(a, b); }
+	static R div(R a, R b) { return lanewise<Avx>(a, b, [](T x, T y) { return x / y; }); }
+	static R min(R a, R b) { return _mm256_min_epi32(a, b); }
+	static R max(R a, R b) { return _mm256_max_epi32(a, b); }
+	static R madd(R a, R b, R c) { return add(mul(a, b), c); }
+
+	template <CompareOp op>
+	static R compare(R a, R b) {
+		R ones = _mm256_set1_epi32(-1);
+		switch (op) {
+			case CompareOp::Lt: return _mm256_cmpgt_epi32(b, a);
+			case CompareOp::Gt: return _mm256_cmpgt_epi32(a, b);
+			case CompareOp::Le: return _mm256_xor_si256(_mm256_cmpgt_epi32(a, b), ones);
+			case CompareOp::Ge: return _mm256_xor_si256(_mm256_cmpgt_epi32(b, a), ones);
+			case CompareOp::Eq: return _mm256_cmpeq_epi32(a, b);
+			default: return _mm256_xor_si256(_mm256_cmpeq_epi32(a, b), ones);
+		}
+	}
+
+	static void storeMask(int32_t* out, R mask) { store(out, _mm256_and_si256(mask, _mm256_set1_epi32(1))); }
+
+	static int64_t lanes(__m256i acc) {
+		int64_t lane[4];
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(lane), acc);
+		return lane[0] + lane[1] + lane[2] + lane[3];
+	}
+
+	// Sign-extends each half to four 64-bit lanes before adding.
+	static int64_t sumWide(const T* x, size_t n) {
+		__m256i acc = _mm256_setzero_si256();
+		size_t i = 0;
+		for (; i + N <= n; i += N) {
+			R v = load(x + i);
+			acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+			acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+		}
+		return lanes(acc) + sumWideScalar(x + i, n - i);
+	}
+
+	// _mm256_mul_epi32 multiplies the even lanes to 64 bits; shifting right
+	// by 32 moves the odd lanes there.
+	static int64_t dotWide(const T* x, const T* y, size_t n) {
+		__m256i acc = _mm256_setzero_si256();
+		size_t i = 0;
+		for (; i + N <= n; i += N) {
+			R a = load(x + i), b = load(y + i);
+			acc = _mm256_add_epi64(acc, _mm256_mul_epi32(a, b));
+			acc = _mm256_add_epi64(acc, _mm256_mul_epi32(_mm256_srli_epi64(a, 32), _mm256_srli_epi64(b, 32)));
+		}
+		return lanes(acc) + dotWideScalar(x + i, y + i, n - i);
+	}
+};
+
+template <>
+struct Avx<int64_t> {
+	using T = int64_t;
+	using R = __m256i;
+	static const size_t N = 4;
+
+	static R load(const T* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+	static void store(T* p, R v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+	static R set1(T v) { return _mm256_set1_epi64x(v); }
+	static R add(R a, R b) { return _mm256_add_epi64(a, b); }
+	static R sub(R a, R b) { return _mm256_sub_epi64(a, b); }
+	static R mul(R a, R b) { return lanewise<Avx>(a, b, [](T x, T y) { return apply<KernelOp::Mul>(x, y); }); }
+	static R div(R a, R b) { return lanewise<Avx>(a, b, [](T x, T y) { return x / y; }); }
+	static R min(R a, R b) { return _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(a, b)); }
+	static R max(R a, R b) { return _mm256_blendv_epi8(b, a, _mm256_cmpgt_epi64(a, b)); }
+	static R madd(R a, R b, R c) { return add(mul(a, b), c); }
+
+	template <CompareOp op>
+	static R compare(R a, R b) {
+		R ones = _mm256_set1_epi64x(-1);
+		switch (op) {
+			case CompareOp::Lt: return _mm256_cmpgt_epi64(b, a);
+			case CompareOp::Gt: return _mm256_cmpgt_epi64(a, b);
+			case CompareOp::Le: return _mm256_xor_si256(_mm256_cmpgt_epi64(a, b), ones);
+			case CompareOp::Ge: return _mm256_xor_si256(_mm256_cmpgt_epi64(b, a), ones);
+			case CompareOp::Eq: return _mm256_cmpeq_epi64(a, b);
+			default: return _mm256_xor_si256(_mm256_cmpeq_epi64(a, b), ones);
+		}
+	}
+
+	static void storeMask(int32_t* out, R mask) { Avx<double>::storeMask(out, _mm256_castsi256_pd(mask)); }
+};
+
+} // namespace
+
+const SimdKernels* avx2Kernels() {
+	static const SimdKernels kernels = makeKernels<Avx>();
+	return &kernels;
+}
+
+#else
+
+const SimdKernels* avx2Kernels() {
+	return nullptr;
+}
+
+#endif // __AVX2__
\ No newline at end of file
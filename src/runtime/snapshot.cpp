@@ -0,0 +1,400 @@
+#include "snapshot.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <map>
+#include <sstream>
+
+#include "../parser/parser.h"
+
+// Layout, integers as they are in memory: magic, Version, Op::Count, the
+// FNV-1a hash of the rest, then the Script's strings, its functions, its
+// global slots and the index of `main`, and last the value of every
+// global slot.
+static const char Magic[8] = { 'L', 'A', 'N', 'G', 'H', 'E', 'A', 'P' };
+static const size_t HeaderSize = sizeof(Magic) + 4 + 4 + 8;
+static const uint32_t None = UINT32_MAX;
+
+static uint64_t checksum(const char* data, size_t size) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= uint8_t(data[i]);
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+namespace {
+
+struct HeapWriter {
+	std::string out;
+	std::map<const Object*, uint32_t> functions, strings;
+
+	void raw(const void* data, size_t size) { out.append(static_cast<const char*>(data), size); }
+	void u8(uint8_t v) { raw(&v, 1); }
+	void u16(uint16_t v) { raw(&v, 2); }
+	void u32(uint32_t v) { raw(&v, 4); }
+	void u64(uint64_t v) { raw(&v, 8); }
+	void str(const std::string& v) {
+		u32(v.size());
+		raw(v.data(), v.size());
+	}
+
+	// A constant or a global. Strings of the Script are written as its
+	// indices, those of the heap by value. Returns false for a generator.
+	bool value(const Value& v) {
+		u8(uint8_t(v.type));
+		switch (v.type) {
+			case ValueType::Bool: u8(v.boolValue); return true;
+			case ValueType::Integer: u64(uint64_t(v.integerValue)); return true;
+			case ValueType::Number: raw(&v.numberValue, 8); return true;
+			case ValueType::Char: u8(uint8_t(v.charValue)); return true;
+			case ValueType::String: {
+				auto it = strings.find(v.objectValue);
+				u8(it != strings.end());
+				if (it != strings.end()) u32(it->second);
+				else str(asString(v)->value);
+				return true;
+			}
+			case ValueType::Function: {
+				auto it = functions.find(v.objectValue);
+				u8(it != functions.end());
+				if (it != functions.end()) u32(it->second);
+				else str(static_cast<const NativeFunction*>(v.objectValue)->name);
+				return true;
+			}
+			case ValueType::Array: {
+				const ArrayObject* array = asArray(v);
+				u8(uint8_t(array->element));
+				u64(array->length);
+				raw(array->data, array->length * elementSize(array->element));
+				return true;
+			}
+			case ValueType::Generator: return false;
+			default: return true;
+		}
+	}
+};
+
+struct HeapReader {
+	const char* pos;
+	const char* end;
+	bool failed = false;
+	std::string missing;  // a native the VM does not define
+	bool reported = false;  // the VM could not make an array
+
+	HeapReader(const char* pos, const char* end) : pos(pos), end(end) {}
+
+	bool take(void* out, size_t size) {
+		if (failed || size_t(end - pos) < size) {
+			failed = true;
+			return false;
+		}
+		std::memcpy(out, pos, size);
+		pos += size;
+		return true;
+	}
+	uint8_t u8() { uint8_t v = 0; take(&v, 1); return v; }
+	uint16_t u16() { uint16_t v = 0; take(&v, 2); return v; }
+	uint32_t u32() { uint32_t v = 0; take(&v, 4); return v; }
+	uint64_t u64() { uint64_t v = 0; take(&v, 8); return v; }
+	std::string str() {
+		uint32_t size = u32();
+		if (failed || size_t(end - pos) < size) {
+			failed = true;
+			return "";
+		}
+		std::string v(pos, size);
+		pos += size;
+		return v;
+	}
+
+	// A count of items of at least `size` bytes each, which must all fit
+	// in what is left, so a damaged count cannot make us allocate.
+	uint32_t count(size_t size) {
+		uint32_t n = u32();
+		if (!failed && size_t(end - pos) / size < n) failed = true;
+		return failed ? 0 : n;
+	}
+
+	// An index below `limit`.
+	uint32_t index(size_t limit) {
+		uint32_t i = u32();
+		if (i >= limit) failed = true;
+		return failed ? 0 : i;
+	}
+
+	// What HeapWriter::value() wrote. Strings and arrays of globals are
+	// made in `vm`'s heap; natives are looked up there.
+	Value value(VM& vm, const Script& script) {
+		Value v;
+		ValueType type = ValueType(u8());
+		switch (type) {
+			case ValueType::Nil: break;
+			case ValueType::Bool: v = Value::boolean(u8() != 0); break;
+			case ValueType::Integer: v = Value::integer(int64_t(u64())); break;
+			case ValueType::Number: {
+				double d = 0;
+				take(&d, 8);
+				v = Value::number(d);
+				break;
+			}
+			case ValueType::Char: v = Value::character(char(u8())); break;
+			case ValueType::String:
+				if (u8()) v = Value::object(type, script.strings[index(script.strings.size())].get());
+				else v = vm.string(str());
+				break;
+			case ValueType::Function:
+				if (u8()) {
+					v = Value::object(type, script.functions[index(script.functions.size())].get());
+				} else {
+					std::string name = str();
+					const NativeFunction* native = vm.native(name);
+					if (native == nullptr && !failed) {
+						missing = name;
+						failed = true;
+					}
+					v = Value::object(type, const_cast<NativeFunction*>(native));
+				}
+				break;
+			case ValueType::Array: {
+				ElementType element = ElementType(u8());
+				uint64_t length = u64();
+				if (failed || uint8_t(element) >= ElementTypes || size_t(end - pos) / elementSize(element) < length) {
+					failed = true;
+					break;
+				}
+				ArrayObject* array = vm.array(element, length, false);
+				if (array == nullptr) {
+					failed = reported = true;
+					break;
+				}
+				take(array->data, length * elementSize(element));
+				v = Value::object(type, array);
+				break;
+			}
+			default:
+				failed = true;
+				break;
+		}
+		return v;
+	}
+};
+
+} // namespace
+
+bool HeapSnapshot::save(const VM& vm, const std::string& path) {
+	const Script* script = vm.script();
+	if (script == nullptr) {
+		error("ERROR: No script is loaded to snapshot.");
+		return false;
+	}
+
+	HeapWriter w;
+	w.u32(script->strings.size());
+	for (size_t i = 0; i < script->strings.size(); i++) {
+		w.strings[script->strings[i].get()] = i;
+		w.str(script->strings[i]->value);
+	}
+	for (size_t i = 0; i < script->functions.size(); i++) {
+		w.functions[script->functions[i].get()] = i;
+	}
+
+	w.u32(script->functions.size());
+	for (auto&& function : script->functions) {
+		w.str(function->name);
+		w.u8(function->publicFunc);
+		w.u8(function->generator);
+		for (int field : { function->line, function->pos, function->params, function->required, function->frameSize, function->maxStack }) {
+			w.u32(field);
+		}
+
+		// Quickened as far as this VM got; each form is valid to run.
+		w.u32(function->code.size());
+		for (size_t i = 0; i < function->code.size(); i++) {
+			const Instr& ins = function->code[i];
+			w.u8(uint8_t(loadOp(ins)));
+			w.u16(__atomic_load_n(&ins.a, __ATOMIC_RELAXED));
+			w.u32(uint32_t(ins.b));
+			w.u32(function->positions[i].line);
+			w.u32(function->positions[i].pos);
+		}
+
+		w.u32(function->constants.size());
+		for (auto&& constant : function->constants) w.value(constant);
+		w.u32(function->entries.size());
+		for (int entry : function->entries) w.u32(entry);
+		w.u32(function->reductions.size());
+		for (auto&& reduction : function->reductions) {
+			w.str(reduction.name);
+			w.u32(reduction.global);
+			w.u8(uint8_t(reduction.op));
+		}
+	}
+
+	w.u32(script->globals.size());
+	for (auto&& slot : script->globals) {
+		w.u8(uint8_t(slot.kind));
+		w.str(slot.name);
+		w.u8(slot.publicName);
+		w.u32(slot.function ? w.functions[slot.function] : None);
+	}
+	w.u32(w.functions[script->main]);
+
+	for (size_t i = 0; i < vm.m_globals.size(); i++) {
+		if (!w.value(vm.m_globals[i])) {
+			error("ERROR: Cannot snapshot \"" << script->globals[i].name << "\", which holds a generator.");
+			return false;
+		}
+	}
+
+	std::string header(Magic, sizeof(Magic));
+	uint32_t version = Version, ops = uint32_t(Op::Count);
+	uint64_t hash = checksum(w.out.data(), w.out.size());
+	header.append((const char*) &version, 4);
+	header.append((const char*) &ops, 4);
+	header.append((const char*) &hash, 8);
+
+	std::string tmp = path + ".tmp";
+	{
+		std::ofstream out(tmp, std::ios::binary);
+		if (!out.write(header.data(), header.size()) || !out.write(w.out.data(), w.out.size())) {
+			error("ERROR: Cannot write snapshot \"" << path << "\".");
+			return false;
+		}
+	}
+	if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+		error("ERROR: Cannot write snapshot \"" << path << "\".");
+		return false;
+	}
+	return true;
+}
+
+std::shared_ptr<const Script> HeapSnapshot::restore(VM& vm, const std::string& path) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		error("ERROR: Cannot read snapshot \"" << path << "\".");
+		return nullptr;
+	}
+	std::ostringstream buffer;
+	buffer << file.rdbuf();
+	const std::string data = buffer.str();
+
+	uint32_t version = 0, ops = 0;
+	uint64_t hash = 0;
+	if (data.size() >= HeaderSize) {
+		std::memcpy(&version, data.data() + sizeof(Magic), 4);
+		std::memcpy(&ops, data.data() + sizeof(Magic) + 4, 4);
+		std::memcpy(&hash, data.data() + sizeof(Magic) + 8, 8);
+	}
+	if (data.size() < HeaderSize || std::memcmp(data.data(), Magic, sizeof(Magic)) != 0 ||
+		version != Version || ops != uint32_t(Op::Count))
+	{
+		error("ERROR: \"" << path << "\" is not a snapshot of this version.");
+		return nullptr;
+	}
+	if (checksum(data.data() + HeaderSize, data.size() - HeaderSize) != hash) {
+		error("ERROR: Snapshot \"" << path << "\" is damaged.");
+		return nullptr;
+	}
+
+	HeapReader in { data.data() + HeaderSize, data.data() + data.size() };
+	std::shared_ptr<Script> script(new Script());
+
+	uint32_t strings = in.count(4);
+	for (uint32_t i = 0; i < strings; i++) {
+		script->strings.emplace_back(new StringObject(in.str()));
+	}
+
+	// Constants may refer to any function, so they all exist first.
+	uint32_t functions = in.count(1);
+	for (uint32_t i = 0; i < functions; i++) {
+		script->functions.emplace_back(new FunctionProto());
+	}
+	for (auto&& function : script->functions) {
+		if (in.failed) break;
+		function->name = in.str();
+		function->publicFunc = in.u8() != 0;
+		function->generator = in.u8() != 0;
+		for (int* field : { &function->line, &function->pos, &function->params, &function->required, &function->frameSize, &function->maxStack }) {
+			*field = int(in.u32());
+		}
+
+		uint32_t code = in.count(15);
+		for (uint32_t i = 0; i < code; i++) {
+			uint8_t op = in.u8();
+			uint16_t a = in.u16();
+			int32_t b = int32_t(in.u32());
+			if (op >= uint8_t(Op::Count)) in.failed = true;
+			function->code.emplace_back(Op(op), a, b);
+			int line = int(in.u32());
+			function->positions.push_back({ line, int(in.u32()) });
+		}
+
+		uint32_t constants = in.count(1);
+		for (uint32_t i = 0; i < constants && !in.failed; i++) {
+			function->constants.push_back(in.value(vm, *script));
+		}
+		uint32_t entries = in.count(4);
+		for (uint32_t i = 0; i < entries; i++) {
+			function->entries.push_back(int(in.index(code)));
+		}
+		if (!in.failed && function->entries.size() != size_t(function->params - function->required + 1)) in.failed = true;
+		uint32_t reductions = in.count(9);
+		for (uint32_t i = 0; i < reductions; i++) {
+			std::string name = in.str();
+			int global = int(in.u32());
+			function->reductions.push_back({ name, global, Op(in.u8()) });
+		}
+	}
+
+	uint32_t globals = in.count(10);
+	for (uint32_t i = 0; i < globals; i++) {
+		GlobalSlot slot;
+		slot.kind = GlobalSlot::Kind(in.u8());
+		slot.name = in.str();
+		slot.publicName = in.u8() != 0;
+		uint32_t function = in.u32();
+		if (function != None) slot.function = script->functions[function < functions ? function : 0].get();
+		if (function != None && function >= functions) in.failed = true;
+		if (slot.kind > GlobalSlot::Native) in.failed = true;
+		script->globals.push_back(slot);
+
+		// The compiler indexes a name's first slot; a native after it
+		// shadowed by a global keeps its slot but not the name.
+		script->m_globalIndex.insert({ slot.name, int(i) });
+	}
+	if (functions > 0) script->main = script->functions[in.index(functions)].get();
+	for (auto&& function : script->functions) {
+		for (auto&& reduction : function->reductions) {
+			if (uint32_t(reduction.global) >= globals) in.failed = true;
+		}
+	}
+
+	// Decoded before the VM switches to the script, so a snapshot that
+	// cannot be restored leaves it as it was. Until then nothing collects.
+	std::vector<Value> values;
+	for (uint32_t i = 0; i < globals && !in.failed; i++) {
+		if (script->globals[i].kind == GlobalSlot::Native && vm.native(script->globals[i].name) == nullptr) {
+			in.missing = script->globals[i].name;
+			in.failed = true;
+		}
+		values.push_back(in.value(vm, *script));
+	}
+
+	if (!in.missing.empty()) {
+		error("ERROR: Undefined name \"" << in.missing << "\".");
+		return nullptr;
+	}
+	if (in.reported) return nullptr;
+	if (in.failed || in.pos != in.end || script->main == nullptr) {
+		error("ERROR: Snapshot \"" << path << "\" is damaged.");
+		return nullptr;
+	}
+
+	vm.load(*script);
+	vm.m_globals = std::move(values);
+	return script;
+}
@@ -0,0 +1,34 @@
+#ifndef LANG_SNAPSHOT_H
+#define LANG_SNAPSHOT_H
+
+#include <memory>
+#include <string>
+
+#include "vm.h"
+
+// Heap snapshots: a compiled Script and the values a VM's globals hold
+// after running it, in one file. Restoring one skips lexing, parsing,
+// compiling and the top-level statements, so a runtime whose prelude is
+// expensive to set up starts in the time it takes to read the file.
+//
+// Nothing in the file is an address: functions and strings are indices
+// into the Script, natives are bound again by name, and strings and arrays
+// in globals are copied into the new VM's heap. Generators cannot be saved.
+// A checksum rejects damaged files, but the instructions themselves are
+// trusted, so only restore snapshots this build wrote.
+class HeapSnapshot {
+public:
+	// Writes `vm`'s script and globals to `path`. Returns false after
+	// reporting why not.
+	static bool save(const VM& vm, const std::string& path);
+
+	// Loads the script saved in `path` into `vm` with the saved globals;
+	// the natives it uses must be defined. Returns null after reporting
+	// errors.
+	static std::shared_ptr<const Script> restore(VM& vm, const std::string& path);
+
+	// Bumped whenever the layout or the instruction set changes.
+	static const uint32_t Version = 1;
+};
+
+#endif // LANG_SNAPSHOT_H
\ No newline at end of file
@@ -0,0 +1,210 @@
+#include "value.h"
+
+#include <cmath>
+#include <limits>
+
+ArithOp binaryArithOp(const std::string& op) {
+	if (op == "+") return ArithOp::Add;
+	if (op == "-") return ArithOp::Sub;
+	if (op == "*") return ArithOp::Mul;
+	if (op == "/") return ArithOp::Div;
+	if (op == "%") return ArithOp::Mod;
+	if (op == "**") return ArithOp::Pow;
+	if (op == "&") return ArithOp::BitAnd;
+	if (op == "|") return ArithOp::BitOr;
+	if (op == "^") return ArithOp::BitXor;
+	if (op == "<<") return ArithOp::Shl;
+	if (op == ">>") return ArithOp::Shr;
+	if (op == "<") return ArithOp::Lt;
+	if (op == ">") return ArithOp::Gt;
+	if (op == "<=") return ArithOp::Le;
+	if (op == ">=") return ArithOp::Ge;
+	if (op == "==") return ArithOp::Eq;
+	if (op == "!=") return ArithOp::Ne;
+	if (op == "&&") return ArithOp::And;
+	if (op == "||") return ArithOp::Or;
+	return ArithOp::Invalid;
+}
+
+ArithOp unaryArithOp(const std::string& op) {
+	if (op == "-") return ArithOp::Neg;
+	if (op == "+") return ArithOp::Plus;
+	if (op == "~") return ArithOp::BitNot;
+	if (op == "!") return ArithOp::Not;
+	return ArithOp::Invalid;
+}
+
+bool Value::truthy() const {
+	switch (type) {
+		case ValueType::Bool: return boolValue;
+		case ValueType::Integer: return integerValue != 0;
+		case ValueType::Number: return numberValue != 0.0;
+		case ValueType::Char: return charValue != '\0';
+		case ValueType::Nil: return false;
+		default: return true;
+	}
+}
+
+bool integerOp(ArithOp op, int64_t a, int64_t b, Value& out) {
+	int64_t r;
+	switch (op) {
+		case ArithOp::Add:
+			if (__builtin_add_overflow(a, b, &r)) out = Value::number(double(a) + double(b));
+			else out = Value::integer(r);
+			return true;
+		case ArithOp::Sub:
+			if (__builtin_sub_overflow(a, b, &r)) out = Value::number(double(a) - double(b));
+			else out = Value::integer(r);
+			return true;
+		case ArithOp::Mul:
+			if (__builtin_mul_overflow(a, b, &r)) out = Value::number(double(a) * double(b));
+			else out = Value::integer(r);
+			return true;
+		case ArithOp::Div:
+			out = Value::number(double(a) / double(b));
+			return true;
+		case ArithOp::Mod:
+			if (b == 0) return false;
+			out = Value::integer(b == -1 ? 0 : a % b);
+			return true;
+		case ArithOp::Pow:
+			out = Value::number(std::pow(double(a), double(b)));
+			return true;
+		case ArithOp::BitAnd: out = Value::integer(a & b); return true;
+		case ArithOp::BitOr: out = Value::integer(a | b); return true;
+		case ArithOp::BitXor: out = Value::integer(a ^ b); return true;
+		// Shift counts wrap at 64 like the hardware does, and left shifts are
+		// done unsigned so they wrap instead of being undefined.
+		case ArithOp::Shl: out = Value::integer(int64_t(uint64_t(a) << (b & 63))); return true;
+		case ArithOp::Shr: out = Value::integer(a >> (b & 63)); return true;
+		case ArithOp::Lt: out = Value::boolean(a < b); return true;
+		case ArithOp::Gt: out = Value::boolean(a > b); return true;
+		case ArithOp::Le: out = Value::boolean(a <= b); return true;
+		case ArithOp::Ge: out = Value::boolean(a >= b); return true;
+		case ArithOp::Eq: out = Value::boolean(a == b); return true;
+		case ArithOp::Ne: out = Value::boolean(a != b); return true;
+		default: return false;
+	}
+}
+
+static bool toInteger(const Value& v, int64_t& out) {
+	if (v.type == ValueType::Integer) {
+		out = v.integerValue;
+		return true;
+	}
+	if (v.type != ValueType::Number) return false;
+
+	double d = std::trunc(v.numberValue);
+	if (!std::isfinite(d) ||
+		d < double(std::numeric_limits<int64_t>::min()) ||
+		d >= double(std::numeric_limits<int64_t>::max()))
+	{
+		return false;
+	}
+	out = int64_t(d);
+	return true;
+}
+
+static bool numberOp(ArithOp op, double a, double b, Value& out) {
+	switch (op) {
+		case ArithOp::Add: out = Value::number(a + b); return true;
+		case ArithOp::Sub: out = Value::number(a - b); return true;
+		case ArithOp::Mul: out = Value::number(a * b); return true;
+		case ArithOp::Div: out = Value::number(a / b); return true;
+		case ArithOp::Mod: out = Value::number(std::fmod(a, b)); return true;
+		case ArithOp::Pow: out = Value::number(std::pow(a, b)); return true;
+		case ArithOp::Lt: out = Value::boolean(a < b); return true;
+		case ArithOp::Gt: out = Value::boolean(a > b); return true;
+		case ArithOp::Le: out = Value::boolean(a <= b); return true;
+		case ArithOp::Ge: out = Value::boolean(a >= b); return true;
+		case ArithOp::Eq: out = Value::boolean(a == b); return true;
+		case ArithOp::Ne: out = Value::boolean(a != b); return true;
+		default: return false;
+	}
+}
+
+bool binaryOp(ArithOp op, const Value& a, const Value& b, Value& out) {
+	if (op == ArithOp::And) {
+		out = Value::boolean(a.truthy() && b.truthy());
+		return true;
+	} else if (op == ArithOp::Or) {
+		out = Value::boolean(a.truthy() || b.truthy());
+		return true;
+	}
+
+	if (a.type == ValueType::Integer && b.type == ValueType::Integer) {
+		return integerOp(op, a.integerValue, b.integerValue, out);
+	}
+
+	switch (op) {
+		case ArithOp::BitAnd:
+		case ArithOp::BitOr:
+		case ArithOp::BitXor:
+		case ArithOp::Shl:
+		case ArithOp::Shr: {
+			int64_t x, y;
+			if (!toInteger(a, x) || !toInteger(b, y)) return false;
+			return integerOp(op, x, y, out);
+		}
+		default: break;
+	}
+
+	if (a.isNumeric() && b.isNumeric()) {
+		return numberOp(op, a.toNumber(), b.toNumber(), out);
+	}
+
+	if (a.type != b.type) {
+		if (op == ArithOp::Eq || op == ArithOp::Ne) {
+			out = Value::boolean(op == ArithOp::Ne);
+			return true;
+		}
+		return false;
+	}
+
+	switch (a.type) {
+		case ValueType::Nil:
+			if (op != ArithOp::Eq && op != ArithOp::Ne) return false;
+			out = Value::boolean(op == ArithOp::Eq);
+			return true;
+		case ValueType::Bool:
+			if (op == ArithOp::Eq) out = Value::boolean(a.boolValue == b.boolValue);
+			else if (op == ArithOp::Ne) out = Value::boolean(a.boolValue != b.boolValue);
+			else return false;
+			return true;
+		case ValueType::Char:
+			return integerOp(op, a.charValue, b.charValue, out) && out.type == ValueType::Bool;
+		default:
+			return false;
+	}
+}
+
+bool unaryOp(ArithOp op, const Value& a, Value& out) {
+	switch (op) {
+		case ArithOp::Not:
+			out = Value::boolean(!a.truthy());
+			return true;
+		case ArithOp::Plus:
+			if (!a.isNumeric()) return false;
+			out = a;
+			return true;
+		case ArithOp::Neg:
+			if (a.type == ValueType::Integer) {
+				int64_t r;
+				if (__builtin_sub_overflow(int64_t(0), a.integerValue, &r)) out = Value::number(-double(a.integerValue));
+				else out = Value::integer(r);
+				return true;
+			} else if (a.type == ValueType::Number) {
+				out = Value::number(-a.numberValue);
+				return true;
+			}
+			return false;
+		case ArithOp::BitNot: {
+			int64_t x;
+			if (!toInteger(a, x)) return false;
+			out = Value::integer(~x);
+			return true;
+		}
+		default:
+			return false;
+	}
+}
\ No newline at end of file
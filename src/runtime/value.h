@@ -0,0 +1,64 @@
+#ifndef LANG_VALUE_H
+#define LANG_VALUE_H
+
+#include <cstdint>
+#include <string>
+
+#include "../parser/valuetype.h"
+
+// Operators resolved once from their lexeme, so evaluation never compares
+// operator strings.
+enum class ArithOp {
+	Invalid = 0,
+	Add, Sub, Mul, Div, Mod, Pow,
+	BitAnd, BitOr, BitXor, Shl, Shr,
+	Lt, Gt, Le, Ge, Eq, Ne,
+	And, Or,
+	Neg, Plus, BitNot, Not
+};
+
+ArithOp binaryArithOp(const std::string& op);
+ArithOp unaryArithOp(const std::string& op);
+
+struct Object;
+
+// Strings, functions, generators and arrays point to an Object (see
+// runtime/object.h); the other types are stored inline, so a Value is two
+// words and never owns anything.
+struct Value {
+	ValueType type;
+	union {
+		bool boolValue;
+		int64_t integerValue;
+		double numberValue;
+		char charValue;
+		Object* objectValue;
+	};
+
+	Value() : type(ValueType::Nil), integerValue(0) {}
+
+	static Value boolean(bool v) { Value r; r.type = ValueType::Bool; r.boolValue = v; return r; }
+	static Value integer(int64_t v) { Value r; r.type = ValueType::Integer; r.integerValue = v; return r; }
+	static Value number(double v) { Value r; r.type = ValueType::Number; r.numberValue = v; return r; }
+	static Value character(char v) { Value r; r.type = ValueType::Char; r.charValue = v; return r; }
+	static Value object(ValueType t, Object* v) { Value r; r.type = t; r.objectValue = v; return r; }
+
+	bool isNumeric() const { return isNumericType(type); }
+	bool isObject() const {
+		return type == ValueType::String || type == ValueType::Function || type == ValueType::Generator || type == ValueType::Array;
+	}
+	double toNumber() const { return type == ValueType::Integer ? double(integerValue) : numberValue; }
+	bool truthy() const;
+};
+
+// Integer fast path. Add, Sub and Mul promote to Number on overflow; the
+// bitwise, shift and modulo operators never touch doubles.
+// Returns false when the operation is undefined (e.g. modulo by zero).
+bool integerOp(ArithOp op, int64_t a, int64_t b, Value& out);
+
+// Generic versions that dispatch on the operand types.
+// Return false when the operator does not apply to the given operands.
+bool binaryOp(ArithOp op, const Value& a, const Value& b, Value& out);
+bool unaryOp(ArithOp op, const Value& a, Value& out);
+
+#endif // LANG_VALUE_H
\ No newline at end of file
@@ -0,0 +1,1092 @@
+#include "vm.h"
+
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <iomanip>
+#include <mutex>
+#include <new>
+
+#include "../parser/parser.h"
+#include "../util/profiler.h"
+#include "../util/threadpool.h"
+#include "array.h"
+
+// Heap size before the first collection, and the least it grows by after.
+static const size_t MinCollect = 1 << 20;
+
+// Most steps between two checks of the budget; see VM::refill().
+static const uint32_t CheckInterval = 1024;
+
+// Chunks per thread of a parallel loop: enough to even out iterations of
+// different cost, few enough that scheduling them stays cheap.
+static const int ChunksPerThread = 8;
+
+static const ArithOp s_arithOps[] = {
+	ArithOp::Add, ArithOp::Sub, ArithOp::Mul, ArithOp::Div, ArithOp::Mod, ArithOp::Pow,
+	ArithOp::BitAnd, ArithOp::BitOr, ArithOp::BitXor, ArithOp::Shl, ArithOp::Shr,
+	ArithOp::Lt, ArithOp::Gt, ArithOp::Le, ArithOp::Ge, ArithOp::Eq, ArithOp::Ne
+};
+
+static const char* s_arithNames[] = {
+	"+", "-", "*", "/", "%", "**",
+	"&", "|", "^", "<<", ">>",
+	"<", ">", "<=", ">=", "==", "!="
+};
+
+static ArithOp arithOp(Op op) { return s_arithOps[int(op) - int(Op::Add)]; }
+static const char* arithName(Op op) { return s_arithNames[int(op) - int(Op::Add)]; }
+
+static const char* unaryName(Op op) {
+	switch (op) {
+		case Op::Neg: return "-";
+		case Op::Plus: return "+";
+		case Op::BitNot: return "~";
+		default: return "!";
+	}
+}
+
+static ArithOp unaryArith(Op op) {
+	switch (op) {
+		case Op::Neg: return ArithOp::Neg;
+		case Op::Plus: return ArithOp::Plus;
+		case Op::BitNot: return ArithOp::BitNot;
+		default: return ArithOp::Not;
+	}
+}
+
+VM::VM(int stackSize)
+	: m_stack(static_cast<Value*>(std::malloc(sizeof(Value) * stackSize)), std::free), m_nextCollect(MinCollect),
+	m_stackSize(stackSize), m_parallelism(ThreadPool::hardwareThreads())
+{
+	if (!m_stack) throw std::bad_alloc();
+	m_sp = m_stack.get();
+	m_stackEnd = m_stack.get() + stackSize;
+
+	// Frames are referenced by pointer while natives re-enter the VM.
+	m_frames.reserve(MaxFrames);
+	refill();
+}
+
+VM::~VM() {
+	while (m_heap != nullptr) {
+		Object* next = m_heap->next;
+		delete m_heap;
+		m_heap = next;
+	}
+}
+
+void VM::define(std::unique_ptr<NativeFunction> native) {
+	std::string name = native->name;
+	m_natives[name] = std::move(native);
+}
+
+const NativeFunction* VM::native(const std::string& name) const {
+	auto it = m_natives.find(name);
+	return it == m_natives.end() ? nullptr : it->second.get();
+}
+
+bool VM::load(const Script& script) {
+	m_script = &script;
+	m_globals.assign(script.globals.size(), Value());
+
+	bool ok = true;
+	for (size_t i = 0; i < script.globals.size(); i++) {
+		const GlobalSlot& slot = script.globals[i];
+		if (slot.kind == GlobalSlot::Function) {
+			m_globals[i] = Value::object(ValueType::Function, slot.function);
+		} else if (slot.kind == GlobalSlot::Native) {
+			auto it = m_natives.find(slot.name);
+			if (it == m_natives.end()) {
+				error("ERROR: Undefined name \"" << slot.name << "\".");
+				ok = false;
+				continue;
+			}
+			m_globals[i] = Value::object(ValueType::Function, it->second.get());
+		}
+	}
+	return ok;
+}
+
+bool VM::run() {
+	if (m_script == nullptr) return false;
+
+	if (!canPush(1)) return fail("Stack overflow.");
+	push(Value::object(ValueType::Function, m_script->main));
+	Value result;
+	return call(0, result);
+}
+
+Value* VM::global(const std::string& name) {
+	int slot = m_script != nullptr ? m_script->global(name) : -1;
+	return slot < 0 ? nullptr : &m_globals[slot];
+}
+
+bool VM::call(int argc, Value& result) {
+	Value* args = m_sp - argc - 1;
+	Value callee = *args;
+	if (m_frames.empty() && !m_worker) startBudget();
+
+	size_t depth = m_frames.size();
+	if (callee.type == ValueType::Function && callee.objectValue->kind == ObjectKind::Function) {
+		const FunctionProto* function = static_cast<const FunctionProto*>(callee.objectValue);
+		if (!enter(function, argc) || (!function->generator && !execute(depth))) {
+			unwind(depth);
+			m_sp = args;
+			return false;
+		}
+	} else if (callee.type == ValueType::Function) {
+		const NativeFunction* native = static_cast<const NativeFunction*>(callee.objectValue);
+		bool ok;
+		if (native->arity >= 0 && native->arity != argc) {
+			ok = fail("Function \"" + native->name + "\" takes " + std::to_string(native->arity) +
+				" arguments, got " + std::to_string(argc) + ".");
+		} else {
+			ok = native->thunk(*this, native->data, args + 1, argc, result);
+		}
+		m_sp = args;
+		return ok;
+	} else {
+		m_sp = args;
+		return fail(std::string("Cannot call a value of type ") + valueTypeName(callee.type) + ".");
+	}
+
+	m_sp--;
+	result = *m_sp;
+	return true;
+}
+
+bool VM::enter(const FunctionProto* function, int argc) {
+	if (argc < function->required || argc > function->params) {
+		return fail("Function \"" + function->name + "\" takes " + std::to_string(function->params) +
+			" arguments, got " + std::to_string(argc) + ".");
+	}
+	if (m_frames.size() >= MaxFrames) return fail("Call stack overflow.");
+
+	Value* base = m_sp - argc;
+	if (function->generator) {
+		// Nothing runs yet: the arguments become the generator's frame and
+		// the generator replaces the callee.
+		GeneratorObject* generator = new GeneratorObject(function);
+		generator->slots.assign(base, m_sp);
+		generator->slots.resize(function->frameSize);
+		generator->ip = function->entries[argc - function->required];
+		adopt(generator);
+		m_sp = base - 1;
+		push(Value::object(ValueType::Generator, generator));
+		return true;
+	}
+	if (m_stackEnd - base < function->frameSize + function->maxStack) return fail("Stack overflow.");
+
+	for (Value* slot = m_sp; slot < base + function->frameSize; slot++) *slot = Value();
+	m_sp = base + function->frameSize;
+
+	m_frames.push_back({ function, function->code.data() + function->entries[argc - function->required], base, nullptr });
+	return true;
+}
+
+// Continues a suspended generator in a new frame on top of the stack.
+bool VM::resume(GeneratorObject* generator) {
+	if (generator->state == GeneratorObject::Running) return fail("Generator \"" + generator->function->name + "\" is already running.");
+	if (generator->owner != this) return fail("A generator cannot be resumed on another thread.");
+	if (m_frames.size() >= MaxFrames) return fail("Call stack overflow.");
+
+	const FunctionProto* function = generator->function;
+	if (m_stackEnd - m_sp < 1 + function->frameSize + function->maxStack) return fail("Stack overflow.");
+
+	push(Value::object(ValueType::Generator, generator));
+	Value* base = m_sp;
+	std::copy(generator->slots.begin(), generator->slots.end(), base);
+	m_sp = base + function->frameSize;
+
+	// While it runs the frame on the stack is the only copy.
+	generator->slots.clear();
+	generator->state = GeneratorObject::Running;
+	m_frames.push_back({ function, function->code.data() + generator->ip, base, generator });
+	return true;
+}
+
+void VM::unwind(size_t depth) {
+	// A generator that failed cannot be resumed.
+	for (size_t i = depth; i < m_frames.size(); i++) {
+		if (m_frames[i].generator) m_frames[i].generator->state = GeneratorObject::Done;
+	}
+	m_frames.resize(depth);
+}
+
+bool VM::fail(const std::string& message) {
+	int line = 0, pos = 0;
+	if (!m_frames.empty()) {
+		const Frame& frame = m_frames.back();
+		size_t at = frame.ip - frame.function->code.data();
+		if (at > 0) at--;
+		if (at < frame.function->positions.size()) {
+			line = frame.function->positions[at].line;
+			pos = frame.function->positions[at].pos;
+		}
+	}
+	error("ERROR(" << line << ":" << pos << "): " << message);
+	return false;
+}
+
+Value VM::string(std::string&& value) {
+	StringObject* str = new StringObject(std::move(value));
+	adopt(str);
+	return Value::object(ValueType::String, str);
+}
+
+ArrayObject* VM::array(ElementType element, size_t length, bool zeroed) {
+	size_t limit = m_budget.heapBytes;
+	if (limit > 0 && (length > limit / elementSize(element) || m_liveBytes + length * elementSize(element) > limit)) {
+		fail("Heap limit of " + std::to_string(limit) + " bytes exceeded by an " + elementTypeName(element) +
+			" array of " + std::to_string(length) + " elements.");
+		return nullptr;
+	}
+
+	ArrayObject* array;
+	try {
+		array = new ArrayObject(element, length, zeroed);
+	} catch (const std::bad_alloc&) {
+		fail("Not enough memory for an " + std::string(elementTypeName(element)) + " array of " +
+			std::to_string(length) + " elements.");
+		return nullptr;
+	}
+	adopt(array);
+	return array;
+}
+
+void VM::adopt(Object* object) {
+	object->owner = this;
+	object->next = m_heap;
+	m_heap = object;
+	m_heapBytes += objectSize(object);
+}
+
+size_t VM::objectSize(const Object* object) const {
+	switch (object->kind) {
+		case ObjectKind::String: return sizeof(StringObject) + static_cast<const StringObject*>(object)->value.capacity();
+		case ObjectKind::Generator:
+			return sizeof(GeneratorObject) + static_cast<const GeneratorObject*>(object)->function->frameSize * sizeof(Value);
+		case ObjectKind::Array: {
+			const ArrayObject* array = static_cast<const ArrayObject*>(object);
+			return sizeof(ArrayObject) + array->length * elementSize(array->element);
+		}
+		default: return sizeof(Object);
+	}
+}
+
+void VM::mark(const Value& value) {
+	if (!value.isObject() || value.objectValue->owner != this || value.objectValue->marked) return;
+	value.objectValue->marked = true;
+
+	if (value.objectValue->kind == ObjectKind::Generator) {
+		for (auto&& slot : static_cast<GeneratorObject*>(value.objectValue)->slots) mark(slot);
+	}
+}
+
+void VM::collect() {
+	for (const Value* v = m_stack.get(); v < m_sp; v++) mark(*v);
+	for (auto&& v : m_globals) mark(v);
+
+	Object** link = &m_heap;
+	size_t live = 0;
+	while (*link != nullptr) {
+		Object* object = *link;
+		if (object->marked) {
+			object->marked = false;
+			live += objectSize(object);
+			link = &object->next;
+		} else {
+			*link = object->next;
+			delete object;
+		}
+	}
+	m_heapBytes = m_liveBytes = live;
+	m_nextCollect = std::max(MinCollect, live * 2);
+	if (m_budget.heapBytes > 0) m_nextCollect = std::min(m_nextCollect, m_budget.heapBytes);
+}
+
+void VM::setBudget(const Budget& budget) {
+	m_budget = budget;
+	m_nextCollect = std::max(MinCollect, m_liveBytes * 2);
+	if (budget.heapBytes > 0) m_nextCollect = std::min(m_nextCollect, budget.heapBytes);
+	refill();
+}
+
+void VM::startBudget() {
+	m_steps = 0;
+	m_span = m_ticks = 0;
+	if (m_budget.time.count() > 0) m_deadline = std::chrono::steady_clock::now() + m_budget.time;
+	refill();
+}
+
+static std::string stepLimit(uint64_t steps) {
+	return "Step limit of " + std::to_string(steps) + " exceeded.";
+}
+
+// Starts the next span: CheckInterval steps, or fewer so that it runs out
+// on the first step over the limit.
+void VM::refill() {
+	m_steps += m_span - m_ticks;
+	uint64_t span = CheckInterval;
+	if (m_budget.steps > 0 && m_steps < m_budget.steps) span = std::min<uint64_t>(span, m_budget.steps + 1 - m_steps);
+	m_span = m_ticks = uint32_t(span);
+}
+
+// Runs at loop back-edges and calls once the span has run out or the heap
+// has grown enough.
+bool VM::checkpoint() {
+	if (m_ticks == 0) {
+		if (m_budget.steps > 0 && steps() > m_budget.steps) {
+			return fail(stepLimit(m_budget.steps));
+		}
+		if (m_budget.time.count() > 0 && std::chrono::steady_clock::now() > m_deadline) {
+			return fail("Time limit of " + std::to_string(m_budget.time.count()) + " ms exceeded.");
+		}
+		refill();
+	}
+	if (m_heapBytes > m_nextCollect) {
+		collect();
+		if (m_budget.heapBytes > 0 && m_heapBytes > m_budget.heapBytes) {
+			return fail("Heap limit of " + std::to_string(m_budget.heapBytes) + " bytes exceeded: " +
+				std::to_string(m_heapBytes) + " bytes in use.");
+		}
+	}
+	return true;
+}
+
+// Shared by every VM. Loops started on one of its threads run sequentially,
+// so a task never waits for tasks queued behind it.
+static ThreadPool& parallelPool() {
+	static ThreadPool pool;
+	return pool;
+}
+
+static Value reductionIdentity(Op op) {
+	switch (op) {
+		case Op::Mul: return Value::integer(1);
+		case Op::BitAnd: return Value::integer(-1);
+		default: return Value::integer(0);
+	}
+}
+
+// Calls the body of a parallel loop over [from, end) and stores the partial
+// result of each reduction. The reductions' globals are restored afterwards,
+// in case this loop runs inside another chunk of itself.
+bool VM::runChunk(const FunctionProto* body, const Value* args, int argc, int64_t from, int64_t end, Value* partials) {
+	if (!canPush(argc + 1)) return fail("Stack overflow.");
+
+	std::vector<Value> saved;
+	for (auto&& reduction : body->reductions) {
+		saved.push_back(m_globals[reduction.global]);
+		m_globals[reduction.global] = reductionIdentity(reduction.op);
+	}
+
+	push(Value::object(ValueType::Function, const_cast<FunctionProto*>(body)));
+	push(Value::integer(from));
+	push(Value::integer(end));
+	for (int i = 2; i < argc; i++) push(args[i]);
+	Value result;
+	bool ok = call(argc, result);
+
+	for (size_t i = 0; i < body->reductions.size(); i++) {
+		partials[i] = m_globals[body->reductions[i].global];
+		m_globals[body->reductions[i].global] = saved[i];
+	}
+	return ok;
+}
+
+// Op::Parallel: splits the range into chunks, which workers take in turn.
+// Each worker is a VM of its own on the same Script, seeded with a copy of
+// our globals, so scripts on different threads share nothing writable. The
+// caller waits; partial results are combined in chunk order, so a loop
+// gives the same result however its chunks were scheduled.
+bool VM::parallel(int argc, int reductions) {
+	Value* args = m_sp - argc - 1;
+	const FunctionProto* body = static_cast<const FunctionProto*>(args[0].objectValue);
+	if (args[1].type != ValueType::Integer || args[2].type != ValueType::Integer) {
+		return fail(std::string("A parallel loop needs integer bounds, got ") + valueTypeName(args[1].type) +
+			" and " + valueTypeName(args[2].type) + ".");
+	}
+
+	int64_t from = args[1].integerValue, end = args[2].integerValue;
+	int64_t count = end > from ? int64_t(uint64_t(end) - uint64_t(from)) : 0;
+	int threads = int(std::min<int64_t>(m_parallelism, count));
+	if (threads > 1 && parallelPool().worker() >= 0) threads = 1;
+	int64_t chunks = threads > 1 ? std::min<int64_t>(count, int64_t(threads) * ChunksPerThread) : 1;
+	std::vector<Value> partials(chunks * reductions);
+
+	// Chunk c starts at chunkFrom(c); the first count % chunks are one longer.
+	auto chunkFrom = [&](int64_t c) { return from + (count / chunks) * c + std::min(c, count % chunks); };
+
+	if (threads <= 1) {
+		if (!runChunk(body, args + 1, argc, from, std::max(from, end), partials.data())) return false;
+	} else {
+		while (m_workers.size() < size_t(threads)) m_workers.emplace_back(new VM(m_stackSize));
+
+		// Each worker may take all the steps we have left, and we are then
+		// charged with what they took together.
+		uint64_t start = steps();
+		for (int i = 0; i < threads; i++) {
+			VM& worker = *m_workers[i];
+			worker.m_script = m_script;
+			worker.m_globals = m_globals;
+			worker.m_worker = true;
+			worker.setBudget(m_budget);
+			worker.m_deadline = m_deadline;
+			worker.m_steps = start;
+			worker.m_span = worker.m_ticks = 0;
+			worker.refill();
+		}
+
+		std::atomic<int64_t> next(0);
+		std::atomic<bool> failed(false);
+		std::vector<std::string> errors(threads);
+		std::mutex lock;
+		std::condition_variable finished;
+		int running = threads;
+
+		for (int t = 0; t < threads; t++) {
+			parallelPool().submit([&, t] {
+				VM& worker = *m_workers[t];
+				DiagnosticCapture capture;
+				for (int64_t c = next++; c < chunks && !failed; c = next++) {
+					if (!worker.runChunk(body, args + 1, argc, chunkFrom(c), chunkFrom(c + 1), &partials[c * reductions])) {
+						failed = true;
+					}
+				}
+				errors[t] = capture.text();
+
+				std::lock_guard<std::mutex> guard(lock);
+				if (--running == 0) finished.notify_one();
+			});
+		}
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			finished.wait(guard, [&] { return running == 0; });
+		}
+
+		for (int i = 0; i < threads; i++) {
+			m_workers[i]->m_globals.clear();
+			m_steps += m_workers[i]->steps() - start;
+		}
+		if (failed) {
+			// Workers stop at their first error; one of them is enough.
+			for (auto&& text : errors) {
+				if (text.empty()) continue;
+				reportError() << text;
+				break;
+			}
+			return false;
+		}
+		if (m_budget.steps > 0 && steps() > m_budget.steps) return fail(stepLimit(m_budget.steps));
+	}
+
+	Value* results = args;
+	for (int r = 0; r < reductions; r++) {
+		const FunctionProto::Reduction& reduction = body->reductions[r];
+		Value total = reductionIdentity(reduction.op);
+		for (int64_t c = 0; c < chunks; c++) {
+			const Value& partial = partials[c * reductions + r];
+			if (partial.isObject() || !binaryOp(arithOp(reduction.op), total, partial, total)) {
+				return fail("Cannot reduce \"" + reduction.name + "\" with \"" + arithName(reduction.op) +
+					"\": got " + valueTypeName(partial.type) + ".");
+			}
+		}
+		results[r] = total;
+	}
+	m_sp = results + reductions;
+	return true;
+}
+
+// Equality and ordering of strings by content, and of functions by
+// identity. Returns false if `a` and `b` are not both objects.
+bool VM::sameObject(const Value& a, const Value& b, Op op, Value& out) {
+	if (!a.isObject() || a.type != b.type) return false;
+
+	int cmp;
+	if (a.type == ValueType::String) {
+		cmp = asString(a)->value.compare(asString(b)->value);
+	} else if (op == Op::Eq || op == Op::Ne) {
+		cmp = a.objectValue == b.objectValue ? 0 : 1;
+	} else {
+		return false;
+	}
+
+	switch (op) {
+		case Op::Eq: out = Value::boolean(cmp == 0); return true;
+		case Op::Ne: out = Value::boolean(cmp != 0); return true;
+		case Op::Lt: out = Value::boolean(cmp < 0); return true;
+		case Op::Gt: out = Value::boolean(cmp > 0); return true;
+		case Op::Le: out = Value::boolean(cmp <= 0); return true;
+		case Op::Ge: out = Value::boolean(cmp >= 0); return true;
+		default: return false;
+	}
+}
+
+// The general case of a binary operator: `*a = *a op b`.
+bool VM::arith(Op op, Value* a, const Value& b) {
+	Value out;
+	if ((a->type == ValueType::Array || b.type == ValueType::Array) && arrayOperator(arithOp(op))) {
+		if (!arrayOp(*this, arithOp(op), *a, b, out)) return false;
+		*a = out;
+		return true;
+	}
+	if (binaryOp(arithOp(op), *a, b, out) || sameObject(*a, b, op, out)) {
+		*a = out;
+		return true;
+	}
+	if (op == Op::Add && a->type == ValueType::String && b.type == ValueType::String) {
+		*a = string(asString(*a)->value + asString(b)->value);
+		return true;
+	}
+	if (op == Op::Mod && a->type == ValueType::Integer && b.type == ValueType::Integer && b.integerValue == 0) {
+		return fail("Division by zero in \"%\".");
+	}
+	return fail(std::string("Invalid operands for \"") + arithName(op) + "\": " +
+		valueTypeName(a->type) + " and " + valueTypeName(b.type) + ".");
+}
+
+// Quickening. A generic arithmetic or comparison instruction that finds
+// two Integers, or two numbers, rewrites itself to the form for those types
+// (intForm(), numberForm()), which goes straight to the operation. A
+// quickened instruction that finds other operands goes back to the generic
+// op and counts that in Instr::a; after MaxDeopts the site stays generic,
+// so operands that keep changing type cannot make it flip back and forth.
+static const uint16_t MaxDeopts = 4;
+
+static void quicken(Instr& ins, Op form) {
+	if (form != Op::Count && __atomic_load_n(&ins.a, __ATOMIC_RELAXED) < MaxDeopts) storeOp(ins, form);
+}
+
+static void deoptimize(Instr& ins, Op generic) {
+	storeOp(ins, generic);
+	__atomic_fetch_add(&ins.a, 1, __ATOMIC_RELAXED);
+}
+
+// Whether `a` and `b` are numbers, not both Integers, for a Number form.
+static inline bool mixedNumbers(const Value& a, const Value& b) {
+	return (a.type == ValueType::Number && (b.type == ValueType::Number || b.type == ValueType::Integer)) ||
+		(a.type == ValueType::Integer && b.type == ValueType::Number);
+}
+
+template <Op op>
+static inline bool intArith(Value* a, const Value& b) {
+	if (a->type != ValueType::Integer || b.type != ValueType::Integer) return false;
+	int64_t r;
+	if (op == Op::AddInt ? __builtin_add_overflow(a->integerValue, b.integerValue, &r) :
+		op == Op::SubInt ? __builtin_sub_overflow(a->integerValue, b.integerValue, &r) :
+		__builtin_mul_overflow(a->integerValue, b.integerValue, &r))
+	{
+		return false;
+	}
+	a->integerValue = r;
+	return true;
+}
+
+// Mod, the bitwise operators and shifts of two Integers, which cannot
+// overflow; a zero divisor is left to the generic op, which reports it.
+template <Op op>
+static inline bool intBits(Value* a, const Value& b) {
+	if (a->type != ValueType::Integer || b.type != ValueType::Integer) return false;
+	int64_t x = a->integerValue, y = b.integerValue;
+	switch (op) {
+		case Op::ModInt:
+			if (y == 0) return false;
+			a->integerValue = y == -1 ? 0 : x % y;
+			return true;
+		case Op::BitAndInt: a->integerValue = x & y; return true;
+		case Op::BitOrInt: a->integerValue = x | y; return true;
+		case Op::BitXorInt: a->integerValue = x ^ y; return true;
+		case Op::ShlInt: a->integerValue = int64_t(uint64_t(x) << (y & 63)); return true;
+		default: a->integerValue = x >> (y & 63); return true;
+	}
+}
+
+template <Op op>
+static inline bool numberArith(Value* a, const Value& b) {
+	if (op == Op::DivNumber || op == Op::PowNumber ? !(a->isNumeric() && b.isNumeric()) : !mixedNumbers(*a, b)) return false;
+	double x = a->toNumber(), y = b.toNumber();
+	switch (op) {
+		case Op::AddNumber: *a = Value::number(x + y); return true;
+		case Op::SubNumber: *a = Value::number(x - y); return true;
+		case Op::MulNumber: *a = Value::number(x * y); return true;
+		case Op::DivNumber: *a = Value::number(x / y); return true;
+		case Op::ModNumber: *a = Value::number(std::fmod(x, y)); return true;
+		default: *a = Value::number(std::pow(x, y)); return true;
+	}
+}
+
+template <typename T>
+static inline bool compare(Op op, T x, T y) {
+	switch (op) {
+		case Op::Lt: case Op::LtInt: case Op::LtNumber: return x < y;
+		case Op::Gt: case Op::GtInt: case Op::GtNumber: return x > y;
+		case Op::Le: case Op::LeInt: case Op::LeNumber: return x <= y;
+		case Op::Ge: case Op::GeInt: case Op::GeNumber: return x >= y;
+		case Op::Eq: case Op::EqInt: return x == y;
+		default: return x != y;
+	}
+}
+
+template <Op op>
+static inline bool intCompare(Value* a, const Value& b) {
+	if (a->type != ValueType::Integer || b.type != ValueType::Integer) return false;
+	*a = Value::boolean(compare(op, a->integerValue, b.integerValue));
+	return true;
+}
+
+template <Op op>
+static inline bool numberCompare(Value* a, const Value& b) {
+	if (!mixedNumbers(*a, b)) return false;
+	*a = Value::boolean(compare(op, a->toNumber(), b.toNumber()));
+	return true;
+}
+
+void OpcodeHistogram::report(std::ostream& out, size_t top) const {
+	std::streamsize precision = out.precision();
+	uint64_t total = 0;
+	for (uint64_t n : ops) total += n;
+	auto share = [&](uint64_t n) { return total > 0 ? 100.0 * double(n) / double(total) : 0.0; };
+
+	std::vector<std::pair<uint64_t, size_t>> sorted;
+	for (size_t i = 0; i < Ops * Ops; i++) {
+		uint64_t n = pairs[i / Ops][i % Ops];
+		if (n > 0) sorted.emplace_back(n, i);
+	}
+	size_t shown = std::min(top, sorted.size());
+	std::partial_sort(sorted.begin(), sorted.begin() + shown, sorted.end(), std::greater<std::pair<uint64_t, size_t>>());
+
+	out << total << " instructions" << std::endl;
+	out << "pairs:" << std::endl;
+	for (size_t i = 0; i < shown; i++) {
+		std::string pair = std::string(opName(Op(sorted[i].second / Ops))) + " " + opName(Op(sorted[i].second % Ops));
+		out << "  " << std::left << std::setw(36) << pair << std::right << std::setw(14) << sorted[i].first <<
+			std::fixed << std::setprecision(2) << std::setw(8) << share(sorted[i].first) << "%" << std::endl;
+	}
+
+	sorted.clear();
+	for (size_t i = 0; i < Ops; i++) {
+		if (ops[i] > 0) sorted.emplace_back(ops[i], i);
+	}
+	shown = std::min(top, sorted.size());
+	std::partial_sort(sorted.begin(), sorted.begin() + shown, sorted.end(), std::greater<std::pair<uint64_t, size_t>>());
+	out << "ops:" << std::endl;
+	for (size_t i = 0; i < shown; i++) {
+		out << "  " << std::left << std::setw(36) << opName(Op(sorted[i].second)) << std::right << std::setw(14) <<
+			sorted[i].first << std::fixed << std::setprecision(2) << std::setw(8) << share(sorted[i].first) << "%" << std::endl;
+	}
+	out << std::defaultfloat << std::setprecision(precision);
+}
+
+bool VM::execute(size_t exitDepth) {
+	if (Profiler::running()) {
+		return m_histogram != nullptr ? dispatch<true, true>(exitDepth) : dispatch<false, true>(exitDepth);
+	}
+	return m_histogram != nullptr ? dispatch<true, false>(exitDepth) : dispatch<false, false>(exitDepth);
+}
+
+template <bool counting, bool profiling>
+bool VM::dispatch(size_t exitDepth) {
+	Frame* frame = &m_frames.back();
+	Instr* ip = frame->ip;
+	Value* base = frame->base;
+	const Value* constants = frame->function->constants.data();
+	Value* sp = m_sp;
+	Op previous = Op::Count;
+
+	// Profiler frames for the calls above exitDepth, one per function, at
+	// the line of the statement running. Those still open when the
+	// execution ends or fails are left here.
+	struct ProfiledFrames {
+		size_t count = 0;
+		~ProfiledFrames() { for (; count > 0; count--) profileLeave(); }
+	} profiled;
+
+// Makes the interpreter state visible to fail(), call() and collect().
+#define SYNC() (frame->ip = ip, m_sp = sp)
+#define RELOAD() (frame = &m_frames.back(), ip = frame->ip, base = frame->base, \
+	constants = frame->function->constants.data(), sp = m_sp)
+
+	for (;;) {
+		Instr& ins = *ip++;
+		Op op = loadOp(ins);
+		if constexpr (counting) {
+			m_histogram->ops[size_t(op)]++;
+			if (previous != Op::Count) m_histogram->pairs[size_t(previous)][size_t(op)]++;
+			previous = op;
+		}
+		if constexpr (profiling) {
+			// Calls, returns and generators change the depth by one
+			// instruction at a time, so comparing depths is enough.
+			size_t depth = m_frames.size() - exitDepth;
+			for (; profiled.count < depth; profiled.count++) {
+				profileEnter(Profiler::intern(m_frames[exitDepth + profiled.count].function->name));
+			}
+			for (; profiled.count > depth; profiled.count--) profileLeave();
+			profileLine(frame->function->positions[ip - 1 - frame->function->code.data()].line);
+		}
+
+		switch (op) {
+			case Op::Nil: *sp++ = Value(); break;
+			case Op::True: *sp++ = Value::boolean(true); break;
+			case Op::False: *sp++ = Value::boolean(false); break;
+			case Op::Const: *sp++ = constants[ins.b]; break;
+			case Op::Pop: sp--; break;
+
+			case Op::LoadLocal: *sp++ = base[ins.b]; break;
+			case Op::StoreLocal: base[ins.b] = *--sp; break;
+			case Op::LoadGlobal: *sp++ = m_globals[ins.b]; break;
+			case Op::StoreGlobal: m_globals[ins.b] = *--sp; break;
+
+			case Op::Add: case Op::Sub: case Op::Mul: {
+				Value* a = sp - 2;
+				const Value& b = sp[-1];
+				sp--;
+				int64_t r;
+				if (a->type == ValueType::Integer && b.type == ValueType::Integer) {
+					if (!(op == Op::Add ? __builtin_add_overflow(a->integerValue, b.integerValue, &r) :
+						op == Op::Sub ? __builtin_sub_overflow(a->integerValue, b.integerValue, &r) :
+						__builtin_mul_overflow(a->integerValue, b.integerValue, &r)))
+					{
+						a->integerValue = r;
+						quicken(ins, intForm(op));
+						break;
+					}
+				} else if (a->isNumeric() && b.isNumeric()) {
+					double x = a->toNumber(), y = b.toNumber();
+					*a = Value::number(op == Op::Add ? x + y : op == Op::Sub ? x - y : x * y);
+					quicken(ins, numberForm(op));
+					break;
+				}
+				SYNC();
+				if (!arith(op, a, b)) return false;
+				break;
+			}
+
+			case Op::Lt: case Op::Gt: case Op::Le: case Op::Ge: case Op::Eq: case Op::Ne: {
+				Value* a = sp - 2;
+				const Value& b = sp[-1];
+				sp--;
+				if (a->type == ValueType::Integer && b.type == ValueType::Integer) {
+					*a = Value::boolean(compare(op, a->integerValue, b.integerValue));
+					quicken(ins, intForm(op));
+				} else if (mixedNumbers(*a, b)) {
+					*a = Value::boolean(compare(op, a->toNumber(), b.toNumber()));
+					quicken(ins, numberForm(op));
+				} else {
+					SYNC();
+					if (!arith(op, a, b)) return false;
+				}
+				break;
+			}
+
+			case Op::Div:
+				if (sp[-2].isNumeric() && sp[-1].isNumeric()) {
+					sp--;
+					sp[-1] = Value::number(sp[-1].toNumber() / sp->toNumber());
+					quicken(ins, Op::DivNumber);
+					break;
+				}
+				sp--;
+				SYNC();
+				if (!arith(op, sp - 1, *sp)) return false;
+				break;
+
+			case Op::Mod: case Op::Pow:
+			case Op::BitAnd: case Op::BitOr: case Op::BitXor: case Op::Shl: case Op::Shr: {
+				Value* a = sp - 2;
+				sp--;
+				if (a->type == ValueType::Integer && sp->type == ValueType::Integer && op != Op::Pow &&
+					(op != Op::Mod || sp->integerValue != 0))
+				{
+					Value out;
+					integerOp(arithOp(op), a->integerValue, sp->integerValue, out);
+					*a = out;
+					quicken(ins, intForm(op));
+					break;
+				}
+				if (op == Op::Pow ? a->isNumeric() && sp->isNumeric() : op == Op::Mod && mixedNumbers(*a, *sp)) {
+					double x = a->toNumber(), y = sp->toNumber();
+					*a = Value::number(op == Op::Pow ? std::pow(x, y) : std::fmod(x, y));
+					quicken(ins, numberForm(op));
+					break;
+				}
+				SYNC();
+				if (!arith(op, a, *sp)) return false;
+				break;
+			}
+
+			case Op::BitNotInt:
+				if (sp[-1].type == ValueType::Integer) {
+					sp[-1].integerValue = ~sp[-1].integerValue;
+					break;
+				}
+				deoptimize(ins, Op::BitNot);
+				op = Op::BitNot;
+				[[fallthrough]];
+
+			case Op::Neg: case Op::Plus: case Op::BitNot: case Op::Not: {
+				if (op == Op::BitNot && sp[-1].type == ValueType::Integer) {
+					sp[-1].integerValue = ~sp[-1].integerValue;
+					quicken(ins, Op::BitNotInt);
+					break;
+				}
+				Value out;
+				if (op == Op::Neg && sp[-1].type == ValueType::Array) {
+					SYNC();
+					if (!arrayNegate(*this, sp[-1], out)) return false;
+				} else if (op == Op::Plus && sp[-1].type == ValueType::Array) {
+					out = sp[-1];
+				} else if (!unaryOp(unaryArith(op), sp[-1], out)) {
+					SYNC();
+					return fail(std::string("Invalid operand for \"") + unaryName(op) + "\": " +
+						valueTypeName(sp[-1].type) + ".");
+				}
+				sp[-1] = out;
+				break;
+			}
+
+			case Op::Truth: sp[-1] = Value::boolean(sp[-1].truthy()); break;
+
+			case Op::Index: {
+				Value* a = sp - 2;
+				const Value& i = sp[-1];
+				sp--;
+				if (a->type == ValueType::Array && i.type == ValueType::Integer &&
+					uint64_t(i.integerValue) < asArray(*a)->length)
+				{
+					*a = asArray(*a)->get(i.integerValue);
+				} else {
+					SYNC();
+					if (!indexValue(*this, *a, i, *a)) return false;
+				}
+				break;
+			}
+
+			case Op::StoreIndex:
+				sp -= 3;
+				SYNC();
+				if (!storeIndex(*this, sp[0], sp[1], sp[2])) return false;
+				break;
+
+			case Op::Jump: ip = frame->function->code.data() + ins.b; break;
+			case Op::JumpIfFalse:
+				if (!(--sp)->truthy()) ip = frame->function->code.data() + ins.b;
+				break;
+			case Op::JumpIfTrue:
+				if ((--sp)->truthy()) ip = frame->function->code.data() + ins.b;
+				break;
+
+			case Op::Loop:
+				if (--m_ticks == 0 || m_heapBytes > m_nextCollect) {
+					SYNC();
+					if (!checkpoint()) return false;
+				}
+				ip = frame->function->code.data() + ins.b;
+				break;
+
+			case Op::ForNext: {
+				const Value& iter = base[ins.a];
+				if (iter.type != ValueType::Generator) {
+					SYNC();
+					return fail(std::string("Cannot iterate a value of type ") + valueTypeName(iter.type) + ".");
+				}
+				GeneratorObject* generator = static_cast<GeneratorObject*>(iter.objectValue);
+				if (generator->state == GeneratorObject::Done) {
+					ip = frame->function->code.data() + ins.b;
+					break;
+				}
+				SYNC();
+				if (!resume(generator)) return false;
+				RELOAD();
+				break;
+			}
+
+			case Op::Call: {
+				int argc = ins.a;
+				Value callee = sp[-argc - 1];
+				SYNC();
+				if ((--m_ticks == 0 || m_heapBytes > m_nextCollect) && !checkpoint()) return false;
+
+				if (callee.type == ValueType::Function && callee.objectValue->kind == ObjectKind::Function) {
+					if (!enter(static_cast<const FunctionProto*>(callee.objectValue), argc)) return false;
+					RELOAD();
+					break;
+				}
+				if (callee.type != ValueType::Function) {
+					return fail(std::string("Cannot call a value of type ") + valueTypeName(callee.type) + ".");
+				}
+
+				const NativeFunction* native = static_cast<const NativeFunction*>(callee.objectValue);
+				if (native->arity >= 0 && native->arity != argc) {
+					return fail("Function \"" + native->name + "\" takes " + std::to_string(native->arity) +
+						" arguments, got " + std::to_string(argc) + ".");
+				}
+				Value result;
+				if (!native->thunk(*this, native->data, sp - argc, argc, result)) return false;
+				sp -= argc + 1;
+				*sp++ = result;
+				break;
+			}
+
+			case Op::Parallel:
+				SYNC();
+				if (!parallel(ins.a, ins.b)) return false;
+				sp = m_sp;
+				break;
+
+			case Op::Yield: {
+				GeneratorObject* generator = frame->generator;
+				Value value = sp[-1];
+				generator->slots.assign(base, base + frame->function->frameSize);
+				generator->ip = ip - frame->function->code.data();
+				generator->state = GeneratorObject::Suspended;
+
+				m_sp = base - 1;
+				*m_sp++ = value;
+				m_frames.pop_back();
+				RELOAD();
+				break;
+			}
+
+			case Op::Return: case Op::ReturnNil: {
+				if (frame->generator) {
+					// Finished: continue after the loop that resumed it.
+					frame->generator->state = GeneratorObject::Done;
+					std::vector<Value>().swap(frame->generator->slots);
+					m_sp = base - 1;
+					m_frames.pop_back();
+					RELOAD();
+					ip = frame->function->code.data() + ip[-1].b;
+					break;
+				}
+				Value result = op == Op::Return ? sp[-1] : Value();
+				m_sp = frame->base - 1;
+				*m_sp++ = result;
+				m_frames.pop_back();
+				if (m_frames.size() == exitDepth) return true;
+				RELOAD();
+				break;
+			}
+
+			case Op::AddInt: if (intArith<Op::AddInt>(sp - 2, sp[-1])) { sp--; break; } goto deoptimized;
+			case Op::SubInt: if (intArith<Op::SubInt>(sp - 2, sp[-1])) { sp--; break; } goto deoptimized;
+			case Op::MulInt: if (intArith<Op::MulInt>(sp - 2, sp[-1])) { sp--; break; } goto deoptimized;
+			case Op::ModInt: if (intBits<Op::ModInt>(sp - 2, sp[-1])) { sp--; break; } goto deoptimized;
+			case Op::BitAndInt: if (intBits<Op::BitAndInt>(sp - 2, sp[-1])) { sp--; break; } goto deoptimized;
+			case Op::BitOrInt: if (intBits<Op::BitOrInt>(sp - 2, sp[-1])) { sp--; break; } goto deoptimized;
+			case Op::BitXorInt: if (intBits<Op::BitXorInt>(sp - 2, sp[-1])) { sp--; break; } goto deoptimized;
+			case Op::ShlInt: if (intBits<Op::ShlInt>(sp - 2, sp[-1])) { sp--; break; } goto deoptimized;
+			case Op::ShrInt: if (intBits<Op::ShrInt>(sp - 2, sp[-1])) { sp--; break; } goto deoptimized;
+			case Op::AddNumber: if (numberArith<Op::AddNumber>(sp - 2, sp[-1])) { sp--; break; } goto deoptimized;
+			case Op::SubNumber: if (numberArith<Op::SubNumber>(sp - 2, sp[-1])) { sp--; break; } goto deoptimized;
+			case Op::MulNumber: if (numberArith<Op::MulNumber>(sp - 2, sp[-1])) { sp--; break; } goto deoptimized;
+			case Op::DivNumber: if (numberArith<Op::DivNumber>(sp - 2, sp[-1])) { sp--; break; } goto deoptimized;
+			case Op::ModNumber: if (numberArith<Op::ModNumber>(sp - 2, sp[-1])) { sp--; break; } goto deoptimized;
+			case Op::PowNumber: if (numberArith<Op::PowNumber>(sp - 2, sp[-1])) { sp--; break; } goto deoptimized;
+			case Op::LtInt: if (intCompare<Op::LtInt>(sp - 2, sp[-1])) { sp--; break; } goto deoptimized;
+			case Op::GtInt: if (intCompare<Op::GtInt>(sp - 2, sp[-1])) { sp--; break; } goto deoptimized;
+			case Op::LeInt: if (intCompare<Op::LeInt>(sp - 2, sp[-1])) { sp--; break; } goto deoptimized;
+			case Op::GeInt: if (intCompare<Op::GeInt>(sp - 2, sp[-1])) { sp--; break; } goto deoptimized;
+			case Op::EqInt: if (intCompare<Op::EqInt>(sp - 2, sp[-1])) { sp--; break; } goto deoptimized;
+			case Op::NeInt: if (intCompare<Op::NeInt>(sp - 2, sp[-1])) { sp--; break; } goto deoptimized;
+			case Op::LtNumber: if (numberCompare<Op::LtNumber>(sp - 2, sp[-1])) { sp--; break; } goto deoptimized;
+			case Op::GtNumber: if (numberCompare<Op::GtNumber>(sp - 2, sp[-1])) { sp--; break; } goto deoptimized;
+			case Op::LeNumber: if (numberCompare<Op::LeNumber>(sp - 2, sp[-1])) { sp--; break; } goto deoptimized;
+			case Op::GeNumber: if (numberCompare<Op::GeNumber>(sp - 2, sp[-1])) { sp--; break; } goto deoptimized;
+
+			// Superinstructions. `ip` is at the second instruction of the
+			// sequence.
+			case Op::LoadLocals:
+				sp[0] = base[ins.b];
+				sp[1] = base[ip->b];
+				sp += 2;
+				ip++;
+				break;
+
+			case Op::LoadLocalConst:
+				sp[0] = base[ins.b];
+				sp[1] = constants[ip->b];
+				sp += 2;
+				ip++;
+				break;
+
+			case Op::IncLocal: {
+				Value* x = base + ins.b;
+				const Value& c = constants[ip->b];
+				int64_t r;
+				if (x->type == ValueType::Integer && c.type == ValueType::Integer &&
+					!__builtin_add_overflow(x->integerValue, c.integerValue, &r))
+				{
+					x->integerValue = r;
+				} else if (x->isNumeric() && c.isNumeric() && !(x->type == ValueType::Integer && c.type == ValueType::Integer)) {
+					*x = Value::number(x->toNumber() + c.toNumber());
+				} else {
+					*sp++ = *x;
+					break;
+				}
+				ip += 3;
+				break;
+			}
+
+			case Op::JumpUnlessLt: case Op::JumpUnlessGt: case Op::JumpUnlessLe:
+			case Op::JumpUnlessGe: case Op::JumpUnlessEq: case Op::JumpUnlessNe: {
+				static_assert(int(Op::JumpUnlessNe) - int(Op::JumpUnlessLt) == int(Op::Ne) - int(Op::Lt),
+					"JumpUnless ops out of order");
+				Op comparison = Op(int(Op::Lt) + int(op) - int(Op::JumpUnlessLt));
+				const Value& a = sp[-2];
+				const Value& b = sp[-1];
+				bool r;
+				if (a.type == ValueType::Integer && b.type == ValueType::Integer) {
+					r = compare(comparison, a.integerValue, b.integerValue);
+				} else if (mixedNumbers(a, b)) {
+					r = compare(comparison, a.toNumber(), b.toNumber());
+				} else {
+					sp--;
+					SYNC();
+					if (!arith(comparison, sp - 1, *sp)) return false;
+					break;
+				}
+				sp -= 2;
+				ip = r ? ip + 1 : frame->function->code.data() + ip->b;
+				break;
+			}
+
+			case Op::LocalsJumpUnlessLt: {
+				const Value& a = base[ins.b];
+				const Value& b = base[ip->b];
+				bool r;
+				if (a.type == ValueType::Integer && b.type == ValueType::Integer) {
+					r = a.integerValue < b.integerValue;
+				} else if (mixedNumbers(a, b)) {
+					r = a.toNumber() < b.toNumber();
+				} else {
+					*sp++ = a;
+					break;
+				}
+				ip = r ? ip + 3 : frame->function->code.data() + ip[2].b;
+				break;
+			}
+
+			deoptimized: {
+				// A quickened instruction found other operands (or an Integer
+				// overflow): the generic op handles them from now on.
+				Op generic = genericForm(op);
+				deoptimize(ins, generic);
+				sp--;
+				SYNC();
+				if (!arith(generic, sp - 1, *sp)) return false;
+				break;
+			}
+
+			case Op::Count:
+				SYNC();
+				return fail("Invalid instruction.");
+		}
+	}
+
+#undef SYNC
+#undef RELOAD
+}
@@ -0,0 +1,180 @@
+#ifndef LANG_VM_H
+#define LANG_VM_H
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <ostream>
+#include <vector>
+
+#include "bytecode.h"
+
+// How often a VM executed each instruction, and each pair of instructions
+// one right after the other (across calls and returns too), to find the
+// sequences worth fusing into superinstructions.
+struct OpcodeHistogram {
+	static const size_t Ops = size_t(Op::Count);
+
+	uint64_t ops[Ops] = {};
+	uint64_t pairs[Ops][Ops] = {};  // [first][second]
+
+	// The `top` most executed pairs and ops with their share of all
+	// instructions.
+	void report(std::ostream& out, size_t top = 20) const;
+};
+
+// Limits on one execution: a run() or a call into the VM from outside it,
+// so that one script cannot stall the thread serving others. Zero is no
+// limit. Steps are loop iterations and calls, both counted and checked at
+// loop back-edges and calls, the wall time every thousand or so steps; a
+// long native call in between runs to its end. The heap limit applies to
+// live objects, checked when collecting, and to arrays before they are
+// made. Going over reports an error at the statement that did and aborts
+// the execution.
+struct Budget {
+	uint64_t steps = 0;
+	std::chrono::milliseconds time { 0 };
+	size_t heapBytes = 0;
+};
+
+// Runs Scripts. A VM holds everything that changes while a script runs:
+// the value stack, call frames, globals and the heap. The Script itself is
+// only read, but for quickened ops, so one Script can be loaded into
+// several VMs.
+//
+// Errors are reported through reportError() with the position of the
+// statement that failed, and unwind to whoever entered the VM.
+class VM {
+public:
+	static const int DefaultStackSize = 1 << 16;
+	static const int MaxFrames = 1 << 12;
+
+	VM(int stackSize = DefaultStackSize);
+	~VM();
+
+	VM(const VM&) = delete;
+	VM& operator=(const VM&) = delete;
+
+	// Makes a native callable from scripts loaded afterwards.
+	void define(std::unique_ptr<NativeFunction> native);
+	const NativeFunction* native(const std::string& name) const;
+
+	// Binds the script's globals (functions and natives). Returns false if
+	// it uses a name nothing defines.
+	bool load(const Script& script);
+	const Script* script() const { return m_script; }
+
+	// Runs the top-level statements.
+	bool run();
+
+	// Calls the function pushed before the last `argc` values with those
+	// values as arguments, then pops all of them.
+	bool call(int argc, Value& result);
+
+	void push(const Value& value) { *m_sp++ = value; }
+	bool canPush(int n) const { return m_stackEnd - m_sp >= n; }
+
+	// Global by name; null if the script has no such global.
+	Value* global(const std::string& name);
+
+	// A string owned by the heap, freed once nothing refers to it.
+	Value string(std::string&& value);
+
+	// A zero-filled array owned by the heap; with `zeroed` false the
+	// elements are left for the caller to write. Null after reporting if
+	// there is not enough memory for it.
+	ArrayObject* array(ElementType element, size_t length, bool zeroed = true);
+
+	// Reports `message` at the current statement and returns false.
+	bool fail(const std::string& message);
+
+	// Frees heap objects unreachable from the stack and globals. Runs by
+	// itself at calls and loop back-edges once the heap has grown enough.
+	void collect();
+	size_t heapBytes() const { return m_heapBytes; }
+
+	// Applies to the executions started afterwards, and to the chunks of
+	// their parallel loops.
+	void setBudget(const Budget& budget);
+	const Budget& budget() const { return m_budget; }
+
+	// Steps taken by the current or last execution.
+	uint64_t steps() const { return m_steps + m_span - m_ticks; }
+
+	// Most threads a `parallel for` splits its range across; by default
+	// one per hardware thread. 1 runs parallel loops sequentially.
+	void setParallelism(int threads) { m_parallelism = std::max(threads, 1); }
+	int parallelism() const { return m_parallelism; }
+
+	// Counts every instruction this VM executes into `histogram` until set
+	// back to null. Chunks of parallel loops run by other threads are not
+	// counted. Off, counting costs nothing: the interpreter loop is
+	// compiled once with and once without it.
+	//
+	// Likewise, executions started while the Profiler runs publish the
+	// script's calls as profiler frames, named after their functions and
+	// moved to the line of each statement.
+	void setHistogram(OpcodeHistogram* histogram) { m_histogram = histogram; }
+
+private:
+	friend class HeapSnapshot;
+
+	struct Frame {
+		const FunctionProto* function;
+		Instr* ip;
+		Value* base;  // slot 0; the callee is at base[-1]
+		GeneratorObject* generator;  // when resumed by ForNext
+	};
+
+	const Script* m_script = nullptr;
+	std::vector<Value> m_globals;
+	std::map<std::string, std::unique_ptr<NativeFunction>> m_natives;
+
+	// Uninitialised: slots above m_sp are always written before they are
+	// read, so only the pages scripts actually reach get committed.
+	std::unique_ptr<Value[], void (*)(void*)> m_stack;
+	Value* m_sp;
+	Value* m_stackEnd;
+
+	std::vector<Frame> m_frames;
+
+	Object* m_heap = nullptr;
+	size_t m_heapBytes = 0, m_nextCollect;
+	size_t m_liveBytes = 0;  // after the last collection
+
+	// Steps are counted down in spans of at most CheckInterval: m_steps
+	// before the current span, m_ticks left of it. The budget is checked
+	// when a span runs out.
+	Budget m_budget;
+	uint64_t m_steps = 0;
+	uint32_t m_span = 0, m_ticks = 0;
+	std::chrono::steady_clock::time_point m_deadline;
+
+	// VMs running chunks of parallel loops for this one. Between loops
+	// they hold no globals, so nothing of ours can dangle in them.
+	int m_stackSize, m_parallelism;
+	std::vector<std::unique_ptr<VM>> m_workers;
+	bool m_worker = false;  // runs chunks on the budget of the VM that made it
+
+	OpcodeHistogram* m_histogram = nullptr;
+
+	bool enter(const FunctionProto* function, int argc);
+	bool resume(GeneratorObject* generator);
+	bool execute(size_t exitDepth);
+	template <bool counting, bool profiling>
+	bool dispatch(size_t exitDepth);
+	bool arith(Op op, Value* a, const Value& b);
+	bool sameObject(const Value& a, const Value& b, Op op, Value& out);
+	void startBudget();
+	void refill();
+	bool checkpoint();
+	bool parallel(int argc, int reductions);
+	bool runChunk(const FunctionProto* body, const Value* args, int argc, int64_t from, int64_t end, Value* partials);
+	void unwind(size_t depth);
+
+	void adopt(Object* object);
+	void mark(const Value& value);
+	size_t objectSize(const Object* object) const;
+};
+
+#endif // LANG_VM_H
\ No newline at end of file
@@ -0,0 +1,406 @@
+#include "server.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "lexer/lexer.h"
+#include "parser/dump.h"
+#include "parser/modulecache.h"
+#include "parser/serialize.h"
+#include "analysis/constfold.h"
+#include "analysis/inliner.h"
+#include "analysis/typeinfer.h"
+#include "runtime/host.h"
+#include "util/diagnostics.h"
+#include "util/threadpool.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Requests only carry paths; anything larger is not a client of ours.
+const uint32_t MaxRequest = 1 << 24;
+
+// Files modified this recently are read again even if their mtime matches.
+const int64_t RacyNs = 1000000000;
+
+void putU32(std::string& out, uint32_t value) {
+	out.append((const char*) &value, 4);
+}
+
+void putString(std::string& out, const std::string& value) {
+	putU32(out, value.size());
+	out += value;
+}
+
+class Reader {
+public:
+	Reader(const std::string& data) : m_pos(data.data()), m_end(data.data() + data.size()) {}
+
+	uint8_t u8() {
+		if (!need(1)) return 0;
+		return uint8_t(*m_pos++);
+	}
+
+	uint32_t u32() {
+		uint32_t value = 0;
+		if (!need(4)) return 0;
+		std::memcpy(&value, m_pos, 4);
+		m_pos += 4;
+		return value;
+	}
+
+	std::string string() {
+		uint32_t size = u32();
+		if (!need(size)) return std::string();
+		std::string value(m_pos, size);
+		m_pos += size;
+		return value;
+	}
+
+	bool failed() const { return m_failed; }
+	bool atEnd() const { return m_pos == m_end; }
+
+private:
+	const char* m_pos;
+	const char* m_end;
+	bool m_failed = false;
+
+	bool need(size_t size) {
+		if (!m_failed && size_t(m_end - m_pos) >= size) return true;
+		m_failed = true;
+		return false;
+	}
+};
+
+bool readAll(int fd, char* data, size_t size) {
+	while (size > 0) {
+		ssize_t n = recv(fd, data, size, 0);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+bool writeAll(int fd, const char* data, size_t size) {
+	while (size > 0) {
+		ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+bool readMessage(int fd, std::string& body, uint32_t limit) {
+	uint32_t size;
+	if (!readAll(fd, (char*) &size, 4) || size > limit) return false;
+	body.resize(size);
+	return readAll(fd, &body[0], size);
+}
+
+bool writeMessage(int fd, const std::string& body) {
+	std::string size;
+	putU32(size, body.size());
+	return writeAll(fd, size.data(), size.size()) && writeAll(fd, body.data(), body.size());
+}
+
+bool address(const std::string& path, sockaddr_un& addr) {
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.empty() || path.size() >= sizeof(addr.sun_path)) return false;
+	std::memcpy(addr.sun_path, path.data(), path.size());
+	return true;
+}
+
+int64_t nanoseconds(const struct timespec& time) {
+	return int64_t(time.tv_sec) * 1000000000 + time.tv_nsec;
+}
+
+} // namespace
+
+CompileServer::CompileServer(const ServerOptions& options)
+	: m_options(options), m_pool(new ThreadPool(options.jobs))
+{}
+
+CompileServer::~CompileServer() = default;
+
+bool CompileServer::serve(const std::string& socketPath) {
+	sockaddr_un addr;
+	if (!address(socketPath, addr)) return false;
+
+	// Only a socket left behind by an earlier server is replaced.
+	struct stat st;
+	if (lstat(socketPath.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) unlink(socketPath.c_str());
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return false;
+	if (bind(fd, (const sockaddr*) &addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+		close(fd);
+		return false;
+	}
+
+	m_stopped = false;
+	std::string request, reply;
+	while (!m_stopped) {
+		int conn = accept(fd, nullptr, nullptr);
+		if (conn < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		while (!m_stopped && readMessage(conn, request, MaxRequest)) {
+			reply.clear();
+			if (!handle(request, reply) || !writeMessage(conn, reply)) break;
+		}
+		close(conn);
+	}
+
+	close(fd);
+	unlink(socketPath.c_str());
+	return true;
+}
+
+bool CompileServer::handle(const std::string& request, std::string& reply) {
+	Reader in(request);
+	uint8_t op = in.u8();
+	uint32_t count = in.u32();
+	std::vector<std::string> paths;
+	for (uint32_t i = 0; i < count && !in.failed(); i++) {
+		paths.push_back(in.string());
+	}
+	if (in.failed() || !in.atEnd() || op < uint8_t(ServerOp::Tokens) || op > uint8_t(ServerOp::Shutdown)) return false;
+
+	if (ServerOp(op) == ServerOp::Shutdown) {
+		m_stopped = true;
+		putU32(reply, 0);
+		return true;
+	}
+
+	std::vector<Entry*> entries;
+	for (auto&& path : paths) {
+		std::unique_ptr<Entry>& entry = m_files[path];
+		if (!entry) {
+			entry.reset(new Entry());
+			entry->path = path;
+		}
+		entries.push_back(entry.get());
+	}
+
+	// A file named twice in one request is answered once.
+	std::vector<Entry*> work = entries;
+	std::sort(work.begin(), work.end());
+	work.erase(std::unique(work.begin(), work.end()), work.end());
+	for (Entry* entry : work) {
+		m_pool->submit([this, entry, op] {
+			refresh(*entry);
+			answer(*entry, ServerOp(op));
+		});
+	}
+	m_pool->wait();
+
+	putU32(reply, entries.size());
+	for (Entry* entry : entries) {
+		const Result& result = entry->results[op - 1];
+		reply.push_back(char(entry->warm ? 1 : 0));
+		putU32(reply, result.errors);
+		putString(reply, result.diagnostics);
+		putString(reply, result.payload);
+	}
+	return true;
+}
+
+// Brings `entry` up to date with its file: untouched files are not read,
+// touched ones are only lexed and parsed again if their text changed.
+void CompileServer::refresh(Entry& entry) {
+	struct stat st;
+	if (stat(entry.path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+		entry = Entry { entry.path };
+		return;
+	}
+	int64_t mtime = nanoseconds(st.st_mtim);
+	if (entry.tokens && !entry.racy && mtime == entry.mtime && int64_t(st.st_size) == entry.size) return;
+
+	std::ostringstream text;
+	std::ifstream file(entry.path, std::ios::binary);
+	if (!file) {
+		entry = Entry { entry.path };
+		return;
+	}
+	text << file.rdbuf();
+	std::string source = text.str();
+
+	uint64_t hash = ModuleCache::key(source);
+	if (!entry.tokens || hash != entry.hash) {
+		load(entry, source);
+		entry.hash = hash;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	entry.mtime = mtime;
+	entry.size = source.size();
+	entry.racy = nanoseconds(now) - mtime < RacyNs;
+}
+
+void CompileServer::load(Entry& entry, const std::string& text) {
+	for (auto&& result : entry.results) result = Result();
+
+	LangLexer lex(text);
+	{
+		DiagnosticCapture capture;
+		lex.tokenize();
+		entry.lexed.diagnostics = capture.text();
+		entry.lexed.errors = capture.errors();
+	}
+	entry.tokens = std::make_shared<const std::vector<Token>>(lex.tokens());
+
+	// Eager bodies, as in batch mode: errors inside functions are reported
+	// even when nothing calls them.
+	DiagnosticCapture capture;
+	LangParser par(entry.tokens, 0, entry.tokens->size());
+	par.setLazyBodies(false);
+	par.parse();
+	entry.parsed.diagnostics = capture.text();
+	entry.parsed.errors = capture.errors();
+
+	entry.ast.clear();
+	writeProgram(par.program(), entry.ast);
+}
+
+// A fresh copy of the kept AST, for the passes that rewrite it.
+std::unique_ptr<Program> CompileServer::program(Entry& entry) {
+	return readProgram(entry.ast.data(), entry.ast.size());
+}
+
+void CompileServer::answer(Entry& entry, ServerOp op) {
+	Result& result = entry.results[int(op) - 1];
+	entry.warm = result.done;
+	if (result.done) return;
+	result.done = true;
+
+	if (!entry.tokens) {
+		DiagnosticCapture capture;
+		reportError() << "ERROR: Cannot read file." << std::endl;
+		result.diagnostics = capture.text();
+		result.errors = capture.errors();
+		return;
+	}
+
+	result.diagnostics = entry.lexed.diagnostics;
+	result.errors = entry.lexed.errors;
+	if (op == ServerOp::Tokens) {
+		OutputBuffer buffer;
+		dumpTokens(*entry.tokens, DumpFormat::Binary, buffer);
+		result.payload = std::move(buffer.data());
+		return;
+	}
+
+	result.diagnostics += entry.parsed.diagnostics;
+	result.errors += entry.parsed.errors;
+	if (op == ServerOp::Parse) {
+		putU32(result.payload, AstFormatVersion);
+		result.payload += entry.ast;
+		return;
+	}
+
+	// Like compileScript(), nothing is compiled after a syntax error.
+	if (op == ServerOp::Compile && result.errors > 0) return;
+
+	DiagnosticCapture capture;
+	std::unique_ptr<Program> tree = program(entry);
+	if (op == ServerOp::Check) {
+		Inliner inliner;
+		inliner.run(tree.get());
+		ConstantFolder folder;
+		folder.run(tree.get());
+		TypeInference types;
+		types.run(tree.get());
+
+		std::ostringstream report;
+		types.report(report);
+		result.payload = report.str();
+	} else {
+		std::shared_ptr<const Script> script = compileProgram(std::move(tree));
+		if (script) {
+			std::ostringstream listing;
+			script->disassemble(listing);
+			result.payload = listing.str();
+		}
+	}
+	result.diagnostics += capture.text();
+	result.errors += capture.errors();
+}
+
+int queryServer(const std::string& socketPath, ServerOp op, const std::vector<std::string>& paths, std::ostream& out) {
+	auto start = std::chrono::steady_clock::now();
+
+	sockaddr_un addr;
+	if (!address(socketPath, addr)) return -1;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	if (connect(fd, (const sockaddr*) &addr, sizeof(addr)) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	// The server resolves relative paths against its own directory.
+	std::string request;
+	request.push_back(char(op));
+	putU32(request, paths.size());
+	for (auto&& path : paths) {
+		std::error_code ec;
+		fs::path absolute = fs::absolute(path, ec);
+		putString(request, ec ? path : absolute.string());
+	}
+
+	std::string reply;
+	bool ok = writeMessage(fd, request) && readMessage(fd, reply, UINT32_MAX);
+	close(fd);
+	if (!ok) return -1;
+
+	Reader in(reply);
+	uint32_t count = in.u32();
+	if (in.failed() || count != (op == ServerOp::Shutdown ? 0 : paths.size())) return -1;
+	if (op == ServerOp::Shutdown) return 0;
+
+	// Payloads go to standard output in large writes, as in batch mode.
+	out.flush();
+	OutputBuffer dump(STDOUT_FILENO);
+
+	int errors = 0, failed = 0, warm = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		uint8_t flags = in.u8();
+		uint32_t fileErrors = in.u32();
+		std::string diagnostics = in.string();
+		std::string payload = in.string();
+		if (in.failed()) return -1;
+
+		if (flags & 1) warm++;
+		errors += fileErrors;
+		if (fileErrors > 0) failed++;
+		if (!diagnostics.empty()) {
+			dump.flush();
+			out << paths[i] << ":\n" << diagnostics << std::flush;
+		}
+		dump.append(payload);
+	}
+	dump.flush();
+
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	out << count << " files, " << errors << " errors in " << failed << " files, " <<
+		warm << " unchanged (" << ms << " ms)" << std::endl;
+	return failed;
+}
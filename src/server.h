@@ -0,0 +1,108 @@
+#ifndef LANG_SERVER_H
+#define LANG_SERVER_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "parser/parser.h"
+
+class ThreadPool;
+
+// What a request asks of each of its files. The payload of a reply is the
+// binary token dump (see dumpTokens()), the binary AST dump (see
+// dumpProgram()), the type inference report, or the disassembled Script.
+enum class ServerOp : uint8_t {
+	Tokens = 1,
+	Parse = 2,
+	Check = 3,    // parse, inline, fold and infer types, as lang --analyze
+	Compile = 4,  // the compileScript() pipeline
+	Shutdown = 5
+};
+
+struct ServerOptions {
+	int jobs = 0;  // worker threads, 0 for one per hardware thread
+};
+
+// Long-running compiler behind a Unix domain socket. Each file it is asked
+// about stays loaded with its tokens, its AST in the compact form of
+// writeProgram() and every reply computed so far. A file whose mtime and
+// size are unchanged is not read again; one that was touched but hashes
+// the same (ModuleCache::key()) keeps everything too. Only changed files
+// are lexed and parsed again, so a request costs what changed since the
+// last one. Files changed within a second of being read are always read
+// again, since a coarse mtime could hide a second edit.
+//
+// Protocol, all integers little-endian, strings as a u32 length and bytes:
+//
+//     request:  u32 size, u8 ServerOp, u32 count, count * path
+//     reply:    u32 size, u32 count, count * file
+//     file:     u8 flags (1: answered from memory), u32 errors,
+//               diagnostics, payload
+//
+// A connection may send any number of requests; they are answered one at
+// a time, the files of one request in parallel. Shutdown is answered with
+// no files and stops the server.
+class CompileServer {
+public:
+	CompileServer(const ServerOptions& options);
+	~CompileServer();
+
+	// Listens on `socketPath`, replacing a stale socket file, until a
+	// Shutdown request. Returns false if the socket cannot be set up.
+	bool serve(const std::string& socketPath);
+
+	// Answers one request body (everything after its size) into `reply`,
+	// likewise without the size. Returns false for a malformed request.
+	bool handle(const std::string& request, std::string& reply);
+
+	bool stopped() const { return m_stopped; }
+
+private:
+	struct Result {
+		bool done = false;
+		std::string diagnostics;
+		int errors = 0;
+		std::string payload;
+	};
+
+	struct Entry {
+		std::string path;
+		int64_t mtime = -1;
+		int64_t size = -1;
+		uint64_t hash = 0;
+		bool racy = true;
+
+		TokenStream tokens;
+		std::string ast;
+		Result lexed, parsed;
+		Result results[4];
+
+		// Whether the last request's answer was already known.
+		bool warm = false;
+
+		Entry() = default;
+		explicit Entry(const std::string& path) : path(path) {}
+	};
+
+	ServerOptions m_options;
+	std::unique_ptr<ThreadPool> m_pool;
+	std::map<std::string, std::unique_ptr<Entry>> m_files;
+	bool m_stopped = false;
+
+	void refresh(Entry& entry);
+	void load(Entry& entry, const std::string& text);
+	void answer(Entry& entry, ServerOp op);
+	std::unique_ptr<Program> program(Entry& entry);
+};
+
+// Sends one request for `paths` to the server at `socketPath` and prints
+// the replies like the batch mode: diagnostics per file to `out`, payloads
+// to standard output. Returns the number of files with errors, or -1 if
+// the server cannot be reached.
+int queryServer(const std::string& socketPath, ServerOp op, const std::vector<std::string>& paths, std::ostream& out);
+
+#endif // LANG_SERVER_H
\ No newline at end of file
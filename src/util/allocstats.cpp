@@ -0,0 +1,24 @@
+#include "stats.h"
+
+#include <cstdlib>
+#include <new>
+
+// Replacing the global operator new is the only way to see allocations
+// made inside the standard library. This file is linked into lang and
+// lang_bench only, never into liblang.a, so embedding hosts keep their own
+// operator new and pay nothing.
+
+static void* allocate(size_t size) {
+	Stats::countAllocation(size);
+
+	void* p = std::malloc(size ? size : 1);
+	if (p == nullptr) throw std::bad_alloc();
+	return p;
+}
+
+void* operator new(size_t size) { return allocate(size); }
+void* operator new[](size_t size) { return allocate(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
@@ -0,0 +1,35 @@
+#include "diagnostics.h"
+
+#include <iostream>
+
+static thread_local DiagnosticCapture* t_capture = nullptr;
+static thread_local int t_errors = 0;
+
+std::ostream& reportError() {
+	t_errors++;
+	if (!t_capture) return std::cerr;
+	t_capture->m_errors++;
+	return t_capture->m_out;
+}
+
+void reportCaptured(const std::string& text, int errors) {
+	t_errors += errors;
+	if (!t_capture) {
+		std::cerr << text;
+		return;
+	}
+	t_capture->m_errors += errors;
+	t_capture->m_out << text;
+}
+
+int reportedErrors() {
+	return t_errors;
+}
+
+DiagnosticCapture::DiagnosticCapture() : m_outer(t_capture) {
+	t_capture = this;
+}
+
+DiagnosticCapture::~DiagnosticCapture() {
+	t_capture = m_outer;
+}
@@ -0,0 +1,42 @@
+#ifndef LANG_DIAGNOSTICS_H
+#define LANG_DIAGNOSTICS_H
+
+#include <ostream>
+#include <sstream>
+#include <string>
+
+// Counts one error and returns the stream to describe it on: std::cerr, or
+// the innermost DiagnosticCapture active on the calling thread.
+std::ostream& reportError();
+
+// Errors reported on the calling thread so far, captured or not.
+int reportedErrors();
+
+// Reports again what a DiagnosticCapture collected: `errors` errors
+// described by `text`. Used to replay a job's diagnostics on the thread
+// that started it, or the one attempt out of several that was kept.
+void reportCaptured(const std::string& text, int errors);
+
+// Collects everything reported on this thread while it is alive, so
+// concurrent jobs can print their diagnostics in a fixed order afterwards.
+class DiagnosticCapture {
+public:
+	DiagnosticCapture();
+	~DiagnosticCapture();
+
+	DiagnosticCapture(const DiagnosticCapture&) = delete;
+	DiagnosticCapture& operator=(const DiagnosticCapture&) = delete;
+
+	std::string text() const { return m_out.str(); }
+	int errors() const { return m_errors; }
+
+private:
+	std::ostringstream m_out;
+	int m_errors = 0;
+	DiagnosticCapture* m_outer;
+
+	friend std::ostream& reportError();
+	friend void reportCaptured(const std::string& text, int errors);
+};
+
+#endif // LANG_DIAGNOSTICS_H
\ No newline at end of file
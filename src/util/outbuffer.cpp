@@ -0,0 +1,79 @@
+#include "outbuffer.h"
+
+#include <cerrno>
+#include <charconv>
+
+#include <unistd.h>
+
+bool dumpFormatFromName(const std::string& name, DumpFormat& format) {
+	if (name == "text") format = DumpFormat::Text;
+	else if (name == "json") format = DumpFormat::Json;
+	else if (name == "binary") format = DumpFormat::Binary;
+	else return false;
+	return true;
+}
+
+OutputBuffer::OutputBuffer(int fd, size_t capacity) : m_fd(fd), m_capacity(capacity) {
+	// An append that crosses the capacity grows the block once; the larger
+	// block is then kept for the rest of the dump.
+	if (fd >= 0) m_data.reserve(capacity);
+}
+
+OutputBuffer::~OutputBuffer() {
+	flush();
+}
+
+void OutputBuffer::integer(int64_t value) {
+	char buf[24];
+	auto result = std::to_chars(buf, buf + sizeof(buf), value);
+	append(buf, result.ptr - buf);
+}
+
+void OutputBuffer::number(double value, int precision) {
+	char buf[32];
+	std::to_chars_result result;
+	if (precision > 0) {
+		result = std::to_chars(buf, buf + sizeof(buf), value, std::chars_format::general, precision);
+	} else {
+		result = std::to_chars(buf, buf + sizeof(buf), value);
+	}
+	append(buf, result.ptr - buf);
+}
+
+void OutputBuffer::quoted(const std::string& value) {
+	static const char hex[] = "0123456789abcdef";
+
+	m_data.push_back('"');
+	for (unsigned char c : value) {
+		if (c == '"' || c == '\\') {
+			m_data.push_back('\\');
+			m_data.push_back(c);
+		} else if (c < 0x20) {
+			const char escape[] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 15] };
+			m_data.append(escape, sizeof(escape));
+		} else {
+			m_data.push_back(c);
+		}
+	}
+	m_data.push_back('"');
+	check();
+}
+
+bool OutputBuffer::flush() {
+	if (m_fd < 0) return true;
+
+	const char* p = m_data.data();
+	size_t left = m_data.size();
+	while (left > 0) {
+		ssize_t n = ::write(m_fd, p, left);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			m_data.clear();
+			return false;
+		}
+		p += n;
+		left -= n;
+	}
+	m_data.clear();
+	return true;
+}
@@ -0,0 +1,66 @@
+#ifndef LANG_OUTBUFFER_H
+#define LANG_OUTBUFFER_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+enum class DumpFormat {
+	Text,   // indented, same layout as Node::print()
+	Json,   // one object per statement / token, one per line
+	Binary  // length-prefixed little-endian, see dumpProgram()/dumpTokens()
+};
+
+// Parses "text", "json" or "binary". Returns false for anything else.
+bool dumpFormatFromName(const std::string& name, DumpFormat& format);
+
+// Append-only output for large dumps. Everything goes into one block that
+// is reused between flushes and handed to the kernel with a single
+// write(2), so nothing is allocated or formatted through iostreams per
+// line. Without a file descriptor the buffer only collects and grows;
+// data() then holds everything written.
+class OutputBuffer {
+public:
+	static const size_t DefaultCapacity = 1 << 20;
+
+	OutputBuffer(int fd = -1, size_t capacity = DefaultCapacity);
+	~OutputBuffer();
+
+	OutputBuffer(const OutputBuffer&) = delete;
+	OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+	void put(char c) { m_data.push_back(c); check(); }
+	void append(const char* data, size_t size) { m_data.append(data, size); check(); }
+	void append(const std::string& value) { append(value.data(), value.size()); }
+	void append(const char* text) { append(text, std::strlen(text)); }
+
+	// A string literal, with its length known at compile time.
+	template <size_t N>
+	void literal(const char (&text)[N]) { append(text, N - 1); }
+
+	void pad(int n) { m_data.append(n, ' '); check(); }
+
+	void integer(int64_t value);
+
+	// `precision` 0 writes the shortest text that reads back exactly,
+	// otherwise like printf("%.*g"), which is also what std::ostream uses.
+	void number(double value, int precision = 0);
+
+	// `value` as a quoted JSON string.
+	void quoted(const std::string& value);
+
+	// The pending bytes. Callers may append to it directly, e.g. with
+	// writeProgram(), and then call check().
+	std::string& data() { return m_data; }
+	void check() { if (m_fd >= 0 && m_data.size() >= m_capacity) flush(); }
+
+	// Writes out everything pending. Returns false on a write error.
+	bool flush();
+
+private:
+	int m_fd;
+	size_t m_capacity;
+	std::string m_data;
+};
+
+#endif // LANG_OUTBUFFER_H
\ No newline at end of file
@@ -0,0 +1,204 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#include <signal.h>
+#include <sys/time.h>
+
+static const int MaxDepth = 32;
+static const int MaxSamples = 1 << 15;
+
+struct ProfileFrame {
+	const char* name;
+	int line;
+};
+
+// Written only by its own thread; the signal handler runs on that same
+// thread, so it sees a consistent prefix as long as depth is updated last.
+struct FrameStack {
+	ProfileFrame frames[MaxDepth];
+	volatile int depth = 0;
+};
+
+struct Sample {
+	ProfileFrame frames[MaxDepth];
+	int depth;
+};
+
+static thread_local FrameStack t_stack;
+
+// Left uninitialized, so only pages that receive samples are ever touched.
+static std::unique_ptr<Sample[]> s_samples;
+static std::atomic<int> s_next { 0 };
+static std::atomic<int> s_dropped { 0 };
+static std::atomic<bool> s_running { false };
+
+static std::mutex s_internLock;
+static std::set<std::string> s_names;
+
+static void onSample(int) {
+	int depth = std::min(int(t_stack.depth), MaxDepth);
+	if (depth == 0) return;
+
+	int index = s_next.fetch_add(1, std::memory_order_relaxed);
+	if (index >= MaxSamples) {
+		s_dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	Sample& sample = s_samples[index];
+	for (int i = 0; i < depth; i++) {
+		sample.frames[i] = t_stack.frames[i];
+	}
+	sample.depth = depth;
+}
+
+bool Profiler::start(int intervalUs) {
+	if (s_running) return false;
+	if (!s_samples) s_samples.reset(new Sample[MaxSamples]);
+	s_next = 0;
+	s_dropped = 0;
+
+	struct sigaction action {};
+	action.sa_handler = onSample;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	if (sigaction(SIGPROF, &action, nullptr) != 0) return false;
+
+	s_running = true;
+	struct itimerval timer {};
+	timer.it_interval.tv_sec = intervalUs / 1000000;
+	timer.it_interval.tv_usec = intervalUs % 1000000;
+	timer.it_value = timer.it_interval;
+	if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+		s_running = false;
+		return false;
+	}
+	return true;
+}
+
+void Profiler::stop() {
+	if (!s_running) return;
+
+	struct itimerval timer {};
+	setitimer(ITIMER_PROF, &timer, nullptr);
+	signal(SIGPROF, SIG_IGN);
+	s_running = false;
+}
+
+bool Profiler::running() {
+	return s_running;
+}
+
+int Profiler::samples() {
+	return std::min(s_next.load(), MaxSamples);
+}
+
+int Profiler::dropped() {
+	return s_dropped;
+}
+
+const char* Profiler::intern(const std::string& name) {
+	// Frames are pushed far more often than new names appear.
+	thread_local std::unordered_map<std::string, const char*> cache;
+	auto it = cache.find(name);
+	if (it != cache.end()) return it->second;
+
+	std::lock_guard<std::mutex> guard(s_internLock);
+	const char* interned = s_names.insert(name).first->c_str();
+	cache.emplace(name, interned);
+	return interned;
+}
+
+static std::string frameName(const ProfileFrame& frame) {
+	std::string name = frame.name ? frame.name : "?";
+	if (frame.line >= 0) name += ":" + std::to_string(frame.line);
+	return name;
+}
+
+void Profiler::writeCollapsed(std::ostream& out) {
+	std::map<std::string, int> stacks;
+	for (int i = 0; i < samples(); i++) {
+		const Sample& sample = s_samples[i];
+		std::string stack;
+		for (int j = 0; j < sample.depth; j++) {
+			if (j > 0) stack += ";";
+			// Only the leaf carries a line, so callers merge into one frame.
+			stack += j + 1 == sample.depth ? frameName(sample.frames[j]) : (sample.frames[j].name ? sample.frames[j].name : "?");
+		}
+		stacks[stack]++;
+	}
+
+	for (auto&& stack : stacks) {
+		out << stack.first << " " << stack.second << "\n";
+	}
+	out.flush();
+}
+
+void Profiler::writeTop(std::ostream& out, int count) {
+	std::map<std::string, int> frames, lines;
+	int total = samples();
+	for (int i = 0; i < total; i++) {
+		const ProfileFrame& leaf = s_samples[i].frames[s_samples[i].depth - 1];
+		frames[leaf.name ? leaf.name : "?"]++;
+		lines[frameName(leaf)]++;
+	}
+
+	auto print = [&](const char* title, const std::map<std::string, int>& counts) {
+		std::vector<std::pair<int, std::string>> sorted;
+		for (auto&& entry : counts) {
+			sorted.push_back({ entry.second, entry.first });
+		}
+		std::sort(sorted.begin(), sorted.end(), [](const std::pair<int, std::string>& a, const std::pair<int, std::string>& b) {
+			return a.first != b.first ? a.first > b.first : a.second < b.second;
+		});
+
+		out << title << std::endl;
+		for (int i = 0; i < count && i < int(sorted.size()); i++) {
+			out << "    " << sorted[i].first << " (" << (100.0 * sorted[i].first / total) << "%) " << sorted[i].second << std::endl;
+		}
+	};
+
+	out << "Profile: " << total << " samples";
+	if (dropped() > 0) out << ", " << dropped() << " dropped";
+	out << std::endl;
+	if (total == 0) return;
+
+	print("Top frames (self):", frames);
+	print("Top lines (self):", lines);
+}
+
+ProfileScope::ProfileScope(const char* name, int line) {
+	profileEnter(name, line);
+}
+
+ProfileScope::ProfileScope(const std::string& name, int line)
+	: ProfileScope(Profiler::running() ? Profiler::intern(name) : nullptr, line)
+{}
+
+ProfileScope::~ProfileScope() {
+	profileLeave();
+}
+
+void profileLine(int line) {
+	int depth = t_stack.depth;
+	if (depth > 0 && depth <= MaxDepth) t_stack.frames[depth - 1].line = line;
+}
+
+void profileEnter(const char* name, int line) {
+	int depth = t_stack.depth;
+	if (depth < MaxDepth) t_stack.frames[depth] = { name, line };
+	std::atomic_signal_fence(std::memory_order_release);
+	t_stack.depth = depth + 1;
+}
+
+void profileLeave() {
+	t_stack.depth = t_stack.depth - 1;
+}
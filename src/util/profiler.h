@@ -0,0 +1,56 @@
+#ifndef LANG_PROFILER_H
+#define LANG_PROFILER_H
+
+#include <ostream>
+#include <string>
+
+// Sampling profiler. Code that wants to be attributed publishes what it is
+// working on as a stack of frames (a name and the current line) on its
+// thread; a SIGPROF timer copies the stack of whichever thread is on the
+// CPU into a preallocated buffer, so sampling never allocates or locks.
+//
+// Frame names must outlive the profiler: use string literals or intern().
+class Profiler {
+public:
+	// Samples every `intervalUs` microseconds of CPU time.
+	static bool start(int intervalUs = 1000);
+	static void stop();
+	static bool running();
+
+	// Stable copy of `name` for use as a frame name.
+	static const char* intern(const std::string& name);
+
+	// One "outer;inner;leaf:line count" line per distinct stack, the input
+	// format of flamegraph.pl and speedscope.
+	static void writeCollapsed(std::ostream& out);
+
+	// The `count` hottest frames and lines by self time.
+	static void writeTop(std::ostream& out, int count = 20);
+
+	static int samples();
+	static int dropped();
+};
+
+// Pushes a frame for the lifetime of the scope. Cheap enough to leave in
+// place when the profiler is off; names are only interned while it runs.
+class ProfileScope {
+public:
+	// A negative line means the frame has none (yet).
+	ProfileScope(const char* name, int line = -1);
+	ProfileScope(const std::string& name, int line = -1);
+	~ProfileScope();
+
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+};
+
+// Moves the innermost frame on this thread to `line`.
+void profileLine(int line);
+
+// For frames that do not follow a C++ scope, like an interpreter's calls:
+// profileEnter() pushes one as ProfileScope does, profileLeave() pops the
+// innermost. Every frame entered must be left on the same thread.
+void profileEnter(const char* name, int line = -1);
+void profileLeave();
+
+#endif // LANG_PROFILER_H
\ No newline at end of file
@@ -0,0 +1,226 @@
+#include "stats.h"
+
+#include <atomic>
+#include <cstdio>
+#include <iomanip>
+
+#include <sys/resource.h>
+#include <time.h>
+
+namespace {
+
+// Allocation counts of one thread. Only the owning thread writes them, so
+// counting is a relaxed load and store on a line no other thread touches;
+// the totals walk the list of live threads when asked.
+struct ThreadCounts {
+	std::atomic<uint64_t> allocations { 0 }, bytes { 0 };
+	ThreadCounts* next = nullptr;
+
+	ThreadCounts();
+	~ThreadCounts();
+};
+
+std::mutex s_threadsLock;
+ThreadCounts* s_threads = nullptr;
+
+// What threads that have exited counted, guarded by s_threadsLock.
+uint64_t s_exitedAllocations = 0, s_exitedBytes = 0;
+
+ThreadCounts::ThreadCounts() {
+	std::lock_guard<std::mutex> guard(s_threadsLock);
+	next = s_threads;
+	s_threads = this;
+}
+
+ThreadCounts::~ThreadCounts() {
+	std::lock_guard<std::mutex> guard(s_threadsLock);
+	ThreadCounts** link = &s_threads;
+	while (*link != this) link = &(*link)->next;
+	*link = next;
+	s_exitedAllocations += allocations.load(std::memory_order_relaxed);
+	s_exitedBytes += bytes.load(std::memory_order_relaxed);
+}
+
+thread_local ThreadCounts t_counts;
+
+} // namespace
+
+void Stats::countAllocation(size_t size) {
+	ThreadCounts& counts = t_counts;
+	counts.allocations.store(counts.allocations.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	counts.bytes.store(counts.bytes.load(std::memory_order_relaxed) + size, std::memory_order_relaxed);
+}
+
+uint64_t Stats::threadAllocations() { return t_counts.allocations.load(std::memory_order_relaxed); }
+uint64_t Stats::threadAllocatedBytes() { return t_counts.bytes.load(std::memory_order_relaxed); }
+
+uint64_t Stats::totalAllocations() {
+	std::lock_guard<std::mutex> guard(s_threadsLock);
+	uint64_t total = s_exitedAllocations;
+	for (ThreadCounts* counts = s_threads; counts; counts = counts->next) {
+		total += counts->allocations.load(std::memory_order_relaxed);
+	}
+	return total;
+}
+
+uint64_t Stats::totalAllocatedBytes() {
+	std::lock_guard<std::mutex> guard(s_threadsLock);
+	uint64_t total = s_exitedBytes;
+	for (ThreadCounts* counts = s_threads; counts; counts = counts->next) {
+		total += counts->bytes.load(std::memory_order_relaxed);
+	}
+	return total;
+}
+
+long Stats::peakRssKb() {
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+	return usage.ru_maxrss;
+}
+
+double Stats::threadCpuMs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+Stats::Stats() : m_start(std::chrono::steady_clock::now()) {}
+
+Stats::Phase::Phase(Stats* stats, const char* name) : m_stats(stats), m_name(name) {
+	if (!stats) return;
+	m_allocations = threadAllocations();
+	m_bytes = threadAllocatedBytes();
+	m_cpu = threadCpuMs();
+	m_wall = std::chrono::steady_clock::now();
+}
+
+Stats::Phase::~Phase() {
+	if (!m_stats) return;
+
+	PhaseStats run;
+	run.name = m_name;
+	run.runs = 1;
+	run.wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_wall).count();
+	run.cpuMs = threadCpuMs() - m_cpu;
+	run.allocations = threadAllocations() - m_allocations;
+	run.bytes = threadAllocatedBytes() - m_bytes;
+	m_stats->record(run);
+}
+
+void Stats::count(const char* phase, uint64_t items, const char* unit) {
+	PhaseStats run;
+	run.name = phase;
+	run.items = items;
+	run.unit = unit;
+	record(run);
+}
+
+void Stats::record(const PhaseStats& run) {
+	std::lock_guard<std::mutex> guard(m_lock);
+	for (auto&& phase : m_phases) {
+		if (phase.name != run.name) continue;
+		phase.runs += run.runs;
+		phase.wallMs += run.wallMs;
+		phase.cpuMs += run.cpuMs;
+		phase.allocations += run.allocations;
+		phase.bytes += run.bytes;
+		phase.items += run.items;
+		if (!run.unit.empty()) phase.unit = run.unit;
+		return;
+	}
+	m_phases.push_back(run);
+}
+
+void Stats::add(const std::string& group, const std::string& name, uint64_t value) {
+	std::lock_guard<std::mutex> guard(m_lock);
+	m_counters[group][name] += value;
+}
+
+static double perSecond(uint64_t items, double ms) {
+	return ms > 0 ? items / (ms / 1000.0) : 0;
+}
+
+void Stats::print(std::ostream& out) const {
+	std::lock_guard<std::mutex> guard(m_lock);
+	double total = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_start).count();
+
+	std::ios::fmtflags flags = out.flags();
+	out << std::fixed << std::setprecision(2);
+	out << std::left << std::setw(10) << "Phase" << std::right <<
+		std::setw(6) << "runs" << std::setw(12) << "wall ms" << std::setw(12) << "cpu ms" <<
+		std::setw(12) << "allocs" << std::setw(14) << "bytes" << std::setw(12) << "items" << "  rate" << std::endl;
+	for (auto&& phase : m_phases) {
+		out << std::left << std::setw(10) << phase.name << std::right <<
+			std::setw(6) << phase.runs << std::setw(12) << phase.wallMs << std::setw(12) << phase.cpuMs <<
+			std::setw(12) << phase.allocations << std::setw(14) << phase.bytes << std::setw(12) << phase.items;
+		if (!phase.unit.empty()) {
+			out << "  " << std::setprecision(0) << perSecond(phase.items, phase.wallMs) << " " << phase.unit << "/s" << std::setprecision(2);
+		}
+		out << std::endl;
+	}
+
+	for (auto&& group : m_counters) {
+		out << group.first << ":" << std::endl;
+		for (auto&& counter : group.second) {
+			out << "    " << std::left << std::setw(16) << counter.first << std::right << counter.second << std::endl;
+		}
+	}
+
+	out << "Total: " << total << " ms, " << totalAllocations() << " allocations, " <<
+		totalAllocatedBytes() << " bytes allocated, peak RSS " << peakRssKb() << " KB" << std::endl;
+	out.flags(flags);
+}
+
+static void jsonString(std::ostream& out, const std::string& value) {
+	out << '"';
+	for (unsigned char c : value) {
+		if (c == '"' || c == '\\') out << '\\' << c;
+		else if (c < 0x20) {
+			char buf[8];
+			std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+			out << buf;
+		} else out << c;
+	}
+	out << '"';
+}
+
+void Stats::writeJson(std::ostream& out) const {
+	std::lock_guard<std::mutex> guard(m_lock);
+	double total = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_start).count();
+
+	out << "{\"phases\":[";
+	for (size_t i = 0; i < m_phases.size(); i++) {
+		const PhaseStats& phase = m_phases[i];
+		if (i > 0) out << ",";
+		out << "{\"name\":";
+		jsonString(out, phase.name);
+		out << ",\"runs\":" << phase.runs <<
+			",\"wall_ms\":" << phase.wallMs <<
+			",\"cpu_ms\":" << phase.cpuMs <<
+			",\"allocations\":" << phase.allocations <<
+			",\"bytes\":" << phase.bytes <<
+			",\"items\":" << phase.items << ",\"unit\":";
+		jsonString(out, phase.unit);
+		out << ",\"per_sec\":" << perSecond(phase.items, phase.wallMs) << "}";
+	}
+	out << "]";
+
+	for (auto&& group : m_counters) {
+		out << ",";
+		jsonString(out, group.first);
+		out << ":{";
+		bool first = true;
+		for (auto&& counter : group.second) {
+			if (!first) out << ",";
+			first = false;
+			jsonString(out, counter.first);
+			out << ":" << counter.second;
+		}
+		out << "}";
+	}
+
+	out << ",\"total_ms\":" << total <<
+		",\"allocations\":" << totalAllocations() <<
+		",\"bytes\":" << totalAllocatedBytes() <<
+		",\"peak_rss_kb\":" << peakRssKb() << "}" << std::endl;
+}
@@ -0,0 +1,83 @@
+#ifndef LANG_STATS_H
+#define LANG_STATS_H
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct PhaseStats {
+	std::string name;
+	int runs = 0;
+	double wallMs = 0, cpuMs = 0;
+
+	// Heap allocations made on the phase's thread while it ran.
+	uint64_t allocations = 0, bytes = 0;
+
+	// What the phase produced, e.g. tokens or nodes, for the rate column.
+	uint64_t items = 0;
+	std::string unit;
+};
+
+// Per-phase wall/CPU time and allocation counts. Phases with the same name
+// are summed, so a batch reports totals over all files (CPU time can then
+// exceed wall time of the whole run). Safe to share between threads.
+class Stats {
+public:
+	Stats();
+	~Stats() = default;
+
+	// Measures its own lifetime as one run of the named phase. A null
+	// `stats` makes it a no-op, so callers need not branch.
+	class Phase {
+	public:
+		Phase(Stats* stats, const char* name);
+		~Phase();
+
+		Phase(const Phase&) = delete;
+		Phase& operator=(const Phase&) = delete;
+
+	private:
+		Stats* m_stats;
+		const char* m_name;
+		std::chrono::steady_clock::time_point m_wall;
+		double m_cpu;
+		uint64_t m_allocations, m_bytes;
+	};
+
+	// Credits `items` to a phase, usually counted after it finished.
+	void count(const char* phase, uint64_t items, const char* unit);
+
+	// Adds to a named counter, e.g. the number of nodes of each kind.
+	void add(const std::string& group, const std::string& name, uint64_t value);
+
+	const std::vector<PhaseStats>& phases() const { return m_phases; }
+
+	void print(std::ostream& out) const;
+	void writeJson(std::ostream& out) const;
+
+	// Counted by the global operator new of util/allocstats.cpp, per thread
+	// and over all threads. Only lang and lang_bench link that file, so in
+	// an embedding host these stay 0.
+	static void countAllocation(size_t size);
+	static uint64_t threadAllocations();
+	static uint64_t threadAllocatedBytes();
+	static uint64_t totalAllocations();
+	static uint64_t totalAllocatedBytes();
+
+	static long peakRssKb();
+	static double threadCpuMs();
+
+private:
+	mutable std::mutex m_lock;
+	std::vector<PhaseStats> m_phases;
+	std::map<std::string, std::map<std::string, uint64_t>> m_counters;
+	std::chrono::steady_clock::time_point m_start;
+
+	void record(const PhaseStats& run);
+};
+
+#endif // LANG_STATS_H
\ No newline at end of file
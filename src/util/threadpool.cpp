@@ -0,0 +1,131 @@
+#include "threadpool.h"
+
+// The pool and deque the current thread works for, if any.
+static thread_local ThreadPool* t_pool = nullptr;
+static thread_local int t_queue = -1;
+
+ThreadPool::ThreadPool(int threads) {
+	if (threads <= 0) threads = hardwareThreads();
+	for (int i = 0; i < threads; i++) {
+		m_queues.emplace_back(new Queue());
+	}
+	for (int i = 0; i < threads; i++) {
+		m_workers.emplace_back(&ThreadPool::work, this, i);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	m_stop = true;
+	for (auto&& queue : m_queues) {
+		std::lock_guard<std::mutex> guard(queue->lock);
+		queue->wake.notify_all();
+	}
+	for (auto&& worker : m_workers) {
+		worker.join();
+	}
+}
+
+int ThreadPool::hardwareThreads() {
+	int count = std::thread::hardware_concurrency();
+	return count > 0 ? count : 1;
+}
+
+int ThreadPool::worker() const {
+	return t_pool == this ? t_queue : -1;
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+	// Counted before it becomes visible, so a worker finishing it early can
+	// never drive m_pending below zero.
+	m_pending++;
+	int index = t_pool == this ? t_queue : m_nextQueue++ % m_queues.size();
+
+	Queue& queue = *m_queues[index];
+	bool sleeping;
+	{
+		std::lock_guard<std::mutex> guard(queue.lock);
+		queue.tasks.push_back(std::move(task));
+		m_queued++;
+		sleeping = queue.sleeping;
+	}
+	if (sleeping) queue.wake.notify_one();
+	else if (m_sleeping > 0) wakeOne(index);
+}
+
+// Wakes a sleeping worker other than `except`'s to steal. A worker about
+// to sleep checks m_queued under its deque's lock after it was raised, so
+// one this misses does not sleep.
+void ThreadPool::wakeOne(int except) {
+	int count = m_queues.size();
+	for (int i = 1; i < count; i++) {
+		Queue& queue = *m_queues[(except + i) % count];
+		std::lock_guard<std::mutex> guard(queue.lock);
+		if (queue.sleeping) {
+			queue.wake.notify_one();
+			return;
+		}
+	}
+}
+
+void ThreadPool::wait() {
+	std::unique_lock<std::mutex> lock(m_lock);
+	m_idle.wait(lock, [this] { return m_pending == 0; });
+}
+
+bool ThreadPool::take(int index, std::function<void()>& task) {
+	{
+		Queue& own = *m_queues[index];
+		std::lock_guard<std::mutex> guard(own.lock);
+		if (!own.tasks.empty()) {
+			task = std::move(own.tasks.back());
+			own.tasks.pop_back();
+			m_queued--;
+			return true;
+		}
+	}
+
+	int count = m_queues.size();
+	for (int i = 1; i < count && m_queued > 0; i++) {
+		Queue& victim = *m_queues[(index + i) % count];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if (!victim.tasks.empty()) {
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			m_queued--;
+			return true;
+		}
+	}
+	return false;
+}
+
+void ThreadPool::work(int index) {
+	t_pool = this;
+	t_queue = index;
+	Queue& own = *m_queues[index];
+
+	while (true) {
+		std::function<void()> task;
+		if (!take(index, task)) {
+			// Sleep until a task is pushed here or this worker is woken
+			// to steal one. m_queued only counts tasks still in a deque,
+			// so it cannot keep an idle worker looking.
+			std::unique_lock<std::mutex> lock(own.lock);
+			own.sleeping = true;
+			m_sleeping++;
+			own.wake.wait(lock, [this] { return m_stop || m_queued > 0; });
+			own.sleeping = false;
+			m_sleeping--;
+			if (m_stop && m_queued == 0) return;
+			continue;
+		}
+
+		task();
+
+		if (--m_pending == 0) {
+			// wait() checks m_pending holding m_lock, so it is either not
+			// asleep yet or gets this notification.
+			std::lock_guard<std::mutex> guard(m_lock);
+			m_idle.notify_all();
+		}
+	}
+}
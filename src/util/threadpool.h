@@ -0,0 +1,72 @@
+#ifndef LANG_THREADPOOL_H
+#define LANG_THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing pool. Every worker owns a deque: it runs its own newest
+// task first (tasks submitted from inside a task stay hot in cache) and,
+// once empty, steals the oldest task of another worker. A worker with
+// nothing to take sleeps on its own deque until a task is pushed there,
+// or until it is woken to steal one pushed to a busy worker's deque. No
+// lock but the deques' is taken per task.
+class ThreadPool {
+public:
+	// threads <= 0 uses one worker per hardware thread.
+	ThreadPool(int threads = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// From a worker of this pool the task goes to that worker's deque,
+	// otherwise the deques are filled round-robin.
+	void submit(std::function<void()> task);
+
+	// Blocks until every submitted task has finished. Must not be called
+	// from inside a task.
+	void wait();
+
+	int size() const { return m_workers.size(); }
+
+	// Index of the calling thread among this pool's workers, or -1 if it
+	// is not one of them.
+	int worker() const;
+
+	static int hardwareThreads();
+
+private:
+	struct Queue {
+		std::mutex lock;
+		std::condition_variable wake;
+		std::deque<std::function<void()>> tasks;
+		bool sleeping = false;  // its worker waits on `wake`
+	};
+
+	std::vector<std::thread> m_workers;
+	std::vector<std::unique_ptr<Queue>> m_queues;
+	std::atomic<unsigned> m_nextQueue { 0 };
+
+	// Tasks in all deques, changed with the deque's lock held as tasks are
+	// pushed and taken, so it is never above zero with nothing to take.
+	std::atomic<int> m_queued { 0 };
+	std::atomic<int> m_sleeping { 0 };
+	std::atomic<bool> m_stop { false };
+
+	// Tasks submitted and not finished. m_lock only lets wait() sleep.
+	std::atomic<int> m_pending { 0 };
+	std::mutex m_lock;
+	std::condition_variable m_idle;
+
+	bool take(int index, std::function<void()>& task);
+	void wakeOne(int except);
+	void work(int index);
+};
+
+#endif // LANG_THREADPOOL_H
\ No newline at end of file
@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "lexer/lexer.h"
+#include "parser/dump.h"
+#include "parser/incremental.h"
+#include "parser/parser.h"
+#include "util/diagnostics.h"
+
+// Random edits through IncrementalParser, each checked against a parse of
+// the same text from scratch: the same tokens at the same positions and
+// the same tree. Undoing an edit must not report errors held back from
+// attempts that were grown past.
+
+static const char* s_source = R"(// comment
+pub let a = 10;
+
+func add(a, b) {
+	return a + b;
+}
+
+/* block
+   comment */
+func test() {
+	let b = 5;
+	if (b > 10) return 42 * b;
+	else { b = "text"; }
+	for x in 1..10 {
+		print(x);
+	}
+	while (b < 3) { b++; }
+	return 42 * a;
+}
+
+let xs = f64(3);
+test();
+)";
+
+static const char* s_pieces[] = { "", "x", ";", "{", "}", "(", ")", "\n", "\"", "/*", "else", "let y = 2;", "func f() {" };
+
+static int s_failures = 0;
+
+static void fail(int step, const std::string& what) {
+	std::cerr << "step " << step << ": " << what << std::endl;
+	s_failures++;
+}
+
+static std::string dump(Program* program) {
+	OutputBuffer out;
+	dumpProgram(program, DumpFormat::Text, out);
+	return out.data();
+}
+
+static bool sameTokens(const std::vector<Token>& a, const std::vector<Token>& b) {
+	if (a.size() != b.size()) return false;
+	for (size_t i = 0; i < a.size(); i++) {
+		if (a[i].type != b[i].type || a[i].lexeme != b[i].lexeme || a[i].line != b[i].line || a[i].pos != b[i].pos ||
+			a[i].offset != b[i].offset || a[i].length != b[i].length)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static void compare(int step, IncrementalParser& incremental) {
+	DiagnosticCapture quiet;
+	LangLexer lexer(incremental.source());
+	lexer.tokenize();
+	LangParser parser(lexer.tokens());
+	parser.setLazyBodies(false);
+	parser.parse();
+
+	if (!sameTokens(incremental.tokens(), lexer.tokens())) fail(step, "tokens differ");
+	if (dump(incremental.program()) != dump(parser.program())) fail(step, "trees differ");
+}
+
+int main() {
+	IncrementalParser incremental;
+	incremental.parse(s_source);
+	compare(0, incremental);
+
+	uint64_t seed = 7;
+	auto next = [&](uint64_t bound) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		return int((seed >> 33) % bound);
+	};
+
+	auto randomEdit = [&](const std::string& text) {
+		int offset = next(text.size() + 1);
+		int removed = std::min(next(4), int(text.size()) - offset);
+		return TextEdit { offset, removed, s_pieces[next(sizeof(s_pieces) / sizeof(*s_pieces))] };
+	};
+
+	// Edits piling up, so the text drifts far from where it started.
+	for (int step = 1; step <= 1000; step++) {
+		DiagnosticCapture quiet;
+		incremental.edit(randomEdit(incremental.source()));
+		compare(step, incremental);
+	}
+
+	// Edits to the clean source, each undone again: the undo must parse
+	// cleanly, whatever the attempts before the accepted one reported.
+	incremental.parse(s_source);
+	for (int step = 1001; step <= 2000; step++) {
+		TextEdit edit = randomEdit(s_source);
+		{
+			DiagnosticCapture quiet;
+			incremental.edit(edit);
+		}
+		compare(step, incremental);
+
+		DiagnosticCapture capture;
+		incremental.edit({ edit.offset, int(edit.inserted.size()), std::string(s_source).substr(edit.offset, edit.removed) });
+		if (incremental.source() != s_source) fail(step, "undo did not restore the text");
+		if (capture.errors() > 0) fail(step, "undo reported errors:\n" + capture.text());
+		compare(step, incremental);
+	}
+
+	if (s_failures > 0) {
+		std::cerr << s_failures << " failures" << std::endl;
+		return 1;
+	}
+	return 0;
+}
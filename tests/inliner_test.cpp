@@ -0,0 +1,132 @@
+#include <iostream>
+#include <string>
+
+#include "lexer/lexer.h"
+#include "parser/parser.h"
+#include "analysis/inliner.h"
+#include "runtime/host.h"
+
+// Inlining: small helpers are expanded at their call sites, and the
+// result computes what the calls did. Recursive callees, arguments with
+// side effects and names the caller's locals (loop variables included)
+// hide are left as calls wherever expanding them would change that.
+
+static int s_failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed" << std::endl; \
+			s_failures++; \
+		} \
+	} while (0)
+
+// Call sites the inliner expands in `source`.
+static int inlined(const std::string& source) {
+	LangLexer lex(source);
+	lex.tokenize();
+	LangParser par(lex.tokens());
+	par.parse();
+	Inliner inliner;
+	inliner.run(par.program());
+	return inliner.inlined();
+}
+
+static std::string s_log;
+
+static int64_t mark(int64_t x) {
+	s_log += std::to_string(x);
+	return x;
+}
+
+static void testExpanded() {
+	const char* source =
+		"func add(a, b) { return a + b; }\n"
+		"func inc(x, by = 1) { return x + by; }\n"
+		"pub func f(i) { return add(i, 1) + inc(i) + inc(i, 2); }\n";
+	CHECK(inlined(source) == 3);
+
+	Runtime rt;
+	CHECK(rt.load(source));
+	CHECK(rt.function<int64_t(int64_t)>("f")(4) == 5 + 5 + 6);
+}
+
+static void testRecursion() {
+	const char* fact =
+		"func fact(n) { return n < 2 ? 1 : n * fact(n - 1); }\n"
+		"pub func f(n) { return fact(n); }\n";
+	CHECK(inlined(fact) == 0);
+
+	// Mutual recursion is expanded at most MaxDepth levels deep.
+	const char* parity =
+		"func even(n) { return n == 0 ? true : odd(n - 1); }\n"
+		"func odd(n) { return n == 0 ? false : even(n - 1); }\n"
+		"pub func isEven(n) { return even(n); }\n";
+	CHECK(inlined(parity) <= 2 * (Inliner::MaxDepth + 1) + 1);
+
+	Runtime rt;
+	CHECK(rt.load(std::string(fact) + parity));
+	CHECK(rt.function<int64_t(int64_t)>("f")(5) == 120);
+	CHECK(rt.function<bool(int64_t)>("isEven")(10));
+	CHECK(!rt.function<bool(int64_t)>("isEven")(7));
+}
+
+static void testSideEffects() {
+	const char* source =
+		"func twice(x) { return x + x; }\n"
+		"func rsub(a, b) { return b - a; }\n"
+		"func pick(c, a, b) { return c ? a : b; }\n"
+		"pub func t() { return twice(mark(3)); }\n"
+		"pub func o() { return rsub(mark(1), mark(2)); }\n"
+		"pub func p() { return pick(true, mark(4), mark(5)); }\n";
+
+	// An argument that calls something is never moved into the callee.
+	CHECK(inlined(source) == 0);
+
+	Runtime rt;
+	rt.define<&mark>("mark");
+	CHECK(rt.load(source));
+	s_log.clear();
+	CHECK(rt.function<int64_t()>("t")() == 6);
+	CHECK(s_log == "3");
+	s_log.clear();
+	CHECK(rt.function<int64_t()>("o")() == 1);
+	CHECK(s_log == "12");
+	s_log.clear();
+	CHECK(rt.function<int64_t()>("p")() == 4);
+	CHECK(s_log == "45");
+
+	// One without calls is, if the callee uses it exactly once.
+	CHECK(inlined("let g = 3;\nfunc add(a, b) { return a + b; }\npub func f() { return add(g * 2, 1); }\n") == 1);
+	CHECK(inlined("let g = 3;\nfunc twice(x) { return x + x; }\npub func f() { return twice(g * 2); }\n") == 0);
+}
+
+static void testLoopVariables() {
+	// The loop variable is a local of the caller: it hides the global the
+	// callee means, but can be passed as an argument.
+	const char* source =
+		"let i = 100;\n"
+		"func addI(x) { return x + i; }\n"
+		"func sq(x) { return x * x; }\n"
+		"pub func shadowed(n) { let t = 0; for i in 0..n { t = t + addI(1); } return t; }\n"
+		"pub func squares(n) { let t = 0; for i in 0..n { t = t + sq(i); } return t; }\n";
+	CHECK(inlined(source) == 1);
+
+	Runtime rt;
+	CHECK(rt.load(source));
+	CHECK(rt.function<int64_t(int64_t)>("shadowed")(3) == 3 * 101);
+	CHECK(rt.function<int64_t(int64_t)>("squares")(4) == 0 + 1 + 4 + 9);
+}
+
+int main() {
+	testExpanded();
+	testRecursion();
+	testSideEffects();
+	testLoopVariables();
+
+	if (s_failures > 0) {
+		std::cerr << s_failures << " failures" << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,97 @@
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "lexer/lexer.h"
+#include "parser/parser.h"
+#include "parser/detail/stmts.hpp"
+#include "runtime/host.h"
+#include "util/diagnostics.h"
+
+// Lazily parsed function bodies: forced once however many threads ask at
+// the same time, and still reported when a file is run without calling
+// them.
+
+static int s_failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed" << std::endl; \
+			s_failures++; \
+		} \
+	} while (0)
+
+static void testConcurrentForce() {
+	std::string source;
+	for (int i = 0; i < 64; i++) {
+		source += "func f" + std::to_string(i) + "(x) { let y = x * " + std::to_string(i) + "; if (y > 3) { return y; } return x + 1; }\n";
+	}
+	source += "func broken() { let = ; }\n";
+
+	for (int round = 0; round < 20; round++) {
+		LangLexer lex(source);
+		lex.tokenize();
+		LangParser par(lex.tokens());
+		par.parse();
+		Program* program = par.program();
+		CHECK(program->stmts.size() == 65);
+
+		// Every thread forces every body; each must see the same
+		// statements, and a broken body is counted once.
+		std::vector<std::thread> threads;
+		std::vector<std::vector<const NodeList*>> seen(8);
+		for (int t = 0; t < 8; t++) {
+			threads.emplace_back([&, t]() {
+				DiagnosticCapture capture;
+				for (auto&& stmt : program->stmts) {
+					seen[t].push_back(&static_cast<FuncDefStmt*>(stmt.get())->body());
+				}
+			});
+		}
+		for (auto&& thread : threads) thread.join();
+
+		for (int t = 1; t < 8; t++) CHECK(seen[t] == seen[0]);
+		for (size_t i = 0; i < 64; i++) {
+			FuncDefStmt* func = static_cast<FuncDefStmt*>(program->stmts[i].get());
+			CHECK(func->body().size() == 3);
+			CHECK(func->bodyErrors == 0);
+		}
+		CHECK(static_cast<FuncDefStmt*>(program->stmts[64].get())->bodyErrors == 1);
+	}
+}
+
+static void testRunReportsUnusedBodies() {
+	char pattern[] = "/tmp/lazy_test.XXXXXX";
+	int fd = mkstemp(pattern);
+	if (fd < 0) {
+		s_failures++;
+		return;
+	}
+	close(fd);
+	std::ofstream(pattern) << "func unused() { let = ; }\npub func one() { return 1; }\n";
+
+	DiagnosticCapture capture;
+	Runtime file;
+	CHECK(!file.loadFile(pattern));
+	CHECK(capture.errors() == 1);
+	CHECK(capture.text().find("ERROR(0:") != std::string::npos);
+
+	std::remove(pattern);
+}
+
+int main() {
+	testConcurrentForce();
+	testRunReportsUnusedBodies();
+
+	if (s_failures > 0) {
+		std::cerr << s_failures << " failures" << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,111 @@
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include <unistd.h>
+
+#include "runtime/host.h"
+#include "util/diagnostics.h"
+
+// Running scripts that import modules: imported functions and variables
+// bound to the exporting module's globals, module code running once in
+// dependency order, and the errors for what cannot be imported or assigned.
+
+namespace fs = std::filesystem;
+
+static int s_failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed" << std::endl; \
+			s_failures++; \
+		} \
+	} while (0)
+
+static fs::path s_dir;
+
+static std::string write(const std::string& name, const std::string& text) {
+	fs::path path = s_dir / name;
+	fs::create_directories(path.parent_path());
+	std::ofstream(path) << text;
+	return path.string();
+}
+
+static void testImport() {
+	write("a/b.rs",
+		"let count = 0;\n"
+		"pub let base = 40;\n"
+		"func bump() { count += 1; return count; }\n"
+		"pub func two() { return bump() + 1; }\n"
+		"pub func calls() { return count; }\n"
+	);
+	write("c.rs",
+		"import a.b (two);\n"
+		"pub func four() { return two() + two(); }\n"
+		"pub let seen = two();\n"
+	);
+	std::string main = write("main.rs",
+		"import a.b (base, calls);\n"
+		"import c;\n"
+		"pub func run() { return base + four(); }\n"
+		"pub func count() { return calls(); }\n"
+		"pub func first() { return seen; }\n"
+	);
+
+	Runtime rt;
+	CHECK(rt.loadFile(main));
+	CHECK(rt.function<int64_t()>("first")() == 2);
+	CHECK(rt.function<int64_t()>("run")() == 40 + 3 + 4);
+	CHECK(rt.function<int64_t()>("count")() == 3);
+
+	// Only the entry's names are the host's to call.
+	CHECK(!rt.function<int64_t()>("two"));
+	CHECK(!rt.function<int64_t()>("four"));
+
+	// Every runtime has globals of its own, modules included.
+	Runtime other;
+	CHECK(other.loadFile(main));
+	CHECK(other.function<int64_t()>("count")() == 1);
+	CHECK(rt.function<int64_t()>("count")() == 3);
+}
+
+static void testErrors() {
+	write("lib.rs", "pub let x = 1;\nlet hidden = 2;\npub func f() { return hidden; }\n");
+
+	DiagnosticCapture capture;
+	Runtime assigns;
+	CHECK(!assigns.loadFile(write("assign.rs", "import lib (x);\nx = 2;\n")));
+	CHECK(capture.errors() == 1);
+	CHECK(capture.text().find("imported") != std::string::npos);
+
+	Runtime hidden;
+	CHECK(!hidden.loadFile(write("hidden.rs", "import lib (hidden);\n")));
+	CHECK(capture.errors() == 2);
+
+	Runtime missing;
+	CHECK(!missing.loadFile(write("missing.rs", "import nowhere;\n")));
+	CHECK(capture.errors() == 3);
+
+	// A script without a file has nowhere to find modules.
+	Runtime source;
+	CHECK(!source.load("import lib (x);\n"));
+	CHECK(capture.errors() == 4);
+}
+
+int main() {
+	char pattern[] = "/tmp/module_test.XXXXXX";
+	if (mkdtemp(pattern) == nullptr) return 1;
+	s_dir = pattern;
+
+	testImport();
+	testErrors();
+
+	fs::remove_all(s_dir);
+	if (s_failures > 0) {
+		std::cerr << s_failures << " failures" << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,115 @@
+#include <iostream>
+#include <string>
+
+#include "lexer/lexer.h"
+#include "parser/dump.h"
+#include "parser/parser.h"
+#include "util/diagnostics.h"
+#include "util/threadpool.h"
+
+// Parallel parsing: whatever the number of workers, parseParallel() gives
+// the statements parse() gives, at the same positions and in the same
+// order, and reports the same diagnostics in the same order.
+
+static int s_failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed" << std::endl; \
+			s_failures++; \
+		} \
+	} while (0)
+
+// Every kind of top-level statement, including ones the pre-scan must not
+// cut: an if/else chain, nested braces and a statement left open at the
+// end. `broken` adds a syntax error every few statements.
+static std::string source(int statements, bool broken) {
+	std::string text = "import a.b (c);\n";
+	for (int i = 0; i < statements; i++) {
+		std::string n = std::to_string(i);
+		switch (i % 6) {
+			case 0: text += "pub let v" + n + " = " + n + " * 2, w" + n + " = \"s\";\n"; break;
+			case 1: text += "func f" + n + "(a, b = 1) {\n\tif (a > b) { return a; }\n\treturn b;\n}\n"; break;
+			case 2: text += "if (v0 > " + n + ") { v0 = 1; }\nelse if (v0 < 0) { v0 = 2; } else { v0++; }\n"; break;
+			case 3: text += "for i in 0.." + n + " { while (i > 3) { i--; } }\n"; break;
+			case 4: text += "parallel for i in 0..10 reduce(+: t) { t += i; }\n"; break;
+			case 5: text += "pub func g" + n + "() { let x = f1(" + n + "); yield x; }\n"; break;
+		}
+		if (broken && i % 7 == 3) text += i % 2 ? "let = ;\n" : "} func (\n";
+	}
+	return text + "let last = (1 +";
+}
+
+struct Parsed {
+	std::string json;
+	std::string diagnostics;
+	int errors;
+};
+
+static Parsed parsed(const std::string& text, ThreadPool* pool, bool lazy) {
+	LangLexer lex(text);
+	lex.tokenize();
+	Parsed result;
+	DiagnosticCapture capture;
+	LangParser par(lex.tokens());
+	par.setLazyBodies(lazy);
+	if (pool) par.parseParallel(*pool);
+	else par.parse();
+	result.diagnostics = capture.text();
+	result.errors = capture.errors();
+
+	// Node::print() leaves out function bodies; the JSON dump has them and
+	// every statement's position.
+	OutputBuffer out;
+	dumpProgram(par.program(), DumpFormat::Json, out);
+	result.json = out.data();
+	return result;
+}
+
+static void compare(const std::string& text) {
+	for (bool lazy : { false, true }) {
+		Parsed expected = parsed(text, nullptr, lazy);
+		for (int threads : { 1, 2, 3, 8 }) {
+			ThreadPool pool(threads);
+			Parsed got = parsed(text, &pool, lazy);
+			CHECK(got.json == expected.json);
+			CHECK(got.diagnostics == expected.diagnostics);
+			CHECK(got.errors == expected.errors);
+		}
+	}
+}
+
+static void testSameTree() {
+	std::string text = source(600, false);
+	Parsed expected = parsed(text, nullptr, false);
+	CHECK(expected.errors == 1);
+	CHECK(expected.json.find("\"f601\"") == std::string::npos);
+	CHECK(expected.json.find("\"g599\"") != std::string::npos);
+	compare(text);
+}
+
+static void testSameDiagnostics() {
+	std::string text = source(600, true);
+	Parsed expected = parsed(text, nullptr, false);
+	CHECK(expected.errors > 100);
+	compare(text);
+}
+
+static void testSmall() {
+	for (const char* text : { "", ";", "}", "let x = 1;", "func f() {", "if (x) { } else" }) {
+		compare(text);
+	}
+}
+
+int main() {
+	testSameTree();
+	testSameDiagnostics();
+	testSmall();
+
+	if (s_failures > 0) {
+		std::cerr << s_failures << " failures" << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,155 @@
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "runtime/pool.h"
+#include "util/diagnostics.h"
+
+// Runtime pools: jobs on several isolates at once with globals kept apart,
+// the shared Script quickened by all of them concurrently, and load()
+// leaving every isolate on the previous script when any of them fails.
+
+static int s_failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed" << std::endl; \
+			s_failures++; \
+		} \
+	} while (0)
+
+static int isolateOf(RuntimePool& pool, Runtime& rt) {
+	for (int i = 0; i < pool.size(); i++) {
+		if (&pool.isolate(i) == &rt) return i;
+	}
+	return -1;
+}
+
+static void testSeparateGlobals() {
+	RuntimePool pool(4);
+	CHECK(pool.size() == 4);
+	CHECK(pool.load(
+		"let count = 0;\n"
+		"pub func bump() { count += 1; return count; }\n"
+		"pub func get() { return count; }\n"
+	));
+
+	const int jobs = 2000;
+	std::vector<std::atomic<int>> ran(pool.size());
+	std::atomic<int> wrong(0);
+	for (int i = 0; i < jobs; i++) {
+		pool.submit([&](Runtime& rt) {
+			int index = isolateOf(pool, rt);
+			if (index < 0) {
+				wrong++;
+				return;
+			}
+			// Only this job runs in the isolate, so its count is exactly
+			// the number of jobs it ran so far.
+			int64_t count = rt.function<int64_t()>("bump")();
+			if (count != ++ran[index]) wrong++;
+		});
+	}
+	pool.wait();
+	CHECK(wrong == 0);
+
+	int total = 0;
+	for (int i = 0; i < pool.size(); i++) {
+		CHECK(pool.isolate(i).function<int64_t()>("get")() == ran[i]);
+		total += ran[i];
+	}
+	CHECK(total == jobs);
+}
+
+// Every isolate sees other operand types at the same instructions, so
+// they keep rewriting each other's quickened forms; each result must still
+// be right.
+static void testConcurrentQuickening() {
+	RuntimePool pool(4);
+	CHECK(pool.load(
+		"pub func add(a, b) { return a + b; }\n"
+		"pub func mixed(n, x) { let t = 0; for i in 0..n { t = t + x; if (t < x) { t = t - 1; } } return t; }\n"
+	));
+
+	std::atomic<int> wrong(0);
+	for (int i = 0; i < 400; i++) {
+		pool.submit([&wrong, i](Runtime& rt) {
+			auto add = rt.function<Value(Value, Value)>("add");
+			auto mixed = rt.function<Value(Value, Value)>("mixed");
+			for (int j = 0; j < 200; j++) {
+				if ((i + j) % 2 == 0) {
+					Value v = add(Value::integer(j), Value::integer(i));
+					if (v.type != ValueType::Integer || v.integerValue != i + j) wrong++;
+				} else {
+					Value v = add(Value::number(j), Value::number(0.5));
+					if (v.type != ValueType::Number || v.numberValue != j + 0.5) wrong++;
+				}
+			}
+			Value v = i % 2 == 0 ? mixed(Value::integer(50), Value::integer(3)) : mixed(Value::integer(50), Value::number(0.25));
+			if (i % 2 == 0 ? v.type != ValueType::Integer || v.integerValue != 150 : v.type != ValueType::Number || v.numberValue != 12.5) {
+				wrong++;
+			}
+		});
+	}
+	pool.wait();
+	CHECK(wrong == 0);
+}
+
+// Fails the call that makes the count reach s_failAt.
+static std::atomic<int> s_calls(0), s_failAt(0);
+
+static bool fragile(VM& vm, const void* /* data */, Value* /* args */, int /* argc */, Value& result) {
+	if (++s_calls == s_failAt) return vm.fail("fragile() failed.");
+	result = Value::integer(s_calls);
+	return true;
+}
+
+static void testLoadIsAtomic() {
+	RuntimePool pool(4, [](Runtime& rt) { rt.define("fragile", &fragile, 0); });
+	CHECK(pool.load("let v = 1;\npub func version() { return v; }\npub func set(x) { v = x; }\n"));
+	const Script* first = pool.script();
+	for (int i = 0; i < pool.size(); i++) pool.isolate(i).function<void(int64_t)>("set")(10 + i);
+
+	// The third isolate to run the new top-level statements fails.
+	DiagnosticCapture capture;
+	s_calls = 0;
+	s_failAt = 3;
+	CHECK(!pool.load("let v = fragile();\npub func version() { return 2; }\n"));
+	CHECK(capture.errors() == 1);
+	CHECK(pool.script() == first);
+	for (int i = 0; i < pool.size(); i++) {
+		CHECK(pool.isolate(i).function<int64_t()>("version")() == 10 + i);
+	}
+
+	// So does one that does not compile.
+	CHECK(!pool.load("pub func version( {"));
+	CHECK(pool.script() == first);
+	CHECK(pool.isolate(0).function<int64_t()>("version")() == 10);
+
+	// Jobs still run on the old script, and then on the new one.
+	std::atomic<int> sum(0);
+	for (int i = 0; i < 8; i++) {
+		pool.submit([&sum](Runtime& rt) { sum += rt.function<int64_t()>("version")(); });
+	}
+	s_failAt = 0;
+	CHECK(pool.load("let v = fragile();\npub func version() { return 2; }\n"));
+	CHECK(sum >= 8 * 10);
+	CHECK(pool.script() != first);
+	for (int i = 0; i < pool.size(); i++) {
+		CHECK(pool.isolate(i).function<int64_t()>("version")() == 2);
+	}
+}
+
+int main() {
+	testSeparateGlobals();
+	testConcurrentQuickening();
+	testLoadIsAtomic();
+
+	if (s_failures > 0) {
+		std::cerr << s_failures << " failures" << std::endl;
+		return 1;
+	}
+	return 0;
+}
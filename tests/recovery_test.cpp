@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "lexer/lexer.h"
+#include "parser/parser.h"
+#include "util/diagnostics.h"
+
+// Panic-mode recovery: every bad statement is reported once, at its own
+// line, the good statements around it still parse, stray '}' and input
+// ending anywhere are single errors, and garbage costs the same per token
+// at any size.
+
+static int s_failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed" << std::endl; \
+			s_failures++; \
+		} \
+	} while (0)
+
+struct Parsed {
+	int statements;
+	int errors;
+	std::vector<int> lines;  // of each error
+	std::string text;
+};
+
+static Parsed parsed(const std::string& source) {
+	LangLexer lex(source);
+	lex.tokenize();
+	DiagnosticCapture capture;
+	LangParser par(lex.tokens());
+	par.setLazyBodies(false);
+	par.parse();
+
+	Parsed result;
+	result.statements = par.program()->stmts.size();
+	result.errors = capture.errors();
+	result.text = capture.text();
+	for (size_t at = result.text.find("ERROR("); at != std::string::npos; at = result.text.find("ERROR(", at + 1)) {
+		result.lines.push_back(std::stoi(result.text.substr(at + 6)));
+	}
+	return result;
+}
+
+static void testOnePerStatement() {
+	const char* bad[] = {
+		"let = ;",
+		"let x = 1 +;",
+		"x = = 2;",
+		"if (x { y = 1; }",
+		"func (a) { }",
+		"for in 0..3 { }",
+		"while x > 1) { x--; }",
+		"return 1 2;",
+		"f(1, , 2);",
+		"import ;",
+		"let y = (1 + (2 * 3);",
+		"if (x) { } else else { }",
+	};
+	const int count = sizeof(bad) / sizeof(bad[0]);
+
+	// Each bad statement between two good ones, one per line.
+	std::string source;
+	std::vector<int> lines;
+	for (int i = 0; i < count; i++) {
+		source += "let a" + std::to_string(i) + " = 1;\n";
+		lines.push_back(2 * i + 1);
+		source += std::string(bad[i]) + "\n";
+	}
+	source += "let last = 2;\n";
+
+	Parsed result = parsed(source);
+	CHECK(result.errors == count);
+	CHECK(result.lines == lines);
+	CHECK(result.statements >= count + 1);
+
+	// Inside a body, recovery stops at the body's statements too.
+	Parsed body = parsed("func f(x) {\n\tlet = ;\n\tx = 1;\n\treturn x +;\n\tx++;\n}\nlet after = 1;\n");
+	CHECK(body.errors == 2);
+	CHECK(body.lines == std::vector<int>({ 1, 3 }));
+	CHECK(body.statements == 2);
+}
+
+static void testNoSpin() {
+	// Every stray '}' is an error of its own and is stepped over.
+	Parsed braces = parsed("}}}}}let x = 1;}");
+	CHECK(braces.errors == 6);
+	CHECK(braces.statements == 1);
+
+	// Input ending anywhere in a statement is one error, at the end.
+	for (const char* text : { "func f() {", "func f(", "let x = (", "if (", "if (x) { } else", "for i in", "x[", "while (x) { if (y) {", "func f() { for i in x { g(", "let x = 1 ? 2" }) {
+		Parsed result = parsed(text);
+		CHECK(result.errors == 1);
+		CHECK(result.text.find("Unexpected end of input") != std::string::npos);
+	}
+}
+
+static double seconds(const std::string& source) {
+	double best = 1e9;
+	for (int i = 0; i < 3; i++) {
+		auto start = std::chrono::steady_clock::now();
+		parsed(source);
+		best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	}
+	return best;
+}
+
+static void testLinear() {
+	// Tokens chosen to open and abandon as much as possible.
+	const char* garbage[] = { "(", "[", "else", ")", "= =", "if (", "}", "{", "?", "func", "..", "let", "-", "," };
+	std::string small, large;
+	for (int i = 0; i < 20000; i++) small += std::string(garbage[i * 7 % 14]) + " ";
+	for (int i = 0; i < 8; i++) large += small;
+
+	Parsed result = parsed(large);
+	CHECK(result.errors > 0);
+	CHECK(result.errors <= 8 * 20000);
+
+	// Eight times the tokens, not sixty-four times the time.
+	double a = seconds(small), b = seconds(large);
+	CHECK(b < 24 * a + 0.05);
+}
+
+int main() {
+	testOnePerStatement();
+	testNoSpin();
+	testLinear();
+
+	if (s_failures > 0) {
+		std::cerr << s_failures << " failures" << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,284 @@
+#include <cmath>
+#include <cstdint>
+#include <initializer_list>
+#include <iostream>
+#include <limits>
+#include <string>
+
+#include "runtime/host.h"
+#include "util/diagnostics.h"
+
+// The runtime through the embedding API: binding C++ both ways, Integer
+// overflow, generators, parallel reductions, and quickened instructions
+// going back to their generic form when the operand types change.
+
+static int s_failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed" << std::endl; \
+			s_failures++; \
+		} \
+	} while (0)
+
+static double area(double w, double h) { return w * h; }
+
+// The example at the top of host.h, and the other binding forms.
+static void testBinder() {
+	Runtime rt;
+	rt.define<&area>("area");
+	CHECK(rt.load("pub func half(w, h) { return area(w, h) / 2; }"));
+	auto half = rt.function<double(double, double)>("half");
+	CHECK(half);
+	CHECK(half(3, 4) == 6);
+	CHECK(half.ok());
+
+	Runtime strings;
+	std::string seen;
+	strings.define("greet", [&seen](std::string name) {
+		seen = name;
+		return "hello " + name;
+	});
+	CHECK(strings.load("pub func run(who) { return greet(who); }"));
+	auto run = strings.function<std::string(std::string)>("run");
+	CHECK(run("lang") == "hello lang");
+	CHECK(seen == "lang");
+
+	// A result of the wrong type fails the call instead of converting.
+	auto wrong = strings.function<int64_t(std::string)>("run");
+	DiagnosticCapture capture;
+	wrong("x");
+	CHECK(!wrong.ok());
+	CHECK(capture.errors() == 1);
+
+	CHECK(!strings.function<void()>("missing"));
+}
+
+static void testOverflow() {
+	Runtime rt;
+	CHECK(rt.load(
+		"pub func add(a, b) { return a + b; }\n"
+		"pub func mul(a, b) { return a * b; }\n"
+		"pub func neg(a) { return -a; }\n"
+		"pub func count(n) { let x = 9223372036854775800; for i in 0..n { x += 1; } return x; }\n"
+	));
+	auto add = rt.function<Value(int64_t, int64_t)>("add");
+	auto mul = rt.function<Value(int64_t, int64_t)>("mul");
+	auto neg = rt.function<Value(int64_t)>("neg");
+	auto count = rt.function<Value(int64_t)>("count");
+	const int64_t max = std::numeric_limits<int64_t>::max(), min = std::numeric_limits<int64_t>::min();
+
+	Value v = add(max - 1, 1);
+	CHECK(v.type == ValueType::Integer && v.integerValue == max);
+	v = add(max, 1);
+	CHECK(v.type == ValueType::Number && v.numberValue == double(max) + 1);
+	v = mul(3037000500, 3037000500);
+	CHECK(v.type == ValueType::Number && v.numberValue == 3037000500.0 * 3037000500.0);
+	v = mul(-3, 7);
+	CHECK(v.type == ValueType::Integer && v.integerValue == -21);
+	v = neg(min);
+	CHECK(v.type == ValueType::Number && v.numberValue == -double(min));
+	v = count(7);
+	CHECK(v.type == ValueType::Integer && v.integerValue == max);
+	v = count(8);
+	CHECK(v.type == ValueType::Number);
+}
+
+static void testGenerators() {
+	Runtime rt;
+	CHECK(rt.load(
+		"func upto(n) { for i in 0..n { yield i; } }\n"
+		"func evens(n) { for i in upto(n) { if (i % 2 == 0) { yield i; } } }\n"
+		"pub func sum(n) { let s = 0; for i in upto(n) { s += i; } return s; }\n"
+		"pub func sumEvens(n) { let s = 0; for i in evens(n) { s += i; } return s; }\n"
+		"pub func firstOver(n, limit) { for i in upto(n) { if (i > limit) { return i; } } return -1; }\n"
+		"pub func gen(n) { return upto(n); }\n"
+	));
+	CHECK(rt.function<int64_t(int64_t)>("sum")(1000) == 499500);
+	CHECK(rt.function<int64_t(int64_t)>("sum")(0) == 0);
+	CHECK(rt.function<int64_t(int64_t)>("sumEvens")(10) == 20);
+	CHECK(rt.function<int64_t(int64_t, int64_t)>("firstOver")(100, 41) == 42);
+	CHECK(rt.function<int64_t(int64_t, int64_t)>("firstOver")(10, 41) == -1);
+	CHECK(rt.function<Value(int64_t)>("gen")(3).type == ValueType::Generator);
+}
+
+static void testParallel() {
+	const char* source =
+		"pub func sum(n) { let t = 0; parallel for i in 0..n reduce(+: t) { t += i; } return t; }\n"
+		"pub func both(n) { let s = 0; let p = 1.0; parallel for i in 0..n reduce(+: s, *: p) { s += i % 7; p *= 1.0001; } return s + p; }\n"
+		"pub func empty() { let t = 5; parallel for i in 0..0 reduce(+: t) { t += 1; } return t; }\n";
+
+	for (int threads : { 1, 4 }) {
+		Runtime rt;
+		rt.vm().setParallelism(threads);
+		CHECK(rt.load(source));
+		CHECK(rt.function<int64_t(int64_t)>("sum")(1000000) == int64_t(499999500000));
+		CHECK(rt.function<int64_t()>("empty")() == 5);
+
+		int64_t s = 0;
+		double p = 1;
+		for (int i = 0; i < 10000; i++) {
+			s += i % 7;
+			p *= 1.0001;
+		}
+		double both = rt.function<double(int64_t)>("both")(10000);
+		CHECK(std::abs(both - (s + p)) < 1e-6 * (s + p));
+	}
+}
+
+// The first instruction of `name` that is one of `ops`, or Op::Count.
+static Op find(const Script* script, const std::string& name, std::initializer_list<Op> ops) {
+	for (auto&& function : script->functions) {
+		if (function->name != name) continue;
+		for (auto&& ins : function->code) {
+			for (Op op : ops) {
+				if (loadOp(ins) == op) return op;
+			}
+		}
+	}
+	return Op::Count;
+}
+
+static void testQuickening() {
+	Runtime rt;
+	CHECK(rt.load("pub func add(a, b) { return a + b; }\n"));
+	auto add = rt.function<Value(Value, Value)>("add");
+	const std::initializer_list<Op> forms = { Op::Add, Op::AddInt, Op::AddNumber };
+
+	CHECK(find(rt.script(), "add", forms) == Op::Add);
+	CHECK(add(Value::integer(1), Value::integer(2)).integerValue == 3);
+	CHECK(find(rt.script(), "add", forms) == Op::AddInt);
+
+	// An Integer overflow sends the Integer form back to the generic op,
+	// which promotes the result.
+	const int64_t max = std::numeric_limits<int64_t>::max();
+	Value v = add(Value::integer(max), Value::integer(1));
+	CHECK(v.type == ValueType::Number && v.numberValue == double(max) + 1);
+	CHECK(find(rt.script(), "add", forms) == Op::Add);
+	CHECK(add(Value::integer(1), Value::integer(2)).integerValue == 3);
+	CHECK(find(rt.script(), "add", forms) == Op::AddInt);
+
+	// So does a Number; the generic op quickens to the Number form the
+	// next time.
+	v = add(Value::number(1.5), Value::integer(2));
+	CHECK(v.type == ValueType::Number && v.numberValue == 3.5);
+	CHECK(find(rt.script(), "add", forms) == Op::Add);
+	v = add(Value::number(1.5), Value::number(2));
+	CHECK(v.type == ValueType::Number && v.numberValue == 3.5);
+	CHECK(find(rt.script(), "add", forms) == Op::AddNumber);
+
+	// Operands that keep changing type leave the site generic for good,
+	// with every result still right.
+	for (int i = 0; i < 8; i++) {
+		v = add(Value::integer(i), Value::integer(1));
+		CHECK(v.type == ValueType::Integer && v.integerValue == i + 1);
+		v = add(Value::number(i), Value::number(0.5));
+		CHECK(v.type == ValueType::Number && v.numberValue == i + 0.5);
+	}
+	CHECK(find(rt.script(), "add", forms) == Op::Add);
+
+	Value s = add(rt.vm().string("a"), rt.vm().string("b"));
+	CHECK(s.type == ValueType::String);
+}
+
+// Every other operator with a quickened form: the results match the
+// generic op before and after quickening, and the site quickens.
+static void testOperatorForms() {
+	Runtime rt;
+	rt.setSuperinstructions(false);
+	CHECK(rt.load(
+		"pub func mod(a, b) { return a % b; }\n"
+		"pub func and(a, b) { return a & b; }\n"
+		"pub func or(a, b) { return a | b; }\n"
+		"pub func xor(a, b) { return a ^ b; }\n"
+		"pub func shl(a, b) { return a << b; }\n"
+		"pub func shr(a, b) { return a >> b; }\n"
+		"pub func pow(a, b) { return a ** b; }\n"
+		"pub func not(a) { return ~a; }\n"
+	));
+	struct Case {
+		const char* name;
+		Op generic, quick;
+		int64_t a, b, expected;
+	};
+	const Case cases[] = {
+		{ "mod", Op::Mod, Op::ModInt, -7, 3, -1 },
+		{ "mod", Op::Mod, Op::ModInt, std::numeric_limits<int64_t>::min(), -1, 0 },
+		{ "and", Op::BitAnd, Op::BitAndInt, 12, 10, 8 },
+		{ "or", Op::BitOr, Op::BitOrInt, 12, 10, 14 },
+		{ "xor", Op::BitXor, Op::BitXorInt, 12, 10, 6 },
+		{ "shl", Op::Shl, Op::ShlInt, 3, 65, 6 },
+		{ "shr", Op::Shr, Op::ShrInt, -16, 2, -4 },
+	};
+	for (const Case& c : cases) {
+		auto f = rt.function<Value(int64_t, int64_t)>(c.name);
+		for (int run = 0; run < 2; run++) {
+			Value v = f(c.a, c.b);
+			CHECK(v.type == ValueType::Integer && v.integerValue == c.expected);
+			CHECK(find(rt.script(), c.name, { c.generic, c.quick }) == c.quick);
+		}
+	}
+
+	auto notf = rt.function<Value(Value)>("not");
+	CHECK(notf(Value::integer(5)).integerValue == -6);
+	CHECK(find(rt.script(), "not", { Op::BitNot, Op::BitNotInt }) == Op::BitNotInt);
+	CHECK(notf(Value::integer(0)).integerValue == -1);
+	Value v = notf(Value::number(5));
+	CHECK(v.type == ValueType::Integer && v.integerValue == -6);
+	CHECK(find(rt.script(), "not", { Op::BitNot, Op::BitNotInt }) == Op::BitNot);
+
+	auto pow = rt.function<Value(Value, Value)>("pow");
+	v = pow(Value::integer(2), Value::integer(10));
+	CHECK(v.type == ValueType::Number && v.numberValue == 1024);
+	CHECK(find(rt.script(), "pow", { Op::Pow, Op::PowNumber }) == Op::PowNumber);
+	v = pow(Value::number(4), Value::number(0.5));
+	CHECK(v.type == ValueType::Number && v.numberValue == 2);
+
+	auto mod = rt.function<Value(Value, Value)>("mod");
+	v = mod(Value::number(7.5), Value::integer(2));
+	CHECK(v.type == ValueType::Number && v.numberValue == 1.5);
+	CHECK(find(rt.script(), "mod", { Op::Mod, Op::ModInt, Op::ModNumber }) == Op::Mod);
+	v = mod(Value::number(7.5), Value::integer(2));
+	CHECK(find(rt.script(), "mod", { Op::Mod, Op::ModInt, Op::ModNumber }) == Op::ModNumber);
+}
+
+// An Integer `%` by zero is reported as such, generic or quickened.
+static void testDivisionByZero() {
+	Runtime rt;
+	CHECK(rt.load("pub func mod(a, b) { return a % b; }\npub func div(a, b) { return a / b; }\n"));
+	auto mod = rt.function<int64_t(int64_t, int64_t)>("mod");
+
+	DiagnosticCapture capture;
+	mod(1, 0);
+	CHECK(!mod.ok());
+	CHECK(capture.errors() == 1);
+	CHECK(capture.text().find("Division by zero") != std::string::npos);
+
+	CHECK(mod(7, 4) == 3);
+	CHECK(mod.ok());
+	CHECK(find(rt.script(), "mod", { Op::Mod, Op::ModInt }) == Op::ModInt);
+	mod(7, 0);
+	CHECK(!mod.ok());
+	CHECK(capture.errors() == 2);
+	CHECK(capture.text().find("Invalid operands") == std::string::npos);
+
+	// Integers are divided as numbers.
+	CHECK(std::isinf(rt.function<double(int64_t, int64_t)>("div")(1, 0)));
+}
+
+int main() {
+	testBinder();
+	testOverflow();
+	testGenerators();
+	testParallel();
+	testQuickening();
+	testOperatorForms();
+	testDivisionByZero();
+
+	if (s_failures > 0) {
+		std::cerr << s_failures << " failures" << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,138 @@
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include <unistd.h>
+
+#include "lexer/lexer.h"
+#include "parser/modulecache.h"
+#include "parser/parser.h"
+#include "parser/serialize.h"
+#include "parser/detail/atom.hpp"
+#include "parser/detail/ops.hpp"
+
+// Reading cached ASTs: a round trip gives the same tree, and truncated
+// data, damaged cache entries and trees nested deeper than the parser
+// allows are rejected instead of crashing.
+
+namespace fs = std::filesystem;
+
+static int s_failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed" << std::endl; \
+			s_failures++; \
+		} \
+	} while (0)
+
+static const char* s_source =
+	"import a.b (c);\n"
+	"pub let x: int = 1, y = \"two\";\n"
+	"func f(a, b = 2) { if (a > b) { return a % b; } else if (a < 0) { return -a; } else { return 'c'; } }\n"
+	"func g(n) { for i in 0..n { yield i * 1.5; } }\n"
+	"pub func h(v) { let t = 0; parallel for i in 0..len(v) reduce(+: t) { t += v[i]; } while (t > 10) { t--; } return t ? t : nil; }\n";
+
+static std::string serialized() {
+	LangLexer lex(s_source);
+	lex.tokenize();
+	LangParser par(lex.tokens());
+	par.setLazyBodies(false);
+	par.parse();
+	std::string out;
+	writeProgram(par.program(), out);
+	return out;
+}
+
+static void testRoundTrip() {
+	std::string data = serialized();
+	std::unique_ptr<Program> program = readProgram(data.data(), data.size());
+	CHECK(program != nullptr);
+	if (!program) return;
+	CHECK(program->stmts.size() == 5);
+
+	std::string again;
+	writeProgram(program.get(), again);
+	CHECK(again == data);
+}
+
+static void testTruncated() {
+	std::string data = serialized();
+	int accepted = 0;
+	for (size_t size = 0; size < data.size(); size++) {
+		if (readProgram(data.data(), size) != nullptr) accepted++;
+	}
+	CHECK(accepted == 0);
+
+	// Trailing bytes are as wrong as missing ones.
+	std::string longer = data + '\0';
+	CHECK(readProgram(longer.data(), longer.size()) == nullptr);
+}
+
+// A Program holding `depth` nested negations of 1.
+static std::string nested(int depth) {
+	Node* node = new IntegerAtom(1);
+	for (int i = 0; i < depth; i++) node = new UnOp(node, "-");
+	Program program;
+	program.stmts.emplace_back(node);
+	std::string out;
+	writeProgram(&program, out);
+	return out;
+}
+
+static void testDeep() {
+	// The Program and the atom take two levels.
+	std::string deepest = nested(LangParser::MaxNesting - 2);
+	CHECK(readProgram(deepest.data(), deepest.size()) != nullptr);
+
+	std::string tooDeep = nested(LangParser::MaxNesting - 1);
+	CHECK(readProgram(tooDeep.data(), tooDeep.size()) == nullptr);
+
+	// Far past the limit, where reading recursively would overflow the
+	// stack.
+	std::string huge = nested(10000);
+	CHECK(readProgram(huge.data(), huge.size()) == nullptr);
+}
+
+static void testCacheEntry() {
+	char pattern[] = "/tmp/serialize_test.XXXXXX";
+	if (mkdtemp(pattern) == nullptr) {
+		s_failures++;
+		return;
+	}
+	ModuleCache cache(pattern);
+
+	bool hit = true;
+	CHECK(cache.load(s_source, &hit) != nullptr);
+	CHECK(!hit);
+	CHECK(cache.load(s_source, &hit) != nullptr);
+	CHECK(hit);
+
+	// A truncated entry is a miss, and is written again.
+	fs::path entry;
+	for (auto&& file : fs::directory_iterator(pattern)) entry = file.path();
+	CHECK(entry.extension() == ".ast");
+	fs::resize_file(entry, fs::file_size(entry) / 2);
+	std::unique_ptr<Program> program = cache.load(s_source, &hit);
+	CHECK(program != nullptr && program->stmts.size() == 5);
+	CHECK(!hit);
+	CHECK(cache.load(s_source, &hit) != nullptr);
+	CHECK(hit);
+
+	fs::remove_all(pattern);
+}
+
+int main() {
+	testRoundTrip();
+	testTruncated();
+	testDeep();
+	testCacheEntry();
+
+	if (s_failures > 0) {
+		std::cerr << s_failures << " failures" << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,257 @@
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "server.h"
+#include "parser/serialize.h"
+
+// The compile server's protocol: replies carry one file per requested
+// path with its errors, diagnostics and payload, unchanged files are
+// answered from memory, malformed requests are refused, and a client on
+// the socket gets the same answers until it asks the server to stop.
+
+namespace fs = std::filesystem;
+
+static int s_failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed" << std::endl; \
+			s_failures++; \
+		} \
+	} while (0)
+
+static std::string s_dir;
+
+static std::string write(const std::string& name, const std::string& text) {
+	std::string path = s_dir + "/" + name;
+	std::ofstream(path, std::ios::trunc) << text;
+	return path;
+}
+
+static void putU32(std::string& out, uint32_t value) {
+	out.append((const char*) &value, 4);
+}
+
+static std::string request(ServerOp op, const std::vector<std::string>& paths) {
+	std::string out(1, char(op));
+	putU32(out, paths.size());
+	for (auto&& path : paths) {
+		putU32(out, path.size());
+		out += path;
+	}
+	return out;
+}
+
+struct File {
+	bool warm;
+	uint32_t errors;
+	std::string diagnostics;
+	std::string payload;
+};
+
+// Decodes a reply; false if it is not exactly `count` files.
+static bool decode(const std::string& reply, size_t count, std::vector<File>& files) {
+	size_t pos = 0;
+	auto u32 = [&](uint32_t& value) {
+		if (reply.size() - pos < 4) return false;
+		std::memcpy(&value, reply.data() + pos, 4);
+		pos += 4;
+		return true;
+	};
+	auto string = [&](std::string& value) {
+		uint32_t size;
+		if (!u32(size) || reply.size() - pos < size) return false;
+		value = reply.substr(pos, size);
+		pos += size;
+		return true;
+	};
+
+	uint32_t n;
+	if (!u32(n) || n != count) return false;
+	files.clear();
+	for (uint32_t i = 0; i < n; i++) {
+		File file;
+		if (pos >= reply.size()) return false;
+		file.warm = reply[pos++] & 1;
+		if (!u32(file.errors) || !string(file.diagnostics) || !string(file.payload)) return false;
+		files.push_back(file);
+	}
+	return pos == reply.size();
+}
+
+static std::vector<File> ask(CompileServer& server, ServerOp op, const std::vector<std::string>& paths) {
+	std::string reply;
+	std::vector<File> files;
+	CHECK(server.handle(request(op, paths), reply));
+	CHECK(decode(reply, paths.size(), files));
+	files.resize(paths.size(), File { false, 0, "", "" });
+	return files;
+}
+
+static void testRequests() {
+	std::string good = write("good.rs", "pub func add(a, b) { return a + b; }\nlet x = add(1, 2);\n");
+	std::string bad = write("bad.rs", "func f() { let = ; }\nlet y = 1;\n");
+	std::string missing = s_dir + "/missing.rs";
+
+	CompileServer server(ServerOptions { 2 });
+	std::vector<File> files = ask(server, ServerOp::Parse, { good, bad, missing, good });
+	CHECK(!files[0].warm && files[0].errors == 0 && files[0].diagnostics.empty());
+
+	// The payload is the versioned binary AST.
+	uint32_t version = 0;
+	if (files[0].payload.size() >= 4) std::memcpy(&version, files[0].payload.data(), 4);
+	CHECK(version == AstFormatVersion);
+	std::unique_ptr<Program> program = readProgram(files[0].payload.data() + 4, files[0].payload.size() - 4);
+	CHECK(program != nullptr && program->stmts.size() == 2);
+
+	// Bodies are parsed eagerly, so the error inside f() counts.
+	CHECK(files[1].errors == 1 && files[1].diagnostics.find("ERROR(0:") != std::string::npos);
+	CHECK(files[2].errors == 1 && files[2].diagnostics.find("Cannot read file.") != std::string::npos);
+	CHECK(files[3].payload == files[0].payload);
+
+	// Asked again, everything is answered from memory.
+	files = ask(server, ServerOp::Parse, { good, bad });
+	CHECK(files[0].warm && files[1].warm);
+	CHECK(files[1].errors == 1);
+
+	// Each operation has its own payload; nothing compiles after a syntax
+	// error.
+	files = ask(server, ServerOp::Tokens, { good });
+	CHECK(!files[0].warm && !files[0].payload.empty());
+	files = ask(server, ServerOp::Check, { good });
+	CHECK(files[0].errors == 0 && files[0].payload.find("add") != std::string::npos);
+	files = ask(server, ServerOp::Compile, { good, bad });
+	CHECK(files[0].errors == 0 && files[0].payload.find("add") != std::string::npos);
+	CHECK(files[1].errors == 1 && files[1].payload.empty());
+
+	// Rewritten with the same text, a file keeps its answers; with another
+	// text it is parsed again.
+	write("good.rs", "pub func add(a, b) { return a + b; }\nlet x = add(1, 2);\n");
+	files = ask(server, ServerOp::Parse, { good });
+	CHECK(files[0].warm);
+	write("bad.rs", "func f() { let y = ; }\nlet y = 1;\n");
+	files = ask(server, ServerOp::Parse, { bad });
+	CHECK(!files[0].warm && files[0].errors == 1);
+	write("bad.rs", "func f() { let y = 2; }\n");
+	files = ask(server, ServerOp::Parse, { bad });
+	CHECK(!files[0].warm && files[0].errors == 0);
+
+	// A file that disappears is an error again.
+	fs::remove(bad);
+	files = ask(server, ServerOp::Parse, { bad });
+	CHECK(files[0].errors == 1 && files[0].diagnostics.find("Cannot read file.") != std::string::npos);
+}
+
+static void testMalformed() {
+	CompileServer server(ServerOptions { 1 });
+	std::string reply;
+	std::string valid = request(ServerOp::Parse, { "a.rs" });
+
+	CHECK(!server.handle("", reply));
+	CHECK(!server.handle(valid + '\0', reply));
+	for (size_t size = 0; size < valid.size(); size++) {
+		CHECK(!server.handle(valid.substr(0, size), reply));
+	}
+	std::string op = valid;
+	op[0] = 0;
+	CHECK(!server.handle(op, reply));
+	op[0] = 6;
+	CHECK(!server.handle(op, reply));
+
+	std::string count = request(ServerOp::Parse, {});
+	count[1] = 3;
+	CHECK(!server.handle(count, reply));
+	CHECK(!server.stopped());
+
+	reply.clear();
+	CHECK(server.handle(request(ServerOp::Shutdown, {}), reply));
+	CHECK(reply == std::string(4, '\0'));
+	CHECK(server.stopped());
+}
+
+static int connectTo(const std::string& path) {
+	sockaddr_un addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	std::memcpy(addr.sun_path, path.data(), path.size());
+
+	// The server may not be listening yet.
+	for (int attempt = 0; attempt < 500; attempt++) {
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (connect(fd, (const sockaddr*) &addr, sizeof(addr)) == 0) return fd;
+		close(fd);
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	return -1;
+}
+
+static bool exchange(int fd, const std::string& body, std::string& reply) {
+	std::string message;
+	putU32(message, body.size());
+	message += body;
+	if (send(fd, message.data(), message.size(), 0) != ssize_t(message.size())) return false;
+
+	uint32_t size = 0;
+	if (recv(fd, &size, 4, MSG_WAITALL) != 4) return false;
+	reply.resize(size);
+	return size == 0 || recv(fd, &reply[0], size, MSG_WAITALL) == ssize_t(size);
+}
+
+static void testSocket() {
+	std::string good = write("socket.rs", "pub func one() { return 1; }\n");
+	std::string path = s_dir + "/server.sock";
+
+	CompileServer server(ServerOptions { 2 });
+	bool served = false;
+	std::thread thread([&] { served = server.serve(path); });
+
+	int fd = connectTo(path);
+	CHECK(fd >= 0);
+	if (fd >= 0) {
+		// Several requests on one connection.
+		std::string reply;
+		std::vector<File> files;
+		CHECK(exchange(fd, request(ServerOp::Parse, { good }), reply));
+		CHECK(decode(reply, 1, files) && !files[0].warm && files[0].errors == 0);
+		CHECK(exchange(fd, request(ServerOp::Parse, { good }), reply));
+		CHECK(decode(reply, 1, files) && files[0].warm);
+		close(fd);
+	}
+
+	std::ostringstream out;
+	CHECK(queryServer(path, ServerOp::Shutdown, {}, out) == 0);
+	thread.join();
+	CHECK(served);
+	CHECK(!fs::exists(path));
+	CHECK(queryServer(path, ServerOp::Parse, { good }, out) == -1);
+}
+
+int main() {
+	char pattern[] = "/tmp/server_test.XXXXXX";
+	if (mkdtemp(pattern) == nullptr) return 1;
+	s_dir = pattern;
+
+	testRequests();
+	testMalformed();
+	testSocket();
+
+	fs::remove_all(s_dir);
+	if (s_failures > 0) {
+		std::cerr << s_failures << " failures" << std::endl;
+		return 1;
+	}
+	return 0;
+}
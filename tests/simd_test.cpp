@@ -0,0 +1,221 @@
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "runtime/host.h"
+#include "runtime/simd.h"
+
+// The typed-array kernels: every instruction set this machine supports
+// gives what the scalar kernels give, at every length around the lane
+// widths, and integer elements wrap on overflow instead of promoting.
+
+static int s_failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed" << std::endl; \
+			s_failures++; \
+		} \
+	} while (0)
+
+static uint64_t s_seed = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t random64() {
+	s_seed = s_seed * 6364136223846793005ULL + 1442695040888963407ULL;
+	return s_seed >> 11 ^ s_seed << 29;
+}
+
+// `n` elements of `type`. Integers use their whole range, so sums and
+// products overflow; divisors are kept away from 0 and -1, which the
+// callers of the kernels rule out.
+static std::vector<char> fill(ElementType type, size_t n, bool divisor) {
+	std::vector<char> data(n * elementSize(type) + 1);
+	for (size_t i = 0; i < n; i++) {
+		uint64_t r = random64();
+		char* at = data.data() + i * elementSize(type);
+		switch (type) {
+			case ElementType::F64: {
+				double v = double(int64_t(r % 2000001) - 1000000) / 64;
+				if (divisor && v == 0) v = 0.5;
+				std::memcpy(at, &v, 8);
+				break;
+			}
+			case ElementType::F32: {
+				float v = float(int64_t(r % 20001) - 10000) / 16;
+				if (divisor && v == 0) v = 0.5f;
+				std::memcpy(at, &v, 4);
+				break;
+			}
+			case ElementType::I64: {
+				int64_t v = divisor ? int64_t(r % 1000) + 1 : int64_t(r);
+				std::memcpy(at, &v, 8);
+				break;
+			}
+			case ElementType::I32: {
+				int32_t v = divisor ? int32_t(r % 1000) + 1 : int32_t(uint32_t(r));
+				std::memcpy(at, &v, 4);
+				break;
+			}
+		}
+	}
+	return data;
+}
+
+// Reductions of floats may add in another order, f32 ones in f32 lanes;
+// everything else is exact.
+static bool sameReduction(ElementType type, const char* a, const char* b, double scale) {
+	if (!isFloatElement(type)) return std::memcmp(a, b, 8) == 0;
+	double x, y;
+	std::memcpy(&x, a, 8);
+	std::memcpy(&y, b, 8);
+	return std::abs(x - y) <= (type == ElementType::F32 ? 1e-5 : 1e-12) * scale;
+}
+
+static double magnitude(ElementType type, const std::vector<char>& a, const std::vector<char>& b, size_t n) {
+	double total = 1;
+	for (size_t i = 0; i < n; i++) {
+		double x = type == ElementType::F64 ? reinterpret_cast<const double*>(a.data())[i] : reinterpret_cast<const float*>(a.data())[i];
+		double y = type == ElementType::F64 ? reinterpret_cast<const double*>(b.data())[i] : reinterpret_cast<const float*>(b.data())[i];
+		total += std::abs(x) * (1 + std::abs(y));
+	}
+	return total;
+}
+
+static void compareLevel(SimdLevel level, const SimdKernels& scalar) {
+	CHECK(setSimdLevel(level));
+	const SimdKernels& kernels = simdKernels();
+	CHECK(simdLevel() == level);
+
+	std::vector<size_t> lengths;
+	for (size_t n = 0; n <= 40; n++) lengths.push_back(n);
+	lengths.push_back(1023);
+	lengths.push_back(4099);
+
+	for (int t = 0; t < ElementTypes; t++) {
+		ElementType type = ElementType(t);
+		size_t size = elementSize(type);
+		for (size_t n : lengths) {
+			std::vector<char> a = fill(type, n, false);
+			std::vector<char> b = fill(type, n, false);
+			std::vector<char> d = fill(type, n, true);
+			std::vector<char> expected(n * size + 1), got(n * size + 1);
+
+			for (int op = 0; op < int(KernelOp::Count); op++) {
+				// Integer division only ever sees divisors the caller
+				// checked, and only on the right.
+				bool division = op == int(KernelOp::Div);
+				const std::vector<char>& right = division ? d : b;
+
+				scalar.binary[t][op](a.data(), right.data(), expected.data(), n);
+				kernels.binary[t][op](a.data(), right.data(), got.data(), n);
+				CHECK(std::memcmp(expected.data(), got.data(), n * size) == 0);
+
+				scalar.broadcast[t][op](a.data(), right.data(), expected.data(), n);
+				kernels.broadcast[t][op](a.data(), right.data(), got.data(), n);
+				CHECK(std::memcmp(expected.data(), got.data(), n * size) == 0);
+
+				if (division && !isFloatElement(type)) continue;
+				scalar.broadcastLeft[t][op](a.data(), right.data(), expected.data(), n);
+				kernels.broadcastLeft[t][op](a.data(), right.data(), got.data(), n);
+				CHECK(std::memcmp(expected.data(), got.data(), n * size) == 0);
+			}
+
+			// In place, as `out` may be an input.
+			std::vector<char> inPlace = a;
+			scalar.binary[t][int(KernelOp::Add)](a.data(), b.data(), expected.data(), n);
+			kernels.binary[t][int(KernelOp::Add)](inPlace.data(), b.data(), inPlace.data(), n);
+			CHECK(std::memcmp(expected.data(), inPlace.data(), n * size) == 0);
+
+			// Some equal elements, so == and <= see ties.
+			std::vector<char> c = b;
+			for (size_t i = 0; i < n; i += 3) std::memcpy(c.data() + i * size, a.data() + i * size, size);
+			std::vector<int32_t> maskExpected(n + 1), maskGot(n + 1);
+			for (int op = 0; op < int(CompareOp::Count); op++) {
+				scalar.compare[t][op](a.data(), c.data(), maskExpected.data(), n);
+				kernels.compare[t][op](a.data(), c.data(), maskGot.data(), n);
+				CHECK(std::memcmp(maskExpected.data(), maskGot.data(), n * 4) == 0);
+				scalar.compareBroadcast[t][op](a.data(), c.data(), maskExpected.data(), n);
+				kernels.compareBroadcast[t][op](a.data(), c.data(), maskGot.data(), n);
+				CHECK(std::memcmp(maskExpected.data(), maskGot.data(), n * 4) == 0);
+			}
+
+			double scale = isFloatElement(type) ? magnitude(type, a, b, n) : 0;
+			char resultExpected[8], resultGot[8];
+			scalar.sum[t](a.data(), n, resultExpected);
+			kernels.sum[t](a.data(), n, resultGot);
+			CHECK(sameReduction(type, resultExpected, resultGot, scale));
+			scalar.dot[t](a.data(), b.data(), n, resultExpected);
+			kernels.dot[t](a.data(), b.data(), n, resultGot);
+			CHECK(sameReduction(type, resultExpected, resultGot, scale));
+			if (n == 0) continue;
+			scalar.min[t](a.data(), n, resultExpected);
+			kernels.min[t](a.data(), n, resultGot);
+			CHECK(std::memcmp(resultExpected, resultGot, 8) == 0);
+			scalar.max[t](a.data(), n, resultExpected);
+			kernels.max[t](a.data(), n, resultGot);
+			CHECK(std::memcmp(resultExpected, resultGot, 8) == 0);
+		}
+	}
+}
+
+static void testKernels() {
+	SimdLevel initial = simdLevel();
+	CHECK(simdSupported(SimdLevel::Scalar));
+	CHECK(setSimdLevel(SimdLevel::Scalar));
+	const SimdKernels scalar = simdKernels();
+
+	int compared = 0;
+	for (SimdLevel level : { SimdLevel::SSE2, SimdLevel::AVX2 }) {
+		if (!simdSupported(level)) {
+			std::cout << simdLevelName(level) << ": not supported here, skipped" << std::endl;
+			CHECK(!setSimdLevel(level));
+			continue;
+		}
+		compareLevel(level, scalar);
+		compared++;
+	}
+	std::cout << compared << " instruction sets compared with scalar" << std::endl;
+	CHECK(setSimdLevel(initial));
+}
+
+// Integer elements wrap like the C++ types they are stored as; sum() and
+// dot() of i32 add in 64 bits, those of i64 wrap.
+static void testWrapping() {
+	const int64_t max = std::numeric_limits<int64_t>::max(), min = std::numeric_limits<int64_t>::min();
+	for (SimdLevel level : { SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2 }) {
+		if (!setSimdLevel(level)) continue;
+		Runtime rt;
+		CHECK(rt.load(
+			"pub func add64(x, y) { let a = i64(5); for i in 0..5 { a[i] = x; } let b = a + y; return b[4]; }\n"
+			"pub func mul32(x, y) { let a = i32(5); for i in 0..5 { a[i] = x; } let b = a * y; return b[4]; }\n"
+			"pub func sum64(x) { let a = i64(5); for i in 0..5 { a[i] = x; } return sum(a); }\n"
+			"pub func sum32(x) { let a = i32(5); for i in 0..5 { a[i] = x; } return sum(a); }\n"
+			"pub func scalar(x, y) { return x + y; }\n"
+		));
+		CHECK(rt.function<int64_t(int64_t, int64_t)>("add64")(max, 1) == min);
+		CHECK(rt.function<int64_t(int64_t, int64_t)>("mul32")(65536, 65536) == 0);
+		CHECK(rt.function<int64_t(int64_t)>("sum64")(max) == int64_t(uint64_t(max) * 5));
+		CHECK(rt.function<int64_t(int64_t)>("sum32")(std::numeric_limits<int32_t>::max()) ==
+			int64_t(std::numeric_limits<int32_t>::max()) * 5);
+
+		// Integer values promote instead.
+		Value v = rt.function<Value(int64_t, int64_t)>("scalar")(max, 1);
+		CHECK(v.type == ValueType::Number);
+	}
+}
+
+int main() {
+	testKernels();
+	testWrapping();
+
+	if (s_failures > 0) {
+		std::cerr << s_failures << " failures" << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,168 @@
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <unistd.h>
+
+#include "runtime/host.h"
+#include "util/diagnostics.h"
+
+// Heap snapshots: a runtime restored from one has the script and the
+// globals its top-level statements left, without running them again, and
+// damaged or foreign files are rejected instead of loaded.
+
+static int s_failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed" << std::endl; \
+			s_failures++; \
+		} \
+	} while (0)
+
+static std::string s_path;
+
+static std::string contents(const std::string& path) {
+	std::ifstream file(path, std::ios::binary);
+	std::ostringstream buffer;
+	buffer << file.rdbuf();
+	return buffer.str();
+}
+
+static void overwrite(const std::string& path, const std::string& data) {
+	std::ofstream(path, std::ios::binary | std::ios::trunc) << data;
+}
+
+static int64_t s_calls = 0;
+
+static int64_t twice(int64_t x) { return 2 * x; }
+
+static void testRoundTrip() {
+	const char* source =
+		"let runs = setup();\n"
+		"let name = \"lang\";\n"
+		"let label = name + \"!\";\n"
+		"let ratio = 0.25;\n"
+		"let flag = true;\n"
+		"let table = i64(4);\n"
+		"for i in 0..4 { table[i] = i * i; }\n"
+		"let double = twice;\n"
+		"func bump(x) { return x + 1; }\n"
+		"let next = bump;\n"
+		"pub func get() { return runs; }\n"
+		"pub func text() { return label; }\n"
+		"pub func scaled(x) { return x * ratio; }\n"
+		"pub func total() { if (flag) { return sum(table); } return 0; }\n"
+		"pub func apply(x) { return next(double(x)); }\n"
+		"pub func count() { runs += 1; return runs; }\n";
+
+	Runtime rt;
+	rt.define("setup", []() { return ++s_calls; });
+	rt.define<&twice>("twice");
+	CHECK(rt.load(source));
+	CHECK(rt.function<int64_t()>("count")() == 2);
+	CHECK(rt.saveSnapshot(s_path));
+
+	// Restoring runs nothing: setup() is not called again, and runs is
+	// what count() left it at.
+	Runtime restored;
+	restored.define("setup", []() { return ++s_calls; });
+	restored.define<&twice>("twice");
+	CHECK(restored.loadSnapshot(s_path));
+	CHECK(s_calls == 1);
+	CHECK(restored.function<int64_t()>("get")() == 2);
+	CHECK(restored.function<std::string()>("text")() == "lang!");
+	CHECK(restored.function<double(double)>("scaled")(8) == 2);
+	CHECK(restored.function<int64_t()>("total")() == 0 + 1 + 4 + 9);
+	CHECK(restored.function<int64_t(int64_t)>("apply")(20) == 41);
+
+	// Its globals are its own.
+	CHECK(restored.function<int64_t()>("count")() == 3);
+	CHECK(rt.function<int64_t()>("get")() == 2);
+
+	// A snapshot of a restored runtime is as good as the first one.
+	CHECK(restored.saveSnapshot(s_path));
+	Runtime again;
+	again.define("setup", []() { return ++s_calls; });
+	again.define<&twice>("twice");
+	CHECK(again.loadSnapshot(s_path));
+	CHECK(again.function<int64_t()>("get")() == 3);
+	CHECK(again.function<int64_t()>("total")() == 14);
+
+	// The natives it was saved with have to be there.
+	DiagnosticCapture capture;
+	Runtime bare;
+	CHECK(!bare.loadSnapshot(s_path));
+	CHECK(capture.errors() == 1);
+	CHECK(capture.text().find("Undefined name") != std::string::npos);
+	CHECK(bare.script() == nullptr);
+}
+
+static void testRejected() {
+	DiagnosticCapture capture;
+
+	Runtime nothing;
+	CHECK(!nothing.saveSnapshot(s_path));
+	CHECK(capture.errors() == 1);
+
+	Runtime generator;
+	CHECK(generator.load("func upto(n) { for i in 0..n { yield i; } }\nlet g = upto(3);\n"));
+	CHECK(!generator.saveSnapshot(s_path));
+	CHECK(capture.errors() == 2);
+
+	Runtime rt;
+	CHECK(rt.load("pub func one() { return 1; }\nlet s = \"text\";\n"));
+	CHECK(rt.saveSnapshot(s_path));
+	const std::string good = contents(s_path);
+
+	// Every prefix is rejected, header or not.
+	int rejected = 0;
+	for (size_t size = 0; size < good.size(); size += 7) {
+		overwrite(s_path, good.substr(0, size));
+		Runtime truncated;
+		if (!truncated.loadSnapshot(s_path) && truncated.script() == nullptr) rejected++;
+	}
+	CHECK(rejected == int((good.size() + 6) / 7));
+
+	std::string flipped = good;
+	flipped[flipped.size() - 3] ^= 0x40;
+	overwrite(s_path, flipped);
+	Runtime damaged;
+	CHECK(!damaged.loadSnapshot(s_path));
+
+	std::string version = good;
+	version[8] ^= 1;
+	overwrite(s_path, version);
+	Runtime foreign;
+	CHECK(!foreign.loadSnapshot(s_path));
+
+	Runtime missing;
+	CHECK(!missing.loadSnapshot(s_path + ".missing"));
+
+	overwrite(s_path, good);
+	Runtime restored;
+	CHECK(restored.loadSnapshot(s_path));
+	CHECK(restored.function<int64_t()>("one")() == 1);
+}
+
+int main() {
+	char pattern[] = "/tmp/snapshot_test.XXXXXX";
+	int fd = mkstemp(pattern);
+	if (fd < 0) return 1;
+	close(fd);
+	s_path = pattern;
+
+	testRoundTrip();
+	testRejected();
+
+	std::remove(s_path.c_str());
+	if (s_failures > 0) {
+		std::cerr << s_failures << " failures" << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,193 @@
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "lexer/lexer.h"
+#include "parser/moduleloader.h"
+#include "parser/parser.h"
+#include "parser/detail/stmts.hpp"
+#include "analysis/treeshake.h"
+#include "runtime/host.h"
+#include "util/diagnostics.h"
+#include "util/threadpool.h"
+
+// Tree shaking: what the roots reach through calls, references and
+// initializers is kept, in order, and everything else is dropped, across
+// modules too, without parsing the bodies of what was dropped.
+
+namespace fs = std::filesystem;
+
+static int s_failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed" << std::endl; \
+			s_failures++; \
+		} \
+	} while (0)
+
+// Top-level functions and variables of `program`, in order, as
+// "name,name,..."; other statements as "*".
+static std::string names(Program* program) {
+	std::string out;
+	for (auto&& stmt : program->stmts) {
+		if (!out.empty()) out += ",";
+		if (FuncDefStmt* func = dynamic_cast<FuncDefStmt*>(stmt.get())) {
+			out += func->name;
+		} else if (LetStmt* let = dynamic_cast<LetStmt*>(stmt.get())) {
+			for (size_t i = 0; i < let->variableList.size(); i++) {
+				out += (i ? "," : "") + let->variableList[i]->name;
+			}
+		} else {
+			out += "*";
+		}
+	}
+	return out;
+}
+
+static std::unique_ptr<Program> parse(const std::string& source) {
+	LangLexer lex(source);
+	lex.tokenize();
+	LangParser par(lex.tokens());
+	par.parse();
+	return par.takeProgram();
+}
+
+static FuncDefStmt* function(Program* program, const std::string& name) {
+	for (auto&& stmt : program->stmts) {
+		FuncDefStmt* func = dynamic_cast<FuncDefStmt*>(stmt.get());
+		if (func && func->name == name) return func;
+	}
+	return nullptr;
+}
+
+static void testReachable() {
+	std::unique_ptr<Program> program = parse(
+		"let scale = 3, unused = 4;\n"
+		"let table = build();\n"
+		"func build() { return 1; }\n"
+		"func helper(x) { return deep(x) * scale; }\n"
+		"func deep(x) { return x + 1; }\n"
+		"func dead(x) { return dead2(x); }\n"
+		"func dead2(x) { return dead(x) + unused; }\n"
+		"func passed(x) { return x; }\n"
+		"func ranged(n) { return n; }\n"
+		"let total = 0;\n"
+		"pub func entry(v) { let f = passed; return helper(f(v)); }\n"
+		"pub let exported = 5;\n"
+		"for i in 0..ranged(2) { }\n"
+		"func reducer(v) { parallel for i in 0..10 reduce(+: total) { total += i; } return total; }\n"
+	);
+	TreeShaker shaker;
+	shaker.run(program.get());
+
+	// `unused` goes although its statement stays; `table` calls something,
+	// so it stays with what it calls. dead() and dead2() only reach each
+	// other, reducer() nothing reaches, and `total` only it.
+	CHECK(names(program.get()) == "scale,table,build,helper,deep,passed,ranged,entry,exported,*");
+	CHECK(shaker.removedFunctions() == 3);
+	CHECK(shaker.removedVariables() == 2);
+
+	// Shaking again finds nothing more.
+	TreeShaker again;
+	again.run(program.get());
+	CHECK(again.removedFunctions() == 0 && again.removedVariables() == 0);
+}
+
+static void testBodiesStayUnparsed() {
+	std::unique_ptr<Program> program = parse(
+		"func unused() { let = ; }\n"
+		"func used() { return 1; }\n"
+		"used();\n"
+	);
+	FuncDefStmt* used = function(program.get(), "used");
+	CHECK(used != nullptr && !used->parsed);
+
+	DiagnosticCapture capture;
+	TreeShaker shaker;
+	shaker.run(program.get());
+	CHECK(names(program.get()) == "used,*");
+	CHECK(used->parsed);
+	CHECK(capture.errors() == 0);
+}
+
+static std::string s_dir;
+
+static std::string write(const std::string& name, const std::string& text) {
+	std::string path = s_dir + "/" + name;
+	fs::create_directories(fs::path(path).parent_path());
+	std::ofstream(path) << text;
+	return path;
+}
+
+static void testModules() {
+	write("lib.rs",
+		"pub func used(x) { return twice(x); }\n"
+		"pub func unused(x) { return x; }\n"
+		"func twice(x) { return 2 * x; }\n"
+		"pub let limit = 10, spare = 11;\n"
+	);
+	std::string main = write("main.rs",
+		"import lib (used, limit);\n"
+		"func local() { return limit; }\n"
+		"pub func run() { return used(local()); }\n"
+	);
+
+	ThreadPool pool(2);
+	ModuleLoader loader(pool);
+	Module* entry = loader.load(main);
+	CHECK(entry != nullptr && loader.errors() == 0);
+	if (!entry) return;
+	Module* lib = loader.order().front();
+	CHECK(lib->name == "lib");
+
+	TreeShaker shaker;
+	shaker.run(loader, entry);
+
+	// Public definitions of other modules are only roots when used.
+	CHECK(names(lib->program.get()) == "used,twice,limit");
+	CHECK(names(entry->program.get()) == "*,local,run");
+	CHECK(lib->exports.count("unused") == 0 && lib->exports.count("spare") == 0);
+	CHECK(lib->definitions.count("unused") == 0);
+	CHECK(lib->exports.count("used") == 1);
+	CHECK(shaker.removedFunctions() == 1);
+	CHECK(shaker.removedVariables() == 1);
+}
+
+static int64_t s_calls = 0;
+
+static void testRuntime() {
+	// Initializers that call something run although nothing reads them.
+	Runtime rt;
+	rt.define("effect", []() { return ++s_calls; });
+	CHECK(rt.load(
+		"let ignored = effect();\n"
+		"func never() { return effect(); }\n"
+		"pub func calls() { return effect(); }\n"
+	));
+	CHECK(s_calls == 1);
+	CHECK(rt.function<int64_t()>("calls")() == 2);
+}
+
+int main() {
+	char pattern[] = "/tmp/treeshake_test.XXXXXX";
+	if (mkdtemp(pattern) == nullptr) return 1;
+	s_dir = pattern;
+
+	testReachable();
+	testBodiesStayUnparsed();
+	testModules();
+	testRuntime();
+
+	fs::remove_all(s_dir);
+	if (s_failures > 0) {
+		std::cerr << s_failures << " failures" << std::endl;
+		return 1;
+	}
+	return 0;
+}
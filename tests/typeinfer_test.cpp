@@ -0,0 +1,130 @@
+#include <initializer_list>
+#include <iostream>
+#include <string>
+
+#include "analysis/typeinfer.h"
+#include "lexer/lexer.h"
+#include "parser/parser.h"
+#include "runtime/host.h"
+#include "util/diagnostics.h"
+
+// Type inference: return types including falling off the end, which
+// functions count as specialized, and the quickened instructions the
+// compiler emits for the operand types it proves.
+
+static int s_failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed" << std::endl; \
+			s_failures++; \
+		} \
+	} while (0)
+
+static const FunctionTypeInfo* find(const TypeInference& types, const std::string& name) {
+	for (auto&& func : types.functions()) {
+		if (func.name == name) return &func;
+	}
+	return nullptr;
+}
+
+static void infer(TypeInference& types, const std::string& source) {
+	LangLexer lexer(source);
+	lexer.tokenize();
+	LangParser parser(lexer.tokens());
+	parser.parse();
+	types.run(parser.program());
+}
+
+static void testReturns() {
+	TypeInference types;
+	infer(types,
+		"func partial(x: int) { if (x > 0) { return 1; } }\n"
+		"func both(x: int) { if (x > 0) { return 1; } else { return 2; } }\n"
+		"func chain(x: int) { if (x > 0) { return 1; } else if (x < 0) { return 2; } }\n"
+		"func looped(x: int) { while (x > 0) { return 1; } }\n"
+		"func none() { let a = 1; }\n"
+		"func gen(n: int) { for i in 0..n { yield i; } }\n"
+	);
+
+	const FunctionTypeInfo* partial = find(types, "partial");
+	CHECK(partial && partial->returnType == ValueType::Any && !partial->specialized);
+	const FunctionTypeInfo* both = find(types, "both");
+	CHECK(both && both->returnType == ValueType::Integer && both->specialized);
+	const FunctionTypeInfo* chain = find(types, "chain");
+	CHECK(chain && chain->returnType == ValueType::Any);
+	const FunctionTypeInfo* looped = find(types, "looped");
+	CHECK(looped && looped->returnType == ValueType::Any);
+	const FunctionTypeInfo* none = find(types, "none");
+	CHECK(none && none->returnType == ValueType::Nil);
+	const FunctionTypeInfo* gen = find(types, "gen");
+	CHECK(gen && gen->returnType == ValueType::Generator);
+}
+
+// What the inferred return type has to describe.
+static void testFallThrough() {
+	Runtime rt;
+	CHECK(rt.load(
+		"func partial(x: int) { if (x > 0) { return 1; } }\n"
+		"pub func get(x) { return partial(x); }\n"
+		"pub func next(x) { return partial(x) + 1; }\n"
+	));
+	CHECK(rt.function<Value(int64_t)>("get")(0).type == ValueType::Nil);
+	CHECK(rt.function<int64_t(int64_t)>("next")(1) == 2);
+
+	DiagnosticCapture capture;
+	auto next = rt.function<int64_t(int64_t)>("next");
+	next(0);
+	CHECK(!next.ok());
+	CHECK(capture.errors() == 1);
+}
+
+// The first instruction of `name` that is one of `ops`, or Op::Count.
+static Op find(const Script* script, const std::string& name, std::initializer_list<Op> ops) {
+	for (auto&& function : script->functions) {
+		if (function->name != name) continue;
+		for (auto&& ins : function->code) {
+			for (Op op : ops) {
+				if (loadOp(ins) == op) return op;
+			}
+		}
+	}
+	return Op::Count;
+}
+
+static void testTypedForms() {
+	Runtime rt;
+	rt.setSuperinstructions(false);
+	CHECK(rt.load(
+		"pub func mix(a: int, b: int) { return a % b + 1; }\n"
+		"pub func ratio(a: int, b: number) { return a / b; }\n"
+		"pub func less(a: int, b: int) { return a < b; }\n"
+		"pub func any(a, b) { return a + b; }\n"
+	));
+	const Script* script = rt.script();
+	CHECK(find(script, "mix", { Op::Add, Op::AddInt, Op::AddNumber }) == Op::AddInt);
+	CHECK(find(script, "mix", { Op::Mod, Op::ModInt, Op::ModNumber }) == Op::ModInt);
+	CHECK(find(script, "ratio", { Op::Div, Op::DivNumber }) == Op::DivNumber);
+	CHECK(find(script, "less", { Op::Lt, Op::LtInt, Op::LtNumber }) == Op::LtInt);
+	CHECK(find(script, "any", { Op::Add, Op::AddInt, Op::AddNumber }) == Op::Add);
+
+	// Still guarded: an annotation is not checked at the call.
+	CHECK(rt.function<int64_t(int64_t, int64_t)>("mix")(7, 4) == 4);
+	CHECK(rt.function<double(int64_t, double)>("ratio")(3, 2) == 1.5);
+	Value v = rt.function<Value(double, int64_t)>("mix")(7.5, 4);
+	CHECK(v.type == ValueType::Number && v.numberValue == 4.5);
+	CHECK(find(script, "mix", { Op::Add, Op::AddInt, Op::AddNumber }) != Op::AddInt);
+}
+
+int main() {
+	testReturns();
+	testFallThrough();
+	testTypedForms();
+
+	if (s_failures > 0) {
+		std::cerr << s_failures << " failures" << std::endl;
+		return 1;
+	}
+	return 0;
+}